@@ -0,0 +1,87 @@
+#ifndef AABB_hpp
+#define AABB_hpp
+
+#include <iostream>
+#include <math.h>
+#include "Vector3d.hpp"
+#include "Ray.hpp"
+
+/* Axis-Aligned Bounding Box */
+// The box between two corners min and max whose faces are
+// parallel to the coordinate planes.
+//
+// * Slab test: the box is the intersection of 3 slabs (one per
+//   axis, between two parallel planes). The ray enters slab i at
+//   t0 = (min[i] - A[i]) / B[i] and leaves at
+//   t1 = (max[i] - A[i]) / B[i] (swapped if B[i] < 0).
+//   The ray is inside the box where it is inside all 3 slabs at
+//   once, i.e. between the largest entry t and the smallest exit
+//   t. It hits the box if that interval is not empty and overlaps
+//   (tMin, tMax).
+//
+//          |   slab x  |
+//   -------+-----------+------- slab y
+//          |    box    |     /
+//   -------+-----------+----/--
+//          |           |   / ray
+//
+// * 1 / B is computed once per ray (invDirection); a division by
+//   0 gives ±∞ which the test handles correctly.
+class AABB {
+public:
+    Vector3d min;
+    Vector3d max;
+    AABB(): min(INFINITY, INFINITY, INFINITY), max(-INFINITY, -INFINITY, -INFINITY) {};
+    AABB(const Vector3d &min, const Vector3d &max): min(min), max(max) {};
+    bool isEmpty() const;
+    Vector3d center() const;
+    Vector3d extent() const;
+    double surfaceArea() const;
+    int longestAxis() const;
+    void extend(const Vector3d &p);
+    void extend(const AABB &box);
+    bool hit(const Vector3d &origin, const Vector3d &invDirection, double tMin, double tMax) const;
+};
+
+inline bool AABB::isEmpty() const {
+    return min.x() > max.x() || min.y() > max.y() || min.z() > max.z();
+}
+
+inline Vector3d AABB::center() const { return 0.5 * (min + max); }
+inline Vector3d AABB::extent() const { return max - min; }
+
+inline double AABB::surfaceArea() const {
+    if (isEmpty()) return 0;
+    Vector3d e = extent();
+    return 2 * (e.x() * e.y() + e.y() * e.z() + e.z() * e.x());
+}
+
+inline int AABB::longestAxis() const {
+    Vector3d e = extent();
+    if (e.x() >= e.y() && e.x() >= e.z()) return 0;
+    return e.y() >= e.z() ? 1 : 2;
+}
+
+inline void AABB::extend(const Vector3d &p) {
+    min = Vector3d(fmin(min.x(), p.x()), fmin(min.y(), p.y()), fmin(min.z(), p.z()));
+    max = Vector3d(fmax(max.x(), p.x()), fmax(max.y(), p.y()), fmax(max.z(), p.z()));
+}
+
+inline void AABB::extend(const AABB &box) {
+    extend(box.min);
+    extend(box.max);
+}
+
+inline bool AABB::hit(const Vector3d &origin, const Vector3d &invDirection, double tMin, double tMax) const {
+    for (int i = 0; i < 3; i++) {
+        double t0 = (min[i] - origin[i]) * invDirection[i];
+        double t1 = (max[i] - origin[i]) * invDirection[i];
+        if (invDirection[i] < 0) std::swap(t0, t1);
+        tMin = t0 > tMin ? t0 : tMin;
+        tMax = t1 < tMax ? t1 : tMax;
+        if (tMax < tMin) return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef AtomicFloat_hpp
+#define AtomicFloat_hpp
+
+#include <iostream>
+#include <atomic>
+
+// Accumulation from several render threads without locks:
+// std::atomic<float> has no fetch_add before C++20.
+inline void atomicAdd(std::atomic<float> &target, float value) {
+    float current = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {}
+}
+
+#endif
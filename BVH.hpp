@@ -0,0 +1,458 @@
+#ifndef BVH_hpp
+#define BVH_hpp
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <math.h>
+#include "Vector3d.hpp"
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+#include "AABB.hpp"
+#include "Hitable.hpp"
+
+/* Bounding Volume Hierarchy */
+// A binary tree of bounding boxes over the primitives of a scene.
+// A ray only descends into children whose box it hits, so finding
+// the closest hit costs O(log N) box tests instead of N primitive
+// tests.
+//
+// * Nodes are stored in one flat array in depth-first order: the
+//   first child of node i is node i + 1, the second child is
+//   node `offset`. No pointers, so the array can be written to a
+//   file and used again as is (see SceneCache.hpp).
+// * Bounds are floats, rounded outwards so they stay conservative.
+//   A node is 32 bytes, two nodes per cache line.
+// * Leaves reference a run of `count` primitives starting at
+//   `offset` in the (reordered) primitive array.
+struct BVHNode {
+    float min[3];
+    int32_t offset; // interior: index of the second child, leaf: first primitive
+    float max[3];
+    uint16_t count; // leaf: number of primitives, interior: 0
+    uint16_t axis;  // interior: split axis, the first child is on the lower side
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode must stay 32 bytes");
+
+// Bounds of one primitive for the builder, float like the nodes.
+struct PrimitiveBounds {
+    float min[3];
+    float max[3];
+};
+
+// Rounds outwards so the float box contains the double box.
+inline PrimitiveBounds toPrimitiveBounds(const AABB &box) {
+    PrimitiveBounds bounds;
+    for (int i = 0; i < 3; i++) {
+        bounds.min[i] = nextafterf(float(box.min[i]), -INFINITY);
+        bounds.max[i] = nextafterf(float(box.max[i]), INFINITY);
+    }
+    return bounds;
+}
+
+/* Slab test against a node */
+// Same as AABB::hit with float bounds. Returns the entry t in
+// tEntry for front to back ordering.
+inline bool hitNode(const BVHNode &node, const double origin[3], const double invDirection[3], double tMin, double tMax, double &tEntry) {
+    for (int i = 0; i < 3; i++) {
+        double t0 = (node.min[i] - origin[i]) * invDirection[i];
+        double t1 = (node.max[i] - origin[i]) * invDirection[i];
+        if (invDirection[i] < 0) std::swap(t0, t1);
+        tMin = t0 > tMin ? t0 : tMin;
+        tMax = t1 < tMax ? t1 : tMax;
+    }
+    tEntry = tMin;
+    return tMin <= tMax;
+}
+
+/* Traversal */
+// Walks the tree front to back with an explicit stack and calls
+// leaf(first, count, tMax) for every leaf the ray reaches. leaf()
+// intersects the primitives, shrinks tMax to the closest hit it
+// found and returns true if it found one.
+// With anyHit set traversal stops at the first leaf hit (shadow
+// rays).
+template <typename LeafFunction>
+inline bool traverseBVH(const BVHNode *nodes, const Ray &ray, double tMin, double tMax, bool anyHit, LeafFunction &&leaf) {
+    Vector3d direction = ray.direction();
+    Vector3d rayOrigin = ray.origin();
+    double origin[3] = { rayOrigin.x(), rayOrigin.y(), rayOrigin.z() };
+    double invDirection[3] = { 1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z() };
+    int stack[64];
+    int stackSize = 0;
+    int current = 0;
+    bool hitAnything = false;
+    double tEntry;
+    if (!hitNode(nodes[0], origin, invDirection, tMin, tMax, tEntry)) return false;
+    while (true) {
+        const BVHNode &node = nodes[current];
+        if (node.count > 0) {
+            if (leaf(node.offset, int(node.count), tMax)) {
+                hitAnything = true;
+                if (anyHit) return true;
+            }
+        } else {
+            // Visit the child on the side the ray comes from first,
+            // its hits shrink tMax and may cull the other child.
+            int first = current + 1;
+            int second = node.offset;
+            if (direction[node.axis] < 0) std::swap(first, second);
+            double tFirst, tSecond;
+            bool hitFirst = hitNode(nodes[first], origin, invDirection, tMin, tMax, tFirst);
+            bool hitSecond = hitNode(nodes[second], origin, invDirection, tMin, tMax, tSecond);
+            if (hitFirst && hitSecond) {
+                if (tSecond < tFirst) std::swap(first, second);
+                stack[stackSize++] = second;
+                current = first;
+                continue;
+            }
+            if (hitFirst || hitSecond) {
+                current = hitFirst ? first : second;
+                continue;
+            }
+        }
+        // Pop the next node that is still in front of the closest hit
+        bool found = false;
+        while (stackSize > 0) {
+            current = stack[--stackSize];
+            if (hitNode(nodes[current], origin, invDirection, tMin, tMax, tEntry)) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) return hitAnything;
+    }
+}
+
+/* Packet traversal */
+// Walks the tree once for a whole RayPacket and calls
+// leaf(ray, first, count) for every leaf a ray reaches. leaf()
+// intersects the primitives with packet.rays[ray] and shrinks
+// packet.tMax[ray] to the closest hit it found.
+//
+// * Every stack entry carries the first ray still active below it
+//   (ranged traversal): at a node the packet first tries that ray.
+//   If it misses, the interval test of the whole packet culls the
+//   node when no ray can hit it, else the following rays are tried
+//   until one hits. Rays before it never see the subtree.
+// * Children are visited in the order of the packet's common
+//   direction sign along the split axis.
+// * An incoherent packet (see RayPacket::prepare()) falls back to
+//   traverseBVH() ray by ray. Within a packet the same happens by
+//   itself once a single ray is left active: it is tested against
+//   every node alone, without the interval test.
+template <typename LeafFunction>
+inline void traversePacketBVH(const BVHNode *nodes, RayPacket &packet, double tMin, LeafFunction &&leaf) {
+    if (!packet.coherent) {
+        for (int ray = 0; ray < packet.size; ray++) {
+            traverseBVH(nodes, packet.rays[ray], tMin, packet.tMax[ray], false, [&](int first, int count, double &closestSoFar) {
+                double before = packet.tMax[ray];
+                leaf(ray, first, count);
+                closestSoFar = packet.tMax[ray];
+                return closestSoFar < before;
+            });
+        }
+        return;
+    }
+    struct Entry {
+        int node;
+        int firstRay;
+    };
+    Entry stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = Entry{ 0, 0 };
+    int tests = 0, culled = 0;
+    while (stackSize > 0) {
+        Entry entry = stack[--stackSize];
+        const BVHNode &node = nodes[entry.node];
+        int ray = entry.firstRay;
+        if (!packet.hitsBox(node.min, node.max, ray, tMin)) {
+            if (packet.size - ray > 1 && (tests < 16 || 4 * culled >= tests)) {
+                tests++;
+                if (!packet.mayHitBox(node.min, node.max, tMin)) {
+                    culled++;
+                    continue;
+                }
+            }
+            do ray++;
+            while (ray < packet.size && !packet.hitsBox(node.min, node.max, ray, tMin));
+            if (ray == packet.size) continue;
+        }
+        if (node.count > 0) {
+            leaf(ray, node.offset, int(node.count));
+            for (int other = ray + 1; other < packet.size; other++) {
+                if (packet.hitsBox(node.min, node.max, other, tMin)) leaf(other, node.offset, int(node.count));
+            }
+            continue;
+        }
+        int first = entry.node + 1;
+        int second = node.offset;
+        if (packet.direction[node.axis][0] < 0) std::swap(first, second);
+        stack[stackSize++] = Entry{ second, ray };
+        stack[stackSize++] = Entry{ first, ray };
+    }
+}
+
+/* Builder */
+// Top-down build with the Surface Area Heuristic (SAH) evaluated
+// over 16 bins of primitive centroids per node: the probability
+// that a ray that hits a node also hits a child is proportional
+// to the ratio of their surface areas, so the split that minimizes
+// area(left) * count(left) + area(right) * count(right) gives the
+// cheapest expected traversal.
+//
+// Fills out nodes and order (order[i] is the original index of the
+// i-th primitive in leaf order).
+class BVHBuilder {
+    static const int binCount = 16;
+    const std::vector<PrimitiveBounds> &bounds;
+    std::vector<BVHNode> &nodes;
+    std::vector<int32_t> &order;
+    int maxLeafSize;
+    struct Box {
+        float min[3];
+        float max[3];
+        Box();
+        void extend(const float pMin[3], const float pMax[3]);
+        float surfaceArea() const;
+    };
+    float centroid(int32_t primitive, int axis) const;
+    void makeLeaf(int node, int begin, int end, const Box &box);
+    int build(int begin, int end, int depth);
+public:
+    BVHBuilder(const std::vector<PrimitiveBounds> &bounds, std::vector<BVHNode> &nodes, std::vector<int32_t> &order, int maxLeafSize);
+};
+
+inline BVHBuilder::Box::Box() {
+    for (int i = 0; i < 3; i++) {
+        min[i] = INFINITY;
+        max[i] = -INFINITY;
+    }
+}
+
+inline void BVHBuilder::Box::extend(const float pMin[3], const float pMax[3]) {
+    for (int i = 0; i < 3; i++) {
+        min[i] = fminf(min[i], pMin[i]);
+        max[i] = fmaxf(max[i], pMax[i]);
+    }
+}
+
+inline float BVHBuilder::Box::surfaceArea() const {
+    if (min[0] > max[0]) return 0;
+    float x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+    return 2 * (x * y + y * z + z * x);
+}
+
+inline float BVHBuilder::centroid(int32_t primitive, int axis) const {
+    return 0.5f * (bounds[primitive].min[axis] + bounds[primitive].max[axis]);
+}
+
+inline BVHBuilder::BVHBuilder(const std::vector<PrimitiveBounds> &bounds, std::vector<BVHNode> &nodes, std::vector<int32_t> &order, int maxLeafSize):
+    bounds(bounds), nodes(nodes), order(order), maxLeafSize(maxLeafSize) {
+    nodes.clear();
+    order.resize(bounds.size());
+    for (size_t i = 0; i < bounds.size(); i++) order[i] = int32_t(i);
+    if (bounds.empty()) {
+        // A single empty leaf that no ray can hit
+        BVHNode empty = { { INFINITY, INFINITY, INFINITY }, 0, { -INFINITY, -INFINITY, -INFINITY }, 0, 0 };
+        nodes.push_back(empty);
+        return;
+    }
+    nodes.reserve(bounds.size() / maxLeafSize * 2 + 1);
+    build(0, int(bounds.size()), 0);
+}
+
+inline void BVHBuilder::makeLeaf(int node, int begin, int end, const Box &box) {
+    BVHNode &leaf = nodes[node];
+    for (int i = 0; i < 3; i++) {
+        leaf.min[i] = box.min[i];
+        leaf.max[i] = box.max[i];
+    }
+    leaf.offset = begin;
+    leaf.count = uint16_t(end - begin);
+    leaf.axis = 0;
+}
+
+inline int BVHBuilder::build(int begin, int end, int depth) {
+    int node = int(nodes.size());
+    nodes.push_back(BVHNode());
+    Box box, centroidBox;
+    for (int i = begin; i < end; i++) {
+        const PrimitiveBounds &b = bounds[order[i]];
+        box.extend(b.min, b.max);
+        float c[3] = { centroid(order[i], 0), centroid(order[i], 1), centroid(order[i], 2) };
+        centroidBox.extend(c, c);
+    }
+    int count = end - begin;
+    // The depth limit keeps traversal within its 64 entry stack
+    if (count <= maxLeafSize || depth >= 60) {
+        makeLeaf(node, begin, end, box);
+        return node;
+    }
+    int axis = 0;
+    for (int i = 1; i < 3; i++) {
+        if (centroidBox.max[i] - centroidBox.min[i] > centroidBox.max[axis] - centroidBox.min[axis]) axis = i;
+    }
+    float lo = centroidBox.min[axis];
+    float hi = centroidBox.max[axis];
+    int mid = begin;
+    if (hi > lo) {
+        /* Binned SAH */
+        Box bins[binCount];
+        int counts[binCount] = { 0 };
+        float scale = binCount / (hi - lo);
+        auto binOf = [&](int32_t primitive) {
+            int b = int((centroid(primitive, axis) - lo) * scale);
+            return b < binCount ? b : binCount - 1;
+        };
+        for (int i = begin; i < end; i++) {
+            int b = binOf(order[i]);
+            counts[b]++;
+            bins[b].extend(bounds[order[i]].min, bounds[order[i]].max);
+        }
+        // Sweep from the right to get the cost of every right side,
+        // then from the left to find the cheapest split plane.
+        float rightArea[binCount];
+        int rightCount[binCount];
+        Box right;
+        int n = 0;
+        for (int b = binCount - 1; b > 0; b--) {
+            right.extend(bins[b].min, bins[b].max);
+            n += counts[b];
+            rightArea[b] = right.surfaceArea();
+            rightCount[b] = n;
+        }
+        Box left;
+        n = 0;
+        float bestCost = INFINITY;
+        int bestSplit = -1;
+        for (int b = 0; b < binCount - 1; b++) {
+            left.extend(bins[b].min, bins[b].max);
+            n += counts[b];
+            if (n == 0 || rightCount[b + 1] == 0) continue;
+            float cost = left.surfaceArea() * n + rightArea[b + 1] * rightCount[b + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestSplit = b;
+            }
+        }
+        // Leaf if splitting costs more than intersecting everything
+        // (traversal cost ≈ 1 primitive test, relative to box area).
+        float leafCost = box.surfaceArea() * count;
+        if (bestSplit < 0 || (bestCost + box.surfaceArea() >= leafCost && count <= 4 * maxLeafSize)) {
+            makeLeaf(node, begin, end, box);
+            return node;
+        }
+        mid = int(std::partition(order.begin() + begin, order.begin() + end,
+                                 [&](int32_t primitive) { return binOf(primitive) <= bestSplit; }) - order.begin());
+    }
+    if (mid == begin || mid == end) {
+        // All centroids in one spot: split by count
+        if (count <= 4 * maxLeafSize) {
+            makeLeaf(node, begin, end, box);
+            return node;
+        }
+        mid = begin + count / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                         [&](int32_t a, int32_t b) { return centroid(a, axis) < centroid(b, axis); });
+    }
+    build(begin, mid, depth + 1);
+    int second = build(mid, end, depth + 1);
+    BVHNode &interior = nodes[node];
+    for (int i = 0; i < 3; i++) {
+        interior.min[i] = box.min[i];
+        interior.max[i] = box.max[i];
+    }
+    interior.offset = second;
+    interior.count = 0;
+    interior.axis = uint16_t(axis);
+    return node;
+}
+
+/* BVH over Hitables */
+// The acceleration structure for a scene built from Hitable
+// objects. All objects must be bounded (see Scene for unbounded
+// ones).
+class BVH: public Hitable {
+    std::vector<BVHNode> nodes;
+    std::vector<Hitable *> primitives;
+public:
+    BVH(const std::vector<Hitable *> &objects, int maxLeafSize = 4);
+    virtual bool closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const;
+    virtual bool occluded(const Ray &ray, double tMin, double tMax) const;
+    virtual void closestHits(RayPacket &packet, double tMin) const;
+    virtual bool boundingBox(AABB &box) const;
+    virtual void collectLights(std::vector<LightSource> &lights) const;
+    int nodeCount() const;
+    size_t bytes() const;
+};
+
+inline BVH::BVH(const std::vector<Hitable *> &objects, int maxLeafSize) {
+    std::vector<PrimitiveBounds> bounds(objects.size());
+    for (size_t i = 0; i < objects.size(); i++) {
+        AABB box;
+        objects[i]->boundingBox(box);
+        bounds[i] = toPrimitiveBounds(box);
+    }
+    std::vector<int32_t> order;
+    BVHBuilder(bounds, nodes, order, maxLeafSize);
+    nodes.shrink_to_fit();
+    primitives.resize(objects.size());
+    for (size_t i = 0; i < order.size(); i++) primitives[i] = objects[order[i]];
+}
+
+inline bool BVH::closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const {
+    Hitable *const *list = primitives.data();
+    return traverseBVH(nodes.data(), ray, tMin, tMax, false, [&](int first, int count, double &closestSoFar) {
+        bool hitAnything = false;
+        for (int i = first; i < first + count; i++) {
+            if (list[i]->closestHit(ray, tMin, closestSoFar, hit)) {
+                hitAnything = true;
+                closestSoFar = hit.t;
+            }
+        }
+        return hitAnything;
+    });
+}
+
+inline bool BVH::occluded(const Ray &ray, double tMin, double tMax) const {
+    Hitable *const *list = primitives.data();
+    return traverseBVH(nodes.data(), ray, tMin, tMax, true, [&](int first, int count, double &closestSoFar) {
+        for (int i = first; i < first + count; i++) {
+            if (list[i]->occluded(ray, tMin, closestSoFar)) return true;
+        }
+        return false;
+    });
+}
+
+inline void BVH::closestHits(RayPacket &packet, double tMin) const {
+    Hitable *const *list = primitives.data();
+    traversePacketBVH(nodes.data(), packet, tMin, [&](int ray, int first, int count) {
+        for (int i = first; i < first + count; i++) {
+            if (list[i]->closestHit(packet.rays[ray], tMin, packet.tMax[ray], packet.hits[ray])) {
+                packet.found[ray] = true;
+                packet.tMax[ray] = packet.hits[ray].t;
+            }
+        }
+    });
+}
+
+inline bool BVH::boundingBox(AABB &box) const {
+    const BVHNode &root = nodes[0];
+    box = AABB(Vector3d(root.min[0], root.min[1], root.min[2]), Vector3d(root.max[0], root.max[1], root.max[2]));
+    return true;
+}
+
+inline void BVH::collectLights(std::vector<LightSource> &lights) const {
+    for (size_t i = 0; i < primitives.size(); i++) primitives[i]->collectLights(lights);
+}
+
+inline int BVH::nodeCount() const { return int(nodes.size()); }
+
+inline size_t BVH::bytes() const {
+    return nodes.capacity() * sizeof(BVHNode) + primitives.capacity() * sizeof(Hitable *);
+}
+
+#endif
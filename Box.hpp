@@ -0,0 +1,123 @@
+#ifndef Box_hpp
+#define Box_hpp
+
+#include <iostream>
+#include <math.h>
+#include <algorithm>
+#include "Vector3d.hpp"
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+#include "Material.hpp"
+#include "Hitable.hpp"
+
+class Material;
+
+/* Axis-aligned box */
+// A closed box between the corners min and max, a solid like a
+// sphere: normals point outwards on both the outer and the inner
+// hit, so glass boxes refract like glass balls.
+//
+// * Slab test (see AABB.hpp) that also remembers which face the
+//   ray enters through (the slab with the largest entry t) and
+//   which one it leaves through (smallest exit t). The entry is the
+//   outer hit, the exit the inner one, same order as
+//   intersectSphere().
+// * The face goes into PrimitiveHit::index (0-2: min faces of x, y
+//   and z, 3-5: max faces), surface() needs no second test.
+// * Texture coordinates run from 0 to 1 across each face.
+// * Emitting boxes glow when hit but are not sampled as lights,
+//   use rectangles for area lights.
+class Box: public Hitable {
+    Vector3d min;
+    Vector3d max;
+public:
+    Box() {};
+    Box(const Vector3d &corner0, const Vector3d &corner1, Material *material);
+    virtual bool closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const;
+    virtual bool occluded(const Ray &ray, double tMin, double tMax) const;
+    virtual void surface(const Ray &ray, const PrimitiveHit &hit, HitRecord &hitRecord) const;
+    virtual bool boundingBox(AABB &box) const;
+    bool intersect(const Ray &ray, double tMin, double tMax, double &t, int &face) const;
+    Material *material;
+};
+
+inline Box::Box(const Vector3d &corner0, const Vector3d &corner1, Material *material): material(material) {
+    min = Vector3d(fmin(corner0.x(), corner1.x()), fmin(corner0.y(), corner1.y()), fmin(corner0.z(), corner1.z()));
+    max = Vector3d(fmax(corner0.x(), corner1.x()), fmax(corner0.y(), corner1.y()), fmax(corner0.z(), corner1.z()));
+}
+
+inline bool Box::intersect(const Ray &ray, double tMin, double tMax, double &t, int &face) const {
+    double tNear = -INFINITY, tFar = INFINITY;
+    int nearFace = 0, farFace = 0;
+    for (int i = 0; i < 3; i++) {
+        double invDirection = 1 / ray.direction()[i];
+        double t0 = (min[i] - ray.origin()[i]) * invDirection;
+        double t1 = (max[i] - ray.origin()[i]) * invDirection;
+        int face0 = i, face1 = i + 3;
+        if (invDirection < 0) {
+            std::swap(t0, t1);
+            std::swap(face0, face1);
+        }
+        if (t0 > tNear) {
+            tNear = t0;
+            nearFace = face0;
+        }
+        if (t1 < tFar) {
+            tFar = t1;
+            farFace = face1;
+        }
+    }
+    if (tNear > tFar) return false;
+    // Outer surface hit t
+    if (tNear < tMax && tNear > tMin) {
+        t = tNear;
+        face = nearFace;
+        return true;
+    }
+    // Inner surface hit t (the ray starts inside the box)
+    if (tFar < tMax && tFar > tMin) {
+        t = tFar;
+        face = farFace;
+        return true;
+    }
+    return false;
+}
+
+inline bool Box::closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const {
+    double t;
+    int face;
+    if (!intersect(ray, tMin, tMax, t, face)) return false;
+    hit.t = t;
+    hit.primitive = this;
+    hit.index = face;
+    return true;
+}
+
+inline bool Box::occluded(const Ray &ray, double tMin, double tMax) const {
+    double t;
+    int face;
+    return intersect(ray, tMin, tMax, t, face);
+}
+
+inline void Box::surface(const Ray &ray, const PrimitiveHit &hit, HitRecord &hitRecord) const {
+    int axis = hit.index % 3;
+    bool maxFace = hit.index >= 3;
+    hitRecord.t = hit.t;
+    hitRecord.p = ray.pointAtParameter(hit.t);
+    hitRecord.p[axis] = maxFace ? max[axis] : min[axis];
+    hitRecord.normal = Vector3d(0, 0, 0);
+    hitRecord.normal[axis] = maxFace ? 1 : -1;
+    hitRecord.material = this->material;
+    int i = (axis + 1) % 3, j = (axis + 2) % 3;
+    double width = max[i] - min[i], height = max[j] - min[j];
+    hitRecord.u = width > 0 ? (hitRecord.p[i] - min[i]) / width : 0;
+    hitRecord.v = height > 0 ? (hitRecord.p[j] - min[j]) / height : 0;
+    hitRecord.uvLength = fmax(width, height);
+}
+
+inline bool Box::boundingBox(AABB &box) const {
+    box = AABB(min, max);
+    return true;
+}
+
+#endif
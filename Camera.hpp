@@ -14,18 +14,60 @@ class Camera {
     Vector3d v;
     Vector3d w;
     double lensRadius;
+    double focusDistance;
+    double filmArea; // of the image plane at distance 1
 public:
+    Camera(): lensRadius(0), focusDistance(1), filmArea(1) {};
     Camera(Vector3d lookFrom, Vector3d lookAt, Vector3d vUp, double vFov, double aspect, double aperture, double focusDistance);
     inline Ray getRay(double s, double t, Vector3d randomOffset) const;
-    friend Vector3d randomInUnitDisk();
+    double pixelSpread(int imageHeight) const;
+    // The camera as a sensor, for paths traced from the lights
+    // (see "Camera importance" below).
+    Vector3d forward() const;
+    double lensArea() const;
+    double importance(const Ray &ray, double &s, double &t) const;
+    void importancePdf(const Ray &ray, double &pdfPosition, double &pdfDirection) const;
+    bool sampleImportance(const Vector3d &from, const Vector3d &sample, Vector3d &lensPoint, double &pdf, double &importance,
+                          double &s, double &t) const;
+    friend Vector3d randomInUnitDisk(const Vector3d &sample);
 };
 
-inline Vector3d randomInUnitDisk() {
-    Vector3d p;
-    do {
-        p = 2 * Vector3d(drand48(), drand48(), 0) - Vector3d(1, 1, 0);
-    } while (dot(p, p) >= 1.0);
-    return p;
+/* Lens sample */
+// Maps a 2D sampler sample (u, v, 0) in [0, 1)^2 to a point in
+// the unit disk with Shirley's concentric mapping: squares
+// around the center become rings, so the stratification of the
+// sample survives (rejection sampling would not keep it).
+inline Vector3d randomInUnitDisk(const Vector3d &sample) {
+    double a = 2 * sample.x() - 1;
+    double b = 2 * sample.y() - 1;
+    if (a == 0 && b == 0) return Vector3d(0, 0, 0);
+    double r, phi;
+    if (fabs(a) > fabs(b)) {
+        r = a;
+        phi = M_PI / 4 * (b / a);
+    } else {
+        r = b;
+        phi = M_PI / 2 - M_PI / 4 * (a / b);
+    }
+    return Vector3d(r * cos(phi), r * sin(phi), 0);
+}
+
+/* Camera settings */
+// Everything about a view except the image aspect ratio, so a
+// scene can carry its default view and the camera is created once
+// the image size is known.
+struct CameraSettings {
+    Point3d lookFrom;
+    Point3d lookAt;
+    Vector3d vUp;
+    double vFov;
+    double aperture;
+    double focusDistance;
+    Camera makeCamera(double aspect) const;
+};
+
+inline Camera CameraSettings::makeCamera(double aspect) const {
+    return Camera(lookFrom, lookAt, vUp, vFov, aspect, aperture, focusDistance);
 }
 
 /* Reverse Pinhole Camera */
@@ -106,6 +148,7 @@ inline Vector3d randomInUnitDisk() {
 // u * (4,0,0) + v * (0,2,0) = (-2,-1,-1)...(2,1,-1).
 Camera::Camera(Vector3d lookFrom, Vector3d lookAt, Vector3d vUp, double vFov, double aspect, double aperture, double focusDistance) {
     lensRadius = aperture / 2;
+    this->focusDistance = focusDistance;
     double theta = vFov * M_PI / 180;
     // Assuming the distance between origin and image plane (d)
     // is equal to 1, the ratio between the vertical FOV (Ø) and
@@ -119,6 +162,7 @@ Camera::Camera(Vector3d lookFrom, Vector3d lookAt, Vector3d vUp, double vFov, do
     lowerLeftCorner = origin - halfWidth * focusDistance * u - halfHeight * focusDistance * v - focusDistance * w;
     horizontal = 2 * halfWidth * focusDistance * u;
     vertical = 2 * halfHeight * focusDistance * v;
+    filmArea = 4 * halfWidth * halfHeight;
 }
 
 inline Ray Camera::getRay(double s, double t, Vector3d cameraOffset) const {
@@ -127,4 +171,70 @@ inline Ray Camera::getRay(double s, double t, Vector3d cameraOffset) const {
     return Ray(origin + offset, lowerLeftCorner + s * horizontal + t * vertical - origin - offset);
 }
 
+// Angle (radians, small angle approximation) one pixel of an image
+// imageHeight pixels high covers, seen from the origin: pixel
+// height on the image plane over the distance to it.
+inline double Camera::pixelSpread(int imageHeight) const {
+    double distance = (lowerLeftCorner + 0.5 * horizontal + 0.5 * vertical - origin).length();
+    return vertical.length() / imageHeight / distance;
+}
+
+/* Camera importance */
+// Light tracing needs the camera the other way round: which image
+// position a ray through the lens lands on and how much it
+// contributes there (pbrt's PerspectiveCamera::We()).
+// * A ray from a lens point meets the focus plane (distance
+//   focusDistance along forward()) where every ray of getRay(s, t)
+//   with the same (s, t) meets it, whatever its lens point.
+// * Importance is normalized so that it integrates to 1 over the
+//   whole image: 1 / (A * lens area * cos⁴θ) with A the area of the
+//   image plane at distance 1 and θ the angle to forward(). cos³θ
+//   turns the uniform image plane into solid angle, one more cos
+//   the lens area into projected area. A pinhole has lens area 1.
+// * The pdfs are those of getRay() with uniform (s, t) and lens
+//   position: 1 / lens area for the point, 1 / (A * cos³θ) per unit
+//   solid angle for the direction.
+// * sampleImportance() picks a lens point for a point `from` in
+//   the scene, pdf is per unit solid angle at `from`.
+inline Vector3d Camera::forward() const { return -w; }
+
+inline double Camera::lensArea() const {
+    return lensRadius > 0 ? M_PI * lensRadius * lensRadius : 1;
+}
+
+inline double Camera::importance(const Ray &ray, double &s, double &t) const {
+    double cosTheta = dot(unitVector(ray.direction()), -w);
+    if (cosTheta <= 0) return 0;
+    Vector3d focus = ray.origin() + ray.direction() * (focusDistance / dot(ray.direction(), -w)) - lowerLeftCorner;
+    s = dot(focus, horizontal) / horizontal.squaredLength();
+    t = dot(focus, vertical) / vertical.squaredLength();
+    if (s < 0 || s >= 1 || t < 0 || t >= 1) return 0;
+    double cos2Theta = cosTheta * cosTheta;
+    return 1 / (filmArea * lensArea() * cos2Theta * cos2Theta);
+}
+
+inline void Camera::importancePdf(const Ray &ray, double &pdfPosition, double &pdfDirection) const {
+    pdfPosition = pdfDirection = 0;
+    double s, t;
+    if (importance(ray, s, t) == 0) return;
+    double cosTheta = dot(unitVector(ray.direction()), -w);
+    pdfPosition = 1 / lensArea();
+    pdfDirection = 1 / (filmArea * cosTheta * cosTheta * cosTheta);
+}
+
+inline bool Camera::sampleImportance(const Vector3d &from, const Vector3d &sample, Vector3d &lensPoint, double &pdf, double &importance,
+                                     double &s, double &t) const {
+    Vector3d rd = lensRadius * randomInUnitDisk(sample);
+    lensPoint = origin + u * rd.x() + v * rd.y();
+    Vector3d toLens = lensPoint - from;
+    double distance2 = toLens.squaredLength();
+    if (distance2 == 0) return false;
+    Vector3d direction = toLens / sqrt(distance2);
+    double cosine = fabs(dot(direction, w));
+    if (cosine == 0) return false;
+    pdf = distance2 / (cosine * lensArea());
+    importance = this->importance(Ray(lensPoint, -direction), s, t);
+    return importance > 0;
+}
+
 #endif
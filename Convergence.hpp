@@ -0,0 +1,261 @@
+#ifndef Convergence_hpp
+#define Convergence_hpp
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <future>
+#include <chrono>
+#include <stdint.h>
+#include <math.h>
+#include "Vector3d.hpp"
+#include "Camera.hpp"
+#include "Film.hpp"
+#include "Scene.hpp"
+#include "Renderer.hpp"
+
+/* Convergence */
+// How fast a render gets close to the right image, as opposed to
+// how many rays per second it traces: the error against a
+// reference image at fixed points in time (a convergence curve).
+// Any integrator, sampler or scene option can be compared by the
+// time it needs for a given error.
+
+/* Image error */
+// Images are linear radiance, row-major, bottom row first (like the
+// film).
+//
+// * filmRadiance() reads a film's radiance. Clamped to the
+//   displayable [0, 1] by default: tiny lights seen directly are
+//   thousands of times brighter, and how much of a pixel they cover
+//   would dominate the error otherwise.
+// * rmse(): root mean square error over all pixels and channels.
+// * relativeMSE(): the mean of (x - r)² / (r² + 0.01), the squared
+//   error relative to the reference's brightness (Rousselle et al.),
+//   on unclamped radiance so dark regions count as much as bright
+//   ones. The 0.01 keeps black pixels finite. The worst 0.1% of the
+//   pixels are left out: a single firefly would otherwise swing
+//   the mean by orders of magnitude from one pass to the next.
+inline void filmRadiance(const Film &film, std::vector<Color> &radiance, bool clamp = true) {
+    int width = film.getWidth();
+    int height = film.getHeight();
+    std::vector<float> row[3];
+    for (int c = 0; c < 3; c++) row[c].resize(width);
+    radiance.resize(size_t(width) * height);
+    const float limit = clamp ? 1.0f : INFINITY;
+    for (int y = 0; y < height; y++) {
+        for (int c = 0; c < 3; c++) film.readRow(y, c, row[c].data());
+        for (int x = 0; x < width; x++) {
+            radiance[size_t(y) * width + x] = Color(fmin(row[0][x], limit), fmin(row[1][x], limit), fmin(row[2][x], limit));
+        }
+    }
+}
+
+inline double rmse(const std::vector<Color> &image, const std::vector<Color> &reference) {
+    double sum = 0;
+    for (size_t i = 0; i < image.size(); i++) {
+        Color d = image[i] - reference[i];
+        sum += d.squaredLength();
+    }
+    return sqrt(sum / (3.0 * image.size()));
+}
+
+inline double relativeMSE(const std::vector<Color> &image, const std::vector<Color> &reference) {
+    std::vector<double> errors(image.size());
+    for (size_t i = 0; i < image.size(); i++) {
+        double sum = 0;
+        for (int c = 0; c < 3; c++) {
+            double d = image[i][c] - reference[i][c];
+            sum += d * d / (reference[i][c] * reference[i][c] + 0.01);
+        }
+        errors[i] = sum / 3;
+    }
+    size_t kept = errors.size() - errors.size() / 1000;
+    if (kept == 0) return 0;
+    std::nth_element(errors.begin(), errors.begin() + (kept - 1), errors.end());
+    double sum = 0;
+    for (size_t i = 0; i < kept; i++) sum += errors[i];
+    return sum / double(kept);
+}
+
+/* Reference images */
+// Stored as PFM (portable float map): a text header "PF", the size
+// and the scale (negative for little endian), then RGB floats,
+// bottom row first, the film's order. Small, lossless and readable
+// by most image tools.
+inline bool writePFM(const std::string &path, int width, int height, const std::vector<Color> &radiance) {
+    std::ofstream writer(path, std::ofstream::binary | std::ofstream::trunc);
+    if (!writer) return false;
+    writer << "PF\n" << width << " " << height << "\n-1.0\n";
+    std::vector<float> row(size_t(width) * 3);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < 3; c++) row[size_t(x) * 3 + c] = float(radiance[size_t(y) * width + x][c]);
+        }
+        writer.write(reinterpret_cast<const char *>(row.data()), row.size() * sizeof(float));
+    }
+    return bool(writer);
+}
+
+// Returns false if the file is missing, not a little endian RGB PFM
+// or of another size.
+inline bool readPFM(const std::string &path, int width, int height, std::vector<Color> &radiance) {
+    std::ifstream reader(path, std::ifstream::binary);
+    if (!reader) return false;
+    std::string magic;
+    int fileWidth = 0, fileHeight = 0;
+    double scale = 0;
+    if (!(reader >> magic >> fileWidth >> fileHeight >> scale) || magic != "PF" || scale >= 0) return false;
+    if (fileWidth != width || fileHeight != height) return false;
+    reader.get(); // the single whitespace after the header
+    std::vector<float> row(size_t(width) * 3);
+    radiance.resize(size_t(width) * height);
+    for (int y = 0; y < height; y++) {
+        if (!reader.read(reinterpret_cast<char *>(row.data()), row.size() * sizeof(float))) return false;
+        for (int x = 0; x < width; x++) {
+            radiance[size_t(y) * width + x] = Color(row[size_t(x) * 3], row[size_t(x) * 3 + 1], row[size_t(x) * 3 + 2]);
+        }
+    }
+    return true;
+}
+
+/* Convergence curves */
+// measureConvergence() renders until the last checkpoint (seconds of
+// rendering) has passed and measures the error after the first pass
+// that ends at or after each checkpoint. Measuring stalls the job
+// (it happens between passes) and its time is not counted.
+//
+// * checkpoint: the requested time, seconds: the render time the
+//   pass actually ended at (passes are not divisible).
+// * rmse is on clamped radiance, relativeMSE on unclamped radiance.
+// * The seed of the settings is used as is, runs with the same
+//   settings render the same samples (the times differ).
+struct ConvergencePoint {
+    double checkpoint;
+    double seconds;
+    int spp;
+    double mraysPerSecond;
+    double rmse;
+    double relativeMSE;
+};
+
+struct ConvergenceCurve {
+    std::string scene;
+    std::string reference; // path of the reference image
+    std::vector<ConvergencePoint> points;
+};
+
+inline std::vector<ConvergencePoint> measureConvergence(Renderer &renderer, const Scene &scene, const Camera &camera, RenderSettings settings,
+                                                        const std::vector<Color> &reference, const std::vector<double> &checkpoints) {
+    std::vector<ConvergencePoint> points;
+    if (checkpoints.empty()) return points;
+    std::vector<Color> clampedReference(reference.size());
+    for (size_t i = 0; i < reference.size(); i++) {
+        clampedReference[i] = Color(fmin(reference[i].x(), 1.0), fmin(reference[i].y(), 1.0), fmin(reference[i].z(), 1.0));
+    }
+    settings.spp = 1 << 16;
+    // Passes finish one after another, the callback's state needs
+    // no locking
+    std::vector<Color> image;
+    double measuring = 0;
+    size_t next = 0;
+    bool stopped = false;
+    std::promise<void> stop;
+    RenderCallbacks callbacks;
+    callbacks.onPass = [&](const RenderJob &job, const RenderProgress &progress) {
+        auto begin = std::chrono::steady_clock::now();
+        double renderTime = progress.seconds - measuring;
+        if (next < checkpoints.size() && renderTime >= checkpoints[next]) {
+            ConvergencePoint point;
+            point.seconds = renderTime;
+            point.spp = progress.samplesCompleted;
+            point.mraysPerSecond = progress.rays / (renderTime * 1e6);
+            filmRadiance(job.getFilm(), image, false);
+            point.relativeMSE = relativeMSE(image, reference);
+            filmRadiance(job.getFilm(), image);
+            point.rmse = rmse(image, clampedReference);
+            // A long pass can pass several checkpoints at once
+            for (; next < checkpoints.size() && renderTime >= checkpoints[next]; next++) {
+                point.checkpoint = checkpoints[next];
+                points.push_back(point);
+            }
+        }
+        measuring += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        if (!stopped && (next == checkpoints.size() || progress.samplesCompleted == progress.samplesTotal)) {
+            stopped = true;
+            stop.set_value();
+        }
+    };
+    std::shared_ptr<RenderJob> job = renderer.submit(scene, camera, settings, callbacks);
+    if (!job) return points;
+    stop.get_future().wait();
+    job->cancel();
+    job->wait();
+    return points;
+}
+
+/* Curve files */
+// CSV: one row per scene and checkpoint, with the label of the
+// configuration, so files of several runs can simply be
+// concatenated. JSON: the same, grouped by scene, plus the
+// settings of the run.
+inline bool writeConvergenceCSV(const std::string &path, const std::string &label, const std::vector<ConvergenceCurve> &curves) {
+    std::ofstream writer(path, std::ofstream::trunc);
+    if (!writer) return false;
+    writer << "label,scene,checkpoint_s,time_s,spp,mrays_per_s,rmse,relmse\n";
+    for (const ConvergenceCurve &curve : curves) {
+        for (const ConvergencePoint &point : curve.points) {
+            writer << label << "," << curve.scene << "," << point.checkpoint << "," << point.seconds << "," << point.spp << ","
+                   << point.mraysPerSecond << "," << point.rmse << "," << point.relativeMSE << "\n";
+        }
+    }
+    return bool(writer);
+}
+
+// Quotes and backslashes escaped, enough for names and paths
+inline std::string jsonString(const std::string &text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+inline bool writeConvergenceJSON(const std::string &path, const std::string &label, const RenderSettings &settings, int threads,
+                                 const std::vector<ConvergenceCurve> &curves) {
+    std::ofstream writer(path, std::ofstream::trunc);
+    if (!writer) return false;
+    writer << "{\n"
+           << "  \"label\": " << jsonString(label) << ",\n"
+           << "  \"width\": " << settings.width << ",\n"
+           << "  \"height\": " << settings.height << ",\n"
+           << "  \"maxDepth\": " << settings.maxDepth << ",\n"
+           << "  \"integrator\": " << jsonString(settings.integrator) << ",\n"
+           << "  \"sampler\": " << jsonString(settings.sampler) << ",\n"
+           << "  \"lightSampling\": " << jsonString(settings.lightSampling) << ",\n"
+           << "  \"guiding\": " << (settings.guiding ? "true" : "false") << ",\n"
+           << "  \"seed\": " << settings.seed << ",\n"
+           << "  \"threads\": " << threads << ",\n"
+           << "  \"scenes\": [";
+    for (size_t i = 0; i < curves.size(); i++) {
+        const ConvergenceCurve &curve = curves[i];
+        writer << (i ? ",\n" : "\n") << "    {\n"
+               << "      \"name\": " << jsonString(curve.scene) << ",\n"
+               << "      \"reference\": " << jsonString(curve.reference) << ",\n"
+               << "      \"points\": [";
+        for (size_t j = 0; j < curve.points.size(); j++) {
+            const ConvergencePoint &point = curve.points[j];
+            writer << (j ? ",\n" : "\n") << "        { \"checkpoint\": " << point.checkpoint << ", \"time\": " << point.seconds
+                   << ", \"spp\": " << point.spp << ", \"mraysPerSecond\": " << point.mraysPerSecond << ", \"rmse\": " << point.rmse
+                   << ", \"relmse\": " << point.relativeMSE << " }";
+        }
+        writer << "\n      ]\n    }";
+    }
+    writer << "\n  ]\n}\n";
+    return bool(writer);
+}
+
+#endif
@@ -12,14 +12,17 @@ class Dielectric: public Material {
     double refractionIndex;
 public:
     Dielectric(Vector3d a, double ri): attenuation(a), refractionIndex(ri) {}
-    virtual bool scatter(const Ray &rayIn, const HitRecord &hitRecord, Vector3d &attenuation, Ray &scattered) const;
+    virtual bool scatter(const Ray &rayIn, const HitRecord &hitRecord, Sampler &sampler, Vector3d &attenuation, Ray &scattered, double &pdf) const;
+    Vector3d getAttenuation() const { return attenuation; }
+    double getRefractionIndex() const { return refractionIndex; }
 };
 
-inline bool Dielectric::scatter(const Ray &rayIn, const HitRecord &hitRecord, Vector3d &attenuation, Ray &scattered) const {
+inline bool Dielectric::scatter(const Ray &rayIn, const HitRecord &hitRecord, Sampler &sampler, Vector3d &attenuation, Ray &scattered, double &pdf) const {
     Vector3d outwardNormal;
     Vector3d reflected = reflect(rayIn.direction(), hitRecord.normal);
     double niOverNt;
     attenuation = this->attenuation;
+    pdf = 0;
     Vector3d refracted;
     double fresnelFactor; // reflection probability
     double cosine;
@@ -40,10 +43,10 @@ inline bool Dielectric::scatter(const Ray &rayIn, const HitRecord &hitRecord, Ve
         fresnelFactor = 1.0;
     }
     // Reflect or refract based on Fresnel factor
-    if (drand48() < fresnelFactor) {
+    if (sampler.get1D() < fresnelFactor) {
         scattered = Ray(hitRecord.p, reflected);
     } else {
-        scattered = Ray(hitRecord.p, refracted + 0.005 * randomInUnitSphere());
+        scattered = Ray(hitRecord.p, refracted + 0.005 * randomInUnitSphere(sampler));
     }
     return true;
 }
@@ -11,11 +11,13 @@ class DiffuseLight: public Material {
     Vector3d color;
 public:
     DiffuseLight(Vector3d color): color(color) {}
-    virtual bool scatter(const Ray &rayIn, const HitRecord &hitRecord, Vector3d &attenuation, Ray &scattered) const;
+    virtual bool scatter(const Ray &rayIn, const HitRecord &hitRecord, Sampler &sampler, Vector3d &attenuation, Ray &scattered, double &pdf) const;
     virtual Vector3d emitted() const;
+    Vector3d getColor() const { return color; }
 };
 
-inline bool DiffuseLight::scatter(const Ray &rayIn, const HitRecord &hitRecord, Vector3d &attenuation, Ray &scattered) const {
+inline bool DiffuseLight::scatter(const Ray &rayIn, const HitRecord &hitRecord, Sampler &sampler, Vector3d &attenuation, Ray &scattered, double &pdf) const {
+    pdf = 0;
     return false;
 }
 
@@ -0,0 +1,266 @@
+#ifndef Film_hpp
+#define Film_hpp
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include "Vector3d.hpp"
+#include "Sampler.hpp"
+#include "Framebuffer.hpp"
+#include "AtomicFloat.hpp"
+
+/* Film */
+// The film separates tracing from image output:
+// * While rendering, samples are only accumulated into the
+//   framebuffer (a running mean per pixel, see Framebuffer.hpp;
+//   row 0 is the bottom line of the image like in the render loop).
+// * resolve() turns the means into displayable 8 bit sRGB pixels:
+//   exposure, tonemapping, sRGB encoding, dithering and
+//   quantization. It runs over the whole image at once, only when
+//   an output is requested, split over threads by rows. Every
+//   stage is a plain loop over contiguous floats so the compiler
+//   vectorizes it (SIMD).
+// * Light tracing (the bidirectional integrator) adds to pixels
+//   that are not the one being sampled, from any thread: those
+//   splats are summed atomically into a separate float buffer
+//   (enableSplats()). Every pixel sample starts one light path, so
+//   the splat image is the sum over lightPaths paths scaled by
+//   pixels / lightPaths, which readRow() adds to the means.
+enum class Tonemap {
+    Clamp,    // clip every channel to 1 (the original behaviour)
+    Reinhard, // x / (1 + x)
+    ACES      // Narkowicz' fit of the ACES filmic curve
+};
+
+struct FilmSettings {
+    double exposure = 0; // in stops, radiance is scaled by 2^exposure
+    Tonemap tonemap = Tonemap::Clamp;
+    bool dither = true;  // blue noise dither before quantization
+    int threads = 0;     // 0 - one per hardware thread
+};
+
+class Film {
+    int width;
+    int height;
+    int frameY; // row of the frame the film's row 0 is (strips)
+    Framebuffer framebuffer;
+    std::vector<std::atomic<float>> splats; // 3 floats per pixel, row by row
+    std::atomic<int64_t> lightPaths;
+    void resolveRows(int begin, int end, float scale, const FilmSettings &settings, uint8_t *rgb) const;
+public:
+    // firstTouch: see Framebuffer
+    Film(int width, int height, PixelFormat format = PixelFormat::Float32, bool firstTouch = false);
+    int getWidth() const;
+    int getHeight() const;
+    // A film that holds a strip of a taller frame dithers with the
+    // frame's rows, so strips resolve exactly like the whole frame
+    void setFrameY(int y);
+    const Framebuffer &buffer() const;
+    // Adds sample number n (n = 1, 2, ...) of pixel (x, y).
+    void addSample(int x, int y, const Color &radiance, int n);
+    // Splats from light paths (thread safe)
+    void enableSplats();
+    bool hasSplats() const;
+    void addSplat(int x, int y, const Color &radiance);
+    void addLightPaths(int64_t count);
+    // One channel of row y: the pixel means plus the splats
+    void readRow(int y, int channel, float *out) const;
+    void clear();
+    // Resolves the accumulated pixel means into interleaved 8 bit
+    // RGB, top row first (width * height * 3 bytes).
+    void resolve(const FilmSettings &settings, uint8_t *rgb) const;
+    bool writePPM(const std::string &path, const FilmSettings &settings) const;
+};
+
+inline Film::Film(int width, int height, PixelFormat format, bool firstTouch): width(width), height(height), frameY(0),
+                                                                               framebuffer(width, height, format, firstTouch), lightPaths(0) {}
+
+inline int Film::getWidth() const { return width; }
+inline int Film::getHeight() const { return height; }
+inline void Film::setFrameY(int y) { frameY = y; }
+inline const Framebuffer &Film::buffer() const { return framebuffer; }
+
+inline void Film::addSample(int x, int y, const Color &radiance, int n) {
+    framebuffer.accumulate(x, y, radiance, n);
+}
+
+inline void Film::enableSplats() {
+    if (splats.empty()) splats = std::vector<std::atomic<float>>(size_t(width) * height * 3);
+    for (std::atomic<float> &splat : splats) splat.store(0, std::memory_order_relaxed);
+    lightPaths = 0;
+}
+
+inline bool Film::hasSplats() const { return !splats.empty(); }
+
+inline void Film::addSplat(int x, int y, const Color &radiance) {
+    std::atomic<float> *pixel = &splats[(size_t(y) * width + x) * 3];
+    for (int c = 0; c < 3; c++) {
+        if (radiance[c] != 0) atomicAdd(pixel[c], float(radiance[c]));
+    }
+}
+
+inline void Film::addLightPaths(int64_t count) { lightPaths += count; }
+
+inline void Film::readRow(int y, int channel, float *out) const {
+    framebuffer.readRow(y, channel, out);
+    int64_t paths = lightPaths;
+    if (splats.empty() || paths == 0) return;
+    float scale = float(double(width) * height / double(paths));
+    const std::atomic<float> *row = &splats[size_t(y) * width * 3 + channel];
+    for (int x = 0; x < width; x++) out[x] += scale * row[3 * x].load(std::memory_order_relaxed);
+}
+
+inline void Film::clear() {
+    framebuffer.clear();
+    if (hasSplats()) enableSplats();
+}
+
+// Branch-free min / max: unlike fminf() / fmaxf(), which have to
+// handle NaNs and end up as library calls, these compile to single
+// SIMD min / max instructions.
+inline float minFloat(float a, float b) { return a < b ? a : b; }
+inline float maxFloat(float a, float b) { return a > b ? a : b; }
+
+/* Tonemapping */
+// Maps scene radiance (0 ... ∞) to display range (0 ... 1).
+inline void tonemapClamp(float *v, int n) {
+    for (int i = 0; i < n; i++) v[i] = minFloat(v[i], 1.0f);
+}
+
+inline void tonemapReinhard(float *v, int n) {
+    for (int i = 0; i < n; i++) v[i] = v[i] / (1.0f + v[i]);
+}
+
+inline void tonemapACES(float *v, int n) {
+    for (int i = 0; i < n; i++) {
+        float x = v[i];
+        v[i] = minFloat((x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f), 1.0f);
+    }
+}
+
+/* sRGB encoding */
+// The sRGB transfer function: linear below 0.0031308, a 1/2.4
+// power curve (≈ gamma 1/2.2 overall) above. This replaces the
+// previous sqrt (gamma 1/2) approximation.
+// powf() does not vectorize, so the curve is tabulated once over
+// the tonemapped range [0, 1] and linearly interpolated; the
+// error stays far below one 8 bit step.
+class SRGBTable {
+public:
+    static const int size = 4096;
+    float table[size + 2];
+    SRGBTable();
+    static const SRGBTable &shared();
+};
+
+inline SRGBTable::SRGBTable() {
+    for (int i = 0; i < size + 2; i++) {
+        double x = fmin(double(i) / size, 1.0);
+        table[i] = float(x <= 0.0031308 ? 12.92 * x : 1.055 * pow(x, 1 / 2.4) - 0.055);
+    }
+}
+
+inline const SRGBTable &SRGBTable::shared() {
+    static SRGBTable instance;
+    return instance;
+}
+
+inline void encodeSRGB(const float *table, float *v, int n) {
+    for (int i = 0; i < n; i++) {
+        float x = minFloat(maxFloat(v[i], 0.0f), 1.0f) * SRGBTable::size;
+        int index = int(x);
+        float f = x - float(index);
+        v[i] = table[index] + f * (table[index + 1] - table[index]);
+    }
+}
+
+inline void Film::resolveRows(int begin, int end, float scale, const FilmSettings &settings, uint8_t *rgb) const {
+    // Locals instead of members: the uint8_t stores below may alias
+    // anything, which would stop the loops from vectorizing.
+    const int n = width;
+    std::vector<float> row[3];
+    std::vector<int32_t> quantized[3];
+    for (int c = 0; c < 3; c++) {
+        row[c].resize(n);
+        quantized[c].resize(n);
+    }
+    std::vector<float> threshold(n, 0.5f);
+    const BlueNoiseMask &mask = BlueNoiseMask::shared();
+    const float *table = SRGBTable::shared().table;
+    for (int y = begin; y < end; y++) {
+        for (int c = 0; c < 3; c++) {
+            /* Exposure */
+            float *v = row[c].data();
+            readRow(y, c, v);
+            for (int x = 0; x < n; x++) v[x] *= scale;
+            switch (settings.tonemap) {
+                case Tonemap::Clamp: tonemapClamp(v, n); break;
+                case Tonemap::Reinhard: tonemapReinhard(v, n); break;
+                case Tonemap::ACES: tonemapACES(v, n); break;
+            }
+            encodeSRGB(table, v, n);
+        }
+        /* Dithering */
+        // Quantizing with a per-pixel threshold from the blue noise
+        // mask instead of 0.5 trades banding in smooth gradients for
+        // fine, barely visible noise.
+        if (settings.dither) {
+            for (int x = 0; x < n; x++) threshold[x] = float(mask.value(x, y + frameY));
+        }
+        /* Quantization */
+        // Rounds into 32 bit integers first (vectorizes), then packs
+        // the three channels into interleaved bytes.
+        // Output is top row first, the film is bottom row first.
+        const float *t = threshold.data();
+        for (int c = 0; c < 3; c++) {
+            const float *v = row[c].data();
+            int32_t *q = quantized[c].data();
+            for (int x = 0; x < n; x++) q[x] = int32_t(minFloat(maxFloat(v[x] * 255.0f + t[x], 0.0f), 255.0f));
+        }
+        uint8_t *out = rgb + size_t(height - 1 - y) * n * 3;
+        const int32_t *r = quantized[0].data();
+        const int32_t *g = quantized[1].data();
+        const int32_t *b = quantized[2].data();
+        for (int x = 0; x < n; x++) {
+            out[3 * x + 0] = uint8_t(r[x]);
+            out[3 * x + 1] = uint8_t(g[x]);
+            out[3 * x + 2] = uint8_t(b[x]);
+        }
+    }
+}
+
+inline void Film::resolve(const FilmSettings &settings, uint8_t *rgb) const {
+    float scale = float(pow(2.0, settings.exposure));
+    int threads = settings.threads > 0 ? settings.threads : int(std::thread::hardware_concurrency());
+    if (threads < 1) threads = 1;
+    if (threads > height) threads = height;
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; i++) {
+        int begin = int(int64_t(height) * i / threads);
+        int end = int(int64_t(height) * (i + 1) / threads);
+        workers.emplace_back(&Film::resolveRows, this, begin, end, scale, std::cref(settings), rgb);
+    }
+    // The calling thread takes the first chunk
+    resolveRows(0, int(height / threads), scale, settings, rgb);
+    for (std::thread &worker : workers) worker.join();
+}
+
+/* PPM output */
+// Binary PPM (P6): header followed by raw 8 bit RGB, top row first.
+inline bool Film::writePPM(const std::string &path, const FilmSettings &settings) const {
+    std::vector<uint8_t> rgb(size_t(width) * height * 3);
+    resolve(settings, rgb.data());
+    std::ofstream writer(path, std::ofstream::binary | std::ofstream::trunc);
+    if (!writer) return false;
+    writer << "P6\n" << width << " " << height << "\n255\n";
+    writer.write(reinterpret_cast<const char *>(rgb.data()), rgb.size());
+    return bool(writer);
+}
+
+#endif
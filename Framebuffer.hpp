@@ -0,0 +1,250 @@
+#ifndef Framebuffer_hpp
+#define Framebuffer_hpp
+
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/mman.h>
+#include "Vector3d.hpp"
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+/* Half precision floats */
+// IEEE 754 binary16: 1 sign bit, 5 exponent bits, 10 mantissa
+// bits. About 3 decimal digits of precision up to 65504, which is
+// plenty for a per-pixel mean (see Framebuffer) and halves the
+// memory of float32.
+// Uses the F16C instructions when the compiler targets them,
+// otherwise converts with integer bit manipulation (round to
+// nearest even, overflow to infinity, denormals kept).
+inline uint16_t floatToHalf(float value) {
+#if defined(__F16C__)
+    return uint16_t(_cvtss_sh(value, 0));
+#else
+    uint32_t f;
+    memcpy(&f, &value, 4);
+    uint32_t sign = (f >> 16) & 0x8000u;
+    uint32_t absolute = f & 0x7fffffffu;
+    if (absolute >= 0x7f800000u) {
+        // Infinity or NaN
+        return uint16_t(sign | 0x7c00u | (absolute > 0x7f800000u ? 0x200u : 0));
+    }
+    if (absolute >= 0x477ff000u) {
+        // Rounds to a value above 65504: infinity
+        return uint16_t(sign | 0x7c00u);
+    }
+    if (absolute < 0x38800000u) {
+        // Denormal half (or zero): shift the mantissa with its
+        // implicit bit into place, rounding to nearest even.
+        if (absolute < 0x33000000u) return uint16_t(sign);
+        uint32_t exponent = absolute >> 23;
+        uint32_t mantissa = (absolute & 0x7fffffu) | 0x800000u;
+        uint32_t shift = 126 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1))) half++;
+        return uint16_t(sign | half);
+    }
+    // Normal: rebias the exponent (127 -> 15), round the mantissa
+    // from 23 to 10 bits to nearest even.
+    uint32_t half = ((absolute - 0x38000000u) >> 13);
+    uint32_t remainder = absolute & 0x1fffu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1))) half++;
+    return uint16_t(sign | half);
+#endif
+}
+
+inline float halfToFloat(uint16_t value) {
+#if defined(__F16C__)
+    return _cvtsh_ss(value);
+#else
+    uint32_t sign = uint32_t(value & 0x8000u) << 16;
+    uint32_t exponent = (value >> 10) & 0x1fu;
+    uint32_t mantissa = value & 0x3ffu;
+    uint32_t f;
+    if (exponent == 0x1fu) {
+        f = sign | 0x7f800000u | (mantissa << 13);
+    } else if (exponent != 0) {
+        f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa != 0) {
+        // Denormal half: normalize
+        exponent = 113;
+        while (!(mantissa & 0x400u)) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        f = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+    } else {
+        f = sign;
+    }
+    float result;
+    memcpy(&result, &f, 4);
+    return result;
+#endif
+}
+
+/* Framebuffer */
+// Per-pixel accumulation storage for the renderer.
+//
+// * One aligned allocation for the whole image instead of one
+//   allocation per row.
+// * Tile-major layout: the image is cut into tileSize x tileSize
+//   tiles, every tile is a contiguous block and inside a tile the
+//   three channels are stored as separate planes:
+//
+//   [tile 0: R plane | G plane | B plane][tile 1: R | G | B] ...
+//
+//   A render thread working on a tile touches only its own block,
+//   and blocks are multiples of 64 bytes so two threads never
+//   write to the same cache line (no false sharing at tile edges).
+// * Every channel is either float32 or half. The buffer stores the
+//   running mean of the samples of a pixel, not their sum: a sum
+//   of hundreds of samples would quickly exhaust the 11 bits of
+//   half precision. The mean is rounded to half after every sample
+//   though, and a step (sample - mean) / n below half a unit in the
+//   last place is lost: past about a thousand samples the mean
+//   stalls and drifts (2048 ones then 2048 zeros read 0.67).
+//   Half buffers take at most halfMaxSamples samples per pixel.
+// * readRow() converts one scanline back to contiguous floats
+//   for output.
+// * With firstTouch the memory is mapped but not written (fresh
+//   anonymous pages read as zero), so each page lands on the NUMA
+//   node of the render thread that first accumulates into it
+//   instead of the node of the thread that created the buffer.
+//
+// Pixel (0, 0) is the bottom left pixel, like in the render loop.
+enum class PixelFormat {
+    Float32,
+    Half
+};
+
+class Framebuffer {
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    PixelFormat format;
+    size_t elementSize;
+    size_t byteCount;
+    void *data;
+    bool mapped;
+    size_t elementIndex(int x, int y, int channel) const;
+    float load(size_t i) const;
+    Framebuffer(const Framebuffer &) = delete;
+    Framebuffer &operator=(const Framebuffer &) = delete;
+public:
+    static const int tileSize = 16;
+    static const int tilePixels = tileSize * tileSize;
+    // Half running means stay within a few percent up to here
+    static const int halfMaxSamples = 1024;
+
+    Framebuffer(int width, int height, PixelFormat format = PixelFormat::Float32, bool firstTouch = false);
+    ~Framebuffer();
+    int getWidth() const;
+    int getHeight() const;
+    int tileCountX() const;
+    int tileCountY() const;
+    PixelFormat pixelFormat() const;
+    size_t bytes() const;
+    void clear();
+    // Folds the n-th sample (n = 1, 2, ...) of pixel (x, y) into its
+    // mean: mean += (sample - mean) / n.
+    void accumulate(int x, int y, const Color &sample, int n);
+    Color get(int x, int y) const;
+    // Writes width floats of `channel` of row y to out.
+    void readRow(int y, int channel, float *out) const;
+};
+
+inline Framebuffer::Framebuffer(int width, int height, PixelFormat format, bool firstTouch): width(width), height(height), format(format),
+                                                                                          mapped(firstTouch) {
+    tilesX = (width + tileSize - 1) / tileSize;
+    tilesY = (height + tileSize - 1) / tileSize;
+    elementSize = format == PixelFormat::Half ? 2 : 4;
+    byteCount = size_t(tilesX) * tilesY * tilePixels * 3 * elementSize;
+    if (mapped) {
+        data = mmap(nullptr, byteCount, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) data = nullptr;
+    } else {
+        // aligned_alloc requires a size that is a multiple of the
+        // alignment; tiles are 768 or 1536 bytes, both multiples of 64.
+        data = aligned_alloc(64, byteCount);
+    }
+    if (!data) {
+        std::cout << "ERROR: Framebuffer allocation of " << byteCount << " bytes failed." << std::endl;
+        abort();
+    }
+    if (!mapped) clear();
+}
+
+inline Framebuffer::~Framebuffer() {
+    if (mapped) munmap(data, byteCount);
+    else free(data);
+}
+
+inline int Framebuffer::getWidth() const { return width; }
+inline int Framebuffer::getHeight() const { return height; }
+inline int Framebuffer::tileCountX() const { return tilesX; }
+inline int Framebuffer::tileCountY() const { return tilesY; }
+inline PixelFormat Framebuffer::pixelFormat() const { return format; }
+inline size_t Framebuffer::bytes() const { return byteCount; }
+
+inline void Framebuffer::clear() {
+    // All zero bits is 0.0 in both float32 and half
+    memset(data, 0, byteCount);
+}
+
+inline size_t Framebuffer::elementIndex(int x, int y, int channel) const {
+    // tileSize is a power of two: divisions and modulos are shifts
+    // and masks on the (non-negative) coordinates.
+    unsigned ux = unsigned(x);
+    unsigned uy = unsigned(y);
+    size_t tile = size_t(uy / tileSize) * tilesX + ux / tileSize;
+    return (tile * 3 + channel) * tilePixels + (uy % tileSize) * tileSize + ux % tileSize;
+}
+
+inline float Framebuffer::load(size_t i) const {
+    if (format == PixelFormat::Half) return halfToFloat(static_cast<const uint16_t *>(data)[i]);
+    return static_cast<const float *>(data)[i];
+}
+
+inline void Framebuffer::accumulate(int x, int y, const Color &sample, int n) {
+    size_t i = elementIndex(x, y, 0);
+    float weight = 1.0f / float(n);
+    if (format == PixelFormat::Half) {
+        uint16_t *element = static_cast<uint16_t *>(data) + i;
+        for (int c = 0; c < 3; c++, element += tilePixels) {
+            float mean = halfToFloat(*element);
+            *element = floatToHalf(mean + (float(sample[c]) - mean) * weight);
+        }
+    } else {
+        float *element = static_cast<float *>(data) + i;
+        for (int c = 0; c < 3; c++, element += tilePixels) *element += (float(sample[c]) - *element) * weight;
+    }
+}
+
+inline Color Framebuffer::get(int x, int y) const {
+    size_t i = elementIndex(x, y, 0);
+    return Color(load(i), load(i + tilePixels), load(i + 2 * tilePixels));
+}
+
+inline void Framebuffer::readRow(int y, int channel, float *out) const {
+    size_t rowInTile = size_t(y % tileSize) * tileSize;
+    size_t tileRow = size_t(y / tileSize) * tilesX;
+    for (int tx = 0; tx < tilesX; tx++) {
+        size_t first = ((tileRow + tx) * 3 + channel) * tilePixels + rowInTile;
+        int x0 = tx * tileSize;
+        int count = width - x0 < tileSize ? width - x0 : tileSize;
+        if (format == PixelFormat::Half) {
+            const uint16_t *source = static_cast<const uint16_t *>(data) + first;
+            for (int i = 0; i < count; i++) out[x0 + i] = halfToFloat(source[i]);
+        } else {
+            memcpy(out + x0, static_cast<const float *>(data) + first, count * sizeof(float));
+        }
+    }
+}
+
+#endif
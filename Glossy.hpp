@@ -6,31 +6,58 @@
 #include "Ray.hpp"
 #include "HitRecord.hpp"
 #include "Material.hpp"
+#include "Texture.hpp"
 
 class Glossy: public Material {
     Vector3d albedo;
+    const Texture *texture;
 public:
-    Glossy(const Vector3d &albedo): albedo(albedo) {}
-    virtual bool scatter(const Ray &rayIn, const HitRecord &hitRecord, Vector3d &attenuation, Ray &scattered) const;
+    Glossy(const Vector3d &albedo, const Texture *texture = nullptr): albedo(albedo), texture(texture) {}
+    virtual bool scatter(const Ray &rayIn, const HitRecord &hitRecord, Sampler &sampler, Vector3d &attenuation, Ray &scattered, double &pdf) const;
+    virtual Vector3d evaluate(const Ray &rayIn, const HitRecord &hitRecord, const Vector3d &direction, double &pdf) const;
+    virtual bool hasDiffuse() const { return true; }
+    double reflectance(const Ray &rayIn, const HitRecord &hitRecord) const;
+    Vector3d getAlbedo() const { return albedo; }
+    const Texture *getTexture() const { return texture; }
+    void setTexture(const Texture *t) { texture = t; }
 };
 
-inline bool Glossy::scatter(const Ray &rayIn, const HitRecord &hitRecord, Vector3d &attenuation, Ray &scattered) const {
+// Reflection probability, a varnish layer (IOR 1.5) over a
+// diffuse base.
+inline double Glossy::reflectance(const Ray &rayIn, const HitRecord &hitRecord) const {
     double cosine = 1.5 * dot(rayIn.direction(), hitRecord.normal) / rayIn.direction().length();
-    double fresnelFactor = schlick(-cosine, 1.5); // reflection probability
-    if (drand48() < fresnelFactor) {
+    return schlick(-cosine, 1.5);
+}
+
+inline bool Glossy::scatter(const Ray &rayIn, const HitRecord &hitRecord, Sampler &sampler, Vector3d &attenuation, Ray &scattered, double &pdf) const {
+    double fresnelFactor = reflectance(rayIn, hitRecord);
+    if (sampler.get1D() < fresnelFactor) {
         // Specular
         Vector3d reflected = reflect(unitVector(rayIn.direction()), hitRecord.normal);
         scattered = Ray(hitRecord.p, reflected);
         attenuation = Vector3d(1, 1, 1);
+        pdf = 0;
         return (dot(scattered.direction(), hitRecord.normal) > 0); // return true only for rays coming outwards (some rays don't)
     } else {
-        // Diffuse
-        Vector3d target = hitRecord.p + hitRecord.normal + randomInUnitSphere();
-        scattered = Ray(hitRecord.p, target - hitRecord.p);
-        attenuation = albedo;
+        // Diffuse, picked with probability 1 - fresnelFactor
+        scattered = Ray(hitRecord.p, cosineDirection(hitRecord.normal, sampler, pdf));
+        pdf *= 1 - fresnelFactor;
+        attenuation = textureAlbedo(texture, albedo, hitRecord);
         return true;
     }
 }
 
+// Only the diffuse lobe, it carries the 1 - fresnelFactor of the
+// light that the varnish lets through.
+inline Vector3d Glossy::evaluate(const Ray &rayIn, const HitRecord &hitRecord, const Vector3d &direction, double &pdf) const {
+    double cosine = dot(direction, hitRecord.normal);
+    if (cosine <= 0) {
+        pdf = 0;
+        return Vector3d(0, 0, 0);
+    }
+    pdf = (1 - reflectance(rayIn, hitRecord)) * cosine / M_PI;
+    return textureAlbedo(texture, albedo, hitRecord) * pdf;
+}
+
 
 #endif
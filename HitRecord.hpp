@@ -16,12 +16,36 @@
 // includes Material.hpp and Material.hpp includes
 // HitRecord.hpp
 class Material;
+class Hitable;
 
+// * u, v: texture coordinates of the hit point, in [0, 1] over
+//   the primitive.
+// * uvLength: world space length of a unit step in u or v at the
+//   hit (the longer of the two), from surface().
+// * footprint: width of the ray's footprint in (u, v) units, from
+//   the integrator (for texture filtering).
 struct HitRecord {
     double t;
     Vector3d p;
     Vector3d normal;
     Material *material;
+    double u = 0;
+    double v = 0;
+    double uvLength = 1;
+    double footprint = 0;
+};
+
+/* Primitive hit */
+// What traversal records for the closest hit found so far:
+// only the ray parameter and which primitive was hit. Surface
+// details (point, normal, material) are computed once, after
+// traversal, by primitive->surface().
+// index is the primitive index inside `primitive` for Hitables
+// that hold several primitives (0 otherwise).
+struct PrimitiveHit {
+    double t;
+    const Hitable *primitive;
+    int index;
 };
 
 #endif
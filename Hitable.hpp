@@ -2,21 +2,118 @@
 #define Hitable_hpp
 
 #include <iostream>
+#include <vector>
 #include "Vector3d.hpp"
 #include "Ray.hpp"
 #include "HitRecord.hpp"
+#include "AABB.hpp"
+#include "Light.hpp"
+#include "RayPacket.hpp"
 
 /* Abstract class */
 // Is a class in which a pure virtual (= 0) function
 // exists. This function cannot be defined in abstract
 // class, but must be implemented in derived classes.
+//
+/* Two-phase intersection */
+// * closestHit() finds the closest hit inside the t range and
+//   records only (t, primitive). Aggregates shrink tMax as they
+//   go, so a primitive that is later beaten by a closer one never
+//   pays for its point, normal or material.
+// * surface() then fills out the full HitRecord of the winning
+//   primitive, once per ray.
+// * occluded() answers "is there anything between tMin and tMax"
+//   for shadow rays and returns at the first hit it finds.
+// * closestHits() does closestHit() for every ray of a packet (see
+//   RayPacket.hpp), within tMin and each ray's tMax. BVHs trace the
+//   packet together, everything else ray by ray.
+//
+/* Light sources */
+// * collectLights() appends a LightSource for every emitting
+//   primitive, aggregates forward to their children.
+// * sampleLight() and lightPdf() are only called on the primitive
+//   of a LightSource, with its index: sampleLight() picks a point
+//   on the light seen from `from` with 2 uniform numbers, lightPdf()
+//   is the solid angle pdf with which it would pick p.
+// * sampleEmission() and emissionPdf() start paths on the light
+//   instead (EmissionSample), same rule.
 class Hitable {
 public:
+    virtual ~Hitable() {};
+    virtual bool closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const = 0;
+    virtual bool occluded(const Ray &ray, double tMin, double tMax) const;
+    virtual void closestHits(RayPacket &packet, double tMin) const;
+    // Only called on the primitive stored in a PrimitiveHit.
+    virtual void surface(const Ray &ray, const PrimitiveHit &hit, HitRecord &hitRecord) const;
+    // Fills out the bounds of the object. Returns false for
+    // unbounded objects, which acceleration structures then have
+    // to keep outside their hierarchy.
+    virtual bool boundingBox(AABB &box) const;
+    virtual void collectLights(std::vector<LightSource> &lights) const;
+    virtual bool sampleLight(int index, const Vector3d &from, const Vector3d &u, LightSample &sample) const;
+    virtual double lightPdf(int index, const Vector3d &from, const Vector3d &p) const;
+    // Emission sampling for light paths (bidirectional integrator)
+    virtual bool sampleEmission(int index, const Vector3d &uPosition, const Vector3d &uDirection, EmissionSample &sample) const;
+    virtual void emissionPdf(int index, const Vector3d &p, const Vector3d &normal, const Vector3d &direction,
+                             double &pdfPosition, double &pdfDirection) const;
     // Every Hitable must have hit function that determines
     // if the Ray (ray) hits the object inside the t range.
     // If so, the function returns true and fills out the
     // hitRecord.
-    virtual bool hit(const Ray &ray, double tMin, double tMax, HitRecord &hitRecord) const = 0;
+    // Convenience wrapper: closestHit() followed by surface().
+    bool hit(const Ray &ray, double tMin, double tMax, HitRecord &hitRecord) const;
 };
 
+// Default: any closest hit is an occluder. Primitives and
+// aggregates override this with an early-out version.
+inline bool Hitable::occluded(const Ray &ray, double tMin, double tMax) const {
+    PrimitiveHit hit;
+    return closestHit(ray, tMin, tMax, hit);
+}
+
+inline void Hitable::closestHits(RayPacket &packet, double tMin) const {
+    for (int i = 0; i < packet.size; i++) {
+        if (closestHit(packet.rays[i], tMin, packet.tMax[i], packet.hits[i])) {
+            packet.tMax[i] = packet.hits[i].t;
+            packet.found[i] = true;
+        }
+    }
+}
+
+inline void Hitable::surface(const Ray &ray, const PrimitiveHit &hit, HitRecord &hitRecord) const {
+    hitRecord.t = hit.t;
+    hitRecord.p = ray.pointAtParameter(hit.t);
+}
+
+inline bool Hitable::boundingBox(AABB &box) const {
+    return false;
+}
+
+// Default: not a light.
+inline void Hitable::collectLights(std::vector<LightSource> &lights) const {}
+
+inline bool Hitable::sampleLight(int index, const Vector3d &from, const Vector3d &u, LightSample &sample) const {
+    return false;
+}
+
+inline double Hitable::lightPdf(int index, const Vector3d &from, const Vector3d &p) const {
+    return 0;
+}
+
+inline bool Hitable::sampleEmission(int index, const Vector3d &uPosition, const Vector3d &uDirection, EmissionSample &sample) const {
+    return false;
+}
+
+inline void Hitable::emissionPdf(int index, const Vector3d &p, const Vector3d &normal, const Vector3d &direction,
+                                 double &pdfPosition, double &pdfDirection) const {
+    pdfPosition = pdfDirection = 0;
+}
+
+inline bool Hitable::hit(const Ray &ray, double tMin, double tMax, HitRecord &hitRecord) const {
+    PrimitiveHit hit;
+    if (!closestHit(ray, tMin, tMax, hit)) return false;
+    hit.primitive->surface(ray, hit, hitRecord);
+    return true;
+}
+
 #endif
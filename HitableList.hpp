@@ -12,25 +12,54 @@ class HitableList: public Hitable {
 public:
     HitableList() {};
     HitableList(Hitable **l, int n): list(l), listSize(n) {};
-    virtual bool hit(const Ray &ray, double tMin, double tMax, HitRecord &hitRecord) const;
+    virtual bool closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const;
+    virtual bool occluded(const Ray &ray, double tMin, double tMax) const;
+    virtual void closestHits(RayPacket &packet, double tMin) const;
+    virtual bool boundingBox(AABB &box) const;
+    virtual void collectLights(std::vector<LightSource> &lights) const;
 };
 
-inline bool HitableList::hit(const Ray &ray, double tMin, double tMax, HitRecord &hitRecord) const {
-    HitRecord tempHitRecord;
+inline bool HitableList::closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const {
     bool hitAnything = false;
     double closestSoFar = tMax;
     /* Find the closest hit */
     for (int i = 0; i < listSize; i++) {
-        if (list[i]->hit(ray, tMin, closestSoFar, tempHitRecord)) {
-            // If current object in list is hit and is the closest
-            // one so far save its HitRecord and shrink the t range
-            // by updating the t value.
+        // If current object in list is hit it is the closest one
+        // so far (the t range was shrunk to the previous closest
+        // hit): it overwrites hit (t + primitive only), shrink the
+        // t range again.
+        if (list[i]->closestHit(ray, tMin, closestSoFar, hit)) {
             hitAnything = true;
-            closestSoFar = tempHitRecord.t;
-            hitRecord = tempHitRecord;
+            closestSoFar = hit.t;
         }
     }
     return hitAnything;
 }
 
+inline bool HitableList::occluded(const Ray &ray, double tMin, double tMax) const {
+    for (int i = 0; i < listSize; i++) {
+        if (list[i]->occluded(ray, tMin, tMax)) return true;
+    }
+    return false;
+}
+
+// Each object shrinks the rays' tMax for the next, like closestSoFar
+inline void HitableList::closestHits(RayPacket &packet, double tMin) const {
+    for (int i = 0; i < listSize; i++) list[i]->closestHits(packet, tMin);
+}
+
+inline bool HitableList::boundingBox(AABB &box) const {
+    box = AABB();
+    for (int i = 0; i < listSize; i++) {
+        AABB child;
+        if (!list[i]->boundingBox(child)) return false;
+        box.extend(child);
+    }
+    return true;
+}
+
+inline void HitableList::collectLights(std::vector<LightSource> &lights) const {
+    for (int i = 0; i < listSize; i++) list[i]->collectLights(lights);
+}
+
 #endif
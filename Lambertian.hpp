@@ -6,19 +6,37 @@
 #include "Ray.hpp"
 #include "HitRecord.hpp"
 #include "Material.hpp"
+#include "Texture.hpp"
 
 class Lambertian: public Material {
     Vector3d albedo;
+    const Texture *texture;
 public:
-    Lambertian(const Vector3d &albedo): albedo(albedo) {};
-    virtual bool scatter(const Ray &rayIn, const HitRecord &hitRecord, Vector3d &attenuation, Ray &scattered) const;
+    Lambertian(const Vector3d &albedo, const Texture *texture = nullptr): albedo(albedo), texture(texture) {};
+    virtual bool scatter(const Ray &rayIn, const HitRecord &hitRecord, Sampler &sampler, Vector3d &attenuation, Ray &scattered, double &pdf) const;
+    virtual Vector3d evaluate(const Ray &rayIn, const HitRecord &hitRecord, const Vector3d &direction, double &pdf) const;
+    virtual bool hasDiffuse() const { return true; }
+    Vector3d getAlbedo() const { return albedo; }
+    const Texture *getTexture() const { return texture; }
+    void setTexture(const Texture *t) { texture = t; }
 };
 
-inline bool Lambertian::scatter(const Ray &rayIn, const HitRecord &hitRecord, Vector3d &attenuation, Ray &scattered) const {
-    Vector3d target = hitRecord.p + hitRecord.normal + randomInUnitSphere(); // this->randomInUnitSphere, this is const
-    scattered = Ray(hitRecord.p, target - hitRecord.p);
-    attenuation = albedo;
-    return true; // always true since randomInUnitSphere vector always faces outwards
+inline bool Lambertian::scatter(const Ray &rayIn, const HitRecord &hitRecord, Sampler &sampler, Vector3d &attenuation, Ray &scattered, double &pdf) const {
+    // Cosine distributed around the normal: BSDF (albedo / π) times
+    // cos(Ø) over pdf (cos(Ø) / π) is just the albedo.
+    scattered = Ray(hitRecord.p, cosineDirection(hitRecord.normal, sampler, pdf));
+    attenuation = textureAlbedo(texture, albedo, hitRecord);
+    return true; // always true since the direction always faces outwards
+}
+
+inline Vector3d Lambertian::evaluate(const Ray &rayIn, const HitRecord &hitRecord, const Vector3d &direction, double &pdf) const {
+    double cosine = dot(direction, hitRecord.normal);
+    if (cosine <= 0) {
+        pdf = 0;
+        return Vector3d(0, 0, 0);
+    }
+    pdf = cosine / M_PI;
+    return textureAlbedo(texture, albedo, hitRecord) * pdf;
 }
 
 #endif
@@ -0,0 +1,177 @@
+#ifndef Light_hpp
+#define Light_hpp
+
+#include <iostream>
+#include <math.h>
+#include <algorithm>
+#include "Vector3d.hpp"
+#include "AABB.hpp"
+
+class Hitable;
+
+/* Light bounds */
+// What the light hierarchy knows about a group of emitters: where
+// they are (box), how much they emit (phi, power) and in which
+// directions (an orientation cone):
+//
+// * w is the cone's axis, every emitting surface normal is within
+//   θo of it (cosThetaO = -1: normals in all directions, spheres).
+// * Each surface point emits within θe of its normal (π/2 for
+//   diffuse emitters).
+// * twoSided: the emitters also emit around -w.
+//
+// importance() is a conservative estimate of how much the group
+// can contribute to a point p with normal n: phi over squared
+// distance, reduced by the smallest angle between the cone and
+// the direction to p and by the smallest angle between n and the
+// directions to the box (Conty Estevez and Kulla, "Importance
+// Sampling of Many Lights with Adaptive Tree Splitting", in the
+// form used by pbrt-v4).
+struct LightBounds {
+    AABB box;
+    Vector3d w;
+    double phi;
+    double cosThetaO;
+    double cosThetaE;
+    bool twoSided;
+    LightBounds(): w(0, 0, 1), phi(0), cosThetaO(1), cosThetaE(1), twoSided(false) {};
+    double importance(const Vector3d &p, const Vector3d &n) const;
+};
+
+// Smallest cone around a and b's axes that holds both cones
+inline void unionCones(const Vector3d &wa, double cosA, const Vector3d &wb, double cosB, Vector3d &w, double &cosTheta) {
+    // Either cone already covers every direction (spheres)
+    if (cosA <= -1 || cosB <= -1) {
+        w = cosA <= -1 ? wa : wb;
+        cosTheta = -1;
+        return;
+    }
+    double thetaA = acos(fmax(-1.0, fmin(1.0, cosA)));
+    double thetaB = acos(fmax(-1.0, fmin(1.0, cosB)));
+    double thetaD = acos(fmax(-1.0, fmin(1.0, dot(wa, wb))));
+    if (fmin(thetaD + thetaB, M_PI) <= thetaA) {
+        w = wa;
+        cosTheta = cosA;
+        return;
+    }
+    if (fmin(thetaD + thetaA, M_PI) <= thetaB) {
+        w = wb;
+        cosTheta = cosB;
+        return;
+    }
+    double thetaO = (thetaA + thetaD + thetaB) / 2;
+    Vector3d axis = cross(wa, wb);
+    if (thetaO >= M_PI || axis.squaredLength() == 0) {
+        w = wa;
+        cosTheta = -1;
+        return;
+    }
+    // Rotate wa towards wb by θo - θa (Rodrigues' rotation formula)
+    double thetaR = thetaO - thetaA;
+    Vector3d k = unitVector(axis);
+    w = wa * cos(thetaR) + cross(k, wa) * sin(thetaR) + k * dot(k, wa) * (1 - cos(thetaR));
+    cosTheta = cos(thetaO);
+}
+
+inline LightBounds unionBounds(const LightBounds &a, const LightBounds &b) {
+    if (a.phi == 0) return b;
+    if (b.phi == 0) return a;
+    LightBounds bounds;
+    bounds.box = a.box;
+    bounds.box.extend(b.box);
+    unionCones(a.w, a.cosThetaO, b.w, b.cosThetaO, bounds.w, bounds.cosThetaO);
+    bounds.phi = a.phi + b.phi;
+    bounds.cosThetaE = fmin(a.cosThetaE, b.cosThetaE);
+    bounds.twoSided = a.twoSided || b.twoSided;
+    return bounds;
+}
+
+// cos(max(0, θa - θb)) from the cosines
+inline double cosSubClamped(double cosA, double sinA, double cosB, double sinB) {
+    if (cosA > cosB) return 1;
+    return cosA * cosB + sinA * sinB;
+}
+
+// sin(max(0, θa - θb)) from the cosines
+inline double sinSubClamped(double cosA, double sinA, double cosB, double sinB) {
+    if (cosA > cosB) return 0;
+    return sinA * cosB - cosA * sinB;
+}
+
+inline double LightBounds::importance(const Vector3d &p, const Vector3d &n) const {
+    Vector3d center = box.center();
+    Vector3d toPoint = p - center;
+    double d2 = toPoint.squaredLength();
+    // Points inside the box should not get an infinite estimate
+    double clampedD2 = fmax(d2, box.extent().length() / 2);
+    double radius2 = 0.25 * box.extent().squaredLength();
+    double cosThetaB = d2 < radius2 ? -1 : sqrt(fmax(0.0, 1 - radius2 / d2));
+    double sinThetaB = sqrt(fmax(0.0, 1 - cosThetaB * cosThetaB));
+
+    // Angle between the cone axis and the direction to p (nothing
+    // to reduce for cones of all directions, spheres)
+    Vector3d wi = d2 > 0 ? toPoint / sqrt(d2) : Vector3d(0, 0, 1);
+    double cosThetaP = 1;
+    if (cosThetaO > -1) {
+        double cosThetaW = dot(w, wi);
+        if (twoSided) cosThetaW = fabs(cosThetaW);
+        double sinThetaW = sqrt(fmax(0.0, 1 - cosThetaW * cosThetaW));
+        double sinThetaO = sqrt(fmax(0.0, 1 - cosThetaO * cosThetaO));
+        // θx = max(0, θw - θo), then θ' = max(0, θx - θb)
+        double cosThetaX = cosSubClamped(cosThetaW, sinThetaW, cosThetaO, sinThetaO);
+        double sinThetaX = sinSubClamped(cosThetaW, sinThetaW, cosThetaO, sinThetaO);
+        cosThetaP = cosSubClamped(cosThetaX, sinThetaX, cosThetaB, sinThetaB);
+        if (cosThetaP <= cosThetaE) return 0;
+    }
+
+    // Angle between n and the direction towards the lights
+    double cosThetaI = -dot(wi, n);
+    double sinThetaI = sqrt(fmax(0.0, 1 - cosThetaI * cosThetaI));
+    double cosThetaPI = cosSubClamped(cosThetaI, sinThetaI, cosThetaB, sinThetaB);
+    if (cosThetaPI <= 0) return 0;
+    return phi * cosThetaP * cosThetaPI / clampedD2;
+}
+
+// Two unit vectors t, b that form an orthonormal basis with the
+// unit vector n (Duff et al., "Building an Orthonormal Basis,
+// Revisited").
+inline void orthonormalBasis(const Vector3d &n, Vector3d &t, Vector3d &b) {
+    double sign = copysign(1.0, n.z());
+    double a = -1 / (sign + n.z());
+    double c = n.x() * n.y() * a;
+    t = Vector3d(1 + sign * n.x() * n.x() * a, sign * c, -sign * n.x());
+    b = Vector3d(c, sign + n.y() * n.y() * a, -n.y());
+}
+
+/* Light sources */
+// An emitting primitive: index inside primitive as in
+// PrimitiveHit.
+struct LightSource {
+    const Hitable *primitive;
+    int index;
+    LightBounds bounds;
+};
+
+// A point sampled on a light as seen from a shading point: pdf is
+// per unit solid angle at the shading point.
+struct LightSample {
+    Vector3d p;
+    Vector3d normal;
+    Vector3d radiance;
+    double pdf;
+};
+
+// A ray leaving a light, for paths traced from the lights: p is
+// uniform on the light's surface (pdfPosition per unit area) and
+// the direction cosine distributed around its normal
+// (pdfDirection per unit solid angle).
+struct EmissionSample {
+    Vector3d p;
+    Vector3d normal;
+    Vector3d direction;
+    Vector3d radiance;
+    double pdfPosition;
+    double pdfDirection;
+};
+
+#endif
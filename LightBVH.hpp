@@ -0,0 +1,325 @@
+#ifndef LightBVH_hpp
+#define LightBVH_hpp
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <stdint.h>
+#include <math.h>
+#include "Vector3d.hpp"
+#include "AABB.hpp"
+#include "Light.hpp"
+#include "Hitable.hpp"
+#include "Sampler.hpp"
+
+/* Light selection */
+// How a path vertex picks the light it sends a shadow ray to:
+// * None: it doesn't, lights are only found by scattered rays.
+// * Uniform: every light with probability 1 / N. Fine for a few
+//   lights of similar power, hopeless for thousands of small ones
+//   where almost every pick is far away or facing away.
+// * BVH: proportional to an estimate of each light's contribution,
+//   from a hierarchy over the lights (below).
+enum class LightSampling { None, Uniform, BVH };
+
+inline bool parseLightSampling(const std::string &name, LightSampling &mode) {
+    if (name == "none") mode = LightSampling::None;
+    else if (name == "uniform") mode = LightSampling::Uniform;
+    else if (name == "bvh") mode = LightSampling::BVH;
+    else return false;
+    return true;
+}
+
+/* Light BVH */
+// A binary tree over the scene's lights whose nodes store the
+// LightBounds of everything below them (pbrt-v4's
+// BVHLightSampler).
+//
+// * Sampling walks down from the root: at every interior node the
+//   two children's importance() for the shading point decides
+//   which one to enter, with probability proportional to it. One
+//   light per leaf, so a pick costs O(log N) importance
+//   evaluations and the probability of the light is the product
+//   of the choices on the way.
+// * pmf() has to give the same probability for a light that was
+//   hit by a scattered ray (for multiple importance sampling).
+//   Every light stores its bit trail, the choices (0: first
+//   child, 1: second child) from the root to its leaf, so pmf()
+//   follows it back down without searching.
+// * Build: top-down, binned like BVHBuilder but with pbrt's cost
+//   for lights: power * solid angle of the orientation cone *
+//   surface area, scaled by how elongated the box is along the
+//   split axis. Bit trails hold 64 levels: below level 32 the
+//   splits are medians, which need at most 32 more.
+//
+//   Nodes are flat and depth first: the first child follows its
+//   parent, offset is the second child (interior) or the light
+//   (leaf).
+// * Paths that start on a light have no shading point to judge
+//   from: samplePower() picks lights in proportion to their power
+//   (phi) from a cumulative table, a binary search per pick.
+struct LightBVHNode {
+    float min[3];
+    float max[3];
+    float w[3];
+    float phi;
+    float cosThetaO;
+    float cosThetaE;
+    int32_t offset;
+    uint8_t leaf;
+    uint8_t twoSided;
+    uint16_t reserved;
+};
+
+class LightBVH {
+    struct KeyHash {
+        size_t operator()(const std::pair<const Hitable *, int> &key) const {
+            return size_t(mixBits(uint64_t(uintptr_t(key.first)) ^ (uint64_t(uint32_t(key.second)) << 48)));
+        }
+    };
+    std::vector<LightSource> lights;
+    std::vector<LightBVHNode> nodes;
+    std::vector<uint64_t> trails;
+    std::vector<double> powerCdf; // powerCdf[i]: power of lights 0..i - 1, normalized
+    std::unordered_map<std::pair<const Hitable *, int>, int, KeyHash> lookup;
+    static const int bucketCount = 12;
+    static const int maxTrailDepth = 64;
+    int build(std::vector<int> &order, int begin, int end, uint64_t trail, int depth);
+    static LightBounds nodeBounds(const LightBVHNode &node);
+    static double cost(const LightBounds &bounds, const AABB &parent, int axis);
+public:
+    LightBVH(const std::vector<LightSource> &lights);
+    int lightCount() const;
+    const LightSource &light(int i) const;
+    // Picks a light for the point p with normal n from u in [0, 1).
+    // Returns false if no light can contribute.
+    bool sample(const Vector3d &p, const Vector3d &n, double u, LightSampling mode, int &light, double &pmf) const;
+    // Probability that sample() picks light for p, n.
+    double pmf(const Vector3d &p, const Vector3d &n, int light, LightSampling mode) const;
+    // Picks a light with probability power / total power.
+    bool samplePower(double u, int &light, double &pmf) const;
+    double powerPmf(int light) const;
+    // The light of a primitive hit, -1 if it is not a light.
+    int find(const Hitable *primitive, int index) const;
+    size_t bytes() const;
+};
+
+inline LightBVH::LightBVH(const std::vector<LightSource> &list): lights(list), trails(list.size(), 0) {
+    lookup.reserve(lights.size());
+    for (size_t i = 0; i < lights.size(); i++) lookup[std::make_pair(lights[i].primitive, lights[i].index)] = int(i);
+    if (lights.empty()) return;
+    powerCdf.resize(lights.size() + 1, 0);
+    for (size_t i = 0; i < lights.size(); i++) powerCdf[i + 1] = powerCdf[i] + fmax(lights[i].bounds.phi, 0.0);
+    double totalPower = powerCdf.back();
+    for (double &c : powerCdf) c = totalPower > 0 ? c / totalPower : 0;
+    nodes.reserve(2 * lights.size() - 1);
+    std::vector<int> order(lights.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = int(i);
+    build(order, 0, int(order.size()), 0, 0);
+}
+
+inline LightBounds LightBVH::nodeBounds(const LightBVHNode &node) {
+    LightBounds bounds;
+    bounds.box = AABB(Vector3d(node.min[0], node.min[1], node.min[2]), Vector3d(node.max[0], node.max[1], node.max[2]));
+    bounds.w = Vector3d(node.w[0], node.w[1], node.w[2]);
+    bounds.phi = node.phi;
+    bounds.cosThetaO = node.cosThetaO;
+    bounds.cosThetaE = node.cosThetaE;
+    bounds.twoSided = node.twoSided != 0;
+    return bounds;
+}
+
+// Power times the solid angle the cone's emission can reach (θo
+// widened by θe), times surface area, times the box's largest over
+// its split axis extent (long thin clusters are cut across).
+inline double LightBVH::cost(const LightBounds &bounds, const AABB &parent, int axis) {
+    double solidAngle = 4 * M_PI; // all directions (spheres)
+    if (bounds.cosThetaO > -1) {
+        double thetaO = acos(fmin(1.0, bounds.cosThetaO));
+        double thetaE = acos(fmax(-1.0, fmin(1.0, bounds.cosThetaE)));
+        double thetaW = fmin(thetaO + thetaE, M_PI);
+        double sinThetaO = sqrt(fmax(0.0, 1 - bounds.cosThetaO * bounds.cosThetaO));
+        solidAngle = 2 * M_PI * (1 - bounds.cosThetaO) +
+                     M_PI / 2 * (2 * thetaW * sinThetaO - cos(thetaO - 2 * thetaW) - 2 * thetaO * sinThetaO + bounds.cosThetaO);
+    }
+    Vector3d extent = parent.extent();
+    double longest = fmax(extent.x(), fmax(extent.y(), extent.z()));
+    double kr = extent[axis] > 0 ? longest / extent[axis] : 1;
+    return bounds.phi * solidAngle * kr * bounds.box.surfaceArea();
+}
+
+inline int LightBVH::build(std::vector<int> &order, int begin, int end, uint64_t trail, int depth) {
+    LightBounds bounds;
+    AABB centroids;
+    for (int i = begin; i < end; i++) {
+        const LightBounds &b = lights[order[i]].bounds;
+        bounds = unionBounds(bounds, b);
+        centroids.extend(b.box.center());
+    }
+    int node = int(nodes.size());
+    nodes.push_back(LightBVHNode());
+    LightBVHNode leafOrInterior;
+    for (int k = 0; k < 3; k++) {
+        leafOrInterior.min[k] = float(bounds.box.min[k]);
+        leafOrInterior.max[k] = float(bounds.box.max[k]);
+        leafOrInterior.w[k] = float(bounds.w[k]);
+    }
+    leafOrInterior.phi = float(bounds.phi);
+    leafOrInterior.cosThetaO = float(bounds.cosThetaO);
+    leafOrInterior.cosThetaE = float(bounds.cosThetaE);
+    leafOrInterior.twoSided = bounds.twoSided;
+    leafOrInterior.reserved = 0;
+
+    if (end - begin == 1) {
+        leafOrInterior.offset = order[begin];
+        leafOrInterior.leaf = 1;
+        nodes[node] = leafOrInterior;
+        trails[order[begin]] = trail;
+        return node;
+    }
+
+    /* Binned split */
+    int mid = -1;
+    if (depth < maxTrailDepth / 2) {
+        double bestCost = INFINITY;
+        int bestAxis = -1;
+        int bestSplit = -1;
+        for (int axis = 0; axis < 3; axis++) {
+            double lo = centroids.min[axis];
+            double hi = centroids.max[axis];
+            if (!(hi > lo)) continue;
+            LightBounds buckets[bucketCount];
+            for (int i = begin; i < end; i++) {
+                const LightBounds &b = lights[order[i]].bounds;
+                int bucket = std::min(bucketCount - 1, int(bucketCount * (b.box.center()[axis] - lo) / (hi - lo)));
+                buckets[bucket] = unionBounds(buckets[bucket], b);
+            }
+            // Costs of everything above each split, then sweep up
+            double aboveCost[bucketCount];
+            LightBounds above;
+            for (int b = bucketCount - 1; b > 0; b--) {
+                above = unionBounds(above, buckets[b]);
+                aboveCost[b - 1] = above.phi > 0 ? cost(above, bounds.box, axis) : -1;
+            }
+            LightBounds below;
+            for (int split = 0; split < bucketCount - 1; split++) {
+                below = unionBounds(below, buckets[split]);
+                if (below.phi == 0 || aboveCost[split] < 0) continue;
+                double c = cost(below, bounds.box, axis) + aboveCost[split];
+                if (c < bestCost) {
+                    bestCost = c;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+        if (bestAxis >= 0) {
+            double lo = centroids.min[bestAxis];
+            double hi = centroids.max[bestAxis];
+            int *split = std::partition(order.data() + begin, order.data() + end, [&](int light) {
+                double c = lights[light].bounds.box.center()[bestAxis];
+                return std::min(bucketCount - 1, int(bucketCount * (c - lo) / (hi - lo))) <= bestSplit;
+            });
+            mid = int(split - order.data());
+        }
+    }
+    if (mid <= begin || mid >= end) {
+        // Median split along the longest centroid axis
+        mid = (begin + end) / 2;
+        int axis = centroids.longestAxis();
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](int a, int b) {
+            return lights[a].bounds.box.center()[axis] < lights[b].bounds.box.center()[axis];
+        });
+    }
+
+    build(order, begin, mid, trail, depth + 1);
+    int second = build(order, mid, end, trail | (uint64_t(1) << depth), depth + 1);
+    leafOrInterior.offset = second;
+    leafOrInterior.leaf = 0;
+    nodes[node] = leafOrInterior;
+    return node;
+}
+
+inline int LightBVH::lightCount() const { return int(lights.size()); }
+inline const LightSource &LightBVH::light(int i) const { return lights[i]; }
+
+inline bool LightBVH::sample(const Vector3d &p, const Vector3d &n, double u, LightSampling mode, int &light, double &pmf) const {
+    if (lights.empty() || mode == LightSampling::None) return false;
+    if (mode == LightSampling::Uniform) {
+        light = std::min(int(u * lights.size()), int(lights.size()) - 1);
+        pmf = 1.0 / lights.size();
+        return true;
+    }
+    int i = 0;
+    pmf = 1;
+    while (!nodes[i].leaf) {
+        double importance0 = nodeBounds(nodes[i + 1]).importance(p, n);
+        double importance1 = nodeBounds(nodes[nodes[i].offset]).importance(p, n);
+        if (importance0 == 0 && importance1 == 0) return false;
+        double p0 = importance0 / (importance0 + importance1);
+        if (u < p0) {
+            i = i + 1;
+            u = fmin(u / p0, oneMinusEpsilon);
+            pmf *= p0;
+        } else {
+            i = nodes[i].offset;
+            u = fmin((u - p0) / (1 - p0), oneMinusEpsilon);
+            pmf *= 1 - p0;
+        }
+    }
+    // A single light is always taken, unless it can't contribute
+    if (i == 0 && nodeBounds(nodes[0]).importance(p, n) == 0) return false;
+    light = nodes[i].offset;
+    return true;
+}
+
+inline double LightBVH::pmf(const Vector3d &p, const Vector3d &n, int light, LightSampling mode) const {
+    if (lights.empty() || mode == LightSampling::None) return 0;
+    if (mode == LightSampling::Uniform) return 1.0 / lights.size();
+    uint64_t trail = trails[light];
+    int i = 0;
+    double pmf = 1;
+    while (!nodes[i].leaf) {
+        double importance0 = nodeBounds(nodes[i + 1]).importance(p, n);
+        double importance1 = nodeBounds(nodes[nodes[i].offset]).importance(p, n);
+        if (importance0 == 0 && importance1 == 0) return 0;
+        if (trail & 1) {
+            pmf *= importance1 / (importance0 + importance1);
+            i = nodes[i].offset;
+        } else {
+            pmf *= importance0 / (importance0 + importance1);
+            i = i + 1;
+        }
+        trail >>= 1;
+    }
+    if (i == 0 && nodeBounds(nodes[0]).importance(p, n) == 0) return 0;
+    return pmf;
+}
+
+inline bool LightBVH::samplePower(double u, int &light, double &pmf) const {
+    if (lights.empty() || powerCdf.back() <= 0) return false;
+    // Last entry with powerCdf <= u, skipping lights without power
+    light = int(std::upper_bound(powerCdf.begin(), powerCdf.end(), u) - powerCdf.begin()) - 1;
+    light = std::max(0, std::min(light, int(lights.size()) - 1));
+    pmf = powerPmf(light);
+    return pmf > 0;
+}
+
+inline double LightBVH::powerPmf(int light) const {
+    if (lights.empty()) return 0;
+    return powerCdf[light + 1] - powerCdf[light];
+}
+
+inline int LightBVH::find(const Hitable *primitive, int index) const {
+    auto found = lookup.find(std::make_pair(primitive, index));
+    return found == lookup.end() ? -1 : found->second;
+}
+
+inline size_t LightBVH::bytes() const {
+    return lights.capacity() * sizeof(LightSource) + nodes.capacity() * sizeof(LightBVHNode) +
+           trails.capacity() * sizeof(uint64_t) + powerCdf.capacity() * sizeof(double) + lookup.size() * (sizeof(std::pair<const Hitable *, int>) + sizeof(int) + 2 * sizeof(void *));
+}
+
+#endif
@@ -5,20 +5,43 @@
 #include "Vector3d.hpp"
 #include "Ray.hpp"
 #include "HitRecord.hpp"
+#include "Sampler.hpp"
 
 // Any Material should have the scatter() function that
 // saves attenuation and scattered ray based on input ray
 // (rayIn) and hitRecord (with hit point, normal, ray length
 // (t)). Returns true if ray was scattered.
+// All random decisions are drawn from the sampler, which is
+// positioned at the current bounce's dimensions. scatter()
+// must not draw more than 4 numbers.
+//
+/* Light sampling */
+// Paths can also reach lights by sampling them directly (next
+// event estimation) at vertices with a diffuse lobe. To weight
+// both strategies (multiple importance sampling) the integrator
+// needs to know, for the same direction, how likely each of them
+// was to produce it:
+// * scatter() returns the solid angle pdf of the direction it
+//   sampled in pdf, 0 for specular directions (mirror, glass)
+//   which light sampling can never produce.
+// * evaluate() returns attenuation * cos(Ø) / π, the BSDF times
+//   cosine, for a unit direction towards a light, and the pdf
+//   with which scatter() would have picked it.
+// * hasDiffuse() tells the integrator whether sampling lights at
+//   this material is worth a shadow ray.
 class Material {
 public:
+    virtual ~Material() {};
     // Pure virtual member function
-    virtual bool scatter(const Ray &rayIn, const HitRecord &hitRecord, Vector3d &attenuation, Ray &scattered) const = 0;
+    virtual bool scatter(const Ray &rayIn, const HitRecord &hitRecord, Sampler &sampler, Vector3d &attenuation, Ray &scattered, double &pdf) const = 0;
+    virtual Vector3d evaluate(const Ray &rayIn, const HitRecord &hitRecord, const Vector3d &direction, double &pdf) const;
+    virtual bool hasDiffuse() const;
     virtual Vector3d emitted() const;
     // The following functions will be called on const *this in
     // derived classes so they have to be either friends
     // or const members.
-    friend Vector3d randomInUnitSphere();
+    friend Vector3d randomInUnitSphere(Sampler &sampler);
+    friend Vector3d randomUnitVector(Sampler &sampler);
     friend Vector3d reflect(const Vector3d &v, const Vector3d &n);
     friend double schlick(double cosine, double refractionIndex);
     friend bool refract(const Vector3d &v, const Vector3d &n, double niOverNt, Vector3d &refracted);
@@ -32,14 +55,53 @@ inline Vector3d Material::emitted() const {
     return Vector3d(0, 0, 0);
 }
 
+// Specular materials: nothing to evaluate for light sampling.
+inline Vector3d Material::evaluate(const Ray &rayIn, const HitRecord &hitRecord, const Vector3d &direction, double &pdf) const {
+    pdf = 0;
+    return Vector3d(0, 0, 0);
+}
+
+inline bool Material::hasDiffuse() const {
+    return false;
+}
+
 /* Diffuse reflection */
 // Scattered light direction is random.
-inline Vector3d randomInUnitSphere() {
-    Vector3d p;
-    do {
-         p = 2.0 * Vector3d(drand48(), drand48(), drand48()) - Vector3d(1.0, 1.0, 1.0);
-    } while (p.squaredLength() >= 1.0);
-    return p;
+// Uniform point inside the unit sphere from 3 sampler dimensions:
+// a uniform direction (z = cos(Ø) uniform in [-1, 1], φ uniform
+// in [0, 2π)) scaled by a radius r = ∛u, since the volume inside
+// radius r grows with r^3.
+// Rejection sampling would consume an unbounded number of
+// dimensions and break the stratification of the sampler.
+inline Vector3d randomInUnitSphere(Sampler &sampler) {
+    Vector3d direction = sampler.get2D();
+    double radius = cbrt(sampler.get1D());
+    double z = 1 - 2 * direction.x();
+    double r = sqrt(fmax(0.0, 1 - z * z));
+    double phi = 2 * M_PI * direction.y();
+    return radius * Vector3d(r * cos(phi), r * sin(phi), z);
+}
+
+// Uniform point on the unit sphere from 2 sampler dimensions.
+// normal + randomUnitVector() is distributed exactly like
+// cos(Ø) / π around the normal (Lambert's cosine law), so a
+// diffuse scatter direction has the pdf cos(Ø) / π.
+inline Vector3d randomUnitVector(Sampler &sampler) {
+    Vector3d direction = sampler.get2D();
+    double z = 1 - 2 * direction.x();
+    double r = sqrt(fmax(0.0, 1 - z * z));
+    double phi = 2 * M_PI * direction.y();
+    return Vector3d(r * cos(phi), r * sin(phi), z);
+}
+
+// The direction of normal + randomUnitVector() and its pdf. The
+// sum can (very rarely) vanish, the normal is used then.
+inline Vector3d cosineDirection(const Vector3d &normal, Sampler &sampler, double &pdf) {
+    Vector3d direction = normal + randomUnitVector(sampler);
+    double length = direction.length();
+    direction = length > 1e-9 ? direction / length : normal;
+    pdf = fmax(0.0, dot(direction, normal)) / M_PI;
+    return direction;
 }
 
 /* Specular reflection */
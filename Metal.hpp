@@ -6,19 +6,26 @@
 #include "Ray.hpp"
 #include "HitRecord.hpp"
 #include "Material.hpp"
+#include "Texture.hpp"
 
 class Metal: public Material {
     Vector3d albedo;
     double fuzz;
+    const Texture *texture;
 public:
-    Metal(const Vector3d &albedo, double f): albedo(albedo), fuzz(f) {}
-    virtual bool scatter(const Ray &rayIn, const HitRecord &hitRecord, Vector3d &attenuation, Ray &scattered) const;
+    Metal(const Vector3d &albedo, double f, const Texture *texture = nullptr): albedo(albedo), fuzz(f), texture(texture) {}
+    virtual bool scatter(const Ray &rayIn, const HitRecord &hitRecord, Sampler &sampler, Vector3d &attenuation, Ray &scattered, double &pdf) const;
+    Vector3d getAlbedo() const { return albedo; }
+    double getFuzz() const { return fuzz; }
+    const Texture *getTexture() const { return texture; }
+    void setTexture(const Texture *t) { texture = t; }
 };
 
-inline bool Metal::scatter(const Ray &rayIn, const HitRecord &hitRecord, Vector3d &attenuation, Ray &scattered) const {
+inline bool Metal::scatter(const Ray &rayIn, const HitRecord &hitRecord, Sampler &sampler, Vector3d &attenuation, Ray &scattered, double &pdf) const {
     Vector3d reflected = reflect(unitVector(rayIn.direction()), hitRecord.normal); // `this->reflect`, `this` is const
-    scattered = Ray(hitRecord.p, reflected + fuzz * randomInUnitSphere());
-    attenuation = albedo;
+    scattered = Ray(hitRecord.p, reflected + fuzz * randomInUnitSphere(sampler));
+    attenuation = textureAlbedo(texture, albedo, hitRecord);
+    pdf = 0; // treated as specular, lights are not sampled
     return (dot(scattered.direction(), hitRecord.normal) > 0); // return true for Rays facing outwards (some Rays don't)
 }
 
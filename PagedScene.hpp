@@ -0,0 +1,759 @@
+#ifndef PagedScene_hpp
+#define PagedScene_hpp
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "Vector3d.hpp"
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+#include "Hitable.hpp"
+#include "Scene.hpp"
+#include "Sphere.hpp"
+#include "BVH.hpp"
+#include "SceneCache.hpp"
+
+/* Paged scene */
+// Renders a scene cache (see SceneCache.hpp) from a fixed amount of
+// memory, for scenes with more geometry than the machine has RAM.
+// Mapping the whole file would leave the residency to the kernel,
+// which counts mapped pages against the process and thrashes
+// without any notion of which geometry rays need next.
+//
+// * The cache stores the BVH depth first and the spheres in leaf
+//   order, so every subtree is a contiguous run of nodes plus a
+//   contiguous run of spheres in the file. The loader cuts the tree
+//   top down into the largest subtrees of at most chunkBytes, the
+//   chunks.
+// * The nodes above the chunks (the top tree) stay in memory, with
+//   a leaf per chunk. Lights and materials stay in memory too.
+// * Chunks are read with pread() into the slots of a GeometryPool,
+//   a single allocation of the memory budget. When the pool is
+//   full, the least recently used chunk (clock algorithm) is
+//   replaced.
+// * A ray first intersects the chunks that are resident and defers
+//   the missing ones. Afterwards only the deferred chunks that are
+//   still in front of its closest hit are loaded, nearest first: a
+//   hit in resident geometry often makes the load unnecessary, and
+//   a shadow ray is done at its first hit.
+// * closestHitsBatch() traces a batch of rays: rays that need a
+//   missing chunk are queued on it, then every queued chunk is
+//   loaded once for all of its rays. Renders batch only camera
+//   packets (--packets, through closestHits(packet)), every other
+//   ray defers chunks only within its own traversal.
+
+/* Chunks */
+// A subtree of the file's BVH: its nodes and spheres, and its root
+// node as stored in the file (the chunk's bounds).
+struct GeometryChunk {
+    uint64_t firstNode;
+    uint64_t nodeCount;
+    uint64_t firstSphere;
+    uint64_t sphereCount;
+    BVHNode root;
+};
+
+inline uint64_t chunkNodeBytes(const GeometryChunk &chunk) {
+    return alignSceneCacheOffset(chunk.nodeCount * sizeof(BVHNode));
+}
+
+inline uint64_t chunkBytes(const GeometryChunk &chunk) {
+    return chunkNodeBytes(chunk) + chunk.sphereCount * sizeof(CachedSphere);
+}
+
+inline bool readSceneCacheNode(int fd, const SceneCacheHeader &header, uint64_t index, BVHNode &node) {
+    return pread(fd, &node, sizeof(node), off_t(header.nodeOffset + index * sizeof(BVHNode))) == ssize_t(sizeof(node));
+}
+
+// Appends the subtree of the file node `node` to the top tree: a
+// leaf for a new chunk if it is a leaf or takes at most maxBytes,
+// else an interior node over its two halves. The subtree covers
+// the file nodes [node, nodeEnd) and spheres [sphereBegin,
+// sphereEnd). Only the nodes above the chunks are read. Returns
+// false if the file's tree is not laid out as expected.
+inline bool addPagedSubtree(int fd, const SceneCacheHeader &header, uint64_t maxBytes, uint64_t node, uint64_t nodeEnd,
+                            uint64_t sphereBegin, uint64_t sphereEnd, std::vector<BVHNode> &top, std::vector<GeometryChunk> &chunks) {
+    BVHNode file;
+    if (!readSceneCacheNode(fd, header, node, file)) return false;
+    size_t index = top.size();
+    top.push_back(file);
+    GeometryChunk chunk = { node, nodeEnd - node, sphereBegin, sphereEnd - sphereBegin, file };
+    if (file.count > 0 || chunkBytes(chunk) <= maxBytes) {
+        top[index].offset = int32_t(chunks.size());
+        top[index].count = 1;
+        top[index].axis = 0;
+        chunks.push_back(chunk);
+        return true;
+    }
+    uint64_t second = uint64_t(file.offset);
+    if (second <= node + 1 || second >= nodeEnd) return false;
+    // The second child's spheres start at its leftmost leaf
+    BVHNode leftmost;
+    uint64_t n = second;
+    do {
+        if (n >= nodeEnd || !readSceneCacheNode(fd, header, n++, leftmost)) return false;
+    } while (leftmost.count == 0);
+    uint64_t split = uint64_t(leftmost.offset);
+    if (split <= sphereBegin || split >= sphereEnd) return false;
+    if (!addPagedSubtree(fd, header, maxBytes, node + 1, second, sphereBegin, split, top, chunks)) return false;
+    top[index].offset = int32_t(top.size());
+    return addPagedSubtree(fd, header, maxBytes, second, nodeEnd, split, sphereEnd, top, chunks);
+}
+
+/* Geometry pool */
+// Fixed slots of memory that hold one chunk each.
+//
+// * pin() returns the slot of a chunk, loading it if needed, and
+//   keeps it there until unpin(). tryPin() only succeeds if the
+//   chunk is resident. A thread pins one chunk at a time.
+// * Pinning a resident chunk takes no lock: the slot's pin count
+//   goes up with a compare and swap (a count of -1 means the slot
+//   is being replaced), then the slot is checked to still hold the
+//   chunk.
+// * Loads take the pool's lock, so two threads never read the
+//   same chunk, and replace the first unpinned slot the clock hand
+//   finds without its referenced bit (set by every pin, cleared by
+//   the passing hand). If every slot is pinned the thread waits
+//   for one.
+// * Nodes are rebased to the chunk when loaded (child and sphere
+//   offsets relative to its first node and sphere), so
+//   traverseBVH() walks a slot as is. Spheres follow the nodes.
+class GeometryPool {
+public:
+    struct Statistics {
+        uint64_t loads;     // chunks read from the file (page faults)
+        uint64_t bytesRead;
+        uint64_t deferred;  // chunk visits deferred because it was missing
+        uint64_t culled;    // deferred visits a closer hit made unnecessary
+    };
+private:
+    struct Slot {
+        std::atomic<int> pins;
+        std::atomic<int> chunk; // -1: empty
+        std::atomic<bool> referenced;
+    };
+    int fd;
+    SceneCacheHeader header;
+    const std::vector<GeometryChunk> &chunks;
+    std::atomic<int> *chunkSlots; // per chunk, -1: not resident
+    Slot *slots;
+    int slotCount;
+    size_t slotBytes;
+    char *memory;
+    std::mutex mutex;
+    int clockHand;
+    std::atomic<uint64_t> loads;
+    std::atomic<uint64_t> bytesRead;
+    std::atomic<uint64_t> deferred;
+    std::atomic<uint64_t> culled;
+    int findVictim();
+    void load(int chunk, int slot);
+    GeometryPool(const GeometryPool &) = delete;
+    GeometryPool &operator=(const GeometryPool &) = delete;
+public:
+    // Takes over fd. At least one slot, even if budgetBytes is
+    // smaller than the largest chunk.
+    GeometryPool(int fd, const SceneCacheHeader &header, const std::vector<GeometryChunk> &chunks, size_t budgetBytes);
+    ~GeometryPool();
+    int tryPin(int chunk);
+    int pin(int chunk);
+    void unpin(int slot);
+    const BVHNode *nodes(int slot) const;
+    const CachedSphere *spheres(int slot, int chunk) const;
+    void countDeferred(uint64_t visits, uint64_t culledVisits);
+    int getSlotCount() const;
+    size_t getSlotBytes() const;
+    size_t bytes() const;
+    Statistics statistics() const;
+};
+
+inline GeometryPool::GeometryPool(int fd, const SceneCacheHeader &header, const std::vector<GeometryChunk> &chunks, size_t budgetBytes):
+    fd(fd), header(header), chunks(chunks), clockHand(0), loads(0), bytesRead(0), deferred(0), culled(0) {
+    slotBytes = 0;
+    for (const GeometryChunk &chunk : chunks) slotBytes = std::max(slotBytes, size_t(chunkBytes(chunk)));
+    slotCount = int(std::max(size_t(1), std::min(budgetBytes / slotBytes, chunks.size())));
+    memory = new char[size_t(slotCount) * slotBytes];
+    slots = new Slot[slotCount];
+    for (int i = 0; i < slotCount; i++) {
+        slots[i].pins = 0;
+        slots[i].chunk = -1;
+        slots[i].referenced = false;
+    }
+    chunkSlots = new std::atomic<int>[chunks.size()];
+    for (size_t i = 0; i < chunks.size(); i++) chunkSlots[i] = -1;
+}
+
+inline GeometryPool::~GeometryPool() {
+    delete[] chunkSlots;
+    delete[] slots;
+    delete[] memory;
+    close(fd);
+}
+
+inline int GeometryPool::tryPin(int chunk) {
+    int slot = chunkSlots[chunk].load();
+    if (slot < 0) return -1;
+    Slot &s = slots[slot];
+    int pins = s.pins.load();
+    do {
+        if (pins < 0) return -1;
+    } while (!s.pins.compare_exchange_weak(pins, pins + 1));
+    // The slot may have been given to another chunk since
+    // chunkSlots was read
+    if (s.chunk.load() != chunk) {
+        s.pins--;
+        return -1;
+    }
+    s.referenced.store(true, std::memory_order_relaxed);
+    return slot;
+}
+
+inline int GeometryPool::pin(int chunk) {
+    int slot = tryPin(chunk);
+    if (slot >= 0) return slot;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot = tryPin(chunk); // loaded by another thread meanwhile
+            if (slot >= 0) return slot;
+            slot = findVictim();
+            if (slot >= 0) {
+                load(chunk, slot);
+                return slot;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+inline void GeometryPool::unpin(int slot) {
+    slots[slot].pins--;
+}
+
+// Called with the lock held. Returns a slot whose pin count is now
+// -1, or -1 if every slot is pinned.
+inline int GeometryPool::findVictim() {
+    for (int step = 0; step < 2 * slotCount; step++) {
+        int candidate = clockHand;
+        clockHand = (clockHand + 1) % slotCount;
+        Slot &s = slots[candidate];
+        if (s.pins.load() != 0) continue;
+        if (s.referenced.exchange(false)) continue;
+        int unpinned = 0;
+        if (s.pins.compare_exchange_strong(unpinned, -1)) return candidate;
+    }
+    return -1;
+}
+
+// Called with the lock held, on a slot from findVictim(). Leaves
+// the chunk pinned once for the caller. A chunk that can not be
+// read is replaced by an empty tree (and reported).
+inline void GeometryPool::load(int chunk, int slot) {
+    Slot &s = slots[slot];
+    int previous = s.chunk.load();
+    if (previous >= 0) chunkSlots[previous] = -1;
+    s.chunk = -1;
+    const GeometryChunk &c = chunks[chunk];
+    char *base = memory + size_t(slot) * slotBytes;
+    BVHNode *nodes = reinterpret_cast<BVHNode *>(base);
+    size_t nodeBytes = c.nodeCount * sizeof(BVHNode);
+    size_t sphereBytes = c.sphereCount * sizeof(CachedSphere);
+    bool ok = pread(fd, base, nodeBytes, off_t(header.nodeOffset + c.firstNode * sizeof(BVHNode))) == ssize_t(nodeBytes) &&
+              pread(fd, base + chunkNodeBytes(c), sphereBytes, off_t(header.sphereOffset + c.firstSphere * sizeof(CachedSphere))) == ssize_t(sphereBytes);
+    if (ok) {
+        for (uint64_t i = 0; i < c.nodeCount; i++) {
+            nodes[i].offset -= int32_t(nodes[i].count > 0 ? c.firstSphere : c.firstNode);
+        }
+    } else {
+        std::cout << "ERROR: reading geometry chunk " << chunk << " failed." << std::endl;
+        nodes[0] = BVHNode{ { INFINITY, INFINITY, INFINITY }, 0, { -INFINITY, -INFINITY, -INFINITY }, 0, 0 };
+    }
+    loads++;
+    bytesRead += nodeBytes + sphereBytes;
+    s.chunk = chunk;
+    s.referenced = true;
+    s.pins = 1;
+    chunkSlots[chunk] = slot;
+}
+
+inline const BVHNode *GeometryPool::nodes(int slot) const {
+    return reinterpret_cast<const BVHNode *>(memory + size_t(slot) * slotBytes);
+}
+
+inline const CachedSphere *GeometryPool::spheres(int slot, int chunk) const {
+    return reinterpret_cast<const CachedSphere *>(memory + size_t(slot) * slotBytes + chunkNodeBytes(chunks[chunk]));
+}
+
+inline void GeometryPool::countDeferred(uint64_t visits, uint64_t culledVisits) {
+    if (visits > 0) deferred += visits;
+    if (culledVisits > 0) culled += culledVisits;
+}
+
+inline int GeometryPool::getSlotCount() const { return slotCount; }
+inline size_t GeometryPool::getSlotBytes() const { return slotBytes; }
+
+inline size_t GeometryPool::bytes() const {
+    return size_t(slotCount) * (slotBytes + sizeof(Slot)) + chunks.size() * sizeof(std::atomic<int>);
+}
+
+inline GeometryPool::Statistics GeometryPool::statistics() const {
+    return Statistics{ loads, bytesRead, deferred, culled };
+}
+
+/* Paged spheres */
+// The root of a paged scene: the top tree over the chunks, the
+// pool and the resident lights. Same primitives and indices (the
+// sphere's position in the file) as MappedSphereBVH, so both
+// render the same image.
+//
+// surface() needs the sphere the closest hit found, whose chunk may
+// be gone by then: closestHit() keeps a copy of its last hit per
+// thread, and only if that is not the one asked for the chunk is
+// pinned again.
+class PagedSphereBVH: public Hitable {
+    static const int maxDeferred = 64;
+    struct LastHit {
+        const PagedSphereBVH *owner;
+        int index;
+        CachedSphere sphere;
+    };
+    std::vector<BVHNode> top;
+    std::vector<GeometryChunk> chunks;
+    GeometryPool *pool;
+    std::vector<Material *> materials;
+    std::vector<std::pair<int, CachedSphere>> lightSpheres; // by index
+    static LastHit &lastHit();
+    Material *sphereMaterial(const CachedSphere &s) const;
+    const CachedSphere &lightSphere(int index) const;
+    bool closestHitInChunk(int chunk, int slot, const Ray &ray, double tMin, double &tMax, PrimitiveHit &hit) const;
+    bool occludedInChunk(int chunk, int slot, const Ray &ray, double tMin, double tMax) const;
+    int sortDeferred(const Ray &ray, double tMin, double tMax, const int *deferred, int count, std::pair<double, int> *entries) const;
+    PagedSphereBVH(const PagedSphereBVH &) = delete;
+    PagedSphereBVH &operator=(const PagedSphereBVH &) = delete;
+public:
+    PagedSphereBVH(int fd, const SceneCacheHeader &header, std::vector<BVHNode> &top, std::vector<GeometryChunk> &chunks,
+                   const std::vector<Material *> &materials, std::vector<std::pair<int, CachedSphere>> &lightSpheres, size_t budgetBytes);
+    virtual ~PagedSphereBVH();
+    virtual bool closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const;
+    virtual bool occluded(const Ray &ray, double tMin, double tMax) const;
+    virtual void surface(const Ray &ray, const PrimitiveHit &hit, HitRecord &hitRecord) const;
+    virtual bool boundingBox(AABB &box) const;
+    virtual void collectLights(std::vector<LightSource> &lights) const;
+    virtual bool sampleLight(int index, const Vector3d &from, const Vector3d &u, LightSample &sample) const;
+    virtual double lightPdf(int index, const Vector3d &from, const Vector3d &p) const;
+    virtual bool sampleEmission(int index, const Vector3d &uPosition, const Vector3d &uDirection, EmissionSample &sample) const;
+    virtual void emissionPdf(int index, const Vector3d &p, const Vector3d &normal, const Vector3d &direction,
+                             double &pdfPosition, double &pdfDirection) const;
+    // Traces the packet with closestHitsBatch()
+    virtual void closestHits(RayPacket &packet, double tMin) const;
+    // Closest hits of count rays, ray i within tMin and tMax[i]
+    // (found[i] tells if hits[i] is one)
+    void closestHitsBatch(const Ray *rays, int count, double tMin, const double *tMax, PrimitiveHit *hits, bool *found) const;
+    int chunkCount() const;
+    GeometryPool &geometryPool() const;
+    // Resident bytes: top tree, chunk table, pool and lights
+    size_t bytes() const;
+};
+
+inline PagedSphereBVH::PagedSphereBVH(int fd, const SceneCacheHeader &header, std::vector<BVHNode> &top, std::vector<GeometryChunk> &chunks,
+                                      const std::vector<Material *> &materials, std::vector<std::pair<int, CachedSphere>> &lightSpheres,
+                                      size_t budgetBytes): materials(materials) {
+    this->top.swap(top);
+    this->chunks.swap(chunks);
+    this->lightSpheres.swap(lightSpheres);
+    pool = new GeometryPool(fd, header, this->chunks, budgetBytes);
+}
+
+inline PagedSphereBVH::~PagedSphereBVH() {
+    delete pool;
+}
+
+inline PagedSphereBVH::LastHit &PagedSphereBVH::lastHit() {
+    static thread_local LastHit last = { nullptr, -1, {} };
+    return last;
+}
+
+inline Material *PagedSphereBVH::sphereMaterial(const CachedSphere &s) const {
+    return materials[s.material < materials.size() ? s.material : 0];
+}
+
+inline const CachedSphere &PagedSphereBVH::lightSphere(int index) const {
+    auto found = std::lower_bound(lightSpheres.begin(), lightSpheres.end(), index,
+                                  [](const std::pair<int, CachedSphere> &light, int i) { return light.first < i; });
+    return found->second;
+}
+
+inline bool PagedSphereBVH::closestHitInChunk(int chunk, int slot, const Ray &ray, double tMin, double &tMax, PrimitiveHit &hit) const {
+    const CachedSphere *list = pool->spheres(slot, chunk);
+    const int firstSphere = int(chunks[chunk].firstSphere);
+    LastHit &last = lastHit();
+    bool hitAnything = traverseBVH(pool->nodes(slot), ray, tMin, tMax, false, [&](int first, int count, double &closestSoFar) {
+        bool found = false;
+        for (int i = first; i < first + count; i++) {
+            const CachedSphere &s = list[i];
+            double t;
+            if (intersectSphere(Vector3d(s.center[0], s.center[1], s.center[2]), s.radius, ray, tMin, closestSoFar, t)) {
+                found = true;
+                closestSoFar = t;
+                hit.t = t;
+                hit.primitive = this;
+                hit.index = firstSphere + i;
+                last = LastHit{ this, firstSphere + i, s };
+            }
+        }
+        return found;
+    });
+    if (hitAnything) tMax = hit.t;
+    return hitAnything;
+}
+
+inline bool PagedSphereBVH::occludedInChunk(int chunk, int slot, const Ray &ray, double tMin, double tMax) const {
+    const CachedSphere *list = pool->spheres(slot, chunk);
+    return traverseBVH(pool->nodes(slot), ray, tMin, tMax, true, [&](int first, int count, double &closestSoFar) {
+        for (int i = first; i < first + count; i++) {
+            const CachedSphere &s = list[i];
+            double t;
+            if (intersectSphere(Vector3d(s.center[0], s.center[1], s.center[2]), s.radius, ray, tMin, closestSoFar, t)) return true;
+        }
+        return false;
+    });
+}
+
+// The deferred chunks the ray still enters before tMax, as (entry
+// t, chunk) nearest first. Returns their number.
+inline int PagedSphereBVH::sortDeferred(const Ray &ray, double tMin, double tMax, const int *deferred, int count,
+                                        std::pair<double, int> *entries) const {
+    Vector3d direction = ray.direction();
+    double origin[3] = { ray.origin().x(), ray.origin().y(), ray.origin().z() };
+    double invDirection[3] = { 1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z() };
+    int entryCount = 0;
+    for (int i = 0; i < count; i++) {
+        double tEntry;
+        if (hitNode(chunks[deferred[i]].root, origin, invDirection, tMin, tMax, tEntry)) entries[entryCount++] = std::make_pair(tEntry, deferred[i]);
+    }
+    std::sort(entries, entries + entryCount);
+    return entryCount;
+}
+
+inline bool PagedSphereBVH::closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const {
+    int deferred[maxDeferred];
+    int deferredCount = 0;
+    double closest = tMax;
+    bool hitAnything = traverseBVH(top.data(), ray, tMin, tMax, false, [&](int chunk, int count, double &closestSoFar) {
+        int slot = pool->tryPin(chunk);
+        if (slot < 0) {
+            if (deferredCount < maxDeferred) {
+                deferred[deferredCount++] = chunk;
+                return false;
+            }
+            slot = pool->pin(chunk);
+        }
+        bool found = closestHitInChunk(chunk, slot, ray, tMin, closestSoFar, hit);
+        pool->unpin(slot);
+        if (found) closest = closestSoFar;
+        return found;
+    });
+    if (deferredCount == 0) return hitAnything;
+    // The missing chunks in front of the closest hit, nearest first.
+    // A hit in one can still make the ones behind it unnecessary.
+    std::pair<double, int> entries[maxDeferred];
+    int entryCount = sortDeferred(ray, tMin, closest, deferred, deferredCount, entries);
+    int loaded = 0;
+    for (int i = 0; i < entryCount && entries[i].first <= closest; i++) {
+        int chunk = entries[i].second;
+        int slot = pool->pin(chunk);
+        if (closestHitInChunk(chunk, slot, ray, tMin, closest, hit)) hitAnything = true;
+        pool->unpin(slot);
+        loaded++;
+    }
+    pool->countDeferred(deferredCount, deferredCount - loaded);
+    return hitAnything;
+}
+
+inline bool PagedSphereBVH::occluded(const Ray &ray, double tMin, double tMax) const {
+    int deferred[maxDeferred];
+    int deferredCount = 0;
+    bool blocked = traverseBVH(top.data(), ray, tMin, tMax, true, [&](int chunk, int count, double &closestSoFar) {
+        int slot = pool->tryPin(chunk);
+        if (slot < 0) {
+            if (deferredCount < maxDeferred) {
+                deferred[deferredCount++] = chunk;
+                return false;
+            }
+            slot = pool->pin(chunk);
+        }
+        bool found = occludedInChunk(chunk, slot, ray, tMin, closestSoFar);
+        pool->unpin(slot);
+        return found;
+    });
+    if (blocked || deferredCount == 0) {
+        pool->countDeferred(deferredCount, deferredCount);
+        return blocked;
+    }
+    std::pair<double, int> entries[maxDeferred];
+    int entryCount = sortDeferred(ray, tMin, tMax, deferred, deferredCount, entries);
+    int loaded = 0;
+    for (int i = 0; i < entryCount && !blocked; i++) {
+        int chunk = entries[i].second;
+        int slot = pool->pin(chunk);
+        blocked = occludedInChunk(chunk, slot, ray, tMin, tMax);
+        pool->unpin(slot);
+        loaded++;
+    }
+    pool->countDeferred(deferredCount, deferredCount - loaded);
+    return blocked;
+}
+
+// First with the resident chunks, deferring the missing ones as
+// (ray, chunk, entry t). Then in rounds: every ray nominates the
+// nearest of its deferred chunks that is still in front of its
+// closest hit, and every nominated chunk is loaded once and
+// intersected with all the rays that deferred it. Nearest first
+// keeps the culling of closestHit(), one load per chunk and round
+// instead of one per ray.
+inline void PagedSphereBVH::closestHitsBatch(const Ray *rays, int count, double tMin, const double *tMax, PrimitiveHit *hits,
+                                             bool *found) const {
+    struct Deferred {
+        int ray;
+        int chunk;
+        double tEntry;
+        bool done;
+    };
+    std::vector<Deferred> deferred;
+    for (int r = 0; r < count; r++) {
+        const Ray &ray = rays[r];
+        found[r] = traverseBVH(top.data(), ray, tMin, tMax[r], false, [&](int chunk, int n, double &closestSoFar) {
+            int slot = pool->tryPin(chunk);
+            if (slot < 0) {
+                deferred.push_back(Deferred{ r, chunk, 0, false });
+                return false;
+            }
+            bool hit = closestHitInChunk(chunk, slot, ray, tMin, closestSoFar, hits[r]);
+            pool->unpin(slot);
+            return hit;
+        });
+    }
+    if (deferred.empty()) return;
+    auto enters = [&](const Deferred &d, double &tEntry) {
+        const Ray &ray = rays[d.ray];
+        double origin[3] = { ray.origin().x(), ray.origin().y(), ray.origin().z() };
+        double invDirection[3] = { 1.0 / ray.direction().x(), 1.0 / ray.direction().y(), 1.0 / ray.direction().z() };
+        return hitNode(chunks[d.chunk].root, origin, invDirection, tMin, found[d.ray] ? hits[d.ray].t : tMax[d.ray], tEntry);
+    };
+    for (Deferred &d : deferred) enters(d, d.tEntry);
+    // By ray and distance for the nominations, by chunk for the loads
+    std::sort(deferred.begin(), deferred.end(), [](const Deferred &a, const Deferred &b) {
+        return a.ray != b.ray ? a.ray < b.ray : a.tEntry < b.tEntry;
+    });
+    std::vector<int> byChunk(deferred.size());
+    for (size_t i = 0; i < byChunk.size(); i++) byChunk[i] = int(i);
+    std::sort(byChunk.begin(), byChunk.end(), [&](int a, int b) { return deferred[a].chunk < deferred[b].chunk; });
+    // Per ray with deferred chunks: its next one and the end of its
+    // run
+    std::vector<std::pair<size_t, size_t>> cursors;
+    for (size_t i = 0; i < deferred.size(); i++) {
+        if (i == 0 || deferred[i].ray != deferred[i - 1].ray) cursors.push_back(std::make_pair(i, i));
+        cursors.back().second = i + 1;
+    }
+    std::vector<int> nominated;
+    size_t visits = 0;
+    while (true) {
+        nominated.clear();
+        size_t active = 0;
+        for (std::pair<size_t, size_t> &cursor : cursors) {
+            size_t &i = cursor.first;
+            double tEntry;
+            // Skip what is done or now behind the closest hit
+            while (i < cursor.second && (deferred[i].done || !enters(deferred[i], tEntry))) deferred[i++].done = true;
+            if (i == cursor.second) continue;
+            nominated.push_back(deferred[i].chunk);
+            cursors[active++] = cursor;
+        }
+        cursors.resize(active);
+        if (nominated.empty()) break;
+        std::sort(nominated.begin(), nominated.end());
+        nominated.erase(std::unique(nominated.begin(), nominated.end()), nominated.end());
+        size_t next = 0;
+        for (int chunk : nominated) {
+            while (deferred[byChunk[next]].chunk < chunk) next++;
+            int slot = pool->pin(chunk);
+            for (; next < byChunk.size() && deferred[byChunk[next]].chunk == chunk; next++) {
+                Deferred &d = deferred[byChunk[next]];
+                double tEntry;
+                if (d.done || !enters(d, tEntry)) continue;
+                d.done = true;
+                double closest = found[d.ray] ? hits[d.ray].t : tMax[d.ray];
+                if (closestHitInChunk(chunk, slot, rays[d.ray], tMin, closest, hits[d.ray])) found[d.ray] = true;
+                visits++;
+            }
+            pool->unpin(slot);
+        }
+    }
+    pool->countDeferred(deferred.size(), deferred.size() - visits);
+}
+
+inline void PagedSphereBVH::closestHits(RayPacket &packet, double tMin) const {
+    PrimitiveHit hits[RayPacket::maxSize];
+    bool found[RayPacket::maxSize];
+    closestHitsBatch(packet.rays, packet.size, tMin, packet.tMax, hits, found);
+    for (int i = 0; i < packet.size; i++) {
+        if (!found[i]) continue;
+        packet.hits[i] = hits[i];
+        packet.tMax[i] = hits[i].t;
+        packet.found[i] = true;
+    }
+}
+
+inline void PagedSphereBVH::surface(const Ray &ray, const PrimitiveHit &hit, HitRecord &hitRecord) const {
+    CachedSphere s;
+    const LastHit &last = lastHit();
+    if (last.owner == this && last.index == hit.index) {
+        s = last.sphere;
+    } else {
+        // The chunk whose spheres start at or before the index
+        auto next = std::upper_bound(chunks.begin(), chunks.end(), uint64_t(hit.index),
+                                     [](uint64_t index, const GeometryChunk &chunk) { return index < chunk.firstSphere; });
+        int chunk = int(next - chunks.begin()) - 1;
+        int slot = pool->pin(chunk);
+        s = pool->spheres(slot, chunk)[uint64_t(hit.index) - chunks[chunk].firstSphere];
+        pool->unpin(slot);
+    }
+    Vector3d center(s.center[0], s.center[1], s.center[2]);
+    hitRecord.t = hit.t;
+    hitRecord.p = ray.pointAtParameter(hit.t);
+    hitRecord.normal = (hitRecord.p - center) / s.radius;
+    hitRecord.material = sphereMaterial(s);
+    sphereTextureCoordinates(hitRecord.normal, s.radius, hitRecord);
+}
+
+inline bool PagedSphereBVH::boundingBox(AABB &box) const {
+    const BVHNode &root = top[0];
+    box = AABB(Vector3d(root.min[0], root.min[1], root.min[2]), Vector3d(root.max[0], root.max[1], root.max[2]));
+    return true;
+}
+
+inline void PagedSphereBVH::collectLights(std::vector<LightSource> &lights) const {
+    for (const std::pair<int, CachedSphere> &light : lightSpheres) {
+        const CachedSphere &s = light.second;
+        LightSource source;
+        source.primitive = this;
+        source.index = light.first;
+        source.bounds = sphereLightBounds(Vector3d(s.center[0], s.center[1], s.center[2]), s.radius, sphereMaterial(s)->emitted());
+        lights.push_back(source);
+    }
+}
+
+inline bool PagedSphereBVH::sampleLight(int index, const Vector3d &from, const Vector3d &u, LightSample &sample) const {
+    const CachedSphere &s = lightSphere(index);
+    if (!sampleSphereLight(Vector3d(s.center[0], s.center[1], s.center[2]), s.radius, from, u, sample)) return false;
+    sample.radiance = sphereMaterial(s)->emitted();
+    return true;
+}
+
+inline double PagedSphereBVH::lightPdf(int index, const Vector3d &from, const Vector3d &p) const {
+    const CachedSphere &s = lightSphere(index);
+    return sphereLightPdf(Vector3d(s.center[0], s.center[1], s.center[2]), s.radius, from, p);
+}
+
+inline bool PagedSphereBVH::sampleEmission(int index, const Vector3d &uPosition, const Vector3d &uDirection, EmissionSample &sample) const {
+    const CachedSphere &s = lightSphere(index);
+    if (!sampleSphereEmission(Vector3d(s.center[0], s.center[1], s.center[2]), s.radius, uPosition, uDirection, sample)) return false;
+    sample.radiance = sphereMaterial(s)->emitted();
+    return true;
+}
+
+inline void PagedSphereBVH::emissionPdf(int index, const Vector3d &p, const Vector3d &normal, const Vector3d &direction,
+                                        double &pdfPosition, double &pdfDirection) const {
+    sphereEmissionPdf(lightSphere(index).radius, normal, direction, pdfPosition, pdfDirection);
+}
+
+inline int PagedSphereBVH::chunkCount() const { return int(chunks.size()); }
+inline GeometryPool &PagedSphereBVH::geometryPool() const { return *pool; }
+
+inline size_t PagedSphereBVH::bytes() const {
+    return top.capacity() * sizeof(BVHNode) + chunks.capacity() * sizeof(GeometryChunk) + pool->bytes() +
+           lightSpheres.capacity() * sizeof(std::pair<int, CachedSphere>);
+}
+
+/* Loading */
+// Opens the cache at path for paging and returns a scene that is
+// ready to render, or nullptr after printing why. Reads the header,
+// the materials and the top of the tree, and scans the spheres
+// once (sequentially, a block at a time) for lights. Chunks take at
+// most maxChunkBytes (or a single leaf), the pool budgetBytes.
+inline Scene *loadPagedSceneCache(const std::string &path, size_t budgetBytes, size_t maxChunkBytes = size_t(64) << 10) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cout << "ERROR: can not open scene cache " << path << "." << std::endl;
+        return nullptr;
+    }
+    struct stat status;
+    SceneCacheHeader header;
+    const char *problem = nullptr;
+    if (fstat(fd, &status) != 0 || pread(fd, &header, sizeof(header), 0) != ssize_t(sizeof(header))) problem = "is not a scene cache";
+    else problem = sceneCacheHeaderProblem(header, size_t(status.st_size));
+    if (!problem && header.sphereCount == 0) problem = "has no spheres to page";
+    if (problem) {
+        std::cout << "ERROR: " << path << " " << problem << "." << std::endl;
+        close(fd);
+        return nullptr;
+    }
+
+    std::vector<CachedMaterial> cachedMaterials(header.materialCount);
+    size_t materialBytes = cachedMaterials.size() * sizeof(CachedMaterial);
+    std::vector<BVHNode> top;
+    std::vector<GeometryChunk> chunks;
+    if (pread(fd, cachedMaterials.data(), materialBytes, off_t(header.materialOffset)) != ssize_t(materialBytes) ||
+        !addPagedSubtree(fd, header, maxChunkBytes, 0, header.nodeCount, 0, header.sphereCount, top, chunks)) {
+        std::cout << "ERROR: " << path << " has a broken BVH." << std::endl;
+        close(fd);
+        return nullptr;
+    }
+    Scene *scene = new Scene();
+    std::vector<Material *> materials(header.materialCount);
+    for (size_t i = 0; i < materials.size(); i++) {
+        materials[i] = unpackMaterial(cachedMaterials[i]);
+        if (!materials[i]) {
+            std::cout << "ERROR: " << path << " has an unknown material type." << std::endl;
+            close(fd);
+            delete scene;
+            return nullptr;
+        }
+        scene->addMaterial(materials[i]);
+    }
+
+    std::vector<std::pair<int, CachedSphere>> lightSpheres;
+    std::vector<CachedSphere> block(65536);
+    for (uint64_t first = 0; first < header.sphereCount; first += block.size()) {
+        size_t count = size_t(std::min(uint64_t(block.size()), header.sphereCount - first));
+        size_t bytes = count * sizeof(CachedSphere);
+        if (pread(fd, block.data(), bytes, off_t(header.sphereOffset + first * sizeof(CachedSphere))) != ssize_t(bytes)) {
+            std::cout << "ERROR: reading the spheres of " << path << " failed." << std::endl;
+            close(fd);
+            delete scene;
+            return nullptr;
+        }
+        for (size_t i = 0; i < count; i++) {
+            const CachedSphere &s = block[i];
+            Vector3d radiance = materials[s.material < materials.size() ? s.material : 0]->emitted();
+            if (radiance.x() > 0 || radiance.y() > 0 || radiance.z() > 0) lightSpheres.push_back(std::make_pair(int(first + i), s));
+        }
+    }
+
+    scene->view = sceneCacheView(header);
+    PagedSphereBVH *root = new PagedSphereBVH(fd, header, top, chunks, materials, lightSpheres, budgetBytes);
+    scene->adoptRoot(root, header.sphereCount, root->bytes());
+    return scene;
+}
+
+#endif
@@ -0,0 +1,416 @@
+#ifndef PathGuiding_hpp
+#define PathGuiding_hpp
+
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+#include <math.h>
+#include "Vector3d.hpp"
+#include "AABB.hpp"
+#include "Sampler.hpp"
+#include "AtomicFloat.hpp"
+
+/* Path guiding */
+// Learns where light arrives from while rendering and samples bounce
+// directions towards it (Müller et al., "Practical Path Guiding for
+// Efficient Light-Transport Simulation", an SD-tree):
+//
+// * A binary tree over space (leaves split their box in half along
+//   x, y, z in turn) holds two directional quadtrees per leaf: the
+//   "building" one paths record incident radiance into and the
+//   "sampling" one learned by the previous iteration that guides
+//   them.
+// * Training runs in iterations of 1, 2, 4, ... passes. After each
+//   iteration leaves that got many records split, every building
+//   quadtree becomes the sampling one and a new building quadtree
+//   is refined where the energy was.
+// * Paths record with atomic adds. The trees only change between
+//   passes, when no path is traced, so lookups need no locks.
+// * Memory is bounded: leaves stop splitting once the field holds
+//   maxBytes, a quadtree node only splits while it holds more than
+//   energyThreshold of its tree's energy (at most
+//   4 * maxDirectionalDepth / energyThreshold nodes per tree), a
+//   threshold that doubles while the new quadtrees don't fit.
+//
+// The first pass only learns the box around the diffuse points
+// camera rays hit (spheres of 10000 for walls make the scene's box
+// useless); the tree starts as one cell over it. Points outside it
+// fall into the nearest leaf.
+
+/* Direction map */
+// (cos(θ), φ) of a unit direction scaled to the unit square. The map
+// preserves area: a pdf over the square is 4π times the pdf over
+// solid angle.
+inline Vector3d squareToDirection(double x, double y) {
+    double cosTheta = 2 * x - 1;
+    double sinTheta = sqrt(fmax(0.0, 1 - cosTheta * cosTheta));
+    double phi = 2 * M_PI * y;
+    return Vector3d(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+}
+
+inline void directionToSquare(const Vector3d &direction, double &x, double &y) {
+    x = fmin(fmax(0.5 * (direction.z() + 1), 0.0), 1.0);
+    double phi = atan2(direction.y(), direction.x());
+    if (phi < 0) phi += 2 * M_PI;
+    y = fmin(fmax(phi / (2 * M_PI), 0.0), 1.0);
+}
+
+/* Directional quadtree */
+// Every node covers a square of the direction map and holds the
+// energy recorded in each of its quadrants (0: low x and y, 1: high
+// x, 2: high y, 3: both high) and, where it is split, the child
+// covering it. Records add to every node on their way down, so
+// sampling walks down picking quadrants by their share.
+struct QuadNode {
+    std::atomic<float> sum[4];
+    uint32_t child[4]; // 0: not split (the root is no one's child)
+    QuadNode();
+    QuadNode(const QuadNode &other);
+    QuadNode &operator=(const QuadNode &other);
+};
+
+inline QuadNode::QuadNode() {
+    for (int q = 0; q < 4; q++) {
+        sum[q].store(0, std::memory_order_relaxed);
+        child[q] = 0;
+    }
+}
+
+inline QuadNode::QuadNode(const QuadNode &other) { *this = other; }
+
+inline QuadNode &QuadNode::operator=(const QuadNode &other) {
+    for (int q = 0; q < 4; q++) {
+        sum[q].store(other.sum[q].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        child[q] = other.child[q];
+    }
+    return *this;
+}
+
+class DirectionalTree {
+    std::vector<QuadNode> nodes;
+    std::atomic<uint32_t> records;
+    void split(const DirectionalTree &from, uint32_t node, int fromNode, double fraction, double total, double threshold,
+               int depth, int maxDepth);
+public:
+    DirectionalTree();
+    DirectionalTree(const DirectionalTree &other);
+    DirectionalTree &operator=(const DirectionalTree &other);
+    // Thread safe: radiance arriving from a unit direction, divided
+    // by the pdf it was sampled with
+    void record(const Vector3d &direction, float radiance);
+    uint32_t recordCount() const;
+    void setRecordCount(uint32_t count);
+    double energy() const;
+    // A unit direction from u in [0, 1)^2, pdf per solid angle
+    Vector3d sample(const Vector3d &u, double &pdf) const;
+    double pdf(const Vector3d &direction) const;
+    // Restructures this tree after the energy recorded in `from`,
+    // with no records
+    void rebuild(const DirectionalTree &from, double threshold, int maxDepth);
+    size_t bytes() const;
+};
+
+inline DirectionalTree::DirectionalTree(): nodes(1), records(0) {}
+
+inline DirectionalTree::DirectionalTree(const DirectionalTree &other): nodes(other.nodes), records(other.recordCount()) {}
+
+inline DirectionalTree &DirectionalTree::operator=(const DirectionalTree &other) {
+    nodes = other.nodes;
+    setRecordCount(other.recordCount());
+    return *this;
+}
+
+inline uint32_t DirectionalTree::recordCount() const { return records.load(std::memory_order_relaxed); }
+inline void DirectionalTree::setRecordCount(uint32_t count) { records.store(count, std::memory_order_relaxed); }
+inline size_t DirectionalTree::bytes() const { return sizeof(DirectionalTree) + nodes.capacity() * sizeof(QuadNode); }
+
+inline double DirectionalTree::energy() const {
+    const QuadNode &root = nodes[0];
+    double total = 0;
+    for (int q = 0; q < 4; q++) total += root.sum[q].load(std::memory_order_relaxed);
+    return total;
+}
+
+inline void DirectionalTree::record(const Vector3d &direction, float radiance) {
+    records.fetch_add(1, std::memory_order_relaxed);
+    if (!(radiance > 0) || std::isinf(radiance)) return;
+    double x, y;
+    directionToSquare(direction, x, y);
+    uint32_t node = 0;
+    while (true) {
+        int qx = x >= 0.5;
+        int qy = y >= 0.5;
+        int q = qx + 2 * qy;
+        atomicAdd(nodes[node].sum[q], radiance);
+        if (!nodes[node].child[q]) return;
+        node = nodes[node].child[q];
+        x = 2 * x - qx;
+        y = 2 * y - qy;
+    }
+}
+
+inline Vector3d DirectionalTree::sample(const Vector3d &u, double &pdf) const {
+    double ux = fmin(u.x(), oneMinusEpsilon);
+    double uy = fmin(u.y(), oneMinusEpsilon);
+    double x = 0;
+    double y = 0;
+    double size = 1;
+    double density = 1; // over the unit square
+    uint32_t node = 0;
+    while (true) {
+        const QuadNode &n = nodes[node];
+        double s[4];
+        for (int q = 0; q < 4; q++) s[q] = n.sum[q].load(std::memory_order_relaxed);
+        double total = s[0] + s[1] + s[2] + s[3];
+        if (total <= 0) break; // uniform inside the node
+        // Pick the column by its share, then the quadrant within it,
+        // and rescale u to stay uniform inside the choice
+        double left = (s[0] + s[2]) / total;
+        int qx = ux < left ? 0 : 1;
+        ux = qx == 0 ? ux / left : (ux - left) / (1 - left);
+        double column = s[qx] + s[qx + 2];
+        double bottom = s[qx] / column;
+        int qy = uy < bottom ? 0 : 1;
+        uy = qy == 0 ? uy / bottom : (uy - bottom) / (1 - bottom);
+        int q = qx + 2 * qy;
+        density *= 4 * s[q] / total;
+        size *= 0.5;
+        x += qx * size;
+        y += qy * size;
+        if (!n.child[q]) break;
+        node = n.child[q];
+    }
+    pdf = density / (4 * M_PI);
+    return squareToDirection(x + fmin(ux, 1.0) * size, y + fmin(uy, 1.0) * size);
+}
+
+inline double DirectionalTree::pdf(const Vector3d &direction) const {
+    double x, y;
+    directionToSquare(direction, x, y);
+    double density = 1;
+    uint32_t node = 0;
+    while (true) {
+        const QuadNode &n = nodes[node];
+        double s[4];
+        for (int q = 0; q < 4; q++) s[q] = n.sum[q].load(std::memory_order_relaxed);
+        double total = s[0] + s[1] + s[2] + s[3];
+        if (total <= 0) break;
+        int qx = x >= 0.5;
+        int qy = y >= 0.5;
+        int q = qx + 2 * qy;
+        density *= 4 * s[q] / total;
+        if (!n.child[q]) break;
+        node = n.child[q];
+        x = 2 * x - qx;
+        y = 2 * y - qy;
+    }
+    return density / (4 * M_PI);
+}
+
+inline void DirectionalTree::rebuild(const DirectionalTree &from, double threshold, int maxDepth) {
+    nodes.assign(1, QuadNode());
+    setRecordCount(0);
+    double total = from.energy();
+    if (total > 0) split(from, 0, 0, 1, total, threshold, 1, maxDepth);
+    nodes.shrink_to_fit();
+}
+
+// Splits the quadrants of `node` that hold more than `threshold` of
+// the energy. fromNode is the node covering the same square in
+// `from` (-1: `from` did not split that far, its energy is spread
+// evenly over the square).
+inline void DirectionalTree::split(const DirectionalTree &from, uint32_t node, int fromNode, double fraction, double total,
+                                   double threshold, int depth, int maxDepth) {
+    if (depth >= maxDepth) return;
+    for (int q = 0; q < 4; q++) {
+        double childFraction = fraction / 4;
+        int fromChild = -1;
+        if (fromNode >= 0) {
+            const QuadNode &n = from.nodes[fromNode];
+            childFraction = n.sum[q].load(std::memory_order_relaxed) / total;
+            if (n.child[q]) fromChild = int(n.child[q]);
+        }
+        if (childFraction <= threshold) continue;
+        uint32_t child = uint32_t(nodes.size());
+        nodes.push_back(QuadNode());
+        nodes[node].child[q] = child;
+        split(from, child, fromChild, childFraction, total, threshold, depth + 1, maxDepth);
+    }
+}
+
+/* Guiding field */
+// The spatial tree and its cells. cell() and includePoint() are
+// thread safe, finishPass() must run between passes.
+struct GuidingCell {
+    DirectionalTree building;
+    DirectionalTree sampling;
+    // Whether the sampling tree learned anything to guide with
+    bool guides() const;
+    // pdf of a direction under the one-sample mixture of BSDF
+    // sampling (bsdfPdf, taken with probability bsdfFraction) and
+    // guided sampling
+    double mixturePdf(const Vector3d &direction, double bsdfPdf) const;
+};
+
+struct SpatialNode {
+    uint32_t child[2]; // 0: leaf
+    uint32_t cell; // of a leaf
+    int axis;
+    int depth;
+};
+
+class GuidingField {
+    AABB bounds; // a cube
+    std::atomic<float> learnedMin[3];
+    std::atomic<float> learnedMax[3];
+    std::vector<SpatialNode> nodes; // empty while learning the bounds
+    std::vector<GuidingCell> cells;
+    int spp;
+    size_t maxBytes;
+    int iteration;
+    int iterationPasses;
+    int iterationEnd; // last pass of the current iteration
+    bool training;
+    void startTree();
+    void refine();
+public:
+    static constexpr double bsdfFraction = 0.5;
+    static constexpr double spatialThreshold = 4000; // records per leaf (times √passes)
+    static constexpr double energyThreshold = 0.01;
+    static const int maxDirectionalDepth = 20;
+    static const int maxSpatialDepth = 60;
+
+    GuidingField(int spp, size_t maxBytes);
+    bool hasCells() const;
+    bool isTraining() const;
+    // The leaf cell around p (hasCells() only)
+    GuidingCell *cell(const Vector3d &p);
+    // Grows the box the cells will cover (first pass)
+    void includePoint(const Vector3d &p);
+    // Ends an iteration after its last pass
+    void finishPass(int pass);
+    int iterationCount() const;
+    size_t cellCount() const;
+    size_t bytes() const;
+};
+
+inline bool GuidingCell::guides() const { return sampling.energy() > 0; }
+
+inline double GuidingCell::mixturePdf(const Vector3d &direction, double bsdfPdf) const {
+    return GuidingField::bsdfFraction * bsdfPdf + (1 - GuidingField::bsdfFraction) * sampling.pdf(direction);
+}
+
+inline GuidingField::GuidingField(int spp, size_t maxBytes): spp(spp), maxBytes(maxBytes), iteration(0), iterationPasses(1),
+                                                              iterationEnd(0), training(true) {
+    for (int a = 0; a < 3; a++) {
+        learnedMin[a].store(INFINITY, std::memory_order_relaxed);
+        learnedMax[a].store(-INFINITY, std::memory_order_relaxed);
+    }
+}
+
+inline bool GuidingField::hasCells() const { return !nodes.empty(); }
+inline bool GuidingField::isTraining() const { return training; }
+inline int GuidingField::iterationCount() const { return iteration; }
+inline size_t GuidingField::cellCount() const { return cells.size(); }
+
+inline size_t GuidingField::bytes() const {
+    size_t total = sizeof(GuidingField) + nodes.capacity() * sizeof(SpatialNode) + (cells.capacity() - cells.size()) * sizeof(GuidingCell);
+    for (const GuidingCell &c : cells) total += c.building.bytes() + c.sampling.bytes();
+    return total;
+}
+
+inline void GuidingField::includePoint(const Vector3d &p) {
+    for (int a = 0; a < 3; a++) {
+        float v = float(p[a]);
+        float current = learnedMin[a].load(std::memory_order_relaxed);
+        while (v < current && !learnedMin[a].compare_exchange_weak(current, v, std::memory_order_relaxed)) {}
+        current = learnedMax[a].load(std::memory_order_relaxed);
+        while (v > current && !learnedMax[a].compare_exchange_weak(current, v, std::memory_order_relaxed)) {}
+    }
+}
+
+inline GuidingCell *GuidingField::cell(const Vector3d &p) {
+    // Position inside the cube in [0, 1]^3, doubled on every level
+    double x[3];
+    for (int a = 0; a < 3; a++) x[a] = (p[a] - bounds.min[a]) / (bounds.max[a] - bounds.min[a]);
+    uint32_t node = 0;
+    while (nodes[node].child[0]) {
+        const SpatialNode &n = nodes[node];
+        int side = x[n.axis] >= 0.5;
+        x[n.axis] = 2 * x[n.axis] - side;
+        node = n.child[side];
+    }
+    return &cells[nodes[node].cell];
+}
+
+// A cube around the learned box, slightly larger
+inline void GuidingField::startTree() {
+    Vector3d learned[2];
+    for (int a = 0; a < 3; a++) {
+        learned[0][a] = learnedMin[a].load(std::memory_order_relaxed);
+        learned[1][a] = learnedMax[a].load(std::memory_order_relaxed);
+    }
+    AABB box(learned[0], learned[1]);
+    Vector3d extent = box.extent();
+    double size = 1.02 * fmax(extent.x(), fmax(extent.y(), extent.z())) + 1e-3;
+    Vector3d half(size / 2, size / 2, size / 2);
+    bounds = AABB(box.center() - half, box.center() + half);
+    nodes.push_back(SpatialNode{ { 0, 0 }, 0, 0, 0 });
+    cells.push_back(GuidingCell());
+}
+
+inline void GuidingField::finishPass(int pass) {
+    if (pass != iterationEnd) return;
+    if (!hasCells()) {
+        // Nothing scattered yet: learn for another pass
+        if (learnedMin[0].load(std::memory_order_relaxed) > learnedMax[0].load(std::memory_order_relaxed)) {
+            iterationEnd = pass + 1;
+            return;
+        }
+        startTree();
+    } else {
+        refine();
+        iteration++;
+        iterationPasses *= 2;
+    }
+    iterationEnd = pass + iterationPasses;
+    // Records of an iteration that can't end are never used
+    training = iterationEnd < spp;
+}
+
+inline void GuidingField::refine() {
+    /* Spatial tree */
+    // Split leaves with many records into halves that each inherit
+    // the leaf's distributions and half its records, until the
+    // halves have few enough or the field is full.
+    double threshold = spatialThreshold * sqrt(double(iterationPasses));
+    size_t total = bytes();
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].child[0] || nodes[i].depth >= maxSpatialDepth) continue;
+        uint32_t c = nodes[i].cell;
+        uint32_t records = cells[c].building.recordCount();
+        size_t splitBytes = 2 * sizeof(SpatialNode) + sizeof(GuidingCell) + cells[c].building.bytes() + cells[c].sampling.bytes();
+        if (records <= threshold || total + splitBytes > maxBytes) continue;
+        total += splitBytes;
+        cells[c].building.setRecordCount(records / 2);
+        uint32_t copy = uint32_t(cells.size());
+        cells.push_back(cells[c]);
+        int axis = (nodes[i].axis + 1) % 3;
+        uint32_t first = uint32_t(nodes.size());
+        nodes.push_back(SpatialNode{ { 0, 0 }, c, axis, nodes[i].depth + 1 });
+        nodes.push_back(SpatialNode{ { 0, 0 }, copy, axis, nodes[i].depth + 1 });
+        nodes[i].child[0] = first;
+        nodes[i].child[1] = first + 1;
+    }
+
+    /* Directional trees */
+    // Coarser ones (fewer nodes split) while the field would not fit
+    for (GuidingCell &c : cells) c.sampling = c.building;
+    for (double threshold = energyThreshold; ; threshold *= 2) {
+        for (GuidingCell &c : cells) c.building.rebuild(c.sampling, threshold, maxDirectionalDepth);
+        if (bytes() <= maxBytes || threshold >= 1) break;
+    }
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef Plane_hpp
+#define Plane_hpp
+
+#include <iostream>
+#include <math.h>
+#include "Vector3d.hpp"
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+#include "Material.hpp"
+#include "Hitable.hpp"
+
+class Material;
+
+/* Infinite plane */
+// All points X with (X - P) • N = 0, for a point P on the plane
+// and its unit normal N. Floors and walls that reach past the
+// view, without the huge bounds (and the precision loss of the
+// quadratic) of a sphere with a radius of 10000.
+//
+// * Ray-plane intersection: (A + t * B - P) • N = 0, so
+//   t = ((P - A) • N) / (B • N), no hit if B • N = 0 (the ray
+//   runs parallel to the plane).
+// * A plane has no inside: the normal is flipped to face the ray,
+//   both sides are the same surface.
+// * It has no bounds either (boundingBox() returns false), Scene
+//   keeps it outside the BVH.
+// * Texture coordinates are the distances along two axes of the
+//   plane, in world units (a texture repeats every 1 / scale).
+// * Emitting planes glow when hit but are never sampled as lights
+//   (they have no finite area to pick a point on).
+class Plane: public Hitable {
+    Vector3d point;
+    Vector3d normal;
+    Vector3d tangent;
+    Vector3d bitangent;
+public:
+    Plane() {};
+    Plane(const Vector3d &point, const Vector3d &normal, Material *material);
+    virtual bool closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const;
+    virtual bool occluded(const Ray &ray, double tMin, double tMax) const;
+    virtual void surface(const Ray &ray, const PrimitiveHit &hit, HitRecord &hitRecord) const;
+    virtual bool boundingBox(AABB &box) const;
+    bool intersect(const Ray &ray, double tMin, double tMax, double &t) const;
+    Material *material;
+};
+
+inline Plane::Plane(const Vector3d &point, const Vector3d &normal, Material *material): point(point),
+                                                                                      normal(unitVector(normal)),
+                                                                                      material(material) {
+    orthonormalBasis(this->normal, tangent, bitangent);
+}
+
+inline bool Plane::intersect(const Ray &ray, double tMin, double tMax, double &t) const {
+    double denominator = dot(ray.direction(), normal);
+    if (denominator == 0) return false;
+    t = dot(point - ray.origin(), normal) / denominator;
+    return t < tMax && t > tMin;
+}
+
+inline bool Plane::closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const {
+    double t;
+    if (!intersect(ray, tMin, tMax, t)) return false;
+    hit.t = t;
+    hit.primitive = this;
+    hit.index = 0;
+    return true;
+}
+
+inline bool Plane::occluded(const Ray &ray, double tMin, double tMax) const {
+    double t;
+    return intersect(ray, tMin, tMax, t);
+}
+
+inline void Plane::surface(const Ray &ray, const PrimitiveHit &hit, HitRecord &hitRecord) const {
+    hitRecord.t = hit.t;
+    hitRecord.p = ray.pointAtParameter(hit.t);
+    hitRecord.normal = dot(ray.direction(), normal) > 0 ? -normal : normal;
+    hitRecord.material = this->material;
+    Vector3d offset = hitRecord.p - point;
+    hitRecord.u = dot(offset, tangent);
+    hitRecord.v = dot(offset, bitangent);
+    hitRecord.uvLength = 1;
+}
+
+inline bool Plane::boundingBox(AABB &box) const {
+    return false;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef ProcessStats_hpp
+#define ProcessStats_hpp
+
+#include <iostream>
+#include <fstream>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+/* Process statistics */
+// Memory use of the running process, for benchmarks.
+
+// Current resident set size (RSS) in bytes, 0 if unknown.
+inline size_t residentMemoryBytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    if (!(statm >> pages >> resident)) return 0;
+    return resident * size_t(sysconf(_SC_PAGESIZE));
+}
+
+// Peak resident set size in bytes since the process started.
+inline size_t peakResidentMemoryBytes() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return size_t(usage.ru_maxrss) * 1024; // Linux reports KiB
+}
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef RayPacket_hpp
+#define RayPacket_hpp
+
+#include <iostream>
+#include <math.h>
+#include <algorithm>
+#include "Vector3d.hpp"
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+
+/* Ray packets */
+// Camera rays of neighbouring pixels start at (nearly) the same
+// point and go in nearly the same direction, so they visit nearly
+// the same BVH nodes. A packet traces up to maxSize of them
+// together (Wald et al., "Ray Tracing Deformable Scenes using
+// Dynamic Bounding Volume Hierarchies"): every node is fetched once
+// for the packet, and a single interval test over the whole packet
+// culls most nodes none of its rays hit.
+//
+// * Rays are stored twice: as Rays for the primitives and one lane
+//   per ray (origin, direction, 1 / direction, tMax) in arrays per
+//   axis for the node tests.
+// * prepare() computes the packet's bounds: the interval of every
+//   origin and 1 / direction component over its rays. A packet is
+//   coherent if every axis's direction has the same sign in all of
+//   its rays. Only coherent packets can share the traversal order
+//   and the interval test, the others are traced ray by ray.
+// * Pinhole cameras give packets with a single origin, thin lens
+//   cameras (lensRadius > 0) ones with origins spread over the
+//   lens: the interval test covers both, it just culls less.
+// * Hits go into hits[i] / found[i], tMax[i] shrinks to the closest
+//   hit like closestSoFar in single ray traversal.
+struct RayPacket {
+    static const int maxSize = 64;
+    int size;
+    Ray rays[maxSize];
+    double origin[3][maxSize];
+    double direction[3][maxSize];
+    double invDirection[3][maxSize];
+    double tMax[maxSize];
+    PrimitiveHit hits[maxSize];
+    bool found[maxSize];
+    double originMin[3], originMax[3];
+    double invDirectionMin[3], invDirectionMax[3];
+    bool coherent;
+    RayPacket(): size(0), coherent(false) {};
+    void clear();
+    void add(const Ray &ray, double tMax);
+    void prepare();
+    // Slab test of ray i against the box (a BVH node's float bounds)
+    bool hitsBox(const float min[3], const float max[3], int i, double tMin) const;
+    // Interval test: false if no ray of the packet can hit the box
+    bool mayHitBox(const float min[3], const float max[3], double tMin) const;
+};
+
+inline void RayPacket::clear() { size = 0; }
+
+inline void RayPacket::add(const Ray &ray, double rayTMax) {
+    int i = size++;
+    rays[i] = ray;
+    Vector3d o = ray.origin();
+    Vector3d d = ray.direction();
+    for (int axis = 0; axis < 3; axis++) {
+        origin[axis][i] = o[axis];
+        direction[axis][i] = d[axis];
+        invDirection[axis][i] = 1.0 / d[axis];
+    }
+    tMax[i] = rayTMax;
+    found[i] = false;
+}
+
+inline void RayPacket::prepare() {
+    coherent = size > 0;
+    for (int axis = 0; axis < 3; axis++) {
+        originMin[axis] = invDirectionMin[axis] = INFINITY;
+        originMax[axis] = invDirectionMax[axis] = -INFINITY;
+        int positive = 0, negative = 0;
+        for (int i = 0; i < size; i++) {
+            originMin[axis] = fmin(originMin[axis], origin[axis][i]);
+            originMax[axis] = fmax(originMax[axis], origin[axis][i]);
+            invDirectionMin[axis] = fmin(invDirectionMin[axis], invDirection[axis][i]);
+            invDirectionMax[axis] = fmax(invDirectionMax[axis], invDirection[axis][i]);
+            positive += direction[axis][i] > 0;
+            negative += direction[axis][i] < 0;
+        }
+        // A zero component (infinite 1 / direction) is left to the
+        // single ray test as well
+        if (positive != size && negative != size) coherent = false;
+    }
+}
+
+inline bool RayPacket::hitsBox(const float min[3], const float max[3], int i, double tMin) const {
+    double tFar = tMax[i];
+    for (int axis = 0; axis < 3; axis++) {
+        double t0 = (min[axis] - origin[axis][i]) * invDirection[axis][i];
+        double t1 = (max[axis] - origin[axis][i]) * invDirection[axis][i];
+        if (invDirection[axis][i] < 0) std::swap(t0, t1);
+        tMin = t0 > tMin ? t0 : tMin;
+        tFar = t1 < tFar ? t1 : tFar;
+    }
+    return tMin <= tFar;
+}
+
+// Interval arithmetic: (bound - origin) * (1 / direction) over the
+// intervals of the packet gives an interval holding every ray's t
+// for each slab plane. If the latest possible entry into a slab is
+// after the earliest possible exit of another, no ray is inside
+// all three at once. Only valid for coherent packets (no interval
+// of 1 / direction contains 0 or infinity).
+inline bool RayPacket::mayHitBox(const float min[3], const float max[3], double tMin) const {
+    double tNear = tMin, tFar = INFINITY;
+    for (int axis = 0; axis < 3; axis++) {
+        auto range = [&](double bound, double &low, double &high) {
+            double a = bound - originMax[axis], b = bound - originMin[axis];
+            double p0 = a * invDirectionMin[axis], p1 = a * invDirectionMax[axis];
+            double p2 = b * invDirectionMin[axis], p3 = b * invDirectionMax[axis];
+            low = fmin(fmin(p0, p1), fmin(p2, p3));
+            high = fmax(fmax(p0, p1), fmax(p2, p3));
+        };
+        double low0, high0, low1, high1;
+        range(min[axis], low0, high0);
+        range(max[axis], low1, high1);
+        // Rays going the negative way enter at max and leave at min
+        bool negative = invDirectionMax[axis] < 0;
+        tNear = fmax(tNear, negative ? low1 : low0);
+        tFar = fmin(tFar, negative ? high0 : high1);
+    }
+    return tNear <= tFar;
+}
+
+#endif
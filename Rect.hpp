@@ -0,0 +1,202 @@
+#ifndef Rect_hpp
+#define Rect_hpp
+
+#include <iostream>
+#include <math.h>
+#include "Vector3d.hpp"
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+#include "Material.hpp"
+#include "Hitable.hpp"
+
+class Material;
+
+/* Axis-aligned rectangle */
+// A rectangle parallel to two of the coordinate axes, given by two
+// opposite corners that share the coordinate along the third (the
+// normal axis). Walls, ceilings and area lights.
+//
+// * Ray-rect intersection: the ray meets the rectangle's plane at
+//   t = (k - A[axis]) / B[axis] (no hit if B[axis] = 0), then the
+//   hit point only has to be inside the rectangle's range on the
+//   two other axes. One division and four comparisons.
+// * Like a plane it has no inside, the normal is flipped to face
+//   the ray. Its bounds are flat along the normal axis (BVH nodes
+//   round them outwards).
+// * Texture coordinates run from 0 to 1 across each side.
+//
+/* Rectangle lights */
+// Rectangles with an emitting material are lights that emit from
+// both sides, like every emitter here (emitted() does not depend
+// on the side that was hit).
+// * Bounds: all normals along ±axis (cosThetaO = 1, twoSided), each
+//   point emits over its hemisphere (θe = π/2). Power: the average
+//   radiance times π times the area, twice (two sides).
+// * Light sampling: a point uniform on the rectangle, its area pdf
+//   1 / area converted to solid angle at `from` with d² / (|cos| *
+//   area). Points seen edge-on (cos = 0) are rejected.
+// * Emission: a uniform point and a side picked with the first
+//   direction number, then a direction cosine distributed around
+//   that side's normal (pdf |cos| / 2π over both sides).
+class Rect: public Hitable {
+    int axis;      // normal axis
+    double k;      // position on the normal axis
+    Vector3d min;  // corners, min[axis] = max[axis] = k
+    Vector3d max;
+    double area() const;
+    Vector3d axisNormal() const;
+    Vector3d pointAt(double a, double b) const;
+public:
+    Rect() {};
+    Rect(const Vector3d &corner0, const Vector3d &corner1, Material *material);
+    virtual bool closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const;
+    virtual bool occluded(const Ray &ray, double tMin, double tMax) const;
+    virtual void surface(const Ray &ray, const PrimitiveHit &hit, HitRecord &hitRecord) const;
+    virtual bool boundingBox(AABB &box) const;
+    virtual void collectLights(std::vector<LightSource> &lights) const;
+    virtual bool sampleLight(int index, const Vector3d &from, const Vector3d &u, LightSample &sample) const;
+    virtual double lightPdf(int index, const Vector3d &from, const Vector3d &p) const;
+    virtual bool sampleEmission(int index, const Vector3d &uPosition, const Vector3d &uDirection, EmissionSample &sample) const;
+    virtual void emissionPdf(int index, const Vector3d &p, const Vector3d &normal, const Vector3d &direction,
+                             double &pdfPosition, double &pdfDirection) const;
+    bool intersect(const Ray &ray, double tMin, double tMax, double &t) const;
+    Material *material;
+};
+
+// The normal axis is the one along which the corners differ least
+// (exactly 0 for a proper rectangle).
+inline Rect::Rect(const Vector3d &corner0, const Vector3d &corner1, Material *material): material(material) {
+    min = Vector3d(fmin(corner0.x(), corner1.x()), fmin(corner0.y(), corner1.y()), fmin(corner0.z(), corner1.z()));
+    max = Vector3d(fmax(corner0.x(), corner1.x()), fmax(corner0.y(), corner1.y()), fmax(corner0.z(), corner1.z()));
+    Vector3d extent = max - min;
+    axis = extent.x() <= extent.y() && extent.x() <= extent.z() ? 0 : (extent.y() <= extent.z() ? 1 : 2);
+    k = 0.5 * (min[axis] + max[axis]);
+    min[axis] = max[axis] = k;
+}
+
+inline double Rect::area() const {
+    int a = (axis + 1) % 3, b = (axis + 2) % 3;
+    return (max[a] - min[a]) * (max[b] - min[b]);
+}
+
+inline Vector3d Rect::axisNormal() const {
+    Vector3d normal(0, 0, 0);
+    normal[axis] = 1;
+    return normal;
+}
+
+// The point at fractions (a, b) across the two other axes
+inline Vector3d Rect::pointAt(double a, double b) const {
+    int i = (axis + 1) % 3, j = (axis + 2) % 3;
+    Vector3d p = min;
+    p[i] += a * (max[i] - min[i]);
+    p[j] += b * (max[j] - min[j]);
+    return p;
+}
+
+inline bool Rect::intersect(const Ray &ray, double tMin, double tMax, double &t) const {
+    double d = ray.direction()[axis];
+    if (d == 0) return false;
+    t = (k - ray.origin()[axis]) / d;
+    if (!(t < tMax && t > tMin)) return false;
+    int i = (axis + 1) % 3, j = (axis + 2) % 3;
+    double a = ray.origin()[i] + t * ray.direction()[i];
+    double b = ray.origin()[j] + t * ray.direction()[j];
+    return a >= min[i] && a <= max[i] && b >= min[j] && b <= max[j];
+}
+
+inline bool Rect::closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const {
+    double t;
+    if (!intersect(ray, tMin, tMax, t)) return false;
+    hit.t = t;
+    hit.primitive = this;
+    hit.index = 0;
+    return true;
+}
+
+inline bool Rect::occluded(const Ray &ray, double tMin, double tMax) const {
+    double t;
+    return intersect(ray, tMin, tMax, t);
+}
+
+inline void Rect::surface(const Ray &ray, const PrimitiveHit &hit, HitRecord &hitRecord) const {
+    hitRecord.t = hit.t;
+    hitRecord.p = ray.pointAtParameter(hit.t);
+    hitRecord.p[axis] = k;
+    Vector3d normal = axisNormal();
+    hitRecord.normal = ray.direction()[axis] > 0 ? -normal : normal;
+    hitRecord.material = this->material;
+    int i = (axis + 1) % 3, j = (axis + 2) % 3;
+    double width = max[i] - min[i], height = max[j] - min[j];
+    hitRecord.u = width > 0 ? (hitRecord.p[i] - min[i]) / width : 0;
+    hitRecord.v = height > 0 ? (hitRecord.p[j] - min[j]) / height : 0;
+    hitRecord.uvLength = fmax(width, height);
+}
+
+inline bool Rect::boundingBox(AABB &box) const {
+    box = AABB(min, max);
+    return true;
+}
+
+inline void Rect::collectLights(std::vector<LightSource> &lights) const {
+    Vector3d radiance = material->emitted();
+    if (radiance.x() <= 0 && radiance.y() <= 0 && radiance.z() <= 0) return;
+    LightSource light;
+    light.primitive = this;
+    light.index = 0;
+    light.bounds.box = AABB(min, max);
+    light.bounds.w = axisNormal();
+    light.bounds.phi = (radiance.x() + radiance.y() + radiance.z()) / 3 * M_PI * area() * 2;
+    light.bounds.cosThetaO = 1;
+    light.bounds.cosThetaE = 0;
+    light.bounds.twoSided = true;
+    lights.push_back(light);
+}
+
+inline bool Rect::sampleLight(int index, const Vector3d &from, const Vector3d &u, LightSample &sample) const {
+    sample.p = pointAt(u.x(), u.y());
+    Vector3d toLight = sample.p - from;
+    double dist2 = toLight.squaredLength();
+    double cosine = fabs(toLight[axis]);
+    if (cosine == 0 || area() <= 0) return false;
+    Vector3d normal = axisNormal();
+    sample.normal = toLight[axis] > 0 ? -normal : normal;
+    sample.pdf = dist2 * sqrt(dist2) / (cosine * area());
+    sample.radiance = material->emitted();
+    return true;
+}
+
+inline double Rect::lightPdf(int index, const Vector3d &from, const Vector3d &p) const {
+    Vector3d toLight = p - from;
+    double dist2 = toLight.squaredLength();
+    double cosine = fabs(toLight[axis]);
+    if (cosine == 0 || area() <= 0) return 0;
+    return dist2 * sqrt(dist2) / (cosine * area());
+}
+
+inline bool Rect::sampleEmission(int index, const Vector3d &uPosition, const Vector3d &uDirection, EmissionSample &sample) const {
+    if (area() <= 0) return false;
+    sample.p = pointAt(uPosition.x(), uPosition.y());
+    sample.pdfPosition = 1 / area();
+    // The side from the first number, reused for the disk
+    double side = uDirection.x() < 0.5 ? 1 : -1;
+    double ux = uDirection.x() < 0.5 ? 2 * uDirection.x() : 2 * uDirection.x() - 1;
+    sample.normal = side * axisNormal();
+    double diskRadius = sqrt(ux);
+    double diskAngle = 2 * M_PI * uDirection.y();
+    double cosine = sqrt(fmax(0.0, 1 - ux));
+    Vector3d t, b;
+    orthonormalBasis(sample.normal, t, b);
+    sample.direction = diskRadius * cos(diskAngle) * t + diskRadius * sin(diskAngle) * b + cosine * sample.normal;
+    sample.pdfDirection = cosine / (2 * M_PI);
+    sample.radiance = material->emitted();
+    return sample.pdfDirection > 0;
+}
+
+inline void Rect::emissionPdf(int index, const Vector3d &p, const Vector3d &normal, const Vector3d &direction,
+                              double &pdfPosition, double &pdfDirection) const {
+    pdfPosition = area() > 0 ? 1 / area() : 0;
+    pdfDirection = fabs(direction[axis]) / (2 * M_PI);
+}
+
+#endif
@@ -0,0 +1,1161 @@
+#ifndef Renderer_hpp
+#define Renderer_hpp
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <stdint.h>
+#include <math.h>
+#include "Vector3d.hpp"
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+#include "Hitable.hpp"
+#include "RayPacket.hpp"
+#include "Material.hpp"
+#include "Camera.hpp"
+#include "Sampler.hpp"
+#include "Framebuffer.hpp"
+#include "Film.hpp"
+#include "Scene.hpp"
+#include "LightBVH.hpp"
+#include "PathGuiding.hpp"
+#include "ThreadPool.hpp"
+#include "TileSchedule.hpp"
+
+// Number of rays traced by color() on the calling thread (for
+// Mrays/s).
+inline uint64_t &raysTraced() {
+    thread_local uint64_t count = 0;
+    return count;
+}
+
+/* Ray cone */
+// Approximates the footprint of a path for texture filtering
+// (Akenine-Möller et al., "Texture Level of Detail Strategies for
+// Real-Time Ray Tracing"): a camera ray starts as a cone with the
+// angle of one pixel, its width grows by spread per unit of
+// distance. Later bounces continue with the width at the last hit
+// and the same spread, which ignores the widening by rough
+// surfaces (lookups are sharper than needed, never blurrier).
+struct RayCone {
+    double width;
+    double spread;
+};
+
+/* Direct lighting */
+// The lights color() samples at every vertex with a diffuse lobe
+// (next event estimation): one light picked by the scene's
+// LightBVH, one point on it, one shadow ray. No lights (nullptr)
+// or LightSampling::None: paths only find lights by scattering
+// into them.
+struct DirectLighting {
+    const LightBVH *lights;
+    LightSampling mode;
+};
+
+// The vertex a ray was scattered from, to weight the light it hits:
+// pdf is the solid angle pdf of the scattered direction, 0 for
+// specular directions.
+struct PathVertex {
+    Vector3d p;
+    Vector3d normal;
+    double pdf;
+};
+
+/* Multiple importance sampling */
+// A light reached by both strategies (a shadow ray to a sampled
+// point, a scattered ray that happens to hit it) is counted by
+// both, each with weight pdf² / (pdf² + other pdf²) (Veach's power
+// heuristic). The weights sum to 1 for every path, and the
+// strategy that is better for it gets most of it: light sampling
+// for small lights, BSDF sampling for large lights close by.
+inline double powerHeuristic(double pdf, double otherPdf) {
+    if (std::isinf(pdf)) return 1;
+    pdf *= pdf;
+    otherPdf *= otherPdf;
+    return pdf + otherPdf > 0 ? pdf / (pdf + otherPdf) : 0;
+}
+
+inline bool isBlack(const Color &c) {
+    return c.x() <= 0 && c.y() <= 0 && c.z() <= 0;
+}
+
+/* Guided scattering */
+// One sample of the mixture of BSDF sampling (with probability
+// bsdfFraction) and the cell's learned distribution, so directions
+// the guide misses stay reachable. Diffuse directions from either
+// strategy are weighted by the mixture's pdf (one-sample MIS),
+// specular ones only the BSDF can produce.
+inline bool guidedScatter(const Ray &r, const HitRecord &hitRecord, const Material &material, const GuidingCell &cell, int depth,
+                          Sampler &sampler, Color &attenuation, Ray &scattered, double &pdf) {
+    sampler.startGuideSample(depth);
+    double choice = sampler.get1D();
+    Vector3d u = sampler.get2D();
+    double bsdfPdf;
+    if (choice < GuidingField::bsdfFraction) {
+        sampler.startBounce(depth);
+        if (!material.scatter(r, hitRecord, sampler, attenuation, scattered, bsdfPdf)) return false;
+        if (bsdfPdf == 0) {
+            attenuation /= GuidingField::bsdfFraction;
+            pdf = 0;
+            return true;
+        }
+    } else {
+        double guidePdf;
+        scattered = Ray(hitRecord.p, cell.sampling.sample(u, guidePdf));
+    }
+    Color f = material.evaluate(r, hitRecord, scattered.direction(), bsdfPdf);
+    pdf = cell.mixturePdf(scattered.direction(), bsdfPdf);
+    if (isBlack(f) || pdf <= 0) return false;
+    attenuation = f / pdf;
+    return true;
+}
+
+// Channel average, the scalar the guiding field learns
+inline double average(const Color &c) {
+    return (c.x() + c.y() + c.z()) / 3;
+}
+
+inline Color color(const Ray &r, const Hitable *scene, const DirectLighting &lighting, GuidingField *guiding, int depth, int maxDepth,
+                   Sampler &sampler, const RayCone &cone, const PathVertex &previous);
+
+// The radiance along r once its closest hit is known (nullptr: it
+// hit nothing). color() traces r first, packets of camera rays
+// are traced together and come in here.
+inline Color colorAtHit(const Ray &r, const PrimitiveHit *closest, const Hitable *scene, const DirectLighting &lighting, GuidingField *guiding,
+                        int depth, int maxDepth, Sampler &sampler, const RayCone &cone, const PathVertex &previous) {
+    if (!closest) {
+        // End of recursion: ray didn't hit anything - return BG color
+        return Color(0.0, 0.0, 0.0);
+    }
+    const PrimitiveHit &hit = *closest;
+    HitRecord hitRecord;
+    hit.primitive->surface(r, hit, hitRecord);
+    double width = cone.width + hitRecord.t * r.direction().length() * cone.spread;
+    hitRecord.footprint = width / hitRecord.uvLength;
+    const Material *material = hitRecord.material;
+    const LightBVH *lights = lighting.mode == LightSampling::None ? nullptr : lighting.lights;
+    if (lights && lights->lightCount() == 0) lights = nullptr;
+
+    // Get light emittance, weighted against light sampling at the
+    // previous vertex if it could have picked this point too
+    Color emitted = material->emitted();
+    if (lights && depth > 0 && previous.pdf > 0 && !isBlack(emitted)) {
+        int light = lights->find(hit.primitive, hit.index);
+        if (light >= 0) {
+            double lightPdf = lights->pmf(previous.p, previous.normal, light, lighting.mode) *
+                              hit.primitive->lightPdf(hit.index, previous.p, hitRecord.p);
+            emitted *= powerHeuristic(previous.pdf, lightPdf);
+        }
+    }
+    // End of recursion
+    if (depth >= maxDepth) return emitted;
+
+    // The guiding cell around a diffuse vertex (none while the
+    // field still learns its bounds)
+    GuidingCell *cell = nullptr;
+    if (guiding && material->hasDiffuse()) {
+        if (guiding->hasCells()) cell = guiding->cell(hitRecord.p);
+        else if (depth == 0) guiding->includePoint(hitRecord.p);
+    }
+    bool guided = cell && cell->guides();
+
+    /* Next event estimation */
+    // Ld = f * Le * cos(Ø) / pdf for a point sampled on a light,
+    // if nothing blocks the way to it.
+    Color direct(0, 0, 0);
+    if (lights && material->hasDiffuse()) {
+        sampler.startLightSample(depth);
+        double u = sampler.get1D();
+        Vector3d u2 = sampler.get2D();
+        int light;
+        double pmf;
+        LightSample lightSample;
+        if (lights->sample(hitRecord.p, hitRecord.normal, u, lighting.mode, light, pmf)) {
+            const LightSource &source = lights->light(light);
+            if (source.primitive->sampleLight(source.index, hitRecord.p, u2, lightSample) && lightSample.pdf > 0) {
+                Vector3d toLight = lightSample.p - hitRecord.p;
+                double distance = toLight.length();
+                Vector3d direction = toLight / distance;
+                double bsdfPdf;
+                Color f = material->evaluate(r, hitRecord, direction, bsdfPdf);
+                if (guided) bsdfPdf = cell->mixturePdf(direction, bsdfPdf);
+                if (!isBlack(f)) {
+                    raysTraced()++;
+                    if (!scene->occluded(Ray(hitRecord.p, direction), 0.001, distance - 0.001)) {
+                        double lightPdf = pmf * lightSample.pdf;
+                        direct = f * lightSample.radiance * (powerHeuristic(lightPdf, bsdfPdf) / lightPdf);
+                    }
+                }
+            }
+        }
+    }
+
+    Ray scattered;
+    Color attenuation;
+    double pdf;
+    bool scatters;
+    if (guided) {
+        scatters = guidedScatter(r, hitRecord, *material, *cell, depth, sampler, attenuation, scattered, pdf);
+    } else {
+        // Position the sampler at this bounce's BSDF dimensions
+        sampler.startBounce(depth);
+        // Get material's scattered ray for current ray and hit record
+        scatters = material->scatter(r, hitRecord, sampler, attenuation, scattered, pdf);
+    }
+    if (scatters) {
+        /* The Rendering Equation */
+        // L0 = Le + ∫(f * Li * cos(Ø) * dw), where:
+        // L0(x,w0) - pixel color at hit point x, ray 0 direction w0
+        // Le(x,w0) - emitted radiance at hit point x, ray 0 direction w0
+        // f(x,wi->w0) - BRDF at hit point x (attenuation)
+        // Li(x,wi) - radiance at hit point x, ray i direction wi
+        // The integral is split into the direct light from sampled
+        // lights and the scattered ray's estimate, MIS weighted.
+
+        // Shoot scattered rays recursively until a light is hit
+        Color incoming = color(scattered, scene, lighting, guiding, depth + 1, maxDepth, sampler, RayCone{ width, cone.spread },
+                               PathVertex{ hitRecord.p, hitRecord.normal, pdf });
+        // Teach the guiding field what arrived from there (the light
+        // sampled at the next vertex included, emission weighted
+        // like it is in the image)
+        if (cell && pdf > 0 && guiding->isTraining()) cell->building.record(scattered.direction(), float(average(incoming) / pdf));
+        return emitted + direct + attenuation * incoming;
+    }
+    // End of recursion: light was hit, return emitted radiance
+    return emitted + direct;
+}
+
+inline Color color(const Ray &r, const Hitable *scene, const DirectLighting &lighting, GuidingField *guiding, int depth, int maxDepth,
+                   Sampler &sampler, const RayCone &cone, const PathVertex &previous) {
+    raysTraced()++;
+    PrimitiveHit hit;
+    // Get closest hit for ray
+    bool found = scene->closestHit(r, 0.001, MAXFLOAT, hit); // TODO: Change to DBL_MAX?
+    return colorAtHit(r, found ? &hit : nullptr, scene, lighting, guiding, depth, maxDepth, sampler, cone, previous);
+}
+
+/* Pixel sample */
+// cameraRay() starts sample `index` of pixel (pixel, line) and
+// returns its camera ray, samplePixel() traces it.
+// Dimensions 0..1 jitter the pixel, 2..3 pick the lens position
+// (every pixel sample gets its own lens position).
+inline Ray cameraRay(int pixel, int line, int index, int width, int height, const Camera &camera, Sampler &sampler) {
+    sampler.startPixelSample(pixel, line, index);
+    Vector3d jitter = sampler.get2D();
+    double u = (double(pixel) + jitter.x()) / double(width);
+    double v = (double(line) + jitter.y()) / double(height);
+    Vector3d lensOffset = randomInUnitDisk(sampler.get2D());
+    return camera.getRay(u, v, lensOffset);
+}
+
+inline Color samplePixel(int pixel, int line, int index, int width, int height, const Camera &camera, const Hitable *scene,
+                         const DirectLighting &lighting, GuidingField *guiding, int rayBounce, Sampler &sampler) {
+    Ray ray = cameraRay(pixel, line, index, width, height, camera, sampler);
+    return color(ray, scene, lighting, guiding, 0, rayBounce, sampler, RayCone{ 0, camera.pixelSpread(height) }, PathVertex{ ray.origin(), Vector3d(0, 0, 0), 0 });
+}
+
+/* Packet of pixel samples */
+// Sample `index` of every pixel in a block of at most
+// RayPacket::maxSize pixels, with the camera rays traced as one
+// packet (see RayPacket.hpp) and the rest of each path alone.
+// The result is samplePixel()'s: afterwards every pixel's sample
+// is started again (its camera ray made again, cheaper than
+// keeping a sampler per pixel) so the path goes on with the same
+// dimensions. radiance gets the block's samples row by row.
+inline void samplePacket(const TileRect &block, int index, int width, int height, const Camera &camera, const Hitable *scene,
+                         const DirectLighting &lighting, GuidingField *guiding, int rayBounce, Sampler &sampler, RayPacket &packet,
+                         Color *radiance) {
+    packet.clear();
+    for (int line = block.y0; line < block.y1; line++) {
+        for (int pixel = block.x0; pixel < block.x1; pixel++) packet.add(cameraRay(pixel, line, index, width, height, camera, sampler), MAXFLOAT);
+    }
+    packet.prepare();
+    scene->closestHits(packet, 0.001);
+    raysTraced() += packet.size;
+    RayCone cone{ 0, camera.pixelSpread(height) };
+    int i = 0;
+    for (int line = block.y0; line < block.y1; line++) {
+        for (int pixel = block.x0; pixel < block.x1; pixel++, i++) {
+            Ray ray = cameraRay(pixel, line, index, width, height, camera, sampler);
+            radiance[i] = colorAtHit(ray, packet.found[i] ? &packet.hits[i] : nullptr, scene, lighting, guiding, 0, rayBounce, sampler, cone,
+                                     PathVertex{ ray.origin(), Vector3d(0, 0, 0), 0 });
+        }
+    }
+}
+
+/* Bidirectional path tracing */
+// Caustics, light that reaches a diffuse surface through glass or
+// off a mirror, are paths color() can only find by scattering out
+// of the diffuse vertex, through the glass and into a light: light
+// sampling can't connect through a specular vertex. Small lights
+// make such paths rare and bright, fireflies. Tracing from the
+// lights as well (Veach's bidirectional path tracing, in the form
+// of pbrt-v3's BDPTIntegrator) finds them the other way round.
+//
+// * Every pixel sample traces a camera subpath (from the lens, like
+//   samplePixel()) and a light subpath (from a point on a light
+//   picked by power, in a cosine distributed direction) and then
+//   joins every prefix of one with every prefix of the other:
+//   s light vertices and t camera vertices. s = 0 is a camera path
+//   that hit a light, s = 1 samples a light point for a camera
+//   vertex like color() does, t = 1 connects a light vertex to a
+//   lens point. That last one lands on any pixel of the image, not
+//   the one being sampled, so it is splatted into the film.
+// * Every path of length n can be made by n + 1 such strategies,
+//   each with its own pdf. The power heuristic (as in color())
+//   weights them:
+//   every vertex stores the pdf (per unit area) with which its own
+//   subpath produced it (pdfForward) and the one with which the
+//   other direction would have (pdfReverse), so the weight of a
+//   connection only needs products of these ratios along the path,
+//   plus the few pdfs the connection itself changes.
+// * Specular vertices (pdf 0 from scatter()) can't be connected;
+//   strategies that would need to are left out of the weights.
+// * Light vertices evaluate the BSDF with the camera side as the
+//   ray in, the same as camera vertices: Glossy's Fresnel factor
+//   is not symmetric.
+enum class VertexType { Camera, Light, Surface };
+
+struct BidirectionalVertex {
+    VertexType type;
+    Vector3d p;
+    Vector3d normal; // (0, 0, 0) for the camera of a camera subpath, a point
+    HitRecord hitRecord; // surface vertices
+    const Hitable *primitive; // with index: the light's primitive
+    int index;
+    int light; // in the LightBVH, -1 if it does not emit
+    Color beta; // throughput of its subpath up to here
+    bool delta; // scattered specularly
+    double pdfForward;
+    double pdfReverse;
+};
+
+inline BidirectionalVertex bidirectionalVertex(VertexType type, const Vector3d &p, const Vector3d &normal, const Color &beta) {
+    BidirectionalVertex vertex;
+    vertex.type = type;
+    vertex.p = p;
+    vertex.normal = normal;
+    vertex.primitive = nullptr;
+    vertex.index = 0;
+    vertex.light = -1;
+    vertex.beta = beta;
+    vertex.delta = false;
+    vertex.pdfForward = vertex.pdfReverse = 0;
+    return vertex;
+}
+
+inline bool isConnectible(const BidirectionalVertex &v) {
+    return v.type != VertexType::Surface || v.hitRecord.material->hasDiffuse();
+}
+
+// Solid angle pdf at `from` to area pdf at `to`
+inline double convertDensity(const BidirectionalVertex &from, double pdf, const BidirectionalVertex &to) {
+    Vector3d w = to.p - from.p;
+    double distance2 = w.squaredLength();
+    if (distance2 == 0) return 0;
+    pdf /= distance2;
+    if (to.normal.squaredLength() > 0) pdf *= fabs(dot(to.normal, w)) / sqrt(distance2);
+    return pdf;
+}
+
+// BSDF (without cosine) of a surface vertex for light arriving
+// from direction toLight and leaving towards toCamera
+inline Color vertexBSDF(const BidirectionalVertex &v, const Vector3d &toCamera, const Vector3d &toLight) {
+    double cosine = fabs(dot(toLight, v.normal));
+    if (cosine == 0) return Color(0, 0, 0);
+    double pdf;
+    return v.hitRecord.material->evaluate(Ray(v.p + toCamera, -toCamera), v.hitRecord, toLight, pdf) / cosine;
+}
+
+// Area pdf at `next` of a light vertex (or a surface vertex that
+// emits) sending its ray there
+inline double lightVertexPdf(const BidirectionalVertex &v, const BidirectionalVertex &next) {
+    Vector3d direction = unitVector(next.p - v.p);
+    double pdfPosition, pdfDirection;
+    v.primitive->emissionPdf(v.index, v.p, v.normal, direction, pdfPosition, pdfDirection);
+    return convertDensity(v, pdfDirection, next);
+}
+
+// Area pdf of a light path starting at v
+inline double lightOriginPdf(const BidirectionalVertex &v, const LightBVH *lights) {
+    double pdfPosition, pdfDirection;
+    v.primitive->emissionPdf(v.index, v.p, v.normal, v.normal, pdfPosition, pdfDirection);
+    return lights->powerPmf(v.light) * pdfPosition;
+}
+
+// Area pdf of light sampling at `from` picking the light vertex v
+inline double lightSamplingPdf(const BidirectionalVertex &v, const BidirectionalVertex &from, const DirectLighting &lighting) {
+    if (from.type != VertexType::Surface || !isConnectible(from)) return 0;
+    double pmf = lighting.lights->pmf(from.p, from.normal, v.light, lighting.mode);
+    if (pmf == 0) return 0;
+    return convertDensity(from, pmf * v.primitive->lightPdf(v.index, from.p, v.p), v);
+}
+
+// Area pdf at `next` of v scattering there after being reached
+// from `previous` (nullptr for the ends of a subpath)
+inline double vertexPdf(const BidirectionalVertex &v, const BidirectionalVertex *previous, const BidirectionalVertex &next,
+                        const Camera &camera) {
+    if (v.type == VertexType::Light) return lightVertexPdf(v, next);
+    Vector3d direction = next.p - v.p;
+    if (direction.squaredLength() == 0) return 0;
+    direction = unitVector(direction);
+    double pdf;
+    if (v.type == VertexType::Camera) {
+        double pdfPosition;
+        camera.importancePdf(Ray(v.p, direction), pdfPosition, pdf);
+    } else {
+        v.hitRecord.material->evaluate(Ray(previous->p, v.p - previous->p), v.hitRecord, direction, pdf);
+    }
+    return convertDensity(v, pdf, next);
+}
+
+inline bool isVisible(const Hitable *scene, const Vector3d &a, const Vector3d &b) {
+    raysTraced()++;
+    Vector3d d = b - a;
+    double distance = d.length();
+    return !scene->occluded(Ray(a, d / distance), 0.001, distance - 0.001);
+}
+
+/* Subpaths */
+// Extends path (whose last vertex sends `ray` with solid angle pdf
+// `pdf`) until it leaves the scene, is absorbed or has maxVertices
+// vertices. Camera subpaths scatter with the dimensions of
+// color()'s bounces, light subpaths with their own.
+inline void randomWalk(const Hitable *scene, const LightBVH *lights, Ray ray, Color beta, double pdf, size_t maxVertices, bool fromLight,
+                       Sampler &sampler, std::vector<BidirectionalVertex> &path) {
+    double pdfForward = pdf;
+    while (path.size() < maxVertices) {
+        raysTraced()++;
+        PrimitiveHit hit;
+        if (!scene->closestHit(ray, 0.001, MAXFLOAT, hit)) break;
+        HitRecord hitRecord;
+        hit.primitive->surface(ray, hit, hitRecord);
+        hitRecord.footprint = 0;
+        BidirectionalVertex vertex = bidirectionalVertex(VertexType::Surface, hitRecord.p, hitRecord.normal, beta);
+        vertex.hitRecord = hitRecord;
+        vertex.primitive = hit.primitive;
+        vertex.index = hit.index;
+        if (lights && !isBlack(hitRecord.material->emitted())) vertex.light = lights->find(hit.primitive, hit.index);
+        vertex.pdfForward = convertDensity(path.back(), pdfForward, vertex);
+        path.push_back(vertex);
+        if (path.size() >= maxVertices) break;
+
+        BidirectionalVertex &current = path[path.size() - 1];
+        BidirectionalVertex &previous = path[path.size() - 2];
+        if (fromLight) sampler.startLightPath(int(path.size()) - 1);
+        else sampler.startBounce(int(path.size()) - 2);
+        Color attenuation;
+        Ray scattered;
+        double scatterPdf;
+        if (!hitRecord.material->scatter(ray, hitRecord, sampler, attenuation, scattered, scatterPdf)) break;
+        Vector3d out = unitVector(scattered.direction());
+        Vector3d toPrevious = unitVector(previous.p - current.p);
+        double pdfReverse = 0;
+        if (scatterPdf == 0) {
+            current.delta = true;
+            pdfForward = 0;
+            beta *= attenuation;
+        } else {
+            pdfForward = scatterPdf;
+            hitRecord.material->evaluate(Ray(current.p + out, -out), hitRecord, toPrevious, pdfReverse);
+            // scatter()'s attenuation is for light arriving along out
+            if (fromLight) beta *= vertexBSDF(current, out, toPrevious) * (fabs(dot(out, current.normal)) / scatterPdf);
+            else beta *= attenuation;
+        }
+        previous.pdfReverse = convertDensity(current, pdfReverse, previous);
+        if (isBlack(beta)) break;
+        ray = scattered;
+    }
+}
+
+inline void cameraSubpath(const Ray &ray, const Camera &camera, const Hitable *scene, const LightBVH *lights, int maxDepth,
+                          Sampler &sampler, std::vector<BidirectionalVertex> &path) {
+    path.clear();
+    path.push_back(bidirectionalVertex(VertexType::Camera, ray.origin(), Vector3d(0, 0, 0), Color(1, 1, 1)));
+    double pdfPosition, pdfDirection;
+    camera.importancePdf(ray, pdfPosition, pdfDirection);
+    randomWalk(scene, lights, ray, Color(1, 1, 1), pdfDirection, size_t(maxDepth) + 2, false, sampler, path);
+}
+
+inline void lightSubpath(const Hitable *scene, const LightBVH *lights, int maxDepth, Sampler &sampler,
+                         std::vector<BidirectionalVertex> &path) {
+    path.clear();
+    if (!lights) return;
+    sampler.startLightPath(0);
+    double u = sampler.get1D();
+    Vector3d uPosition = sampler.get2D();
+    Vector3d uDirection = sampler.get2D();
+    int light;
+    double pmf;
+    if (!lights->samplePower(u, light, pmf)) return;
+    const LightSource &source = lights->light(light);
+    EmissionSample emission;
+    if (!source.primitive->sampleEmission(source.index, uPosition, uDirection, emission)) return;
+    BidirectionalVertex vertex = bidirectionalVertex(VertexType::Light, emission.p, emission.normal, emission.radiance);
+    vertex.primitive = source.primitive;
+    vertex.index = source.index;
+    vertex.light = light;
+    vertex.pdfForward = pmf * emission.pdfPosition;
+    path.push_back(vertex);
+    Color beta = emission.radiance * (fabs(dot(emission.normal, emission.direction)) / (pmf * emission.pdfPosition * emission.pdfDirection));
+    randomWalk(scene, lights, Ray(emission.p, emission.direction), beta, emission.pdfDirection, size_t(maxDepth) + 1, true, sampler, path);
+}
+
+/* MIS weight */
+// pbrt-v3's MISWeight() with squared ratios (power heuristic): the
+// ratios of the other strategies' pdfs to this one's, walking away
+// from the connection on both sides.
+// qs (last light vertex) and pt (last camera vertex) are the
+// sampled vertex for s = 1 and t = 1, the reverse pdfs of
+// qs, pt and their predecessors are the ones of the connected path.
+// Zero pdfs (specular vertices) count as 1 in the ratios, the
+// strategies they stand for are skipped.
+// Unlike pbrt, s = 1 is color()'s light sampling (light BVH, cone
+// of the sphere), which picks the light vertex x0 from x1 with a
+// different pdf than a light path starting there. The ratios are
+// built with the light path's pdf and the one of s = 1 is then
+// corrected by neeRatio. (With the uniform point pbrt assumes,
+// light sampling would look far worse than it is, and the noisier
+// strategies would get its share.)
+inline double misWeight(const std::vector<BidirectionalVertex> &lightPath, const std::vector<BidirectionalVertex> &cameraPath,
+                        const BidirectionalVertex &sampled, int s, int t, const Camera &camera, const DirectLighting &lighting) {
+    if (s + t == 2) return 1;
+    const LightBVH *lights = lighting.lights;
+    auto remap0 = [](double f) { return f != 0 ? f : 1; };
+    auto square = [](double f) { return f * f; };
+    const BidirectionalVertex *qs = s > 0 ? (s == 1 ? &sampled : &lightPath[s - 1]) : nullptr;
+    const BidirectionalVertex *pt = t > 0 ? (t == 1 ? &sampled : &cameraPath[t - 1]) : nullptr;
+    const BidirectionalVertex *qsMinus = s > 1 ? &lightPath[s - 2] : nullptr;
+    const BidirectionalVertex *ptMinus = t > 1 ? &cameraPath[t - 2] : nullptr;
+    double ptReverse = 0;
+    if (t > 1) ptReverse = s > 0 ? vertexPdf(*qs, qsMinus, *pt, camera) : lightOriginPdf(*pt, lights);
+    double ptMinusReverse = 0;
+    if (ptMinus) ptMinusReverse = s > 0 ? vertexPdf(*pt, qs, *ptMinus, camera) : lightVertexPdf(*pt, *ptMinus);
+    double qsReverse = qs ? vertexPdf(*pt, ptMinus, *qs, camera) : 0;
+    double qsMinusReverse = qsMinus ? vertexPdf(*qs, pt, *qsMinus, camera) : 0;
+    const BidirectionalVertex &x0 = s == 0 ? *pt : s == 1 ? sampled : lightPath[0];
+    const BidirectionalVertex &x1 = s == 0 ? *ptMinus : s == 1 ? *pt : lightPath[1];
+    double neeRatio = lighting.mode == LightSampling::None ? 0 : lightSamplingPdf(x0, x1, lighting) / lightOriginPdf(x0, lights);
+
+    double sumRatios = 0;
+    double ratio = 1;
+    for (int i = t - 1; i > 0; i--) {
+        double reverse = i == t - 1 ? ptReverse : i == t - 2 ? ptMinusReverse : cameraPath[i].pdfReverse;
+        ratio *= remap0(reverse) / remap0(cameraPath[i].pdfForward);
+        bool delta = i == t - 1 ? false : cameraPath[i].delta;
+        // s = 0: the first step is strategy s = 1
+        if (!delta && !cameraPath[i - 1].delta) sumRatios += s == 0 && i == t - 1 ? square(ratio * neeRatio) : square(ratio);
+    }
+    ratio = 1;
+    for (int i = s - 1; i >= 0; i--) {
+        double reverse = i == s - 1 ? qsReverse : i == s - 2 ? qsMinusReverse : lightPath[i].pdfReverse;
+        double forward = i == s - 1 ? qs->pdfForward : lightPath[i].pdfForward;
+        ratio *= remap0(reverse) / remap0(forward);
+        bool delta = i == s - 1 ? false : lightPath[i].delta;
+        // Area lights only, none is a delta light
+        bool deltaBefore = i > 0 ? lightPath[i - 1].delta : false;
+        if (!delta && !deltaBefore) sumRatios += i == 1 ? square(ratio * neeRatio) : square(ratio);
+    }
+    if (s == 1) sumRatios /= square(neeRatio);
+    return 1 / (1 + sumRatios);
+}
+
+/* Connections */
+// The MIS weighted contribution of strategy (s, t). For t = 1 it
+// belongs to the image position (splatS, splatT) instead of the
+// pixel being sampled.
+inline Color connectSubpaths(const std::vector<BidirectionalVertex> &lightPath, const std::vector<BidirectionalVertex> &cameraPath,
+                             int s, int t, const Hitable *scene, const DirectLighting &lighting, const Camera &camera, Sampler &sampler,
+                             double &splatS, double &splatT) {
+    const LightBVH *lights = lighting.lights;
+    Color L(0, 0, 0);
+    BidirectionalVertex sampled = bidirectionalVertex(VertexType::Surface, Vector3d(0, 0, 0), Vector3d(0, 0, 0), L);
+    if (s == 0) {
+        // The camera path hit a light
+        const BidirectionalVertex &pt = cameraPath[t - 1];
+        if (pt.light < 0) return L;
+        L = pt.beta * pt.hitRecord.material->emitted();
+    } else if (t == 1) {
+        // Light vertex to a point on the lens
+        const BidirectionalVertex &qs = lightPath[s - 1];
+        if (!isConnectible(qs)) return L;
+        sampler.startCameraConnection(s - 1);
+        Vector3d lensPoint;
+        double pdf, importance;
+        if (!camera.sampleImportance(qs.p, sampler.get2D(), lensPoint, pdf, importance, splatS, splatT)) return L;
+        sampled = bidirectionalVertex(VertexType::Camera, lensPoint, camera.forward(), Color(1, 1, 1) * (importance / pdf));
+        Vector3d toCamera = unitVector(lensPoint - qs.p);
+        L = qs.beta * vertexBSDF(qs, toCamera, unitVector(lightPath[s - 2].p - qs.p)) * sampled.beta * fabs(dot(toCamera, qs.normal));
+        if (isBlack(L) || !isVisible(scene, qs.p, lensPoint)) return Color(0, 0, 0);
+    } else if (s == 1) {
+        // Camera vertex to a point sampled on a light
+        const BidirectionalVertex &pt = cameraPath[t - 1];
+        if (!isConnectible(pt) || !lights) return L;
+        sampler.startLightSample(t - 2);
+        double u = sampler.get1D();
+        Vector3d u2 = sampler.get2D();
+        int light;
+        double pmf;
+        if (!lights->sample(pt.p, pt.normal, u, lighting.mode, light, pmf)) return L;
+        const LightSource &source = lights->light(light);
+        LightSample lightSample;
+        if (!source.primitive->sampleLight(source.index, pt.p, u2, lightSample) || lightSample.pdf <= 0) return L;
+        sampled = bidirectionalVertex(VertexType::Light, lightSample.p, lightSample.normal, lightSample.radiance / (lightSample.pdf * pmf));
+        sampled.primitive = source.primitive;
+        sampled.index = source.index;
+        sampled.light = light;
+        sampled.pdfForward = lightOriginPdf(sampled, lights);
+        Vector3d toLight = unitVector(lightSample.p - pt.p);
+        L = pt.beta * vertexBSDF(pt, unitVector(cameraPath[t - 2].p - pt.p), toLight) * sampled.beta * fabs(dot(toLight, pt.normal));
+        if (isBlack(L) || !isVisible(scene, pt.p, lightSample.p)) return Color(0, 0, 0);
+    } else {
+        // Two surface vertices
+        const BidirectionalVertex &qs = lightPath[s - 1];
+        const BidirectionalVertex &pt = cameraPath[t - 1];
+        if (!isConnectible(qs) || !isConnectible(pt)) return L;
+        Vector3d d = pt.p - qs.p;
+        double distance2 = d.squaredLength();
+        if (distance2 == 0) return L;
+        Vector3d w = d / sqrt(distance2);
+        L = qs.beta * vertexBSDF(qs, w, unitVector(lightPath[s - 2].p - qs.p)) *
+            vertexBSDF(pt, unitVector(cameraPath[t - 2].p - pt.p), -w) * pt.beta;
+        L *= fabs(dot(qs.normal, w)) * fabs(dot(pt.normal, w)) / distance2;
+        if (isBlack(L) || !isVisible(scene, qs.p, pt.p)) return Color(0, 0, 0);
+    }
+    return L * misWeight(lightPath, cameraPath, sampled, s, t, camera, lighting);
+}
+
+/* Bidirectional pixel sample */
+// Same dimensions 0..3 as samplePixel(), then both subpaths and
+// every connection of at most maxDepth bounces. Returns what
+// belongs to this pixel, light tracing goes to film.addSplat().
+inline Color bidirectionalSample(int pixel, int line, int index, int width, int height, const Camera &camera, const Hitable *scene,
+                                 const DirectLighting &lighting, int maxDepth, Sampler &sampler, Film &film) {
+    const LightBVH *lights = lighting.lights;
+    // Per thread so paths don't allocate
+    thread_local std::vector<BidirectionalVertex> cameraPath;
+    thread_local std::vector<BidirectionalVertex> lightPath;
+    sampler.startPixelSample(pixel, line, index);
+    Vector3d jitter = sampler.get2D();
+    double u = (double(pixel) + jitter.x()) / double(width);
+    double v = (double(line) + jitter.y()) / double(height);
+    Vector3d lensOffset = randomInUnitDisk(sampler.get2D());
+    cameraSubpath(camera.getRay(u, v, lensOffset), camera, scene, lights, maxDepth, sampler, cameraPath);
+    lightSubpath(scene, lights, maxDepth, sampler, lightPath);
+
+    Color L(0, 0, 0);
+    for (int t = 1; t <= int(cameraPath.size()); t++) {
+        for (int s = 0; s <= int(lightPath.size()); s++) {
+            int depth = s + t - 2;
+            if ((s == 1 && t == 1) || depth < 0 || depth > maxDepth) continue;
+            double splatS, splatT;
+            Color contribution = connectSubpaths(lightPath, cameraPath, s, t, scene, lighting, camera, sampler, splatS, splatT);
+            if (isBlack(contribution)) continue;
+            if (t == 1) {
+                int x = std::min(int(splatS * width), width - 1);
+                int y = std::min(int(splatT * height), height - 1);
+                film.addSplat(x, y, contribution);
+            } else {
+                L += contribution;
+            }
+        }
+    }
+    return L;
+}
+
+/* Renderer */
+// Renders images of a built Scene as asynchronous jobs on a
+// ThreadPool. submit() returns at once with a RenderJob handle
+// whose future delivers the finished Film.
+//
+// * A job renders spp passes, one sample per pixel each. A pass is
+//   split into the framebuffer's tiles, which the job's runners
+//   (one pool task per thread) pull from a shared counter. The
+//   runner that finishes last reports the pass and schedules the
+//   next one, so no pool thread ever waits for another.
+// * Jobs only read the scene: any number of jobs, from one or
+//   several Renderers on the same pool, can render one scene at
+//   the same time. The scene must outlive its jobs.
+// * cancel() stops a job after the tiles in flight, also in the
+//   middle of a pass. Its Film then holds pass n + 1 in the tiles
+//   that got it and pass n in the rest, every pixel is still an
+//   average of its own samples.
+// * A job can render several views of the scene at once (product
+//   shots, stereo pairs, cube faces), each with its own camera,
+//   resolution and Film. The tiles of all views form one queue per
+//   pass, so threads that finish a small view keep working on the
+//   others instead of waiting at the end of its pass. View v
+//   samples with seed + v, so views don't share their noise.
+// * With settings.guiding the job learns a GuidingField from its
+//   own paths (all views) and guides later passes with it. The
+//   field is refined in finishPass(), between passes. The film
+//   keeps the early, less guided passes too: every pass is an
+//   unbiased estimate, they only have more noise.
+// * settings.integrator "bdpt" renders with bidirectionalSample()
+//   instead of samplePixel(): every pixel sample also traces a
+//   light path, whose splats every film sums next to its means.
+//   Light paths start on lights picked by power, s = 1 connections
+//   use settings.lightSampling. No guiding.
+// * settings.crop renders only a rectangle of every view (the
+//   camera still maps the whole frame, pixels outside stay black).
+//   Not with bdpt, whose light paths splat into the whole frame.
+//   settings.tileOrder picks the order of the tiles in a pass
+//   (scanline, spiral or hilbert, see TileSchedule.hpp).
+// * settings.priorityRegions are rendered first: the job renders
+//   all spp passes over the tiles that touch a region, then all
+//   passes over the rest. Their progress is in
+//   RenderProgress::prioritySamplesCompleted, samplesCompleted
+//   only counts passes over the whole (cropped) frame. Not with
+//   guiding, whose training needs every pass to cover the image.
+// * On a pool spread over NUMA nodes every node renders its own
+//   band of each view, against its own replica of the scene (see
+//   Scene::setReplica()), into film memory placed on the node by
+//   first touch. A node that runs out of tiles takes tiles of the
+//   other bands. The image is the same as without nodes.
+// * settings.packetSize > 0 traces the camera rays of n x n pixel
+//   blocks of a tile as packets (samplePacket()), same image. The
+//   path integrator only, bdpt traces its camera subpaths alone.
+// * Callbacks run on pool threads: onTile after every tile (from
+//   any runner, concurrently), onPass after every complete pass
+//   while no runner touches the films, so they may be resolved and
+//   written there (progressive output).
+struct RenderSettings {
+    int width = 960; // of submit()'s single view
+    int height = 400;
+    int spp = 800;
+    int maxDepth = 50;
+    std::string sampler = "sobol";
+    std::string lightSampling = "bvh"; // none, uniform or bvh
+    std::string integrator = "path"; // path or bdpt (bidirectional)
+    bool guiding = false;
+    size_t guidingBytes = size_t(64) << 20; // bound of the guiding field
+    uint64_t seed = 0;
+    PixelFormat pixelFormat = PixelFormat::Float32;
+    PixelRect crop; // empty: the whole frame
+    std::string tileOrder = "scanline"; // scanline, spiral or hilbert
+    std::vector<PixelRect> priorityRegions;
+    int packetSize = 0; // camera rays traced n x n at a time (1-8), 0: one by one
+};
+
+// A view can also be a strip of a taller frame: rows frameY to
+// frameY + height (from the bottom) of a frame frameHeight rows
+// high, with the camera mapping the whole frame (see
+// StripRender.hpp). frameHeight 0: the view is the whole frame.
+struct RenderView {
+    Camera camera;
+    int width;
+    int height;
+    int frameY = 0;
+    int frameHeight = 0;
+};
+
+struct RenderProgress {
+    int samplesCompleted; // complete passes
+    int prioritySamplesCompleted; // complete passes over the priority regions
+    int samplesTotal;
+    int64_t tilesCompleted; // over all passes and views
+    int64_t tilesTotal;
+    uint64_t rays;
+    double seconds; // since submit()
+};
+
+class RenderJob;
+
+struct RenderCallbacks {
+    std::function<void(const RenderProgress &)> onTile;
+    std::function<void(const RenderJob &, const RenderProgress &)> onPass;
+};
+
+struct RenderResult {
+    std::shared_ptr<Film> film; // of the first view
+    std::vector<std::shared_ptr<Film>> films; // one per view
+    int samplesCompleted;
+    bool cancelled;
+    uint64_t rays;
+    double seconds;
+};
+
+class RenderJob {
+    friend class Renderer;
+    struct View {
+        Camera camera;
+        int width;
+        int height;
+        int frameY;
+        int frameHeight;
+        Sampler *sampler;
+        std::shared_ptr<Film> film;
+    };
+    // A tile of a view in the queue of a phase
+    struct Tile {
+        int view;
+        TileRect rect;
+    };
+    // The scene as seen from one NUMA node of the pool (its replica)
+    struct NodeScene {
+        const Hitable *world;
+        DirectLighting lighting;
+    };
+    ThreadPool *pool;
+    std::vector<NodeScene> nodeScenes; // one per node of the pool
+    GuidingField *guiding; // owned, nullptr without guiding
+    bool bidirectional;
+    std::vector<View> views;
+    RenderSettings settings;
+    RenderCallbacks callbacks;
+    // Phase 0: the tiles of the priority regions, phase 1: the rest.
+    // Each phase renders all spp passes over its tiles. The tiles of
+    // a phase are grouped by node: node n starts with the tiles
+    // phaseStarts[phase][n] to phaseStarts[phase][n + 1] (all of them
+    // on a single node).
+    std::vector<Tile> phases[2];
+    std::vector<int> phaseStarts[2];
+    int phase;
+    int runnersPerPass;
+    int pass;
+    std::vector<std::atomic<int>> nextTiles; // per node
+    std::atomic<int> activeRunners;
+    std::atomic<int> samplesCompleted;
+    std::atomic<int> prioritySamplesCompleted;
+    std::atomic<int64_t> tilesCompleted;
+    std::atomic<uint64_t> rays;
+    std::atomic<bool> cancelled;
+    std::atomic<bool> finished;
+    std::chrono::steady_clock::time_point start;
+    std::promise<RenderResult> promise;
+    std::shared_future<RenderResult> future;
+    RenderJob(const RenderJob &) = delete;
+    RenderJob &operator=(const RenderJob &) = delete;
+public:
+    RenderJob();
+    ~RenderJob();
+    void cancel();
+    bool isCancelled() const;
+    bool isDone() const;
+    RenderProgress progress() const;
+    int viewCount() const;
+    // The film of a view being rendered: only read it in onPass or
+    // once the job is done.
+    const Film &getFilm(int view = 0) const;
+    // Same for the guiding field (nullptr without guiding)
+    const GuidingField *guidingField() const;
+    std::shared_future<RenderResult> result() const;
+    // Blocks until the job is done (finished or cancelled)
+    RenderResult wait() const;
+};
+
+inline RenderJob::RenderJob(): pool(nullptr), guiding(nullptr), bidirectional(false), phase(0), runnersPerPass(0), pass(0),
+                               activeRunners(0), samplesCompleted(0), prioritySamplesCompleted(0), tilesCompleted(0), rays(0),
+                               cancelled(false), finished(false) {}
+
+inline RenderJob::~RenderJob() {
+    for (View &view : views) delete view.sampler;
+    delete guiding;
+}
+
+inline void RenderJob::cancel() { cancelled = true; }
+inline bool RenderJob::isCancelled() const { return cancelled; }
+inline bool RenderJob::isDone() const { return finished; }
+inline int RenderJob::viewCount() const { return int(views.size()); }
+inline const Film &RenderJob::getFilm(int view) const { return *views[view].film; }
+inline const GuidingField *RenderJob::guidingField() const { return guiding; }
+inline std::shared_future<RenderResult> RenderJob::result() const { return future; }
+inline RenderResult RenderJob::wait() const { return future.get(); }
+
+inline RenderProgress RenderJob::progress() const {
+    RenderProgress progress;
+    progress.samplesCompleted = samplesCompleted;
+    progress.prioritySamplesCompleted = prioritySamplesCompleted;
+    progress.samplesTotal = settings.spp;
+    progress.tilesCompleted = tilesCompleted;
+    progress.tilesTotal = int64_t(phases[0].size() + phases[1].size()) * settings.spp;
+    progress.rays = rays;
+    progress.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return progress;
+}
+
+class Renderer {
+    ThreadPool *pool;
+    bool ownsPool;
+    static void startPass(const std::shared_ptr<RenderJob> &job);
+    static void runTiles(const std::shared_ptr<RenderJob> &job);
+    static void finishPass(const std::shared_ptr<RenderJob> &job);
+    Renderer(const Renderer &) = delete;
+    Renderer &operator=(const Renderer &) = delete;
+public:
+    // With its own pool of `threads` workers (<= 0: hardware threads),
+    // spread over the given NUMA nodes (none: not pinned)
+    Renderer(int threads = 0, const std::vector<NumaNode> &topology = std::vector<NumaNode>());
+    // On a pool shared with other renderers
+    Renderer(ThreadPool &pool);
+    // Waits for the jobs still running if the pool is its own
+    ~Renderer();
+    // Both return nullptr (after printing why) for invalid settings.
+    // One view of settings.width x settings.height
+    std::shared_ptr<RenderJob> submit(const Scene &scene, const Camera &camera, const RenderSettings &settings,
+                                      const RenderCallbacks &callbacks = RenderCallbacks());
+    // Any number of views in one job (settings.width/height unused)
+    std::shared_ptr<RenderJob> submit(const Scene &scene, const std::vector<RenderView> &views, const RenderSettings &settings,
+                                      const RenderCallbacks &callbacks = RenderCallbacks());
+    int threadCount() const;
+};
+
+inline Renderer::Renderer(int threads, const std::vector<NumaNode> &topology): pool(new ThreadPool(threads, topology)), ownsPool(true) {}
+inline Renderer::Renderer(ThreadPool &pool): pool(&pool), ownsPool(false) {}
+
+inline Renderer::~Renderer() {
+    if (ownsPool) delete pool;
+}
+
+inline int Renderer::threadCount() const { return pool->threadCount(); }
+
+inline std::shared_ptr<RenderJob> Renderer::submit(const Scene &scene, const Camera &camera, const RenderSettings &settings,
+                                                   const RenderCallbacks &callbacks) {
+    RenderView view;
+    view.camera = camera;
+    view.width = settings.width;
+    view.height = settings.height;
+    return submit(scene, std::vector<RenderView>(1, view), settings, callbacks);
+}
+
+inline std::shared_ptr<RenderJob> Renderer::submit(const Scene &scene, const std::vector<RenderView> &views, const RenderSettings &settings,
+                                                   const RenderCallbacks &callbacks) {
+    if (views.empty() || settings.spp <= 0) {
+        std::cout << "ERROR: a render needs at least one view and a positive spp." << std::endl;
+        return nullptr;
+    }
+    if (settings.pixelFormat == PixelFormat::Half && settings.spp > Framebuffer::halfMaxSamples) {
+        std::cout << "ERROR: a half framebuffer takes at most " << Framebuffer::halfMaxSamples << " spp." << std::endl;
+        return nullptr;
+    }
+    for (const RenderView &view : views) {
+        if (view.width <= 0 || view.height <= 0) {
+            std::cout << "ERROR: width and height must be positive." << std::endl;
+            return nullptr;
+        }
+        if (view.frameHeight > 0 && (view.frameY < 0 || view.frameY + view.height > view.frameHeight)) {
+            std::cout << "ERROR: the view is not a strip of its frame." << std::endl;
+            return nullptr;
+        }
+        // Light paths splat anywhere in the frame
+        if (view.frameHeight > 0 && settings.integrator == "bdpt") {
+            std::cout << "ERROR: bdpt can only render whole frames." << std::endl;
+            return nullptr;
+        }
+    }
+    if (!scene.world()) {
+        std::cout << "ERROR: scene is not built." << std::endl;
+        return nullptr;
+    }
+    std::shared_ptr<RenderJob> job(new RenderJob());
+    job->start = std::chrono::steady_clock::now();
+    job->pool = pool;
+    LightSampling lightSampling;
+    if (!parseLightSampling(settings.lightSampling, lightSampling)) {
+        std::cout << "ERROR: unknown light sampling " << settings.lightSampling << "." << std::endl;
+        return nullptr;
+    }
+    const int nodes = pool->nodeCount();
+    for (int node = 0; node < nodes; node++) {
+        const Scene &replica = scene.replica(node);
+        job->nodeScenes.push_back(RenderJob::NodeScene{ replica.world(), DirectLighting{ replica.lights(), lightSampling } });
+    }
+    if (settings.integrator != "path" && settings.integrator != "bdpt") {
+        std::cout << "ERROR: unknown integrator " << settings.integrator << "." << std::endl;
+        return nullptr;
+    }
+    job->bidirectional = settings.integrator == "bdpt";
+    if (job->bidirectional && settings.guiding) {
+        std::cout << "ERROR: path guiding needs the path integrator." << std::endl;
+        return nullptr;
+    }
+    if (job->bidirectional && !settings.crop.isEmpty()) {
+        std::cout << "ERROR: bdpt can not render a crop window." << std::endl;
+        return nullptr;
+    }
+    TileOrder tileOrder;
+    if (!parseTileOrder(settings.tileOrder, tileOrder)) {
+        std::cout << "ERROR: unknown tile order " << settings.tileOrder << "." << std::endl;
+        return nullptr;
+    }
+    if (settings.packetSize < 0 || settings.packetSize * settings.packetSize > RayPacket::maxSize) {
+        std::cout << "ERROR: packets are 1 x 1 to 8 x 8 pixels." << std::endl;
+        return nullptr;
+    }
+    if (settings.guiding && !settings.priorityRegions.empty()) {
+        std::cout << "ERROR: path guiding can not render priority regions first." << std::endl;
+        return nullptr;
+    }
+    if (settings.guiding) job->guiding = new GuidingField(settings.spp, settings.guidingBytes);
+    job->settings = settings;
+    job->callbacks = callbacks;
+    job->views.resize(views.size());
+    for (size_t i = 0; i < views.size(); i++) {
+        RenderJob::View &view = job->views[i];
+        view.camera = views[i].camera;
+        view.width = views[i].width;
+        view.height = views[i].height;
+        view.frameY = views[i].frameHeight > 0 ? views[i].frameY : 0;
+        view.frameHeight = views[i].frameHeight > 0 ? views[i].frameHeight : view.height;
+        view.sampler = createSampler(settings.sampler, settings.spp, settings.seed + i);
+        if (!view.sampler) {
+            std::cout << "ERROR: unknown sampler " << settings.sampler << "." << std::endl;
+            return nullptr;
+        }
+        // On several nodes the pages of the film land on the node
+        // that renders them first
+        view.film = std::make_shared<Film>(view.width, view.height, settings.pixelFormat, nodes > 1);
+        view.film->setFrameY(view.frameY);
+        if (job->bidirectional) view.film->enableSplats();
+        std::vector<TileRect> priority, rest;
+        scheduleTiles(view.width, view.height, Framebuffer::tileSize, settings.crop, tileOrder, settings.priorityRegions, priority, rest);
+        for (const TileRect &rect : priority) job->phases[0].push_back(RenderJob::Tile{ int(i), rect });
+        for (const TileRect &rect : rest) job->phases[1].push_back(RenderJob::Tile{ int(i), rect });
+    }
+    if (job->phases[0].empty() && job->phases[1].empty()) {
+        std::cout << "ERROR: the crop window is outside the image." << std::endl;
+        return nullptr;
+    }
+    // Every node gets a band of each view's tiles (in storage order,
+    // so a band is one contiguous piece of the framebuffer) and keeps
+    // rendering the same band in every pass: the band's film memory
+    // stays on its node. Within a band the tile order is kept.
+    auto band = [&](const RenderJob::Tile &tile) {
+        const RenderJob::View &view = job->views[tile.view];
+        int tilesX = (view.width + Framebuffer::tileSize - 1) / Framebuffer::tileSize;
+        int tilesY = (view.height + Framebuffer::tileSize - 1) / Framebuffer::tileSize;
+        int index = (tile.rect.y0 / Framebuffer::tileSize) * tilesX + tile.rect.x0 / Framebuffer::tileSize;
+        return int(int64_t(index) * nodes / (int64_t(tilesX) * tilesY));
+    };
+    for (int p = 0; p < 2; p++) {
+        std::vector<RenderJob::Tile> &tiles = job->phases[p];
+        std::stable_sort(tiles.begin(), tiles.end(), [&](const RenderJob::Tile &a, const RenderJob::Tile &b) { return band(a) < band(b); });
+        for (int node = 0; node <= nodes; node++) {
+            auto start = std::partition_point(tiles.begin(), tiles.end(), [&](const RenderJob::Tile &tile) { return band(tile) < node; });
+            job->phaseStarts[p].push_back(int(start - tiles.begin()));
+        }
+    }
+    std::vector<std::atomic<int>>(nodes).swap(job->nextTiles);
+    job->phase = job->phases[0].empty() ? 1 : 0;
+    job->future = job->promise.get_future().share();
+    startPass(job);
+    return job;
+}
+
+inline void Renderer::startPass(const std::shared_ptr<RenderJob> &job) {
+    for (size_t node = 0; node < job->nextTiles.size(); node++) job->nextTiles[node] = job->phaseStarts[job->phase][node];
+    job->runnersPerPass = std::min(job->pool->threadCount(), int(job->phases[job->phase].size()));
+    job->activeRunners = job->runnersPerPass;
+    for (int i = 0; i < job->runnersPerPass; i++) {
+        job->pool->submit([job]() { runTiles(job); });
+    }
+}
+
+inline void Renderer::runTiles(const std::shared_ptr<RenderJob> &job) {
+    const int pass = job->pass;
+    const std::vector<RenderJob::Tile> &tiles = job->phases[job->phase];
+    const std::vector<int> &starts = job->phaseStarts[job->phase];
+    const int nodes = int(job->nextTiles.size());
+    const int node = std::min(ThreadPool::currentNode(), nodes - 1);
+    const RenderJob::NodeScene &scene = job->nodeScenes[node];
+    // The next tile of this node's band, else one of the other bands
+    // (a node that is done early helps the others)
+    auto nextTile = [&]() {
+        for (int i = 0; i < nodes; i++) {
+            int n = (node + i) % nodes;
+            if (job->nextTiles[n] >= starts[n + 1]) continue;
+            int tile = job->nextTiles[n]++;
+            if (tile < starts[n + 1]) return tile;
+        }
+        return -1;
+    };
+    // Sampler copies per view, made when the runner first gets a
+    // tile of that view
+    std::vector<Sampler *> local(job->views.size(), nullptr);
+    uint64_t raysBefore = raysTraced();
+    const int packetSize = job->bidirectional ? 0 : job->settings.packetSize;
+    RayPacket packet;
+    Color radiance[RayPacket::maxSize];
+    for (int tile = nextTile(); tile >= 0 && !job->cancelled; tile = nextTile()) {
+        const int v = tiles[tile].view;
+        const TileRect &rect = tiles[tile].rect;
+        RenderJob::View &view = job->views[v];
+        if (!local[v]) local[v] = view.sampler->clone();
+        // Pixels are sampled in frame rows (line + frameY), so a strip
+        // gets the same samples as the whole frame there
+        const int frameY = view.frameY;
+        for (int y = rect.y0; packetSize > 0 && y < rect.y1; y += packetSize) {
+            for (int x = rect.x0; x < rect.x1; x += packetSize) {
+                TileRect block{ x, y + frameY, std::min(x + packetSize, rect.x1), std::min(y + packetSize, rect.y1) + frameY };
+                samplePacket(block, pass, view.width, view.frameHeight, view.camera, scene.world, scene.lighting, job->guiding,
+                             job->settings.maxDepth, *local[v], packet, radiance);
+                int i = 0;
+                for (int line = block.y0; line < block.y1; line++) {
+                    for (int pixel = block.x0; pixel < block.x1; pixel++) view.film->addSample(pixel, line - frameY, radiance[i++], pass + 1);
+                }
+            }
+        }
+        for (int line = rect.y0; packetSize == 0 && line < rect.y1; line++) {
+            for (int pixel = rect.x0; pixel < rect.x1; pixel++) {
+                // Get color for pixel sample, add to film
+                Color sample;
+                if (job->bidirectional) {
+                    sample = bidirectionalSample(pixel, line, pass, view.width, view.height, view.camera, scene.world, scene.lighting,
+                                                 job->settings.maxDepth, *local[v], *view.film);
+                } else {
+                    sample = samplePixel(pixel, line + frameY, pass, view.width, view.frameHeight, view.camera, scene.world, scene.lighting,
+                                         job->guiding, job->settings.maxDepth, *local[v]);
+                }
+                view.film->addSample(pixel, line, sample, pass + 1);
+            }
+        }
+        if (job->bidirectional) view.film->addLightPaths(rect.pixelCount());
+        job->tilesCompleted++;
+        if (job->callbacks.onTile) job->callbacks.onTile(job->progress());
+    }
+    job->rays += raysTraced() - raysBefore;
+    for (Sampler *sampler : local) delete sampler;
+    if (--job->activeRunners == 0) finishPass(job);
+}
+
+// Runs on the last runner of a pass, no other runner is active.
+// After the last pass of the priority phase the other tiles start
+// over at pass 0.
+inline void Renderer::finishPass(const std::shared_ptr<RenderJob> &job) {
+    if (!job->cancelled) {
+        if (job->guiding) job->guiding->finishPass(job->pass);
+        bool lastPhase = job->phase == 1 || job->phases[1].empty();
+        if (job->phase == 0 || job->phases[0].empty()) job->prioritySamplesCompleted = job->pass + 1;
+        if (lastPhase) job->samplesCompleted = job->pass + 1;
+        if (job->callbacks.onPass) job->callbacks.onPass(*job, job->progress());
+        if (job->pass + 1 < job->settings.spp && !job->cancelled) {
+            job->pass++;
+            startPass(job);
+            return;
+        }
+        if (!lastPhase && !job->cancelled) {
+            job->phase = 1;
+            job->pass = 0;
+            startPass(job);
+            return;
+        }
+    }
+    RenderResult result;
+    for (RenderJob::View &view : job->views) result.films.push_back(view.film);
+    result.film = result.films[0];
+    result.samplesCompleted = job->samplesCompleted;
+    result.cancelled = job->cancelled;
+    result.rays = job->rays;
+    result.seconds = job->progress().seconds;
+    job->finished = true;
+    job->promise.set_value(result);
+}
+
+#endif
@@ -0,0 +1,436 @@
+#ifndef Sampler_hpp
+#define Sampler_hpp
+
+#include <iostream>
+#include <string>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include "Vector3d.hpp"
+
+/* Sampler */
+// A Sampler hands out the uniform random numbers in [0, 1) that
+// drive every random decision of a path: pixel jitter, lens
+// position and the BSDF sampling done at every bounce.
+//
+// * Every pixel sample starts with startPixelSample(x, y, i). The
+//   sampler is then asked for consecutive dimensions with get1D()
+//   and get2D().
+// * Dimensions are assigned to decisions up front so that the same
+//   decision always gets the same dimension, no matter how many
+//   numbers the previous bounces consumed:
+//
+//   dimension  0..1  pixel jitter (u, v)
+//   dimension  2..3  lens position
+//   dimension  4 + depth * 16 ... 4 + depth * 16 + 3  BSDF at
+//                    bounce `depth` (lobe choice + direction)
+//   dimension  4 + depth * 16 + 4 ... 4 + depth * 16 + 6  light
+//                    sampling at bounce `depth` (light choice +
+//                    point on the light)
+//   dimension  4 + depth * 16 + 8 ... 4 + depth * 16 + 10  path
+//                    guiding at bounce `depth` (strategy choice +
+//                    guided direction); the bidirectional
+//                    integrator, which doesn't guide, picks the
+//                    lens point for light vertex `depth` there
+//   dimension  4 + depth * 16 + 11 ... 4 + depth * 16 + 15  light
+//                    subpath vertex `depth` of the bidirectional
+//                    integrator (light choice, point and direction
+//                    at depth 0, BSDF after that)
+//
+//   Materials never consume more than 4 numbers, the integrator
+//   calls startBounce(depth) before scattering,
+//   startLightSample(depth) before picking a light,
+//   startGuideSample(depth) before picking a guided direction,
+//   startCameraConnection(depth) before picking a lens point for a
+//   light vertex and startLightPath(depth) before extending a
+//   light subpath.
+// * Samplers are cheap value objects with no shared state: every
+//   render thread owns its own copy.
+class Sampler {
+protected:
+    int64_t spp;
+    uint64_t seed;
+    int pixelX;
+    int pixelY;
+    int64_t sampleIndex;
+    int dimension;
+public:
+    static const int pixelDimension = 0;
+    static const int lensDimension = 2;
+    static const int bsdfDimension = 4;
+    static const int lightDimension = 4;
+    static const int guideDimension = 8;
+    static const int cameraConnectionDimension = 8;
+    static const int lightPathDimension = 11;
+    static const int dimensionsPerBounce = 16;
+
+    Sampler(int spp, uint64_t seed): spp(spp), seed(seed), pixelX(0), pixelY(0), sampleIndex(0), dimension(0) {};
+    virtual ~Sampler() {};
+    virtual Sampler *clone() const = 0;
+    virtual const char *name() const = 0;
+    virtual void startPixelSample(int x, int y, int64_t index);
+    void startBounce(int depth);
+    void startLightSample(int depth);
+    void startGuideSample(int depth);
+    void startCameraConnection(int depth);
+    void startLightPath(int depth);
+    void setDimension(int d);
+    int samplesPerPixel() const;
+    virtual double get1D() = 0;
+    // Returns (u, v, 0).
+    virtual Vector3d get2D() = 0;
+};
+
+inline void Sampler::startPixelSample(int x, int y, int64_t index) {
+    pixelX = x;
+    pixelY = y;
+    sampleIndex = index;
+    dimension = 0;
+}
+
+inline void Sampler::startBounce(int depth) { dimension = bsdfDimension + depth * dimensionsPerBounce; }
+inline void Sampler::startLightSample(int depth) { dimension = bsdfDimension + depth * dimensionsPerBounce + lightDimension; }
+inline void Sampler::startGuideSample(int depth) { dimension = bsdfDimension + depth * dimensionsPerBounce + guideDimension; }
+inline void Sampler::startCameraConnection(int depth) { dimension = bsdfDimension + depth * dimensionsPerBounce + cameraConnectionDimension; }
+inline void Sampler::startLightPath(int depth) { dimension = bsdfDimension + depth * dimensionsPerBounce + lightPathDimension; }
+inline void Sampler::setDimension(int d) { dimension = d; }
+inline int Sampler::samplesPerPixel() const { return int(spp); }
+
+/* Hashing and scrambling helpers */
+// 1.0 - 2^-53, the largest double below 1.
+static const double oneMinusEpsilon = 0x1.fffffffffffffp-1;
+
+// SplitMix64 finalizer: a cheap, well mixing 64 bit hash.
+inline uint64_t mixBits(uint64_t v) {
+    v ^= (v >> 31);
+    v *= 0x7fb5d329728ea185ULL;
+    v ^= (v >> 27);
+    v *= 0x81dadef4bc2dd44dULL;
+    v ^= (v >> 33);
+    return v;
+}
+
+inline uint64_t hashValues(uint64_t a, uint64_t b, uint64_t c, uint64_t d) {
+    uint64_t h = mixBits(a + 0x9e3779b97f4a7c15ULL);
+    h = mixBits(h ^ (b + 0x9e3779b97f4a7c15ULL));
+    h = mixBits(h ^ (c + 0x9e3779b97f4a7c15ULL));
+    return mixBits(h ^ (d + 0x9e3779b97f4a7c15ULL));
+}
+
+inline uint32_t reverseBits32(uint32_t v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+    v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+    return (v >> 16) | (v << 16);
+}
+
+// Uniform double in [0, 1) from the top 53 bits of a hash.
+inline double hashToUnit(uint64_t h) {
+    return double(h >> 11) * 0x1.0p-53;
+}
+
+/* Random permutation without a table */
+// Andrew Kensler's "Correlated Multi-Jittered Sampling":
+// returns element i of a pseudo-random permutation of
+// 0 ... n - 1 selected by seed p.
+inline uint32_t permutationElement(uint32_t i, uint32_t n, uint32_t p) {
+    uint32_t w = n - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= n);
+    return (i + p) % n;
+}
+
+/* Owen scrambling */
+// Brent Burley's hash based approximation of nested uniform
+// (Owen) scrambling: flips every bit depending on all the
+// higher bits. Keeps the stratification of (0,2)-sequences.
+inline uint32_t owenScramble(uint32_t v, uint32_t seed) {
+    v = reverseBits32(v);
+    v ^= v * 0x3d20adea;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56;
+    v ^= v * 0x53a22864;
+    return reverseBits32(v);
+}
+
+/* Sobol (0,2)-sequence */
+// The first two Sobol dimensions: the van der Corput sequence
+// and its companion whose generator matrix is built from
+// v(k) = v(k-1) ^ (v(k-1) >> 1). Together they form a (0,2)-
+// sequence, i.e. every power of two prefix is stratified over
+// all elementary intervals of the unit square.
+inline uint32_t sobolDimension0(uint32_t i) {
+    return reverseBits32(i);
+}
+
+inline uint32_t sobolDimension1(uint32_t i) {
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1) {
+        if (i & 1) result ^= v;
+    }
+    return result;
+}
+
+inline double bitsToUnit(uint32_t v) {
+    return fmin(double(v) * 0x1.0p-32, oneMinusEpsilon);
+}
+
+/* Independent sampler */
+// Uncorrelated random numbers. The generator is reseeded for every
+// pixel sample so renders are reproducible and threads never share
+// generator state.
+class IndependentSampler: public Sampler {
+    unsigned short state[3];
+public:
+    IndependentSampler(int spp, uint64_t seed = 0): Sampler(spp, seed) { state[0] = state[1] = state[2] = 0; };
+    virtual Sampler *clone() const { return new IndependentSampler(*this); }
+    virtual const char *name() const { return "independent"; }
+    virtual void startPixelSample(int x, int y, int64_t index);
+    virtual double get1D();
+    virtual Vector3d get2D();
+};
+
+inline void IndependentSampler::startPixelSample(int x, int y, int64_t index) {
+    Sampler::startPixelSample(x, y, index);
+    uint64_t h = hashValues(uint64_t(x), uint64_t(y), uint64_t(index), seed);
+    state[0] = (unsigned short)(h);
+    state[1] = (unsigned short)(h >> 16);
+    state[2] = (unsigned short)(h >> 32);
+}
+
+inline double IndependentSampler::get1D() {
+    dimension++;
+    return erand48(state);
+}
+
+inline Vector3d IndependentSampler::get2D() {
+    dimension += 2;
+    double u = erand48(state);
+    double v = erand48(state);
+    return Vector3d(u, v, 0);
+}
+
+/* Stratified sampler */
+// Jittered stratification of every dimension (1D) and dimension pair
+// (2D) over the pixel's spp samples. Sample i of a pixel lands in
+// stratum permutation(i); the permutation differs per pixel and per
+// dimension so dimensions stay uncorrelated (Latin hypercube-like
+// padding).
+class StratifiedSampler: public Sampler {
+    int xStrata;
+    int yStrata;
+public:
+    StratifiedSampler(int spp, uint64_t seed = 0);
+    virtual Sampler *clone() const { return new StratifiedSampler(*this); }
+    virtual const char *name() const { return "stratified"; }
+    virtual double get1D();
+    virtual Vector3d get2D();
+};
+
+inline StratifiedSampler::StratifiedSampler(int spp, uint64_t seed): Sampler(spp, seed) {
+    xStrata = int(sqrt(double(spp)));
+    if (xStrata < 1) xStrata = 1;
+    yStrata = (spp + xStrata - 1) / xStrata;
+}
+
+inline double StratifiedSampler::get1D() {
+    uint64_t h = hashValues(uint64_t(pixelX), uint64_t(pixelY), uint64_t(dimension), seed);
+    uint32_t stratum = permutationElement(uint32_t(sampleIndex % spp), uint32_t(spp), uint32_t(h));
+    double jitter = hashToUnit(mixBits(h ^ uint64_t(sampleIndex)));
+    dimension++;
+    return fmin((stratum + jitter) / double(spp), oneMinusEpsilon);
+}
+
+inline Vector3d StratifiedSampler::get2D() {
+    uint64_t h = hashValues(uint64_t(pixelX), uint64_t(pixelY), uint64_t(dimension), seed);
+    uint32_t strata = uint32_t(xStrata * yStrata);
+    uint32_t stratum = permutationElement(uint32_t(sampleIndex % spp), strata, uint32_t(h));
+    uint64_t jitter = mixBits(h ^ uint64_t(sampleIndex));
+    double u = (stratum % xStrata + hashToUnit(jitter)) / double(xStrata);
+    double v = (stratum / xStrata + hashToUnit(mixBits(jitter))) / double(yStrata);
+    dimension += 2;
+    return Vector3d(fmin(u, oneMinusEpsilon), fmin(v, oneMinusEpsilon), 0);
+}
+
+/* Scrambled Sobol sampler */
+// Padded, Owen scrambled Sobol points. Every dimension pair uses the
+// (0,2)-sequence with its own scramble seed and its own shuffle of
+// the sample index (seeded by pixel and dimension), so no high
+// dimensional generator matrices are needed and dimensions are
+// decorrelated. Best results with power of two spp.
+class SobolSampler: public Sampler {
+public:
+    SobolSampler(int spp, uint64_t seed = 0): Sampler(spp, seed) {};
+    virtual Sampler *clone() const { return new SobolSampler(*this); }
+    virtual const char *name() const { return "sobol"; }
+    virtual double get1D();
+    virtual Vector3d get2D();
+};
+
+inline double SobolSampler::get1D() {
+    uint64_t h = hashValues(uint64_t(pixelX), uint64_t(pixelY), uint64_t(dimension), seed);
+    uint32_t index = permutationElement(uint32_t(sampleIndex % spp), uint32_t(spp), uint32_t(h));
+    dimension++;
+    return bitsToUnit(owenScramble(sobolDimension0(index), uint32_t(h >> 32)));
+}
+
+inline Vector3d SobolSampler::get2D() {
+    uint64_t h = hashValues(uint64_t(pixelX), uint64_t(pixelY), uint64_t(dimension), seed);
+    uint32_t index = permutationElement(uint32_t(sampleIndex % spp), uint32_t(spp), uint32_t(h));
+    uint64_t scramble = mixBits(h);
+    double u = bitsToUnit(owenScramble(sobolDimension0(index), uint32_t(scramble)));
+    double v = bitsToUnit(owenScramble(sobolDimension1(index), uint32_t(scramble >> 32)));
+    dimension += 2;
+    return Vector3d(u, v, 0);
+}
+
+/* Blue noise mask */
+// A 64x64 tileable array of ranks 0 ... 4095 (divided by 4096)
+// with a blue noise spectrum, generated once with the void-and-
+// cluster method (Ulichney 1993): repeatedly put the next rank
+// into the largest void, i.e. the unranked cell with the lowest
+// Gaussian-filtered energy of all already ranked cells.
+class BlueNoiseMask {
+public:
+    static const int size = 64;
+    static const BlueNoiseMask &shared();
+    double value(int x, int y) const;
+private:
+    double mask[size * size];
+    BlueNoiseMask();
+};
+
+inline BlueNoiseMask::BlueNoiseMask() {
+    const int n = size * size;
+    const double sigma = 1.9;
+    // Toroidal Gaussian kernel, indexed by (dx, dy) wrapped to the tile
+    double kernel[size * size];
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int dx = x < size / 2 ? x : x - size;
+            int dy = y < size / 2 ? y : y - size;
+            kernel[y * size + x] = exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+        }
+    }
+    double *energy = new double[n];
+    bool *ranked = new bool[n];
+    for (int i = 0; i < n; i++) {
+        energy[i] = 0;
+        ranked[i] = false;
+    }
+    // Ties (all cells are empty at the start) are broken by a fixed
+    // hash so the mask is deterministic without scanline-order bias.
+    for (int rank = 0; rank < n; rank++) {
+        int best = -1;
+        double bestEnergy = 0;
+        for (int i = 0; i < n; i++) {
+            if (ranked[i]) continue;
+            double e = energy[i] + 1e-9 * hashToUnit(mixBits(uint64_t(i)));
+            if (best < 0 || e < bestEnergy) {
+                best = i;
+                bestEnergy = e;
+            }
+        }
+        ranked[best] = true;
+        mask[best] = (rank + 0.5) / double(n);
+        int bx = best % size;
+        int by = best / size;
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                int kx = (x - bx + size) % size;
+                int ky = (y - by + size) % size;
+                energy[y * size + x] += kernel[ky * size + kx];
+            }
+        }
+    }
+    delete[] energy;
+    delete[] ranked;
+}
+
+inline const BlueNoiseMask &BlueNoiseMask::shared() {
+    // Thread-safe lazy initialization (C++11 magic statics)
+    static BlueNoiseMask *instance = new BlueNoiseMask();
+    return *instance;
+}
+
+inline double BlueNoiseMask::value(int x, int y) const {
+    return mask[(y & (size - 1)) * size + (x & (size - 1))];
+}
+
+/* Blue noise dithered sampler */
+// Every pixel uses the same Owen scrambled Sobol sequence, shifted
+// (Cranley-Patterson rotation) by a per-pixel offset read from the
+// blue noise mask. Neighbouring pixels get decorrelated offsets
+// that differ as much as possible, which pushes the remaining
+// error into high frequencies where it is far less visible at
+// low spp. Each dimension reads the mask at a different toroidal
+// shift.
+class BlueNoiseSampler: public Sampler {
+    const BlueNoiseMask *mask;
+    double offset(int d) const;
+public:
+    BlueNoiseSampler(int spp, uint64_t seed = 0): Sampler(spp, seed), mask(&BlueNoiseMask::shared()) {};
+    virtual Sampler *clone() const { return new BlueNoiseSampler(*this); }
+    virtual const char *name() const { return "bluenoise"; }
+    virtual double get1D();
+    virtual Vector3d get2D();
+};
+
+inline double BlueNoiseSampler::offset(int d) const {
+    uint64_t h = hashValues(uint64_t(d), seed, 0, 0);
+    return mask->value(pixelX + int(h & 63), pixelY + int((h >> 6) & 63));
+}
+
+inline double BlueNoiseSampler::get1D() {
+    uint64_t h = hashValues(uint64_t(dimension), seed, 1, 0);
+    uint32_t index = uint32_t(sampleIndex);
+    double u = bitsToUnit(owenScramble(sobolDimension0(index), uint32_t(h))) + offset(dimension);
+    dimension++;
+    return fmin(u - floor(u), oneMinusEpsilon);
+}
+
+inline Vector3d BlueNoiseSampler::get2D() {
+    uint64_t h = hashValues(uint64_t(dimension), seed, 1, 0);
+    uint32_t index = uint32_t(sampleIndex);
+    double u = bitsToUnit(owenScramble(sobolDimension0(index), uint32_t(h))) + offset(dimension);
+    double v = bitsToUnit(owenScramble(sobolDimension1(index), uint32_t(h >> 32))) + offset(dimension + 1);
+    dimension += 2;
+    return Vector3d(fmin(u - floor(u), oneMinusEpsilon), fmin(v - floor(v), oneMinusEpsilon), 0);
+}
+
+/* Factory */
+// Returns nullptr for unknown names.
+inline Sampler *createSampler(const std::string &name, int spp, uint64_t seed) {
+    if (name == "independent") return new IndependentSampler(spp, seed);
+    if (name == "stratified") return new StratifiedSampler(spp, seed);
+    if (name == "sobol") return new SobolSampler(spp, seed);
+    if (name == "bluenoise") return new BlueNoiseSampler(spp, seed);
+    return nullptr;
+}
+
+#endif
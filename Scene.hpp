@@ -0,0 +1,209 @@
+#ifndef Scene_hpp
+#define Scene_hpp
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include "Vector3d.hpp"
+#include "Ray.hpp"
+#include "Camera.hpp"
+#include "Material.hpp"
+#include "Texture.hpp"
+#include "Hitable.hpp"
+#include "HitableList.hpp"
+#include "Sphere.hpp"
+#include "BVH.hpp"
+#include "LightBVH.hpp"
+
+/* Scene */
+// Owns everything a render needs to know about the world: the
+// materials, the objects and the acceleration structure over them,
+// plus a default view.
+//
+// * Objects, materials and textures are handed over with add(),
+//   addMaterial() and addTexture() and deleted with the scene.
+// * Spheres can also be created in one block (reserveSpheres() +
+//   addSphere()), which avoids one allocation per sphere in scenes
+//   with millions of them.
+// * build() puts all bounded objects into a BVH. Unbounded objects
+//   would make every node's box infinite, so they stay outside the
+//   hierarchy and are tested next to it.
+// * adoptRoot() takes an acceleration structure that was built
+//   elsewhere (a mapped scene cache, see SceneCache.hpp) in place of
+//   build().
+// * Both also gather the emitting primitives into a LightBVH for
+//   light sampling.
+// * After build() the scene is read-only and can be shared by any
+//   number of render threads.
+// * setReplica() hands over a copy of the scene that was generated
+//   and built on another NUMA node (so its memory is there, see
+//   Topology.hpp). replica(node) is the copy for a node, the scene
+//   itself for node 0 and nodes without a copy.
+class Scene {
+    std::vector<Material *> materials;
+    std::vector<Texture *> textures;
+    std::vector<Hitable *> objects;
+    Sphere *sphereBlock;
+    size_t sphereCount;
+    size_t sphereCapacity;
+    BVH *bvh;
+    std::vector<Hitable *> unbounded;
+    Hitable *root;
+    LightBVH *lightBVH;
+    size_t adoptedObjects;
+    size_t adoptedBytes;
+    std::vector<Scene *> replicas; // by node, nullptr: none
+    void buildLights();
+    Scene(const Scene &) = delete;
+    Scene &operator=(const Scene &) = delete;
+public:
+    CameraSettings view;
+
+    Scene();
+    ~Scene();
+    Material *addMaterial(Material *material);
+    Texture *addTexture(Texture *texture);
+    Hitable *add(Hitable *object);
+    void reserveSpheres(size_t count);
+    Sphere *addSphere(const Point3d &center, double radius, Material *material);
+    void build();
+    void adoptRoot(Hitable *prebuilt, size_t objectCount, size_t bytes);
+    void setReplica(int node, Scene *replica);
+    const Scene &replica(int node) const;
+    int replicaCount() const;
+    // The root to trace rays against (only valid after build()).
+    const Hitable *world() const;
+    // The lights of the scene (only valid after build()).
+    const LightBVH *lights() const;
+    size_t objectCount() const;
+    size_t materialCount() const;
+    const std::vector<Hitable *> &objectList() const;
+    const std::vector<Material *> &materialList() const;
+    // Approximate bytes held by objects and acceleration structure.
+    size_t bytes() const;
+};
+
+inline Scene::Scene(): sphereBlock(nullptr), sphereCount(0), sphereCapacity(0), bvh(nullptr), root(nullptr),
+                      lightBVH(nullptr), adoptedObjects(0), adoptedBytes(0) {}
+
+inline Scene::~Scene() {
+    for (Scene *copy : replicas) delete copy;
+    delete lightBVH;
+    if (root != bvh) delete root;
+    delete bvh;
+    for (Hitable *object : objects) {
+        bool inBlock = sphereBlock && object >= sphereBlock && object < sphereBlock + sphereCapacity;
+        if (!inBlock) delete object;
+    }
+    delete[] sphereBlock;
+    for (Material *material : materials) delete material;
+    for (Texture *texture : textures) delete texture;
+}
+
+inline Material *Scene::addMaterial(Material *material) {
+    materials.push_back(material);
+    return material;
+}
+
+inline Texture *Scene::addTexture(Texture *texture) {
+    textures.push_back(texture);
+    return texture;
+}
+
+inline Hitable *Scene::add(Hitable *object) {
+    objects.push_back(object);
+    return object;
+}
+
+// Only one block per scene: call once, before the first addSphere().
+inline void Scene::reserveSpheres(size_t count) {
+    if (sphereBlock) return;
+    sphereBlock = new Sphere[count];
+    sphereCapacity = count;
+    objects.reserve(objects.size() + count);
+}
+
+inline Sphere *Scene::addSphere(const Point3d &center, double radius, Material *material) {
+    Sphere *sphere;
+    if (sphereCount < sphereCapacity) {
+        sphere = &sphereBlock[sphereCount++];
+        *sphere = Sphere(center, radius, material);
+    } else {
+        sphere = new Sphere(center, radius, material);
+    }
+    objects.push_back(sphere);
+    return sphere;
+}
+
+inline void Scene::build() {
+    if (root != bvh) delete root;
+    delete bvh;
+    adoptedObjects = adoptedBytes = 0;
+    std::vector<Hitable *> bounded;
+    unbounded.clear();
+    bounded.reserve(objects.size());
+    for (Hitable *object : objects) {
+        AABB box;
+        if (object->boundingBox(box)) bounded.push_back(object);
+        else unbounded.push_back(object);
+    }
+    bvh = new BVH(bounded);
+    if (unbounded.empty()) {
+        root = bvh;
+    } else {
+        unbounded.push_back(bvh);
+        root = new HitableList(unbounded.data(), int(unbounded.size()));
+    }
+    buildLights();
+}
+
+// The scene owns the adopted root, objectCount and bytes describe
+// what it holds for the statistics.
+inline void Scene::adoptRoot(Hitable *prebuilt, size_t objectCount, size_t bytes) {
+    if (root != bvh) delete root;
+    delete bvh;
+    bvh = nullptr;
+    root = prebuilt;
+    adoptedObjects = objectCount;
+    adoptedBytes = bytes;
+    buildLights();
+}
+
+inline void Scene::setReplica(int node, Scene *replica) {
+    if (node >= int(replicas.size())) replicas.resize(node + 1, nullptr);
+    delete replicas[node];
+    replicas[node] = replica;
+}
+
+inline const Scene &Scene::replica(int node) const {
+    return node > 0 && node < int(replicas.size()) && replicas[node] ? *replicas[node] : *this;
+}
+
+// Copies besides the scene itself
+inline int Scene::replicaCount() const {
+    return int(std::count_if(replicas.begin(), replicas.end(), [](const Scene *copy) { return copy != nullptr; }));
+}
+
+inline void Scene::buildLights() {
+    delete lightBVH;
+    std::vector<LightSource> sources;
+    root->collectLights(sources);
+    lightBVH = new LightBVH(sources);
+}
+
+inline const Hitable *Scene::world() const { return root; }
+inline const LightBVH *Scene::lights() const { return lightBVH; }
+inline size_t Scene::objectCount() const { return objects.size() + adoptedObjects; }
+inline size_t Scene::materialCount() const { return materials.size(); }
+inline const std::vector<Hitable *> &Scene::objectList() const { return objects; }
+inline const std::vector<Material *> &Scene::materialList() const { return materials; }
+
+inline size_t Scene::bytes() const {
+    size_t total = objects.capacity() * sizeof(Hitable *) + sphereCapacity * sizeof(Sphere);
+    total += (objects.size() - sphereCount) * sizeof(Sphere); // individually allocated objects, roughly
+    if (bvh) total += bvh->bytes();
+    if (lightBVH) total += lightBVH->bytes();
+    return total + adoptedBytes;
+}
+
+#endif
@@ -0,0 +1,479 @@
+#ifndef SceneCache_hpp
+#define SceneCache_hpp
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Vector3d.hpp"
+#include "Ray.hpp"
+#include "HitRecord.hpp"
+#include "Hitable.hpp"
+#include "Camera.hpp"
+#include "Scene.hpp"
+#include "Sphere.hpp"
+#include "BVH.hpp"
+#include "Lambertian.hpp"
+#include "Glossy.hpp"
+#include "Metal.hpp"
+#include "Dielectric.hpp"
+#include "DiffuseLight.hpp"
+
+/* Scene cache */
+// A built scene written to disk as it is laid out in memory, so a
+// render can mmap() it and start tracing without generating
+// objects or building a BVH.
+//
+//   +--------+-----------+---------+-----------+
+//   | header | materials | spheres | BVH nodes |
+//   +--------+-----------+---------+-----------+
+//
+// * Sections are referenced by byte offsets from the start of the
+//   file and aligned to 64 bytes. Spheres refer to materials and
+//   leaves to spheres by index, so nothing has to be fixed up after
+//   mapping and any address works.
+// * Spheres are stored in BVH leaf order: a leaf's run of spheres
+//   is contiguous in the file.
+// * Pages are read on first touch: a render only faults in the
+//   parts of the scene its rays reach, and a second run finds them
+//   in the page cache. For files larger than memory,
+//   PagedScene.hpp reads the same file into a bounded pool instead.
+// * The header carries a version and an endianness tag, a file
+//   written by a different layout is rejected instead of misread.
+//   Contents past the header are trusted, the cache is an output
+//   of this program, not an exchange format.
+// * Only spheres can be cached for now (sphere-room and the fields,
+//   not the plane walled room).
+const char sceneCacheMagic[8] = { 'G', 'L', 'O', 'O', 'M', 'S', 'C', '\n' };
+const uint32_t sceneCacheVersion = 1;
+const uint32_t sceneCacheEndianTag = 0x01020304;
+const uint64_t sceneCacheAlignment = 64;
+
+struct SceneCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t endianTag;
+    uint64_t fileSize;
+    uint64_t materialOffset;
+    uint64_t materialCount;
+    uint64_t sphereOffset;
+    uint64_t sphereCount;
+    uint64_t nodeOffset;
+    uint64_t nodeCount;
+    double lookFrom[3];
+    double lookAt[3];
+    double vUp[3];
+    double vFov;
+    double aperture;
+    double focusDistance;
+};
+
+enum class CachedMaterialType: uint32_t {
+    Lambertian,
+    Glossy,
+    Metal,
+    Dielectric,
+    DiffuseLight
+};
+
+// color is albedo, attenuation or emitted color, parameter is the
+// fuzz of Metal and the refraction index of Dielectric.
+struct CachedMaterial {
+    CachedMaterialType type;
+    uint32_t reserved;
+    double color[3];
+    double parameter;
+};
+
+struct CachedSphere {
+    double center[3];
+    double radius;
+    uint32_t material;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(CachedMaterial) == 40, "CachedMaterial layout changed, bump sceneCacheVersion");
+static_assert(sizeof(CachedSphere) == 40, "CachedSphere layout changed, bump sceneCacheVersion");
+
+/* Mapped spheres */
+// The root of a loaded cache: traverses the mapped nodes and
+// intersects the mapped spheres directly, one primitive per sphere
+// without a Hitable object for each. Unmaps the file when deleted.
+class MappedSphereBVH: public Hitable {
+    void *mapping;
+    size_t mappingSize;
+    const BVHNode *nodes;
+    const CachedSphere *spheres;
+    size_t sphereCount;
+    std::vector<Material *> materials;
+    Material *sphereMaterial(const CachedSphere &s) const;
+    MappedSphereBVH(const MappedSphereBVH &) = delete;
+    MappedSphereBVH &operator=(const MappedSphereBVH &) = delete;
+public:
+    MappedSphereBVH(void *mapping, size_t mappingSize, const SceneCacheHeader &header, const std::vector<Material *> &materials);
+    virtual ~MappedSphereBVH();
+    virtual bool closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const;
+    virtual bool occluded(const Ray &ray, double tMin, double tMax) const;
+    virtual void closestHits(RayPacket &packet, double tMin) const;
+    virtual void surface(const Ray &ray, const PrimitiveHit &hit, HitRecord &hitRecord) const;
+    virtual bool boundingBox(AABB &box) const;
+    virtual void collectLights(std::vector<LightSource> &lights) const;
+    virtual bool sampleLight(int index, const Vector3d &from, const Vector3d &u, LightSample &sample) const;
+    virtual double lightPdf(int index, const Vector3d &from, const Vector3d &p) const;
+    virtual bool sampleEmission(int index, const Vector3d &uPosition, const Vector3d &uDirection, EmissionSample &sample) const;
+    virtual void emissionPdf(int index, const Vector3d &p, const Vector3d &normal, const Vector3d &direction,
+                             double &pdfPosition, double &pdfDirection) const;
+};
+
+inline MappedSphereBVH::MappedSphereBVH(void *mapping, size_t mappingSize, const SceneCacheHeader &header, const std::vector<Material *> &materials):
+    mapping(mapping), mappingSize(mappingSize), sphereCount(header.sphereCount), materials(materials) {
+    const char *base = static_cast<const char *>(mapping);
+    nodes = reinterpret_cast<const BVHNode *>(base + header.nodeOffset);
+    spheres = reinterpret_cast<const CachedSphere *>(base + header.sphereOffset);
+}
+
+inline MappedSphereBVH::~MappedSphereBVH() {
+    munmap(mapping, mappingSize);
+}
+
+inline Material *MappedSphereBVH::sphereMaterial(const CachedSphere &s) const {
+    return materials[s.material < materials.size() ? s.material : 0];
+}
+
+inline bool MappedSphereBVH::closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const {
+    const CachedSphere *list = spheres;
+    return traverseBVH(nodes, ray, tMin, tMax, false, [&](int first, int count, double &closestSoFar) {
+        bool hitAnything = false;
+        for (int i = first; i < first + count; i++) {
+            const CachedSphere &s = list[i];
+            double t;
+            if (intersectSphere(Vector3d(s.center[0], s.center[1], s.center[2]), s.radius, ray, tMin, closestSoFar, t)) {
+                hitAnything = true;
+                closestSoFar = t;
+                hit.t = t;
+                hit.primitive = this;
+                hit.index = i;
+            }
+        }
+        return hitAnything;
+    });
+}
+
+inline bool MappedSphereBVH::occluded(const Ray &ray, double tMin, double tMax) const {
+    const CachedSphere *list = spheres;
+    return traverseBVH(nodes, ray, tMin, tMax, true, [&](int first, int count, double &closestSoFar) {
+        for (int i = first; i < first + count; i++) {
+            const CachedSphere &s = list[i];
+            double t;
+            if (intersectSphere(Vector3d(s.center[0], s.center[1], s.center[2]), s.radius, ray, tMin, closestSoFar, t)) return true;
+        }
+        return false;
+    });
+}
+
+inline void MappedSphereBVH::closestHits(RayPacket &packet, double tMin) const {
+    const CachedSphere *list = spheres;
+    traversePacketBVH(nodes, packet, tMin, [&](int ray, int first, int count) {
+        for (int i = first; i < first + count; i++) {
+            const CachedSphere &s = list[i];
+            double t;
+            if (intersectSphere(Vector3d(s.center[0], s.center[1], s.center[2]), s.radius, packet.rays[ray], tMin, packet.tMax[ray], t)) {
+                packet.found[ray] = true;
+                packet.tMax[ray] = t;
+                packet.hits[ray] = PrimitiveHit{ t, this, i };
+            }
+        }
+    });
+}
+
+inline void MappedSphereBVH::surface(const Ray &ray, const PrimitiveHit &hit, HitRecord &hitRecord) const {
+    const CachedSphere &s = spheres[hit.index];
+    Vector3d center(s.center[0], s.center[1], s.center[2]);
+    hitRecord.t = hit.t;
+    hitRecord.p = ray.pointAtParameter(hit.t);
+    hitRecord.normal = (hitRecord.p - center) / s.radius;
+    hitRecord.material = sphereMaterial(s);
+    sphereTextureCoordinates(hitRecord.normal, s.radius, hitRecord);
+}
+
+inline bool MappedSphereBVH::boundingBox(AABB &box) const {
+    const BVHNode &root = nodes[0];
+    box = AABB(Vector3d(root.min[0], root.min[1], root.min[2]), Vector3d(root.max[0], root.max[1], root.max[2]));
+    return true;
+}
+
+// Every emitting sphere is a light, index is its position in the
+// file like PrimitiveHit::index.
+inline void MappedSphereBVH::collectLights(std::vector<LightSource> &lights) const {
+    for (size_t i = 0; i < sphereCount; i++) {
+        const CachedSphere &s = spheres[i];
+        Vector3d radiance = sphereMaterial(s)->emitted();
+        if (radiance.x() <= 0 && radiance.y() <= 0 && radiance.z() <= 0) continue;
+        LightSource light;
+        light.primitive = this;
+        light.index = int(i);
+        light.bounds = sphereLightBounds(Vector3d(s.center[0], s.center[1], s.center[2]), s.radius, radiance);
+        lights.push_back(light);
+    }
+}
+
+inline bool MappedSphereBVH::sampleLight(int index, const Vector3d &from, const Vector3d &u, LightSample &sample) const {
+    const CachedSphere &s = spheres[index];
+    if (!sampleSphereLight(Vector3d(s.center[0], s.center[1], s.center[2]), s.radius, from, u, sample)) return false;
+    sample.radiance = sphereMaterial(s)->emitted();
+    return true;
+}
+
+inline double MappedSphereBVH::lightPdf(int index, const Vector3d &from, const Vector3d &p) const {
+    const CachedSphere &s = spheres[index];
+    return sphereLightPdf(Vector3d(s.center[0], s.center[1], s.center[2]), s.radius, from, p);
+}
+
+inline bool MappedSphereBVH::sampleEmission(int index, const Vector3d &uPosition, const Vector3d &uDirection, EmissionSample &sample) const {
+    const CachedSphere &s = spheres[index];
+    if (!sampleSphereEmission(Vector3d(s.center[0], s.center[1], s.center[2]), s.radius, uPosition, uDirection, sample)) return false;
+    sample.radiance = sphereMaterial(s)->emitted();
+    return true;
+}
+
+inline void MappedSphereBVH::emissionPdf(int index, const Vector3d &p, const Vector3d &normal, const Vector3d &direction,
+                                         double &pdfPosition, double &pdfDirection) const {
+    sphereEmissionPdf(spheres[index].radius, normal, direction, pdfPosition, pdfDirection);
+}
+
+/* Writing */
+inline uint64_t alignSceneCacheOffset(uint64_t offset) {
+    return (offset + sceneCacheAlignment - 1) / sceneCacheAlignment * sceneCacheAlignment;
+}
+
+inline bool packMaterial(const Material *material, CachedMaterial &cached) {
+    Vector3d color;
+    cached.reserved = 0;
+    cached.parameter = 0;
+    // Textures live in a TextureCache, not in the file
+    if (const Lambertian *lambertian = dynamic_cast<const Lambertian *>(material)) {
+        if (lambertian->getTexture()) return false;
+        cached.type = CachedMaterialType::Lambertian;
+        color = lambertian->getAlbedo();
+    } else if (const Glossy *glossy = dynamic_cast<const Glossy *>(material)) {
+        if (glossy->getTexture()) return false;
+        cached.type = CachedMaterialType::Glossy;
+        color = glossy->getAlbedo();
+    } else if (const Metal *metal = dynamic_cast<const Metal *>(material)) {
+        if (metal->getTexture()) return false;
+        cached.type = CachedMaterialType::Metal;
+        color = metal->getAlbedo();
+        cached.parameter = metal->getFuzz();
+    } else if (const Dielectric *dielectric = dynamic_cast<const Dielectric *>(material)) {
+        cached.type = CachedMaterialType::Dielectric;
+        color = dielectric->getAttenuation();
+        cached.parameter = dielectric->getRefractionIndex();
+    } else if (const DiffuseLight *light = dynamic_cast<const DiffuseLight *>(material)) {
+        cached.type = CachedMaterialType::DiffuseLight;
+        color = light->getColor();
+    } else {
+        return false;
+    }
+    for (int i = 0; i < 3; i++) cached.color[i] = color[i];
+    return true;
+}
+
+inline Material *unpackMaterial(const CachedMaterial &cached) {
+    Color color(cached.color[0], cached.color[1], cached.color[2]);
+    switch (cached.type) {
+        case CachedMaterialType::Lambertian: return new Lambertian(color);
+        case CachedMaterialType::Glossy: return new Glossy(color);
+        case CachedMaterialType::Metal: return new Metal(color, cached.parameter);
+        case CachedMaterialType::Dielectric: return new Dielectric(color, cached.parameter);
+        case CachedMaterialType::DiffuseLight: return new DiffuseLight(color);
+    }
+    return nullptr;
+}
+
+// Writes the objects, materials and view of scene. Builds its own
+// BVH over the spheres (the scene does not need to be built).
+// Returns false and prints why if the scene can not be cached.
+inline bool writeSceneCache(const Scene &scene, const std::string &path) {
+    const std::vector<Material *> &materialList = scene.materialList();
+    const std::vector<Hitable *> &objectList = scene.objectList();
+
+    std::vector<CachedMaterial> materials(materialList.size());
+    std::unordered_map<const Material *, uint32_t> materialIndex;
+    for (size_t i = 0; i < materialList.size(); i++) {
+        if (!packMaterial(materialList[i], materials[i])) {
+            std::cout << "ERROR: scene cache does not support material " << i << "." << std::endl;
+            return false;
+        }
+        materialIndex[materialList[i]] = uint32_t(i);
+    }
+
+    std::vector<const Sphere *> sphereList(objectList.size());
+    std::vector<PrimitiveBounds> bounds(objectList.size());
+    for (size_t i = 0; i < objectList.size(); i++) {
+        sphereList[i] = dynamic_cast<const Sphere *>(objectList[i]);
+        auto material = sphereList[i] ? materialIndex.find(sphereList[i]->material) : materialIndex.end();
+        if (material == materialIndex.end()) {
+            std::cout << "ERROR: scene cache only supports spheres with scene materials (object " << i << ")." << std::endl;
+            return false;
+        }
+        AABB box;
+        sphereList[i]->boundingBox(box);
+        bounds[i] = toPrimitiveBounds(box);
+    }
+    std::vector<BVHNode> nodes;
+    std::vector<int32_t> order;
+    BVHBuilder(bounds, nodes, order, 4);
+
+    SceneCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, sceneCacheMagic, sizeof(header.magic));
+    header.version = sceneCacheVersion;
+    header.endianTag = sceneCacheEndianTag;
+    header.materialCount = materials.size();
+    header.sphereCount = sphereList.size();
+    header.nodeCount = nodes.size();
+    header.materialOffset = alignSceneCacheOffset(sizeof(SceneCacheHeader));
+    header.sphereOffset = alignSceneCacheOffset(header.materialOffset + header.materialCount * sizeof(CachedMaterial));
+    header.nodeOffset = alignSceneCacheOffset(header.sphereOffset + header.sphereCount * sizeof(CachedSphere));
+    header.fileSize = header.nodeOffset + header.nodeCount * sizeof(BVHNode);
+    const CameraSettings &view = scene.view;
+    for (int i = 0; i < 3; i++) {
+        header.lookFrom[i] = view.lookFrom[i];
+        header.lookAt[i] = view.lookAt[i];
+        header.vUp[i] = view.vUp[i];
+    }
+    header.vFov = view.vFov;
+    header.aperture = view.aperture;
+    header.focusDistance = view.focusDistance;
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        std::cout << "ERROR: can not open " << path << " for writing." << std::endl;
+        return false;
+    }
+    uint64_t written = 0;
+    auto padTo = [&](uint64_t offset) {
+        static const char zeros[sceneCacheAlignment] = { 0 };
+        file.write(zeros, std::streamsize(offset - written));
+        written = offset;
+    };
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    written = sizeof(header);
+    padTo(header.materialOffset);
+    file.write(reinterpret_cast<const char *>(materials.data()), std::streamsize(materials.size() * sizeof(CachedMaterial)));
+    written += materials.size() * sizeof(CachedMaterial);
+    padTo(header.sphereOffset);
+    // In leaf order, written in chunks to keep the buffer small
+    std::vector<CachedSphere> chunk;
+    chunk.reserve(65536);
+    for (size_t i = 0; i < order.size(); i++) {
+        const Sphere *sphere = sphereList[order[i]];
+        CachedSphere cached;
+        Vector3d center = sphere->getCenter();
+        for (int k = 0; k < 3; k++) cached.center[k] = center[k];
+        cached.radius = sphere->getRadius();
+        cached.material = materialIndex[sphere->material];
+        cached.reserved = 0;
+        chunk.push_back(cached);
+        if (chunk.size() == chunk.capacity() || i + 1 == order.size()) {
+            file.write(reinterpret_cast<const char *>(chunk.data()), std::streamsize(chunk.size() * sizeof(CachedSphere)));
+            written += chunk.size() * sizeof(CachedSphere);
+            chunk.clear();
+        }
+    }
+    padTo(header.nodeOffset);
+    file.write(reinterpret_cast<const char *>(nodes.data()), std::streamsize(nodes.size() * sizeof(BVHNode)));
+    if (!file) {
+        std::cout << "ERROR: writing " << path << " failed." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/* Loading */
+inline bool sceneCacheSectionFits(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t fileSize) {
+    if (offset % sceneCacheAlignment != 0 || offset > fileSize) return false;
+    return count <= (fileSize - offset) / elementSize;
+}
+
+// Why a header can not be used with a file of `size` bytes, or
+// nullptr if it can.
+inline const char *sceneCacheHeaderProblem(const SceneCacheHeader &header, size_t size) {
+    if (memcmp(header.magic, sceneCacheMagic, sizeof(header.magic)) != 0) return "is not a scene cache";
+    if (header.endianTag != sceneCacheEndianTag) return "was written on a machine with different byte order";
+    if (header.version != sceneCacheVersion) return "was written by a different version";
+    if (header.fileSize != size) return "is truncated";
+    if (header.materialCount == 0 || header.nodeCount == 0 ||
+        !sceneCacheSectionFits(header.materialOffset, header.materialCount, sizeof(CachedMaterial), size) ||
+        !sceneCacheSectionFits(header.sphereOffset, header.sphereCount, sizeof(CachedSphere), size) ||
+        !sceneCacheSectionFits(header.nodeOffset, header.nodeCount, sizeof(BVHNode), size)) return "has a broken header";
+    return nullptr;
+}
+
+inline CameraSettings sceneCacheView(const SceneCacheHeader &header) {
+    CameraSettings view;
+    view.lookFrom = Point3d(header.lookFrom[0], header.lookFrom[1], header.lookFrom[2]);
+    view.lookAt = Point3d(header.lookAt[0], header.lookAt[1], header.lookAt[2]);
+    view.vUp = Vector3d(header.vUp[0], header.vUp[1], header.vUp[2]);
+    view.vFov = header.vFov;
+    view.aperture = header.aperture;
+    view.focusDistance = header.focusDistance;
+    return view;
+}
+
+// Maps the cache at path and returns a scene that is ready to
+// render (no build() needed), or nullptr after printing why.
+inline Scene *loadSceneCache(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cout << "ERROR: can not open scene cache " << path << "." << std::endl;
+        return nullptr;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || size_t(status.st_size) < sizeof(SceneCacheHeader)) {
+        std::cout << "ERROR: " << path << " is not a scene cache." << std::endl;
+        close(fd);
+        return nullptr;
+    }
+    size_t size = size_t(status.st_size);
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (mapping == MAP_FAILED) {
+        std::cout << "ERROR: mmap of " << path << " failed." << std::endl;
+        return nullptr;
+    }
+
+    const SceneCacheHeader &header = *static_cast<const SceneCacheHeader *>(mapping);
+    const char *problem = sceneCacheHeaderProblem(header, size);
+    if (problem) {
+        std::cout << "ERROR: " << path << " " << problem << "." << std::endl;
+        munmap(mapping, size);
+        return nullptr;
+    }
+
+    Scene *scene = new Scene();
+    const CachedMaterial *cachedMaterials = reinterpret_cast<const CachedMaterial *>(static_cast<const char *>(mapping) + header.materialOffset);
+    std::vector<Material *> materials(header.materialCount);
+    for (size_t i = 0; i < materials.size(); i++) {
+        materials[i] = unpackMaterial(cachedMaterials[i]);
+        if (!materials[i]) {
+            std::cout << "ERROR: " << path << " has an unknown material type." << std::endl;
+            munmap(mapping, size);
+            delete scene;
+            return nullptr;
+        }
+        scene->addMaterial(materials[i]);
+    }
+    scene->view = sceneCacheView(header);
+    scene->adoptRoot(new MappedSphereBVH(mapping, size, header, materials), header.sphereCount, size);
+    return scene;
+}
+
+#endif
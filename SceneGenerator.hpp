@@ -0,0 +1,298 @@
+#ifndef SceneGenerator_hpp
+#define SceneGenerator_hpp
+
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include "Vector3d.hpp"
+#include "Sampler.hpp"
+#include "Camera.hpp"
+#include "Scene.hpp"
+#include "Sphere.hpp"
+#include "Plane.hpp"
+#include "Rect.hpp"
+#include "Box.hpp"
+#include "Lambertian.hpp"
+#include "Glossy.hpp"
+#include "Metal.hpp"
+#include "Dielectric.hpp"
+#include "DiffuseLight.hpp"
+
+/* Scene generators */
+// Return new, not yet built scenes: call Scene::build() before
+// rendering (kept separate so build time can be measured).
+
+/* Default scene */
+// The room: floor, back and left walls, a row of glossy, metal and
+// glass balls and a large spherical light to the right.
+// A smaller lightRadius keeps the light's center and power (the
+// radiance grows with 1 / R²), so the room is lit as brightly
+// but by a nearly point-like light: hard shadows and sharp
+// caustics under the glass ball, which paths traced from the
+// camera only find by hitting the light by chance.
+//
+// * defaultRoomScene(): the floor and walls are infinite planes,
+//   outside the BVH, which then only bounds the balls and the light.
+// * sphereRoomScene(): the original 11 sphere room with the floor
+//   and walls as spheres of radius 1000 and 10000 (almost the same
+//   image, for comparisons). Their bounds span the whole scene, so
+//   every BVH node above them does too.
+inline void addRoomBalls(Scene *scene, double lightRadius) {
+    scene->addSphere(Point3d(-1.2, 0 + 0.45, -0.7), 0.45, scene->addMaterial(new Glossy(Color(0.7, 0.1, 0.25)))); // left Glossy
+    scene->addSphere(Point3d(0, 0 + 0.5, -1), 0.5, scene->addMaterial(new Glossy(Color(1, 0.2, 0.4)))); // middle Glossy
+    scene->addSphere(Point3d(1.2, 0 + 0.3, -0.7), 0.3, scene->addMaterial(new Metal(Color(0.75, 0.75, 0.75), 0.0))); // right Metal
+    scene->addSphere(Point3d(2.0, 0 + 0.3, -0.7), 0.3, scene->addMaterial(new Glossy(Color(0.25, 0.45, 0.65)))); // right Glossy
+    scene->addSphere(Point3d(0.45, 0 + 0.3, -0.2), 0.3, scene->addMaterial(new Dielectric(Color(0.96, 0.96, 0.98), 1.5))); // front right glass
+    scene->addSphere(Point3d(-0.45, 0 + 0.25, -0.25), 0.25, scene->addMaterial(new Glossy(Color(0.2, 1.0, 0.55)))); // front left Glossy
+    double lightScale = (30 / lightRadius) * (30 / lightRadius);
+    scene->addSphere(Point3d(30, 20, 0), lightRadius, scene->addMaterial(new DiffuseLight(lightScale * Color(2.2, 2.0, 3.3)))); // right light
+    scene->addSphere(Point3d(-1.0, 0 + 0.35, 0.5), 0.35, scene->addMaterial(new Glossy(Color(1.0, 0.2, 0.55)))); // front left Glossy
+}
+
+inline void setRoomView(Scene *scene) {
+    scene->view.lookFrom = Point3d(0, 1.5, 3);
+    scene->view.lookAt = Point3d(0, 0.5, -1);
+    scene->view.vUp = Vector3d(0, 1, 0);
+    scene->view.vFov = 40;
+    scene->view.focusDistance = (scene->view.lookFrom - scene->view.lookAt).length();
+    scene->view.aperture = 0.25;
+}
+
+inline Scene *defaultRoomScene(double lightRadius = 30) {
+    Scene *scene = new Scene();
+    Material *wallMaterial = scene->addMaterial(new Lambertian(Color(0.15, 0.26, 0.6)));
+
+    scene->add(new Plane(Point3d(0, 0, 0), Vector3d(0, 1, 0), wallMaterial)); // floor
+    scene->add(new Plane(Point3d(0, 0, -2.25), Vector3d(0, 0, 1), wallMaterial)); // back wall
+    scene->add(new Plane(Point3d(-2.5, 0, 0), Vector3d(1, 0, 0), wallMaterial)); // left wall
+    addRoomBalls(scene, lightRadius);
+    setRoomView(scene);
+    return scene;
+}
+
+inline Scene *sphereRoomScene(double lightRadius = 30) {
+    Scene *scene = new Scene();
+    Material *wallMaterial = scene->addMaterial(new Lambertian(Color(0.15, 0.26, 0.6)));
+
+    scene->addSphere(Point3d(0, -1000, -1), 1000, wallMaterial); // floor
+    scene->addSphere(Point3d(0, 0, -10000 - 2.25), 10000, wallMaterial); // back wall
+    scene->addSphere(Point3d(-10000 - 2.5, 0, -1), 10000, wallMaterial); // left wall
+    addRoomBalls(scene, lightRadius);
+    setRoomView(scene);
+    return scene;
+}
+
+/* Cornell box */
+// A 2 x 2 x 2 box open towards the camera: white floor, ceiling and
+// back wall, a red left and a green right wall, lit by a square
+// rectangle light just below the ceiling. A tall white box and a
+// short glass box stand on the floor. Everything but the camera is
+// a Rect or a Box.
+inline Scene *cornellBoxScene() {
+    Scene *scene = new Scene();
+    Material *white = scene->addMaterial(new Lambertian(Color(0.73, 0.73, 0.73)));
+    Material *red = scene->addMaterial(new Lambertian(Color(0.65, 0.05, 0.05)));
+    Material *green = scene->addMaterial(new Lambertian(Color(0.12, 0.45, 0.15)));
+
+    scene->add(new Rect(Point3d(-1, 0, -1), Point3d(1, 0, 1), white)); // floor
+    scene->add(new Rect(Point3d(-1, 2, -1), Point3d(1, 2, 1), white)); // ceiling
+    scene->add(new Rect(Point3d(-1, 0, -1), Point3d(1, 2, -1), white)); // back wall
+    scene->add(new Rect(Point3d(-1, 0, -1), Point3d(-1, 2, 1), red)); // left wall
+    scene->add(new Rect(Point3d(1, 0, -1), Point3d(1, 2, 1), green)); // right wall
+    // Slightly below the ceiling so the two never overlap
+    scene->add(new Rect(Point3d(-0.25, 1.998, -0.25), Point3d(0.25, 1.998, 0.25), scene->addMaterial(new DiffuseLight(Color(12, 12, 12))))); // light
+    scene->add(new Box(Point3d(-0.6, 0, -0.6), Point3d(-0.05, 1.2, -0.05), white)); // tall box
+    scene->add(new Box(Point3d(0.05, 0, 0.05), Point3d(0.6, 0.6, 0.6), scene->addMaterial(new Dielectric(Color(0.96, 0.96, 0.98), 1.5)))); // glass box
+
+    /* Camera */
+    scene->view.lookFrom = Point3d(0, 1, 3.8);
+    scene->view.lookAt = Point3d(0, 1, 0);
+    scene->view.vUp = Vector3d(0, 1, 0);
+    scene->view.vFov = 40;
+    scene->view.aperture = 0;
+    scene->view.focusDistance = (scene->view.lookFrom - scene->view.lookAt).length();
+    return scene;
+}
+
+/* Procedural sphere fields */
+// Random fields of spheres for scaling tests, from a handful up to
+// tens of millions of objects. Everything is derived from the seed,
+// so the same settings always give the same scene.
+//
+// * Uniform: centers uniformly distributed in a cube.
+// * Clustered: centers normally distributed around cluster centers
+//   (about 1000 spheres per cluster), which gives the very uneven
+//   density real scenes have.
+//
+// The cube grows with the object count (side ∝ ∛N) so the density,
+// and with it the work per ray, stays comparable. Materials are
+// picked from a fixed palette per type with the given mix weights,
+// so millions of spheres share a few dozen material objects.
+//
+// lightCount > 0 replaces the large light above the field with that
+// many small emitting spheres with the same total power (many-light
+// scenes: the more lights, the smaller each one).
+enum class SceneLayout {
+    Uniform,
+    Clustered
+};
+
+struct MaterialMix {
+    double lambertian = 0.5;
+    double glossy = 0.3;
+    double metal = 0.1;
+    double dielectric = 0.05;
+    double light = 0.05;
+};
+
+struct SphereFieldSettings {
+    size_t objectCount = 1000;
+    SceneLayout layout = SceneLayout::Uniform;
+    MaterialMix mix;
+    uint64_t seed = 1;
+    size_t lightCount = 0;
+};
+
+// Deterministic random numbers for the generator (SplitMix64).
+class SceneRandom {
+    uint64_t state;
+public:
+    SceneRandom(uint64_t seed): state(seed) {};
+    uint64_t next();
+    double uniform();
+    double normal();
+};
+
+inline uint64_t SceneRandom::next() {
+    state += 0x9e3779b97f4a7c15ULL;
+    return mixBits(state);
+}
+
+inline double SceneRandom::uniform() { return hashToUnit(next()); }
+
+// Box-Muller transform
+inline double SceneRandom::normal() {
+    double u1 = fmax(uniform(), 1e-300);
+    double u2 = uniform();
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+// Parses "lambertian=0.5,glossy=0.3,metal=0.1,dielectric=0.05,light=0.05"
+// (any subset, missing types get weight 0). Returns false on
+// unknown names.
+inline bool parseMaterialMix(const std::string &text, MaterialMix &mix) {
+    MaterialMix parsed;
+    parsed.lambertian = parsed.glossy = parsed.metal = parsed.dielectric = parsed.light = 0;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos) end = text.size();
+        std::string item = text.substr(start, end - start);
+        size_t equals = item.find('=');
+        if (equals == std::string::npos) return false;
+        std::string name = item.substr(0, equals);
+        double weight = atof(item.c_str() + equals + 1);
+        if (name == "lambertian") parsed.lambertian = weight;
+        else if (name == "glossy") parsed.glossy = weight;
+        else if (name == "metal") parsed.metal = weight;
+        else if (name == "dielectric") parsed.dielectric = weight;
+        else if (name == "light") parsed.light = weight;
+        else return false;
+        start = end + 1;
+    }
+    mix = parsed;
+    return true;
+}
+
+inline Scene *generateSphereField(const SphereFieldSettings &settings) {
+    Scene *scene = new Scene();
+    SceneRandom random(settings.seed);
+    const size_t count = settings.objectCount;
+
+    /* Material palette */
+    const int paletteSize = 16;
+    Material *palette[5][paletteSize];
+    for (int i = 0; i < paletteSize; i++) {
+        Color albedo(0.2 + 0.8 * random.uniform(), 0.2 + 0.8 * random.uniform(), 0.2 + 0.8 * random.uniform());
+        palette[0][i] = scene->addMaterial(new Lambertian(albedo));
+        palette[1][i] = scene->addMaterial(new Glossy(albedo));
+        palette[2][i] = scene->addMaterial(new Metal(albedo, 0.3 * random.uniform()));
+        palette[3][i] = scene->addMaterial(new Dielectric(Color(0.96, 0.96, 0.98), 1.3 + 0.4 * random.uniform()));
+        palette[4][i] = scene->addMaterial(new DiffuseLight(4 * albedo));
+    }
+    const MaterialMix &mix = settings.mix;
+    double weights[5] = { mix.lambertian, mix.glossy, mix.metal, mix.dielectric, mix.light };
+    double totalWeight = 0;
+    for (double w : weights) totalWeight += fmax(w, 0.0);
+    if (totalWeight <= 0) {
+        weights[0] = totalWeight = 1;
+    }
+
+    /* Layout */
+    // Average spacing between neighbouring centers is about 2.
+    const double side = 2 * cbrt(double(count > 0 ? count : 1));
+    const double half = side / 2;
+    size_t clusterCount = count / 1000 + 1;
+    std::vector<Point3d> clusters;
+    if (settings.layout == SceneLayout::Clustered) {
+        for (size_t i = 0; i < clusterCount; i++) {
+            clusters.push_back(Point3d(side * random.uniform() - half, side * random.uniform() - half, side * random.uniform() - half));
+        }
+    }
+    const double clusterSigma = 0.15 * side / cbrt(double(clusterCount));
+
+    scene->reserveSpheres(count + std::max(settings.lightCount, size_t(1)));
+    for (size_t i = 0; i < count; i++) {
+        Point3d center;
+        if (settings.layout == SceneLayout::Clustered) {
+            const Point3d &cluster = clusters[random.next() % clusterCount];
+            center = cluster + clusterSigma * Vector3d(random.normal(), random.normal(), random.normal());
+        } else {
+            center = Point3d(side * random.uniform() - half, side * random.uniform() - half, side * random.uniform() - half);
+        }
+        double radius = 0.2 + 0.5 * random.uniform();
+        double pick = random.uniform() * totalWeight;
+        int type = 0;
+        while (type < 4 && pick >= fmax(weights[type], 0.0)) {
+            pick -= fmax(weights[type], 0.0);
+            type++;
+        }
+        scene->addSphere(center, radius, palette[type][random.next() % paletteSize]);
+    }
+    // A large light above the field so every mix is lit
+    const double lightRadius = half + 1;
+    const double lightRadiance = 3;
+    if (settings.lightCount == 0) {
+        scene->addSphere(Point3d(0, 2 * side + 2, 0), lightRadius, scene->addMaterial(new DiffuseLight(Color(lightRadiance, lightRadiance, lightRadiance))));
+    } else {
+        // A layer above the field (and above the view), three times as
+        // wide on each side, so most lights are far from any given point. Power ∝
+        // radiance * area is split evenly over the small lights, their
+        // radius shrinks with √N like the spacing between them (0.5 for
+        // 10 lights). Every light gets its own material (tinted like
+        // the palette) since the radiance depends on the radius.
+        double power = lightRadiance * lightRadius * lightRadius / double(settings.lightCount);
+        double smallRadius = 0.5 * sqrt(10.0 / double(settings.lightCount));
+        for (size_t i = 0; i < settings.lightCount; i++) {
+            Point3d center(6 * side * random.uniform() - 3 * side, (1.2 + 0.1 * random.uniform()) * side, 6 * side * random.uniform() - 3 * side);
+            double radius = smallRadius * (0.5 + random.uniform());
+            Color tint(0.5 + 0.5 * random.uniform(), 0.5 + 0.5 * random.uniform(), 0.5 + 0.5 * random.uniform());
+            tint /= (tint.x() + tint.y() + tint.z()) / 3;
+            scene->addSphere(center, radius, scene->addMaterial(new DiffuseLight(power / (radius * radius) * tint)));
+        }
+    }
+
+    /* Camera */
+    scene->view.lookFrom = Point3d(0.3 * side, 0.4 * side, 1.4 * side + 3);
+    scene->view.lookAt = Point3d(0, 0, 0);
+    scene->view.vUp = Vector3d(0, 1, 0);
+    scene->view.vFov = 40;
+    scene->view.aperture = 0;
+    scene->view.focusDistance = (scene->view.lookFrom - scene->view.lookAt).length();
+    return scene;
+}
+
+#endif
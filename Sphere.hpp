@@ -18,10 +18,31 @@ public:
     Sphere(Vector3d center, double radius, Material *material): center(center),
                                                               radius(radius),
                                                               material(material) {};
-    virtual bool hit(const Ray &ray, double tMin, double tMax, HitRecord &hitRecord) const;
+    virtual bool closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const;
+    virtual bool occluded(const Ray &ray, double tMin, double tMax) const;
+    virtual void surface(const Ray &ray, const PrimitiveHit &hit, HitRecord &hitRecord) const;
+    virtual bool boundingBox(AABB &box) const;
+    virtual void collectLights(std::vector<LightSource> &lights) const;
+    virtual bool sampleLight(int index, const Vector3d &from, const Vector3d &u, LightSample &sample) const;
+    virtual double lightPdf(int index, const Vector3d &from, const Vector3d &p) const;
+    virtual bool sampleEmission(int index, const Vector3d &uPosition, const Vector3d &uDirection, EmissionSample &sample) const;
+    virtual void emissionPdf(int index, const Vector3d &p, const Vector3d &normal, const Vector3d &direction,
+                             double &pdfPosition, double &pdfDirection) const;
+    bool intersect(const Ray &ray, double tMin, double tMax, double &t) const;
+    Vector3d getCenter() const;
+    double getRadius() const;
     Material *material;
 };
 
+inline Vector3d Sphere::getCenter() const { return center; }
+inline double Sphere::getRadius() const { return radius; }
+
+inline bool Sphere::boundingBox(AABB &box) const {
+    Vector3d r(fabs(radius), fabs(radius), fabs(radius));
+    box = AABB(center - r, center + r);
+    return true;
+}
+
 /* Ray-Sphere intersection */
 // * Sphere equation: X^2 + Y^2 + Z^2 = R^2, any point X,Y,Z
 //   that satisfies the equation is on the sphere.
@@ -40,38 +61,214 @@ public:
 //   (A + t * B - C) • (A + t * B - C) = r * r.
 //   Rearrange it and solve a quadratic equation for t1 and t2:
 //   tt * (B • B) + 2t * (B • (A - C)) + ((A - C) • (A - C)) - RR = 0
-inline bool Sphere::hit(const Ray &ray, double tMin, double tMax, HitRecord &hitRecord) const {
+//   Only t is computed here, the hit point and normal are left
+//   to surface() once the closest hit is known.
+inline bool intersectSphere(const Vector3d &center, double radius, const Ray &ray, double tMin, double tMax, double &t) {
     Vector3d oc = ray.origin() - center;
     double a = dot(ray.direction(), ray.direction());
     double b = dot(oc, ray.direction()); // b is divided by 2
     double c = dot(oc, oc) - radius * radius;
     double discriminant = b * b - a * c;
     if (discriminant > 0) {
+        double root = sqrt(discriminant);
         // Outer surface hit t
-        double t = (-b - sqrt(discriminant)) / a;
-        if (t < tMax && t > tMin) {
-            hitRecord.t = t;
-            hitRecord.p = ray.pointAtParameter(hitRecord.t);
-            hitRecord.normal = (hitRecord.p - center) / radius;
-            hitRecord.material = this->material;
-            return true;
-        }
+        t = (-b - root) / a;
+        if (t < tMax && t > tMin) return true;
         /* Inner surface hit t */
         // When ray hits the outer surface, if BSDF sends a new ray
         // inside the Sphere it originates at the first intersection
         // (outer surface), so its origin t = 0 is less than tMin
         // (0.001) so the first intersection check fails, and this
         // t is calculated.
-        t = (-b + sqrt(discriminant)) / a;
-        if (t < tMax && t > tMin) {
-            hitRecord.t = t;
-            hitRecord.p = ray.pointAtParameter(hitRecord.t);
-            hitRecord.normal = (hitRecord.p - center) / radius;
-            hitRecord.material = this->material;
-            return true;
-        }
+        t = (-b + root) / a;
+        if (t < tMax && t > tMin) return true;
     }
     return false;
 }
 
+inline bool Sphere::intersect(const Ray &ray, double tMin, double tMax, double &t) const {
+    return intersectSphere(center, radius, ray, tMin, tMax, t);
+}
+
+inline bool Sphere::closestHit(const Ray &ray, double tMin, double tMax, PrimitiveHit &hit) const {
+    double t;
+    if (!intersect(ray, tMin, tMax, t)) return false;
+    hit.t = t;
+    hit.primitive = this;
+    hit.index = 0;
+    return true;
+}
+
+inline bool Sphere::occluded(const Ray &ray, double tMin, double tMax) const {
+    double t;
+    return intersect(ray, tMin, tMax, t);
+}
+
+/* Sphere texture coordinates */
+// Longitude and latitude of the unit normal n:
+// u = (atan2(-n.z, n.x) + π) / 2π around the Y axis,
+// v = acos(-n.y) / π from the bottom pole (0) to the top (1).
+// A step in u covers 2πR * sin(θ) (less towards the poles), a step
+// in v πR.
+inline void sphereTextureCoordinates(const Vector3d &normal, double radius, HitRecord &hitRecord) {
+    double y = fmax(-1.0, fmin(1.0, normal.y()));
+    hitRecord.u = (atan2(-normal.z(), normal.x()) + M_PI) / (2 * M_PI);
+    hitRecord.v = acos(-y) / M_PI;
+    hitRecord.uvLength = fabs(radius) * fmax(2 * M_PI * sqrt(1 - y * y), M_PI);
+}
+
+inline void Sphere::surface(const Ray &ray, const PrimitiveHit &hit, HitRecord &hitRecord) const {
+    hitRecord.t = hit.t;
+    hitRecord.p = ray.pointAtParameter(hit.t);
+    hitRecord.normal = (hitRecord.p - center) / radius;
+    hitRecord.material = this->material;
+    sphereTextureCoordinates(hitRecord.normal, radius, hitRecord);
+}
+
+/* Spherical lights */
+// * Bounds: a sphere has normals in every direction (cosThetaO =
+//   -1) and every point emits over its hemisphere (θe = π/2). Its
+//   power is the average radiance times π (the cosine weighted
+//   hemisphere) times its area 4πR².
+// * Seen from outside only the cap facing `from` can be reached.
+//   It fills the cone of half angle θmax around the direction to
+//   the center, sin(θmax) = R / d. A direction uniform inside the
+//   cone has the pdf 1 / (2π * (1 - cos(θmax))). The point on the
+//   sphere is found from the angle α it makes at the center
+//   instead of intersecting a ray with the sphere (pbrt-v4's
+//   Sphere::Sample). For far away spheres 1 - cos(θmax) loses all
+//   precision, its Taylor expansion sin²(θmax) / 2 is used then.
+// * Seen from inside the whole sphere is visible: the point is
+//   uniform on the sphere and its area pdf is converted to solid
+//   angle with d² / (|cos| * area).
+// * Emission: a point uniform on the sphere (pdf 1 / 4πR²) and a
+//   direction cosine distributed around its normal (cos / π), the
+//   outgoing radiance is constant so this follows it exactly.
+static const double smallConeSin2 = 0.00068523; // sin²(1.5°)
+
+inline LightBounds sphereLightBounds(const Vector3d &center, double radius, const Vector3d &radiance) {
+    LightBounds bounds;
+    Vector3d r(fabs(radius), fabs(radius), fabs(radius));
+    bounds.box = AABB(center - r, center + r);
+    double average = (radiance.x() + radiance.y() + radiance.z()) / 3;
+    bounds.phi = average * M_PI * 4 * M_PI * radius * radius;
+    bounds.cosThetaO = -1;
+    bounds.cosThetaE = 0;
+    return bounds;
+}
+
+inline double sphereConeSolidAngle(double sin2ThetaMax) {
+    double oneMinusCosThetaMax = sin2ThetaMax < smallConeSin2 ? sin2ThetaMax / 2 : 1 - sqrt(fmax(0.0, 1 - sin2ThetaMax));
+    return 2 * M_PI * oneMinusCosThetaMax;
+}
+
+inline bool sampleSphereLight(const Vector3d &center, double radius, const Vector3d &from, const Vector3d &u, LightSample &sample) {
+    double r = fabs(radius);
+    Vector3d toCenter = center - from;
+    double d2 = toCenter.squaredLength();
+    if (d2 <= r * r) {
+        double z = 1 - 2 * u.x();
+        double s = sqrt(fmax(0.0, 1 - z * z));
+        double phi = 2 * M_PI * u.y();
+        sample.normal = Vector3d(s * cos(phi), s * sin(phi), z);
+        sample.p = center + r * sample.normal;
+        Vector3d toLight = sample.p - from;
+        double dist2 = toLight.squaredLength();
+        double cosine = fabs(dot(sample.normal, toLight));
+        if (cosine == 0) return false;
+        sample.pdf = dist2 * sqrt(dist2) / (cosine * 4 * M_PI * r * r);
+        return true;
+    }
+    double sin2ThetaMax = r * r / d2;
+    double sinThetaMax = sqrt(sin2ThetaMax);
+    double solidAngle = sphereConeSolidAngle(sin2ThetaMax);
+    // θ uniform in solid angle inside the cone
+    double cosTheta = 1 - u.x() * solidAngle / (2 * M_PI);
+    double sin2Theta = 1 - cosTheta * cosTheta;
+    if (sin2ThetaMax < smallConeSin2) {
+        sin2Theta = sin2ThetaMax * u.x();
+        cosTheta = sqrt(1 - sin2Theta);
+    }
+    double cosAlpha = sin2Theta / sinThetaMax + cosTheta * sqrt(fmax(0.0, 1 - sin2Theta / sin2ThetaMax));
+    double sinAlpha = sqrt(fmax(0.0, 1 - cosAlpha * cosAlpha));
+    double phi = 2 * M_PI * u.y();
+    Vector3d w = toCenter / sqrt(d2);
+    Vector3d t, b;
+    orthonormalBasis(w, t, b);
+    // The normal points back towards `from`, α away from -w
+    sample.normal = -(sinAlpha * cos(phi) * t + sinAlpha * sin(phi) * b + cosAlpha * w);
+    sample.p = center + r * sample.normal;
+    sample.pdf = 1 / solidAngle;
+    return true;
+}
+
+inline double sphereLightPdf(const Vector3d &center, double radius, const Vector3d &from, const Vector3d &p) {
+    double r = fabs(radius);
+    double d2 = (center - from).squaredLength();
+    if (d2 <= r * r) {
+        Vector3d toLight = p - from;
+        double dist2 = toLight.squaredLength();
+        double cosine = fabs(dot((p - center) / r, toLight));
+        if (cosine == 0) return 0;
+        return dist2 * sqrt(dist2) / (cosine * 4 * M_PI * r * r);
+    }
+    return 1 / sphereConeSolidAngle(r * r / d2);
+}
+
+inline bool sampleSphereEmission(const Vector3d &center, double radius, const Vector3d &uPosition, const Vector3d &uDirection,
+                                 EmissionSample &sample) {
+    double r = fabs(radius);
+    double z = 1 - 2 * uPosition.x();
+    double s = sqrt(fmax(0.0, 1 - z * z));
+    double phi = 2 * M_PI * uPosition.y();
+    sample.normal = Vector3d(s * cos(phi), s * sin(phi), z);
+    sample.p = center + r * sample.normal;
+    sample.pdfPosition = 1 / (4 * M_PI * r * r);
+    // A uniform point on the unit disk, lifted onto the hemisphere
+    double diskRadius = sqrt(uDirection.x());
+    double diskAngle = 2 * M_PI * uDirection.y();
+    double cosine = sqrt(fmax(0.0, 1 - uDirection.x()));
+    Vector3d t, b;
+    orthonormalBasis(sample.normal, t, b);
+    sample.direction = diskRadius * cos(diskAngle) * t + diskRadius * sin(diskAngle) * b + cosine * sample.normal;
+    sample.pdfDirection = cosine / M_PI;
+    return sample.pdfDirection > 0;
+}
+
+inline void sphereEmissionPdf(double radius, const Vector3d &normal, const Vector3d &direction, double &pdfPosition, double &pdfDirection) {
+    pdfPosition = 1 / (4 * M_PI * radius * radius);
+    pdfDirection = fmax(0.0, dot(normal, direction)) / M_PI;
+}
+
+inline void Sphere::collectLights(std::vector<LightSource> &lights) const {
+    Vector3d radiance = material->emitted();
+    if (radiance.x() <= 0 && radiance.y() <= 0 && radiance.z() <= 0) return;
+    LightSource light;
+    light.primitive = this;
+    light.index = 0;
+    light.bounds = sphereLightBounds(center, radius, radiance);
+    lights.push_back(light);
+}
+
+inline bool Sphere::sampleLight(int index, const Vector3d &from, const Vector3d &u, LightSample &sample) const {
+    if (!sampleSphereLight(center, radius, from, u, sample)) return false;
+    sample.radiance = material->emitted();
+    return true;
+}
+
+inline double Sphere::lightPdf(int index, const Vector3d &from, const Vector3d &p) const {
+    return sphereLightPdf(center, radius, from, p);
+}
+
+inline bool Sphere::sampleEmission(int index, const Vector3d &uPosition, const Vector3d &uDirection, EmissionSample &sample) const {
+    if (!sampleSphereEmission(center, radius, uPosition, uDirection, sample)) return false;
+    sample.radiance = material->emitted();
+    return true;
+}
+
+inline void Sphere::emissionPdf(int index, const Vector3d &p, const Vector3d &normal, const Vector3d &direction,
+                                double &pdfPosition, double &pdfDirection) const {
+    sphereEmissionPdf(radius, normal, direction, pdfPosition, pdfDirection);
+}
+
 #endif
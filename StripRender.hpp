@@ -0,0 +1,110 @@
+#ifndef StripRender_hpp
+#define StripRender_hpp
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <stdint.h>
+#include "Camera.hpp"
+#include "Film.hpp"
+#include "Scene.hpp"
+#include "Renderer.hpp"
+
+/* Strip rendering */
+// A film holds the whole image (12 bytes per pixel in float32), so
+// a 64k x 32k poster needs 24 GiB before the first ray. Streamed,
+// the image is rendered as horizontal strips, each to full spp in
+// its own job with a film of only the strip (a view that is a strip
+// of the frame, see RenderView), and every finished strip is
+// resolved and appended to the output right away.
+//
+// * Strips go from the top of the image down, the order of a PPM
+//   file, so the file is written front to back with the header
+//   first (the size is known up front).
+// * Up to `window` strip jobs are in flight on the renderer's pool.
+//   Jobs after the first keep threads busy while the first one
+//   finishes a pass. Its strip is written, its film freed and the
+//   next strip submitted, so memory is window x strip, whatever the
+//   image height.
+// * Strip heights are a multiple of the framebuffer's tiles, the
+//   last (bottom) strip takes what is left.
+// * Pixels sample in frame coordinates and films dither with frame
+//   rows: the file is the same as a whole frame render written at
+//   once. Not with bdpt, whose light paths splat into the whole
+//   frame.
+struct StripStatistics {
+    int strips;
+    int stripHeight;
+    size_t stripBytes; // framebuffer of one strip
+    uint64_t rays;
+    double seconds;
+};
+
+// onStrip(done, total, progress) after every strip written
+inline bool renderStrips(Renderer &renderer, const Scene &scene, const Camera &camera, const RenderSettings &settings, int stripHeight,
+                         int window, const FilmSettings &filmSettings, const std::string &path, StripStatistics &statistics,
+                         const std::function<void(int, int, const StripStatistics &)> &onStrip = nullptr) {
+    auto start = std::chrono::steady_clock::now();
+    const int tile = Framebuffer::tileSize;
+    const int width = settings.width;
+    const int height = settings.height;
+    stripHeight = std::max(tile, (std::min(stripHeight, height) + tile - 1) / tile * tile);
+    window = std::max(1, window);
+    const int strips = (height + stripHeight - 1) / stripHeight;
+    statistics = StripStatistics{ strips, stripHeight, 0, 0, 0 };
+    std::ofstream writer(path, std::ofstream::binary | std::ofstream::trunc);
+    if (!writer) {
+        std::cout << "ERROR: can not write " << path << "." << std::endl;
+        return false;
+    }
+    writer << "P6\n" << width << " " << height << "\n255\n";
+    // Strip k covers frame rows top - (k + 1) * stripHeight to
+    // top - k * stripHeight (clipped at the bottom)
+    auto submit = [&](int k) {
+        RenderView view;
+        view.camera = camera;
+        view.width = width;
+        view.frameHeight = height;
+        view.frameY = std::max(0, height - (k + 1) * stripHeight);
+        view.height = height - k * stripHeight - view.frameY;
+        return renderer.submit(scene, std::vector<RenderView>(1, view), settings);
+    };
+    std::deque<std::shared_ptr<RenderJob>> jobs;
+    // On errors: the jobs still use the scene, let them stop first
+    auto abandon = [&]() {
+        for (const std::shared_ptr<RenderJob> &pending : jobs) pending->cancel();
+        for (const std::shared_ptr<RenderJob> &pending : jobs) pending->wait();
+        return false;
+    };
+    int submitted = 0;
+    std::vector<uint8_t> rgb;
+    for (int k = 0; k < strips; k++) {
+        while (submitted < strips && submitted < k + window) {
+            std::shared_ptr<RenderJob> job = submit(submitted++);
+            if (!job) return abandon();
+            jobs.push_back(job);
+        }
+        RenderResult result = jobs.front()->wait();
+        jobs.pop_front();
+        const Film &film = *result.film;
+        statistics.stripBytes = std::max(statistics.stripBytes, film.buffer().bytes());
+        rgb.resize(size_t(film.getWidth()) * film.getHeight() * 3);
+        film.resolve(filmSettings, rgb.data());
+        writer.write(reinterpret_cast<const char *>(rgb.data()), rgb.size());
+        if (!writer) {
+            std::cout << "ERROR: std::ofstream failed." << std::endl;
+            return abandon();
+        }
+        statistics.rays += result.rays;
+        statistics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (onStrip) onStrip(k + 1, strips, statistics);
+    }
+    return true;
+}
+
+#endif
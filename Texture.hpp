@@ -0,0 +1,51 @@
+#ifndef Texture_hpp
+#define Texture_hpp
+
+#include <iostream>
+#include <math.h>
+#include "Vector3d.hpp"
+#include "HitRecord.hpp"
+#include "TextureCache.hpp"
+
+/* Textures */
+// A color that varies over a surface, looked up with the texture
+// coordinates (u, v) of a hit. Materials multiply their albedo
+// with it.
+class Texture {
+public:
+    virtual ~Texture() {}
+    virtual Color value(const HitRecord &hitRecord) const = 0;
+};
+
+/* Image texture */
+// An image served by a TextureCache, repeated `scale` times over
+// the surface in both directions.
+//
+// * Mip level: hitRecord.footprint is the width of the ray's
+//   footprint in (u, v) units, times the texture's width it is the
+//   number of texels the footprint covers. The level where that is
+//   about one texel is log2 of it, coarser levels would blur,
+//   finer levels alias and read more tiles.
+class ImageTexture: public Texture {
+    TextureCache &cache;
+    int texture;
+    double scale;
+public:
+    ImageTexture(TextureCache &cache, int texture, double scale = 1): cache(cache), texture(texture), scale(scale) {};
+    virtual Color value(const HitRecord &hitRecord) const;
+};
+
+inline Color ImageTexture::value(const HitRecord &hitRecord) const {
+    double texels = hitRecord.footprint * scale * std::max(cache.width(texture, 0), cache.height(texture, 0));
+    int level = texels > 1 ? int(log2(texels) + 0.5) : 0;
+    level = std::min(level, cache.levelCount(texture) - 1);
+    return cache.lookup(texture, level, hitRecord.u * scale, hitRecord.v * scale);
+}
+
+// The albedo of a material at a hit: albedo alone without a
+// texture, tinted by the texture with one.
+inline Color textureAlbedo(const Texture *texture, const Color &albedo, const HitRecord &hitRecord) {
+    return texture ? albedo * texture->value(hitRecord) : albedo;
+}
+
+#endif
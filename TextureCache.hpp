@@ -0,0 +1,370 @@
+#ifndef TextureCache_hpp
+#define TextureCache_hpp
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include "Vector3d.hpp"
+
+/* PPM image input */
+// Reads binary 8-bit PPM (P6), the format Film writes. Comments
+// in the header are skipped. Returns false after printing why.
+inline bool readPPM(const std::string &path, int &width, int &height, std::vector<uint8_t> &rgb) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cout << "ERROR: can not open " << path << "." << std::endl;
+        return false;
+    }
+    std::string magic;
+    file >> magic;
+    int values[3];
+    for (int i = 0; i < 3 && file; i++) {
+        file >> std::ws;
+        while (file.peek() == '#') {
+            std::string comment;
+            std::getline(file, comment);
+            file >> std::ws;
+        }
+        file >> values[i];
+    }
+    if (!file || magic != "P6" || values[0] <= 0 || values[1] <= 0 || values[2] != 255) {
+        std::cout << "ERROR: " << path << " is not an 8-bit binary PPM (P6)." << std::endl;
+        return false;
+    }
+    file.get(); // the single whitespace after maxval
+    width = values[0];
+    height = values[1];
+    rgb.resize(size_t(width) * height * 3);
+    file.read(reinterpret_cast<char *>(rgb.data()), std::streamsize(rgb.size()));
+    if (!file) {
+        std::cout << "ERROR: " << path << " is truncated." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/* sRGB decoding */
+// 8-bit sRGB to linear, as a table.
+class SRGBDecodeTable {
+    float table[256];
+public:
+    SRGBDecodeTable();
+    static const SRGBDecodeTable &shared();
+    float operator[](uint8_t value) const { return table[value]; }
+};
+
+inline SRGBDecodeTable::SRGBDecodeTable() {
+    for (int i = 0; i < 256; i++) {
+        double c = i / 255.0;
+        table[i] = float(c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4));
+    }
+}
+
+inline const SRGBDecodeTable &SRGBDecodeTable::shared() {
+    static SRGBDecodeTable table;
+    return table;
+}
+
+/* Texture cache */
+// Serves texels of image textures from a bounded amount of memory.
+//
+// * addTexture() converts an image once into a mip pyramid (every
+//   level half the size of the one above, averaged in linear
+//   space) cut into 32x32 tiles and written to an unlinked
+//   temporary file. Only the tiles rays actually read are loaded,
+//   from the finest level where the footprint of the ray needs
+//   it, so a texture seen from afar costs a few small tiles.
+// * Every tile carries one extra column and row (the texels right
+//   of and below it, wrapped), so a bilinear lookup always finds
+//   its 2x2 texels in a single tile.
+// * Tiles are kept as 8-bit sRGB (3 KiB each) and decoded on
+//   lookup. The cache is split into 16 shards, each with its own
+//   lock and LRU list, so render threads rarely wait for each
+//   other. When a shard is over its share of the capacity, its
+//   least recently used tiles are dropped.
+// * Textures are added before rendering starts, lookups are
+//   thread-safe.
+class TextureCache {
+public:
+    static const int tileSize = 32;
+    static const int tileStride = tileSize + 1; // with the border
+    static const size_t tileBytes = size_t(tileStride) * tileStride * 3;
+    static const int shardCount = 16;
+    struct Statistics {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t residentBytes;
+    };
+private:
+    struct Level {
+        int width;
+        int height;
+        int tilesX;
+        int tilesY;
+        uint64_t fileOffset;
+    };
+    struct Texture {
+        int fd;
+        std::vector<Level> levels;
+    };
+    struct Tile {
+        uint64_t key;
+        std::vector<uint8_t> texels;
+    };
+    struct Shard {
+        std::mutex mutex;
+        std::list<Tile> tiles; // most recently used first
+        std::unordered_map<uint64_t, std::list<Tile>::iterator> index;
+        size_t bytes = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+    std::vector<Texture> textures;
+    Shard shards[shardCount];
+    size_t capacity;
+    static uint64_t tileKey(int texture, int level, int tileX, int tileY);
+    bool readTile(const Texture &texture, int level, int tileX, int tileY, std::vector<uint8_t> &texels) const;
+    TextureCache(const TextureCache &) = delete;
+    TextureCache &operator=(const TextureCache &) = delete;
+public:
+    TextureCache(size_t capacity = size_t(256) << 20);
+    ~TextureCache();
+    static TextureCache &shared();
+    // Capacity in bytes of tile data, change it before rendering
+    void setCapacity(size_t bytes);
+    size_t getCapacity() const;
+    // Returns the texture's id, or -1 after printing why
+    int addTexture(const std::string &path);
+    int addTexture(int width, int height, const std::vector<uint8_t> &rgb);
+    int levelCount(int texture) const;
+    int width(int texture, int level) const;
+    int height(int texture, int level) const;
+    // Bilinear lookup at (s, t) in [0, 1) (wrapped outside), linear
+    // RGB
+    Color lookup(int texture, int level, double s, double t);
+    Statistics statistics();
+    void resetStatistics();
+};
+
+inline TextureCache::TextureCache(size_t capacity): capacity(capacity) {}
+
+inline TextureCache::~TextureCache() {
+    for (Texture &texture : textures) close(texture.fd);
+}
+
+inline TextureCache &TextureCache::shared() {
+    static TextureCache cache;
+    return cache;
+}
+
+inline void TextureCache::setCapacity(size_t bytes) { capacity = bytes; }
+inline size_t TextureCache::getCapacity() const { return capacity; }
+inline int TextureCache::levelCount(int texture) const { return int(textures[texture].levels.size()); }
+inline int TextureCache::width(int texture, int level) const { return textures[texture].levels[level].width; }
+inline int TextureCache::height(int texture, int level) const { return textures[texture].levels[level].height; }
+
+inline uint64_t TextureCache::tileKey(int texture, int level, int tileX, int tileY) {
+    return (uint64_t(texture) << 48) | (uint64_t(level) << 40) | (uint64_t(tileY) << 20) | uint64_t(tileX);
+}
+
+inline int TextureCache::addTexture(const std::string &path) {
+    int width, height;
+    std::vector<uint8_t> rgb;
+    if (!readPPM(path, width, height, rgb)) return -1;
+    return addTexture(width, height, rgb);
+}
+
+inline int TextureCache::addTexture(int width, int height, const std::vector<uint8_t> &rgb) {
+    if (width <= 0 || height <= 0 || width >= (1 << 20) || height >= (1 << 20)) {
+        std::cout << "ERROR: texture size " << width << "x" << height << " is not supported." << std::endl;
+        return -1;
+    }
+    const char *directory = getenv("TMPDIR");
+    std::string name = std::string(directory ? directory : "/tmp") + "/gloom-texture-XXXXXX";
+    std::vector<char> nameBuffer(name.begin(), name.end());
+    nameBuffer.push_back(0);
+    int fd = mkstemp(nameBuffer.data());
+    if (fd < 0) {
+        std::cout << "ERROR: can not create a texture tile file in " << (directory ? directory : "/tmp") << "." << std::endl;
+        return -1;
+    }
+    unlink(nameBuffer.data()); // removed when closed
+
+    // Level by level: cut the level into tiles, write them, then
+    // average 2x2 texels (in linear space) into the next level.
+    const SRGBDecodeTable &decode = SRGBDecodeTable::shared();
+    Texture texture;
+    texture.fd = fd;
+    const uint8_t *data = rgb.data(); // the level being cut
+    std::vector<uint8_t> current;
+    std::vector<uint8_t> next;
+    std::vector<uint8_t> tile(tileBytes);
+    uint64_t offset = 0;
+    int levelWidth = width, levelHeight = height;
+    while (true) {
+        Level level;
+        level.width = levelWidth;
+        level.height = levelHeight;
+        level.tilesX = (levelWidth + tileSize - 1) / tileSize;
+        level.tilesY = (levelHeight + tileSize - 1) / tileSize;
+        level.fileOffset = offset;
+        for (int ty = 0; ty < level.tilesY; ty++) {
+            for (int tx = 0; tx < level.tilesX; tx++) {
+                for (int y = 0; y < tileStride; y++) {
+                    int sy = (ty * tileSize + y) % levelHeight;
+                    for (int x = 0; x < tileStride; x++) {
+                        int sx = (tx * tileSize + x) % levelWidth;
+                        const uint8_t *source = &data[(size_t(sy) * levelWidth + sx) * 3];
+                        uint8_t *target = &tile[(size_t(y) * tileStride + x) * 3];
+                        target[0] = source[0];
+                        target[1] = source[1];
+                        target[2] = source[2];
+                    }
+                }
+                if (pwrite(fd, tile.data(), tileBytes, off_t(offset)) != ssize_t(tileBytes)) {
+                    std::cout << "ERROR: writing texture tiles failed." << std::endl;
+                    close(fd);
+                    return -1;
+                }
+                offset += tileBytes;
+            }
+        }
+        texture.levels.push_back(level);
+        if (levelWidth == 1 && levelHeight == 1) break;
+        int nextWidth = std::max(1, levelWidth / 2);
+        int nextHeight = std::max(1, levelHeight / 2);
+        next.resize(size_t(nextWidth) * nextHeight * 3);
+        for (int y = 0; y < nextHeight; y++) {
+            for (int x = 0; x < nextWidth; x++) {
+                for (int c = 0; c < 3; c++) {
+                    float sum = 0;
+                    for (int dy = 0; dy < 2; dy++) {
+                        int sy = std::min(2 * y + dy, levelHeight - 1);
+                        for (int dx = 0; dx < 2; dx++) {
+                            int sx = std::min(2 * x + dx, levelWidth - 1);
+                            sum += decode[data[(size_t(sy) * levelWidth + sx) * 3 + c]];
+                        }
+                    }
+                    double linear = sum / 4;
+                    double encoded = linear <= 0.0031308 ? 12.92 * linear : 1.055 * pow(linear, 1 / 2.4) - 0.055;
+                    next[(size_t(y) * nextWidth + x) * 3 + c] = uint8_t(std::min(255.0, encoded * 255 + 0.5));
+                }
+            }
+        }
+        current.swap(next);
+        data = current.data();
+        levelWidth = nextWidth;
+        levelHeight = nextHeight;
+    }
+    textures.push_back(texture);
+    return int(textures.size()) - 1;
+}
+
+inline bool TextureCache::readTile(const Texture &texture, int level, int tileX, int tileY, std::vector<uint8_t> &texels) const {
+    const Level &l = texture.levels[level];
+    uint64_t offset = l.fileOffset + (uint64_t(tileY) * l.tilesX + tileX) * tileBytes;
+    texels.resize(tileBytes);
+    return pread(texture.fd, texels.data(), tileBytes, off_t(offset)) == ssize_t(tileBytes);
+}
+
+inline Color TextureCache::lookup(int texture, int level, double s, double t) {
+    const Texture &tex = textures[texture];
+    const Level &l = tex.levels[level];
+    // Texel centers are at half integers
+    double x = s * l.width - 0.5;
+    double y = t * l.height - 0.5;
+    double fx = floor(x), fy = floor(y);
+    double wx = x - fx, wy = y - fy;
+    int x0 = int(fx - l.width * floor(fx / l.width));
+    int y0 = int(fy - l.height * floor(fy / l.height));
+    int tileX = x0 / tileSize, tileY = y0 / tileSize;
+    int ix = x0 - tileX * tileSize, iy = y0 - tileY * tileSize;
+
+    uint64_t key = tileKey(texture, level, tileX, tileY);
+    Shard &shard = shards[(key * 0x9e3779b97f4a7c15ULL) >> 60];
+    uint8_t texels[4][3];
+    auto copyTexels = [&](const std::vector<uint8_t> &tile) {
+        const uint8_t *row0 = &tile[(size_t(iy) * tileStride + ix) * 3];
+        const uint8_t *row1 = row0 + tileStride * 3;
+        for (int c = 0; c < 3; c++) {
+            texels[0][c] = row0[c];
+            texels[1][c] = row0[3 + c];
+            texels[2][c] = row1[c];
+            texels[3][c] = row1[3 + c];
+        }
+    };
+    bool found = false;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto entry = shard.index.find(key);
+        if (entry != shard.index.end()) {
+            shard.tiles.splice(shard.tiles.begin(), shard.tiles, entry->second);
+            copyTexels(entry->second->texels);
+            shard.hits++;
+            found = true;
+        }
+    }
+    if (!found) {
+        // Read without holding the lock, another thread may load the
+        // same tile meanwhile (the second copy is dropped).
+        Tile tile;
+        tile.key = key;
+        if (!readTile(tex, level, tileX, tileY, tile.texels)) return Color(0, 0, 0);
+        copyTexels(tile.texels);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.misses++;
+        if (shard.index.find(key) == shard.index.end()) {
+            shard.tiles.push_front(std::move(tile));
+            shard.index[key] = shard.tiles.begin();
+            shard.bytes += tileBytes;
+            // Keep at least the new tile, even under a tiny capacity
+            size_t shardCapacity = capacity / shardCount;
+            while (shard.bytes > shardCapacity && shard.tiles.size() > 1) {
+                shard.index.erase(shard.tiles.back().key);
+                shard.tiles.pop_back();
+                shard.bytes -= tileBytes;
+                shard.evictions++;
+            }
+        }
+    }
+
+    const SRGBDecodeTable &decode = SRGBDecodeTable::shared();
+    double w[4] = { (1 - wx) * (1 - wy), wx * (1 - wy), (1 - wx) * wy, wx * wy };
+    double rgb[3];
+    for (int c = 0; c < 3; c++) {
+        rgb[c] = w[0] * decode[texels[0][c]] + w[1] * decode[texels[1][c]] + w[2] * decode[texels[2][c]] + w[3] * decode[texels[3][c]];
+    }
+    return Color(rgb[0], rgb[1], rgb[2]);
+}
+
+inline TextureCache::Statistics TextureCache::statistics() {
+    Statistics total = { 0, 0, 0, 0 };
+    for (Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total.hits += shard.hits;
+        total.misses += shard.misses;
+        total.evictions += shard.evictions;
+        total.residentBytes += shard.bytes;
+    }
+    return total;
+}
+
+inline void TextureCache::resetStatistics() {
+    for (Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.hits = shard.misses = shard.evictions = 0;
+    }
+}
+
+#endif
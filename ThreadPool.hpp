@@ -0,0 +1,118 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <algorithm>
+#include "Topology.hpp"
+
+/* Thread pool */
+// A fixed set of worker threads running tasks in submission order.
+// Renderers share one pool, so several render jobs can run at once
+// without each starting threads of its own.
+//
+// * Tasks may submit further tasks (a render pass schedules the
+//   next one from the worker that finished it).
+// * The destructor runs every task that is still queued, including
+//   the ones those tasks submit, then joins the workers.
+// * Given NUMA nodes (see Topology.hpp), worker i is pinned to a core
+//   of node i % nodes, so the workers are spread evenly over the
+//   nodes and never migrate. currentNode() then tells a task which
+//   node it runs on (the index into the given nodes), for node
+//   local data. Without nodes, or if pinning fails, every worker is
+//   on node 0.
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool stopping;
+    int nodes;
+    static int &workerNode();
+    void run(int node, int cpu);
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+public:
+    // threads <= 0: one per hardware thread (per CPU of the nodes)
+    ThreadPool(int threads = 0, const std::vector<NumaNode> &topology = std::vector<NumaNode>());
+    ~ThreadPool();
+    void submit(std::function<void()> task);
+    int threadCount() const;
+    // Nodes the workers are spread over (1 if not pinned)
+    int nodeCount() const;
+    // Node of the calling worker, 0 on other threads
+    static int currentNode();
+};
+
+inline ThreadPool::ThreadPool(int threads, const std::vector<NumaNode> &topology): stopping(false), nodes(1) {
+    if (threads <= 0) threads = topology.empty() ? std::max(1, int(std::thread::hardware_concurrency())) : cpuCount(topology);
+    bool pinned = false;
+    if (!topology.empty()) {
+        cpu_set_t allowed;
+        // Pinning is not allowed everywhere (some containers), test
+        // it once on this thread and restore the mask
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && pinThread(topology[0].cpus[0])) {
+            sched_setaffinity(0, sizeof(allowed), &allowed);
+            nodes = int(topology.size());
+            pinned = true;
+        } else {
+            std::cout << "WARNING: can not pin threads to CPUs, running without NUMA placement." << std::endl;
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        int node = i % nodes;
+        int cpu = pinned ? topology[node].cpus[(i / nodes) % topology[node].cpus.size()] : -1;
+        workers.emplace_back(&ThreadPool::run, this, node, cpu);
+    }
+}
+
+inline ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    available.notify_all();
+    for (std::thread &worker : workers) worker.join();
+}
+
+inline void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    available.notify_one();
+}
+
+inline int ThreadPool::threadCount() const { return int(workers.size()); }
+inline int ThreadPool::nodeCount() const { return nodes; }
+
+inline int &ThreadPool::workerNode() {
+    static thread_local int node = 0;
+    return node;
+}
+
+inline int ThreadPool::currentNode() { return workerNode(); }
+
+inline void ThreadPool::run(int node, int cpu) {
+    workerNode() = node;
+    if (cpu >= 0) pinThread(cpu);
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) return; // stopping and nothing left
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+#endif
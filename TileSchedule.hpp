@@ -0,0 +1,170 @@
+#ifndef TileSchedule_hpp
+#define TileSchedule_hpp
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <math.h>
+
+/* Pixel rectangles */
+// A rectangle of pixels in image coordinates: x from the left, y
+// from the top (like the written image and most image viewers).
+// The film counts rows from the bottom, toFilm() converts.
+// An empty rectangle (width or height <= 0) means "none" or "the
+// whole frame", depending on where it is used.
+struct PixelRect {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+    bool isEmpty() const { return width <= 0 || height <= 0; }
+};
+
+// Parses "x,y,width,height". Returns false on anything else.
+inline bool parsePixelRect(const std::string &text, PixelRect &rect) {
+    int values[4];
+    size_t start = 0;
+    for (int i = 0; i < 4; i++) {
+        size_t end = text.find(',', start);
+        if ((end == std::string::npos) != (i == 3)) return false;
+        if (end == std::string::npos) end = text.size();
+        if (end == start) return false;
+        values[i] = atoi(text.substr(start, end - start).c_str());
+        start = end + 1;
+    }
+    rect.x = values[0];
+    rect.y = values[1];
+    rect.width = values[2];
+    rect.height = values[3];
+    return true;
+}
+
+/* Tile rectangles */
+// A render tile in film coordinates (rows from the bottom): pixels
+// x0 <= x < x1, y0 <= y < y1.
+struct TileRect {
+    int x0, y0, x1, y1;
+    bool isEmpty() const { return x1 <= x0 || y1 <= y0; }
+    int pixelCount() const { return (x1 - x0) * (y1 - y0); }
+};
+
+// The film area of an image rectangle, clipped to the frame
+inline TileRect toFilm(const PixelRect &rect, int width, int height) {
+    TileRect tile;
+    tile.x0 = std::max(rect.x, 0);
+    tile.x1 = std::min(rect.x + rect.width, width);
+    tile.y0 = std::max(height - (rect.y + rect.height), 0);
+    tile.y1 = std::min(height - rect.y, height);
+    return tile;
+}
+
+inline TileRect intersectRects(const TileRect &a, const TileRect &b) {
+    return TileRect{ std::max(a.x0, b.x0), std::max(a.y0, b.y0), std::min(a.x1, b.x1), std::min(a.y1, b.y1) };
+}
+
+/* Tile order */
+// The order in which a pass visits the tiles of a view. Every
+// order visits every tile once, only what appears first changes:
+// * Scanline: row by row from the bottom of the film, the original
+//   order.
+// * Spiral: square rings around the center tile (of the crop
+//   window, else of the frame), counterclockwise inside a ring. The
+//   middle of the image, where the subject usually is, is done
+//   first.
+// * Hilbert: along a Hilbert curve over the tile grid. Consecutive
+//   tiles are neighbours, so the threads of a pass work on nearby
+//   parts of the scene (warmer caches) and a partial pass is a few
+//   compact blobs instead of stripes.
+enum class TileOrder { Scanline, Spiral, Hilbert };
+
+inline bool parseTileOrder(const std::string &name, TileOrder &order) {
+    if (name == "scanline") order = TileOrder::Scanline;
+    else if (name == "spiral") order = TileOrder::Spiral;
+    else if (name == "hilbert") order = TileOrder::Hilbert;
+    else return false;
+    return true;
+}
+
+// Position d along the Hilbert curve over an n x n grid (n a power
+// of two) to its cell (x, y), the iterative form of the recursive
+// construction: each step places the quadrant and rotates/flips
+// the remaining curve into it.
+inline void hilbertCell(int n, int d, int &x, int &y) {
+    x = y = 0;
+    for (int s = 1; s < n; s *= 2) {
+        int rx = 1 & (d / 2);
+        int ry = 1 & (d ^ rx);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+}
+
+// Tile indices (ty * tilesX + tx) of a tilesX x tilesY grid in the
+// given order. (centerX, centerY) is the spiral's center in tile
+// units.
+inline std::vector<int> orderTiles(int tilesX, int tilesY, TileOrder order, double centerX, double centerY) {
+    std::vector<int> tiles;
+    tiles.reserve(size_t(tilesX) * tilesY);
+    if (order == TileOrder::Hilbert) {
+        int n = 1;
+        while (n < tilesX || n < tilesY) n *= 2;
+        for (int d = 0; d < n * n; d++) {
+            int x, y;
+            hilbertCell(n, d, x, y);
+            if (x < tilesX && y < tilesY) tiles.push_back(y * tilesX + x);
+        }
+        return tiles;
+    }
+    for (int i = 0; i < tilesX * tilesY; i++) tiles.push_back(i);
+    if (order == TileOrder::Spiral) {
+        int cx = int(floor(centerX)), cy = int(floor(centerY));
+        auto ring = [&](int tile) { return std::max(abs(tile % tilesX - cx), abs(tile / tilesX - cy)); };
+        auto angle = [&](int tile) { return atan2(double(tile / tilesX - cy), double(tile % tilesX - cx)); };
+        std::stable_sort(tiles.begin(), tiles.end(), [&](int a, int b) {
+            int ra = ring(a), rb = ring(b);
+            return ra != rb ? ra < rb : angle(a) < angle(b);
+        });
+    }
+    return tiles;
+}
+
+/* Tile schedule */
+// The tiles of one view to render: the tile grid (Framebuffer's
+// tiles, so threads never share a tile's memory) clipped to the
+// crop window, in the given order, and split into the tiles that
+// touch a priority region and the rest. Tiles outside the crop
+// window are left out, tiles on its edge only keep their pixels
+// inside it. The camera still maps the whole frame, a crop is a
+// piece of the full image.
+inline void scheduleTiles(int width, int height, int tileSize, const PixelRect &crop, TileOrder order,
+                          const std::vector<PixelRect> &priorityRegions, std::vector<TileRect> &priority, std::vector<TileRect> &rest) {
+    TileRect frame{ 0, 0, width, height };
+    TileRect window = crop.isEmpty() ? frame : toFilm(crop, width, height);
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+    double centerX = 0.5 * (window.x0 + window.x1) / tileSize;
+    double centerY = 0.5 * (window.y0 + window.y1) / tileSize;
+    std::vector<TileRect> regions;
+    for (const PixelRect &region : priorityRegions) regions.push_back(intersectRects(toFilm(region, width, height), window));
+    for (int index : orderTiles(tilesX, tilesY, order, centerX, centerY)) {
+        int x0 = (index % tilesX) * tileSize;
+        int y0 = (index / tilesX) * tileSize;
+        TileRect tile = intersectRects(TileRect{ x0, y0, std::min(x0 + tileSize, width), std::min(y0 + tileSize, height) }, window);
+        if (tile.isEmpty()) continue;
+        bool important = false;
+        for (const TileRect &region : regions) important = important || !intersectRects(tile, region).isEmpty();
+        (important ? priority : rest).push_back(tile);
+    }
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef Topology_hpp
+#define Topology_hpp
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <algorithm>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+
+/* NUMA topology */
+// On machines with several sockets every socket has its own memory
+// (a NUMA node). A thread reads memory on its own node faster and
+// with more bandwidth than memory on another node, and Linux puts
+// a page on the node of the thread that first writes it (first
+// touch).
+//
+// * numaTopology() reads the nodes and their CPUs from
+//   /sys/devices/system/node, keeping only the CPUs this process may
+//   run on. Without that directory (not Linux, no NUMA support) the
+//   machine is one node with all allowed CPUs, so everything built
+//   on top degrades to the single node case.
+// * splitNumaNodes() pretends every node is `count` nodes, to run
+//   the multi-node code paths on a single socket machine (for
+//   testing, the memory of course stays where it is).
+// * pinThread() binds the calling thread to one CPU, runOnNode()
+//   runs a function on a thread bound to a node's CPUs, so the
+//   memory it allocates and fills lands on that node.
+struct NumaNode {
+    int id;
+    std::vector<int> cpus;
+};
+
+// Parses a Linux CPU list ("0-3,8,10-11"). Returns false on
+// anything else.
+inline bool parseCpuList(const std::string &text, std::vector<int> &cpus) {
+    size_t start = 0;
+    std::string list = text.substr(0, text.find_last_not_of(" \n") + 1);
+    while (start < list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        std::string range = list.substr(start, end - start);
+        size_t dash = range.find('-');
+        char *rest;
+        long first = strtol(range.c_str(), &rest, 10);
+        if (rest == range.c_str()) return false;
+        long last = first;
+        if (dash != std::string::npos) {
+            last = strtol(range.c_str() + dash + 1, &rest, 10);
+            if (rest == range.c_str() + dash + 1 || last < first) return false;
+        }
+        for (long cpu = first; cpu <= last; cpu++) cpus.push_back(int(cpu));
+        start = end + 1;
+    }
+    return true;
+}
+
+inline std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+    if (cpus.empty()) {
+        for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) cpus.push_back(int(cpu));
+    }
+    return cpus;
+}
+
+inline std::vector<NumaNode> numaTopology() {
+    std::vector<int> allowed = allowedCpus();
+    std::vector<NumaNode> nodes;
+    if (DIR *directory = opendir("/sys/devices/system/node")) {
+        while (dirent *entry = readdir(directory)) {
+            std::string name = entry->d_name;
+            if (name.compare(0, 4, "node") != 0 || name.size() == 4 || name.find_first_not_of("0123456789", 4) != std::string::npos) continue;
+            std::ifstream file("/sys/devices/system/node/" + name + "/cpulist");
+            std::string text;
+            std::vector<int> cpus;
+            if (!std::getline(file, text) || !parseCpuList(text, cpus)) continue;
+            NumaNode node;
+            node.id = atoi(name.c_str() + 4);
+            for (int cpu : cpus) {
+                if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) node.cpus.push_back(cpu);
+            }
+            if (!node.cpus.empty()) nodes.push_back(node);
+        }
+        closedir(directory);
+    }
+    if (nodes.empty()) nodes.push_back(NumaNode{ 0, allowed });
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode &a, const NumaNode &b) { return a.id < b.id; });
+    return nodes;
+}
+
+// Nodes with fewer CPUs than count share them.
+inline std::vector<NumaNode> splitNumaNodes(const std::vector<NumaNode> &nodes, int count) {
+    std::vector<NumaNode> split;
+    for (const NumaNode &node : nodes) {
+        for (int part = 0; part < count; part++) {
+            NumaNode piece;
+            piece.id = int(split.size());
+            size_t size = node.cpus.size();
+            size_t begin = size * part / count, end = size * (part + 1) / count;
+            if (begin == end) piece.cpus.push_back(node.cpus[begin % size]);
+            else piece.cpus.assign(node.cpus.begin() + begin, node.cpus.begin() + end);
+            split.push_back(piece);
+        }
+    }
+    return split;
+}
+
+inline int cpuCount(const std::vector<NumaNode> &nodes) {
+    int count = 0;
+    for (const NumaNode &node : nodes) count += int(node.cpus.size());
+    return count;
+}
+
+inline bool pinThread(const std::vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+inline bool pinThread(int cpu) {
+    return pinThread(std::vector<int>(1, cpu));
+}
+
+// Runs f on a new thread bound to the node's CPUs and waits for it.
+inline void runOnNode(const NumaNode &node, const std::function<void()> &f) {
+    std::thread thread([&]() {
+        pinThread(node.cpus);
+        f();
+    });
+    thread.join();
+}
+
+#endif
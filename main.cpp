@@ -1,7 +1,20 @@
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <time.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <sys/stat.h>
 
 #include "Vector3d.hpp"
+#include "Sampler.hpp"
+#include "Framebuffer.hpp"
+#include "Film.hpp"
 #include "Camera.hpp"
 #include "Material.hpp"
 #include "Hitable.hpp"
@@ -12,124 +25,1384 @@
 #include "Glossy.hpp"
 #include "DiffuseLight.hpp"
 #include "Dielectric.hpp"
+#include "BVH.hpp"
+#include "Scene.hpp"
+#include "SceneGenerator.hpp"
+#include "SceneCache.hpp"
+#include "PagedScene.hpp"
+#include "ProcessStats.hpp"
+#include "Topology.hpp"
+#include "ThreadPool.hpp"
+#include "Renderer.hpp"
+#include "LightBVH.hpp"
+#include "PathGuiding.hpp"
+#include "Texture.hpp"
+#include "TextureCache.hpp"
+#include "Convergence.hpp"
+#include "StripRender.hpp"
 
-Color color(const Ray &r, Hitable *scene, int depth, int maxDepth) {
-    HitRecord hitRecord;
-    // Get hit record of closest hit for ray
-    if (scene->hit(r, 0.001, MAXFLOAT, hitRecord)) { // TODO: Change to DBL_MAX?
-        Ray scattered;
-        Color attenuation;
-        // Get light emittance
-        Color emitted = hitRecord.material->emitted();
-        // Get material's scattered ray for current ray and hit record
-        if (depth < maxDepth && hitRecord.material->scatter(r, hitRecord, attenuation, scattered)) {
-            /* The Rendering Equation */
-            // L0 = Le + ∫(f * Li * cos(Ø) * dw), where:
-            // L0(x,w0) - pixel color at hit point x, ray 0 direction w0
-            // Le(x,w0) - emitted radiance at hit point x, ray 0 direction w0
-            // f(x,wi->w0) - BRDF at hit point x (attenuation)
-            // Li(x,wi) - radiance at hit point x, ray i direction wi
-
-            // Shoot scattered rays recursively until a light is hit
-            return emitted + attenuation * color(scattered, scene, depth + 1, maxDepth);
-        } else {
-            // End of recursion: light was hit, return emitted radiance
-            return emitted;
+/* Sampler comparison */
+// Renders the scene with spp samples per pixel into a linear
+// radiance buffer (row-major, bottom row first).
+void renderRadiance(const Hitable *scene, const DirectLighting &lighting, const Camera &camera, int width, int height, int spp, int rayBounce,
+                    Sampler &sampler, std::vector<Color> &radiance) {
+    radiance.assign(size_t(width) * height, Color(0, 0, 0));
+    for (int line = 0; line < height; line++) {
+        for (int pixel = 0; pixel < width; pixel++) {
+            Color sum(0, 0, 0);
+            for (int s = 0; s < spp; s++) sum += samplePixel(pixel, line, s, width, height, camera, scene, lighting, nullptr, rayBounce, sampler);
+            radiance[size_t(line) * width + pixel] = sum / double(spp);
         }
-    } else {
-        // End of recursion: ray didn't hit anything - return BG color
-        return Color(0.0, 0.0, 0.0);
     }
 }
 
-int main() {
+// Renders a high spp reference with the Sobol sampler, then every
+// sampler at the requested spp (same seed for all), and prints the
+// RMSE of each against the reference.
+void compareSamplers(const Hitable *scene, const DirectLighting &lighting, const Camera &camera, int width, int height, int spp, int referenceSpp,
+                     int rayBounce) {
+    std::vector<Color> reference;
+    std::vector<Color> image;
+    SobolSampler referenceSampler(referenceSpp, 0x5eed);
+    std::cout << "Reference: " << width << "x" << height << ", " << referenceSpp << " spp" << std::endl;
+    renderRadiance(scene, lighting, camera, width, height, referenceSpp, rayBounce, referenceSampler, reference);
+    const char *names[] = { "independent", "stratified", "sobol", "bluenoise" };
+    for (const char *name : names) {
+        Sampler *sampler = createSampler(name, spp, 1);
+        clock_t begin = clock();
+        renderRadiance(scene, lighting, camera, width, height, spp, rayBounce, *sampler, image);
+        double timePassed = double(clock() - begin) / CLOCKS_PER_SEC;
+        std::cout << name << ": " << spp << " spp, RMSE " << rmse(image, reference) << ", Time: " << timePassed << "s." << std::endl;
+        delete sampler;
+    }
+}
+
+/* Resolve benchmark */
+// Times Film::resolve() alone (no file I/O) on a film filled with
+// random radiance.
+void benchmarkResolve(int width, int height, const FilmSettings &settings) {
+    Film film(width, height);
+    IndependentSampler random(1);
+    for (int y = 0; y < height; y++) {
+        random.startPixelSample(0, y, 0);
+        for (int x = 0; x < width; x++) film.addSample(x, y, 4 * Color(random.get1D(), random.get1D(), random.get1D()), 1);
+    }
+    std::vector<uint8_t> rgb(size_t(width) * height * 3);
+    // Warm up: builds the shared blue noise and sRGB tables
+    film.resolve(settings, rgb.data());
+    const int runs = 10;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) film.resolve(settings, rgb.data());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() / runs;
+    std::cout << "Resolve " << width << "x" << height << ": " << seconds * 1e3 << "ms, "
+              << seconds * 1e3 / (width * double(height) * 1e-6) << "ms/MP." << std::endl;
+}
+
+/* Framebuffer benchmark */
+// Memory and accumulation bandwidth of the old per-row double
+// buffer (Color **) against the tile-major Framebuffer in float32
+// and half, plus the cost of converting the Framebuffer back to
+// scanlines. Pixels are written tile by tile, like the renderer
+// does.
+void benchmarkFramebuffer(int width, int height) {
+    const int tile = Framebuffer::tileSize;
+    const Color sample(0.25, 0.5, 0.75);
+    auto seconds = [](std::chrono::steady_clock::time_point begin) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+    auto report = [&](const char *name, size_t bytes, double accumulateTime, double scanlineTime) {
+        std::cout << name << ": " << bytes / (1024.0 * 1024.0) << " MiB, accumulate " << accumulateTime * 1e3 << "ms ("
+                  << 2 * bytes / accumulateTime / 1e9 << " GB/s)";
+        if (scanlineTime > 0) std::cout << ", to scanlines " << scanlineTime * 1e3 << "ms";
+        std::cout << "." << std::endl;
+    };
+    std::cout << "Framebuffer " << width << "x" << height << ":" << std::endl;
+    {
+        Color **buffer = new Color*[height];
+        for (int i = 0; i < height; i++) buffer[i] = new Color[width];
+        for (int y = 0; y < height; y++) for (int x = 0; x < width; x++) buffer[y][x] = Color(0, 0, 0);
+        auto begin = std::chrono::steady_clock::now();
+        for (int ty = 0; ty < height; ty += tile)
+            for (int tx = 0; tx < width; tx += tile)
+                for (int y = ty; y < std::min(ty + tile, height); y++)
+                    for (int x = tx; x < std::min(tx + tile, width); x++) buffer[y][x] = buffer[y][x] + sample;
+        report("Color ** (double, row-major)", size_t(width) * height * sizeof(Color), seconds(begin), 0);
+        for (int i = 0; i < height; i++) delete[] buffer[i];
+        delete[] buffer;
+    }
+    PixelFormat formats[] = { PixelFormat::Float32, PixelFormat::Half };
+    for (PixelFormat format : formats) {
+        Framebuffer framebuffer(width, height, format);
+        auto begin = std::chrono::steady_clock::now();
+        for (int ty = 0; ty < height; ty += tile)
+            for (int tx = 0; tx < width; tx += tile)
+                for (int y = ty; y < std::min(ty + tile, height); y++)
+                    for (int x = tx; x < std::min(tx + tile, width); x++) framebuffer.accumulate(x, y, sample, 2);
+        double accumulateTime = seconds(begin);
+        std::vector<float> row(width);
+        begin = std::chrono::steady_clock::now();
+        for (int y = 0; y < height; y++)
+            for (int c = 0; c < 3; c++) framebuffer.readRow(y, c, row.data());
+        report(format == PixelFormat::Half ? "Framebuffer (half, tile-major)" : "Framebuffer (float32, tile-major)",
+               framebuffer.bytes(), accumulateTime, seconds(begin));
+    }
+}
+
+/* Scaling benchmark */
+// For every object count: generate a sphere field with the given
+// layout, mix and seed, build it and render benchSpp passes with
+// every thread count. Prints one line per configuration.
+void benchmarkScaling(SphereFieldSettings settings, const std::vector<long long> &objectCounts, const std::vector<long long> &threadCounts,
+                      int width, int height, int benchSpp, int rayBounce) {
+    auto seconds = [](std::chrono::steady_clock::time_point begin) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+    std::cout << "objects, layout, generate (s), build (s), scene (MiB), RSS (MiB), threads, Mrays/s" << std::endl;
+    for (long long objectCount : objectCounts) {
+        settings.objectCount = size_t(objectCount);
+        auto begin = std::chrono::steady_clock::now();
+        Scene *world = generateSphereField(settings);
+        double generateTime = seconds(begin);
+        begin = std::chrono::steady_clock::now();
+        world->build();
+        double buildTime = seconds(begin);
+        Camera camera = world->view.makeCamera(double(width) / double(height));
+        RenderSettings renderSettings;
+        renderSettings.width = width;
+        renderSettings.height = height;
+        renderSettings.spp = benchSpp;
+        renderSettings.maxDepth = rayBounce;
+        for (long long threads : threadCounts) {
+            Renderer renderer{int(threads)};
+            begin = std::chrono::steady_clock::now();
+            std::shared_ptr<RenderJob> job = renderer.submit(*world, camera, renderSettings);
+            if (!job) {
+                delete world;
+                return;
+            }
+            uint64_t rays = job->wait().rays;
+            double renderTime = seconds(begin);
+            std::cout << objectCount << ", " << (settings.layout == SceneLayout::Clustered ? "clustered" : "uniform") << ", "
+                      << generateTime << ", " << buildTime << ", " << world->bytes() / (1024.0 * 1024.0) << ", "
+                      << residentMemoryBytes() / (1024.0 * 1024.0) << ", " << threads << ", " << rays / (renderTime * 1e6) << std::endl;
+        }
+        delete world;
+    }
+}
+
+/* Paging benchmark */
+// The scene cache at path rendered from every memory budget (MiB,
+// paged, see PagedScene.hpp) and once mapped as a whole for
+// comparison: render throughput, chunk loads per 1000 rays and
+// bytes read. Then the primary rays (one per pixel center) traced
+// one by one and in batches of a 64x64 tile, each from an empty
+// pool, to show what deferring rays to batched loads saves.
+// Chunks are read through the page cache, a second run of the same
+// file measures the pool, not the disk.
+void benchmarkPaging(const std::string &path, const std::vector<long long> &budgets, size_t chunkBytes, RenderSettings settings, int threads) {
+    auto seconds = [](std::chrono::steady_clock::time_point begin) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0) {
+        std::cout << "ERROR: can not open scene cache " << path << "." << std::endl;
+        return;
+    }
+    double fileMiB = status.st_size / (1024.0 * 1024.0);
+    Renderer renderer(threads);
+    std::cout << "Scene cache: " << path << ", " << fileMiB << " MiB, " << renderer.threadCount() << " thread(s)." << std::endl;
+    std::cout << "budget (MiB), budget (% of file), chunks, slots, Mrays/s, loads per 1000 rays, read (MiB), deferred culled (%), "
+              << "primary loads, primary batched loads, primary Mrays/s, primary batched Mrays/s" << std::endl;
+    Scene *mapped = loadSceneCache(path);
+    if (!mapped) return;
+    Camera camera = mapped->view.makeCamera(double(settings.width) / double(settings.height));
+    std::shared_ptr<RenderJob> job = renderer.submit(*mapped, camera, settings);
+    if (!job) {
+        delete mapped;
+        return;
+    }
+    RenderResult result = job->wait();
+    std::cout << "mapped, 100, -, -, " << result.rays / (result.seconds * 1e6) << ", -, -, -, -, -, -, -" << std::endl;
+    delete mapped;
+
+    // Primary rays in tile order
+    const int tile = 64;
+    std::vector<Ray> rays;
+    std::vector<int> tileStarts;
+    for (int ty = 0; ty < settings.height; ty += tile) {
+        for (int tx = 0; tx < settings.width; tx += tile) {
+            tileStarts.push_back(int(rays.size()));
+            for (int y = ty; y < std::min(ty + tile, settings.height); y++) {
+                for (int x = tx; x < std::min(tx + tile, settings.width); x++) {
+                    rays.push_back(camera.getRay((x + 0.5) / settings.width, (y + 0.5) / settings.height, Vector3d(0, 0, 0)));
+                }
+            }
+        }
+    }
+    tileStarts.push_back(int(rays.size()));
+    std::vector<PrimitiveHit> hits(rays.size());
+    std::unique_ptr<bool[]> found(new bool[rays.size()]);
+    std::vector<double> tMax(rays.size(), INFINITY);
+
+    for (long long budget : budgets) {
+        size_t budgetBytes = size_t(budget) << 20;
+        Scene *paged = loadPagedSceneCache(path, budgetBytes, chunkBytes);
+        if (!paged) return;
+        const PagedSphereBVH *root = dynamic_cast<const PagedSphereBVH *>(paged->world());
+        const GeometryPool &pool = root->geometryPool();
+        job = renderer.submit(*paged, camera, settings);
+        if (!job) {
+            delete paged;
+            return;
+        }
+        result = job->wait();
+        GeometryPool::Statistics stats = pool.statistics();
+        int chunkCount = root->chunkCount(), slotCount = pool.getSlotCount();
+        delete paged;
+
+        // One by one, then batched, both from an empty pool
+        uint64_t primaryLoads[2];
+        double primaryTime[2];
+        double tSum[2] = { 0, 0 };
+        for (int batched = 0; batched < 2; batched++) {
+            paged = loadPagedSceneCache(path, budgetBytes, chunkBytes);
+            if (!paged) return;
+            root = dynamic_cast<const PagedSphereBVH *>(paged->world());
+            auto begin = std::chrono::steady_clock::now();
+            for (size_t t = 0; t + 1 < tileStarts.size(); t++) {
+                int first = tileStarts[t], count = tileStarts[t + 1] - first;
+                if (batched) {
+                    root->closestHitsBatch(&rays[first], count, 0.001, &tMax[first], &hits[first], &found[first]);
+                } else {
+                    for (int i = first; i < first + count; i++) found[i] = root->closestHit(rays[i], 0.001, INFINITY, hits[i]);
+                }
+            }
+            primaryTime[batched] = seconds(begin);
+            primaryLoads[batched] = root->geometryPool().statistics().loads;
+            for (size_t i = 0; i < rays.size(); i++) tSum[batched] += found[i] ? hits[i].t : 0;
+            delete paged;
+        }
+        if (fabs(tSum[0] - tSum[1]) > 1e-6 * fabs(tSum[0])) std::cout << "ERROR: batched primary hits differ." << std::endl;
+        double culled = stats.deferred ? 100.0 * stats.culled / stats.deferred : 0;
+        std::cout << budget << ", " << 100 * budget / fileMiB << ", " << chunkCount << ", " << slotCount << ", "
+                  << result.rays / (result.seconds * 1e6) << ", " << 1000.0 * stats.loads / result.rays << ", "
+                  << stats.bytesRead / (1024.0 * 1024.0) << ", " << culled << ", " << primaryLoads[0] << ", " << primaryLoads[1] << ", "
+                  << rays.size() / (primaryTime[0] * 1e6) << ", " << rays.size() / (primaryTime[1] * 1e6) << std::endl;
+    }
+}
+
+/* Job benchmark */
+// Cost of the Renderer's job machinery: submits jobCount small
+// preview jobs (64x36, 1 spp) at once and compares the pool time
+// spent per job with rendering the same preview directly on one
+// thread. Jobs of a single pixel show the fixed cost per job.
+void benchmarkJobs(const Scene &scene, int jobCount, int threads, int rayBounce) {
+    auto seconds = [](std::chrono::steady_clock::time_point begin) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+    RenderSettings preview;
+    preview.width = 64;
+    preview.height = 36;
+    preview.spp = 1;
+    preview.maxDepth = rayBounce;
+    Camera camera = scene.view.makeCamera(double(preview.width) / double(preview.height));
+
+    // Direct: the same pixels in the same tile order, without jobs
+    // or threads (the first run warms up)
+    const int tile = Framebuffer::tileSize;
+    Sampler *sampler = createSampler(preview.sampler, preview.spp, preview.seed);
+    DirectLighting lighting{ scene.lights(), LightSampling::None };
+    parseLightSampling(preview.lightSampling, lighting.mode);
+    const int directRuns = 20;
+    auto begin = std::chrono::steady_clock::now();
+    for (int run = 0; run <= directRuns; run++) {
+        if (run == 1) begin = std::chrono::steady_clock::now();
+        Film film(preview.width, preview.height);
+        for (int ty = 0; ty < preview.height; ty += tile)
+            for (int tx = 0; tx < preview.width; tx += tile)
+                for (int line = ty; line < std::min(ty + tile, preview.height); line++)
+                    for (int pixel = tx; pixel < std::min(tx + tile, preview.width); pixel++)
+                        film.addSample(pixel, line, samplePixel(pixel, line, 0, preview.width, preview.height, camera, scene.world(), lighting, nullptr, rayBounce,
+                                                                        *sampler), 1);
+    }
+    double directTime = seconds(begin) / directRuns;
+    delete sampler;
+
+    Renderer renderer(threads);
+    auto runJobs = [&](const RenderSettings &settings) {
+        std::vector<std::shared_ptr<RenderJob>> jobs;
+        jobs.reserve(jobCount);
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < jobCount; i++) jobs.push_back(renderer.submit(scene, camera, settings));
+        for (std::shared_ptr<RenderJob> &job : jobs) {
+            if (job) job->wait();
+        }
+        return seconds(begin);
+    };
+    runJobs(preview); // warm up
+    double previewTime = runJobs(preview);
+    RenderSettings pixel = preview;
+    pixel.width = pixel.height = 1;
+    double pixelTime = runJobs(pixel);
+    int poolThreads = renderer.threadCount();
+    double perJob = previewTime * poolThreads / jobCount;
+    std::cout << "Jobs: " << jobCount << " x " << preview.width << "x" << preview.height << " " << preview.spp << " spp, "
+              << poolThreads << " thread(s)" << std::endl
+              << "  direct render:     " << directTime * 1e6 << "us per preview" << std::endl
+              << "  submitted at once: " << previewTime * 1e3 << "ms, " << perJob * 1e6 << "us thread time per job, overhead "
+              << (perJob - directTime) * 1e6 << "us (" << 100 * (perJob - directTime) / directTime << "%)" << std::endl
+              << "  1 pixel jobs:      " << pixelTime * 1e6 / jobCount << "us per job" << std::endl;
+}
+
+// Parses a comma separated list of integers ("1000,1e6" style
+// exponents are accepted too).
+std::vector<long long> parseList(const std::string &text) {
+    std::vector<long long> values;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos) end = text.size();
+        values.push_back((long long)(atof(text.substr(start, end - start).c_str())));
+        start = end + 1;
+    }
+    return values;
+}
+
+// Parses a comma separated list of names.
+std::vector<std::string> parseNames(const std::string &text) {
+    std::vector<std::string> names;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos) end = text.size();
+        names.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    return names;
+}
+
+/* Texturing */
+// Puts the image at path on every Lambertian, Glossy and Metal
+// material of the scene (tinted by their albedo).
+bool applyTexture(Scene &scene, const std::string &path, double scale) {
+    TextureCache &cache = TextureCache::shared();
+    int id = cache.addTexture(path);
+    if (id < 0) return false;
+    Texture *texture = scene.addTexture(new ImageTexture(cache, id, scale));
+    int textured = 0;
+    for (Material *material : scene.materialList()) {
+        if (Lambertian *lambertian = dynamic_cast<Lambertian *>(material)) lambertian->setTexture(texture);
+        else if (Glossy *glossy = dynamic_cast<Glossy *>(material)) glossy->setTexture(texture);
+        else if (Metal *metal = dynamic_cast<Metal *>(material)) metal->setTexture(texture);
+        else continue;
+        textured++;
+    }
+    std::cout << "Texture: " << path << ", " << cache.width(id, 0) << "x" << cache.height(id, 0) << ", " << cache.levelCount(id)
+              << " levels, on " << textured << " materials." << std::endl;
+    return true;
+}
+
+/* Views */
+// Parses --view "fromX,fromY,fromZ,atX,atY,atZ[,vFov[,width,height]]",
+// everything else comes from the scene's default view. Returns
+// false on malformed input.
+bool parseView(const std::string &text, const CameraSettings &defaults, int defaultWidth, int defaultHeight, RenderView &view) {
+    std::vector<double> values;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos) end = text.size();
+        char *parsed;
+        std::string item = text.substr(start, end - start);
+        values.push_back(strtod(item.c_str(), &parsed));
+        if (item.empty() || *parsed != 0) return false;
+        start = end + 1;
+    }
+    if (values.size() != 6 && values.size() != 7 && values.size() != 9) return false;
+    CameraSettings settings = defaults;
+    settings.lookFrom = Point3d(values[0], values[1], values[2]);
+    settings.lookAt = Point3d(values[3], values[4], values[5]);
+    settings.focusDistance = (settings.lookFrom - settings.lookAt).length();
+    if (values.size() >= 7) settings.vFov = values[6];
+    view.width = values.size() == 9 ? int(values[7]) : defaultWidth;
+    view.height = values.size() == 9 ? int(values[8]) : defaultHeight;
+    if (view.width <= 0 || view.height <= 0) return false;
+    view.camera = settings.makeCamera(double(view.width) / double(view.height));
+    return true;
+}
+
+// A parallel stereo pair: the default view moved half the eye
+// separation to the left and to the right.
+std::vector<RenderView> stereoViews(const CameraSettings &center, double separation, int width, int height) {
+    Vector3d right = unitVector(cross(center.lookAt - center.lookFrom, center.vUp));
+    std::vector<RenderView> views;
+    for (int eye = -1; eye <= 1; eye += 2) {
+        CameraSettings settings = center;
+        settings.lookFrom = center.lookFrom + (0.5 * eye * separation) * right;
+        settings.lookAt = center.lookAt + (0.5 * eye * separation) * right;
+        RenderView view;
+        view.width = width;
+        view.height = height;
+        view.camera = settings.makeCamera(double(width) / double(height));
+        views.push_back(view);
+    }
+    return views;
+}
+
+// render.ppm -> render_0.ppm, render_1.ppm, ... for several views
+std::string viewOutputPath(const std::string &path, int view, int viewCount) {
+    if (viewCount == 1) return path;
+    size_t dot = path.rfind('.');
+    size_t slash = path.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = path.size();
+    return path.substr(0, dot) + "_" + std::to_string(view) + path.substr(dot);
+}
+
+/* Batch benchmark */
+// Renders the views one job after another, then all of them as one
+// batch job, and prints time and throughput of both.
+void benchmarkBatch(const Scene &scene, const std::vector<RenderView> &views, const RenderSettings &settings, int threads) {
+    auto seconds = [](std::chrono::steady_clock::time_point begin) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+    Renderer renderer(threads);
+    uint64_t rays = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (const RenderView &view : views) {
+        std::shared_ptr<RenderJob> job = renderer.submit(scene, std::vector<RenderView>(1, view), settings);
+        if (!job) return;
+        rays += job->wait().rays;
+    }
+    double sequentialTime = seconds(begin);
+    std::cout << "Views one after another: " << sequentialTime << "s, " << rays / (sequentialTime * 1e6) << " Mrays/s." << std::endl;
+    begin = std::chrono::steady_clock::now();
+    std::shared_ptr<RenderJob> job = renderer.submit(scene, views, settings);
+    if (!job) return;
+    rays = job->wait().rays;
+    double batchTime = seconds(begin);
+    std::cout << "Views in one batch:      " << batchTime << "s, " << rays / (batchTime * 1e6) << " Mrays/s ("
+              << sequentialTime / batchTime << "x)." << std::endl;
+}
+
+/* Packet benchmark */
+// Camera rays only (closest hit, no shading), passes samples of
+// every pixel on the calling thread: one by one, then in 4 x 4 and
+// 8 x 8 packets (RayPacket.hpp), with a pinhole version of the
+// scene's view and a thin lens one (its aperture, else 5% of the
+// focus distance). Prints Mrays/s, the speedup over single rays
+// and how many rays found another hit than alone (must be 0).
+void benchmarkPackets(const Scene &scene, int width, int height, int passes) {
+    const Hitable *world = scene.world();
+    Sampler *sampler = createSampler("sobol", passes, 0);
+    std::cout << "camera, packet, Mrays/s, speedup, packets traced alone, different hits" << std::endl;
+    for (int lens = 0; lens < 2; lens++) {
+        CameraSettings view = scene.view;
+        view.aperture = lens ? (view.aperture > 0 ? view.aperture : 0.05 * view.focusDistance) : 0;
+        Camera camera = view.makeCamera(double(width) / double(height));
+        std::vector<PrimitiveHit> reference;
+        double single = 0;
+        const int packetSizes[] = { 0, 4, 8 };
+        for (int packetSize : packetSizes) {
+            std::vector<PrimitiveHit> hits;
+            hits.reserve(size_t(width) * height * passes);
+            RayPacket packet;
+            int64_t incoherent = 0;
+            auto begin = std::chrono::steady_clock::now();
+            for (int pass = 0; pass < passes; pass++) {
+                int step = packetSize > 0 ? packetSize : 1;
+                for (int y = 0; y < height; y += step) {
+                    for (int x = 0; x < width; x += step) {
+                        if (packetSize == 0) {
+                            PrimitiveHit hit;
+                            if (!world->closestHit(cameraRay(x, y, pass, width, height, camera, *sampler), 0.001, MAXFLOAT, hit)) hit.primitive = nullptr;
+                            hits.push_back(hit);
+                            continue;
+                        }
+                        packet.clear();
+                        for (int line = y; line < std::min(y + step, height); line++) {
+                            for (int pixel = x; pixel < std::min(x + step, width); pixel++) {
+                                packet.add(cameraRay(pixel, line, pass, width, height, camera, *sampler), MAXFLOAT);
+                            }
+                        }
+                        packet.prepare();
+                        if (!packet.coherent) incoherent++;
+                        world->closestHits(packet, 0.001);
+                        for (int i = 0; i < packet.size; i++) {
+                            if (!packet.found[i]) packet.hits[i].primitive = nullptr;
+                            hits.push_back(packet.hits[i]);
+                        }
+                    }
+                }
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            double mrays = hits.size() / (seconds * 1e6);
+            if (packetSize == 0) {
+                single = mrays;
+                reference.swap(hits);
+                std::cout << (lens ? "thin lens" : "pinhole") << ", single, " << mrays << ", 1x, -, -" << std::endl;
+                continue;
+            }
+            // Packets visit the pixels block by block: compare by
+            // pixel, not by position in the list
+            int64_t different = 0;
+            size_t i = 0;
+            for (int pass = 0; pass < passes; pass++) {
+                for (int y = 0; y < height; y += packetSize) {
+                    for (int x = 0; x < width; x += packetSize) {
+                        for (int line = y; line < std::min(y + packetSize, height); line++) {
+                            for (int pixel = x; pixel < std::min(x + packetSize, width); pixel++, i++) {
+                                const PrimitiveHit &a = reference[(size_t(pass) * height + line) * width + pixel];
+                                const PrimitiveHit &b = hits[i];
+                                if (a.primitive != b.primitive || (a.primitive && (a.index != b.index || a.t != b.t))) different++;
+                            }
+                        }
+                    }
+                }
+            }
+            std::cout << (lens ? "thin lens" : "pinhole") << ", " << packetSize << "x" << packetSize << ", " << mrays << ", " << mrays / single
+                      << "x, " << incoherent << ", " << different << std::endl;
+        }
+    }
+    delete sampler;
+}
+
+/* NUMA benchmark */
+// Throughput on the first 1, 2, ... nodes of the topology, with one
+// worker per CPU of those nodes: plain (threads not pinned, one copy
+// of the scene, film wherever it was allocated) against NUMA aware
+// (pinned workers, the scene's replicas and first touch films, see
+// Renderer). Scaling is against plain on one node.
+void benchmarkNuma(const Scene &scene, const std::vector<NumaNode> &topology, const RenderSettings &settings) {
+    Camera camera = scene.view.makeCamera(double(settings.width) / double(settings.height));
+    std::cout << "nodes, threads, placement, Mrays/s, scaling" << std::endl;
+    double base = 0;
+    for (size_t count = 1; count <= topology.size(); count++) {
+        std::vector<NumaNode> nodes(topology.begin(), topology.begin() + count);
+        int threads = cpuCount(nodes);
+        for (int aware = 0; aware < 2; aware++) {
+            Renderer renderer(threads, aware ? nodes : std::vector<NumaNode>());
+            std::shared_ptr<RenderJob> job = renderer.submit(scene, camera, settings);
+            if (!job) return;
+            RenderResult result = job->wait();
+            double mrays = result.rays / (result.seconds * 1e6);
+            if (base == 0) base = mrays;
+            std::cout << count << ", " << threads << ", " << (aware ? "numa" : "plain") << ", " << mrays << ", " << mrays / base << "x" << std::endl;
+        }
+    }
+}
+
+/* Light benchmark */
+// Many-light sampling at equal time: for every light count a sphere
+// field lit by that many small lights (same total power) renders for
+// `seconds` with every light selection, and prints the RMSE against
+// a reference rendered 8 times as long with the light BVH (on
+// clamped radiance, see filmRadiance()).
+void benchmarkLights(SphereFieldSettings settings, const std::vector<long long> &lightCounts, int width, int height, double seconds,
+                     int threads, int rayBounce) {
+    std::cout << "lights, light BVH build (ms), light BVH (MiB), selection, spp, Mrays/s, RMSE" << std::endl;
+    Renderer renderer(threads);
+    for (long long lightCount : lightCounts) {
+        settings.lightCount = size_t(lightCount);
+        // Diffuse only: exactly lightCount lights, and no specular
+        // paths whose noise no light sampling can reach
+        settings.mix = MaterialMix();
+        settings.mix.glossy = settings.mix.metal = settings.mix.dielectric = settings.mix.light = 0;
+        Scene *world = generateSphereField(settings);
+        world->build();
+        // The light BVH alone, the scene's is built along with it
+        auto begin = std::chrono::steady_clock::now();
+        std::vector<LightSource> sources;
+        world->world()->collectLights(sources);
+        LightBVH lights(sources);
+        double buildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        RenderSettings renderSettings;
+        renderSettings.width = width;
+        renderSettings.height = height;
+        renderSettings.spp = 1 << 16;
+        renderSettings.maxDepth = rayBounce;
+        Camera camera = world->view.makeCamera(double(width) / double(height));
+        auto render = [&](const char *selection, double budget, std::vector<Color> &radiance, RenderResult &result) {
+            renderSettings.lightSampling = selection;
+            std::shared_ptr<RenderJob> job = renderer.submit(*world, camera, renderSettings);
+            if (!job) return false;
+            if (job->result().wait_for(std::chrono::duration<double>(budget)) == std::future_status::timeout) job->cancel();
+            result = job->wait();
+            filmRadiance(*result.film, radiance);
+            return true;
+        };
+        std::vector<Color> reference;
+        std::vector<Color> image;
+        RenderResult result;
+        if (!render("bvh", 8 * seconds, reference, result)) {
+            delete world;
+            return;
+        }
+        const char *selections[] = { "none", "uniform", "bvh" };
+        for (const char *selection : selections) {
+            if (!render(selection, seconds, image, result)) {
+                delete world;
+                return;
+            }
+            std::cout << lightCount << ", " << buildTime * 1e3 << ", " << lights.bytes() / (1024.0 * 1024.0) << ", " << selection << ", "
+                      << result.samplesCompleted << ", " << result.rays / (result.seconds * 1e6) << ", " << rmse(image, reference) << std::endl;
+        }
+        delete world;
+    }
+}
+
+/* Guiding benchmark */
+// Time to a target error with and without path guiding: both
+// render until their RMSE against a reference (plain path tracing,
+// 8 times as long) is at most `target` or `seconds` of rendering
+// have passed.
+// The error is measured after every pass and its time is not
+// counted.
+void benchmarkGuiding(const Scene &scene, RenderSettings settings, double target, double seconds, int threads) {
+    auto elapsed = [](std::chrono::steady_clock::time_point begin) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+    Renderer renderer(threads);
+    Camera camera = scene.view.makeCamera(double(settings.width) / double(settings.height));
+    settings.spp = 1 << 16;
+    settings.guiding = false;
+    std::vector<Color> reference;
+    std::shared_ptr<RenderJob> job = renderer.submit(scene, camera, settings);
+    if (!job) return;
+    if (job->result().wait_for(std::chrono::duration<double>(8 * seconds)) == std::future_status::timeout) job->cancel();
+    filmRadiance(*job->wait().film, reference);
+
+    std::cout << "guiding, spp, Mrays/s, RMSE, time to RMSE " << target << " (s), guiding field (MiB)" << std::endl;
+    for (int guided = 0; guided < 2; guided++) {
+        settings.guiding = guided;
+        // Passes finish one after another, the callback's state
+        // needs no locking
+        std::vector<Color> image;
+        double measuring = 0;
+        double reached = -1;
+        double error = 0;
+        bool stopped = false;
+        std::promise<void> stop;
+        RenderCallbacks callbacks;
+        callbacks.onPass = [&](const RenderJob &job, const RenderProgress &progress) {
+            auto begin = std::chrono::steady_clock::now();
+            filmRadiance(job.getFilm(), image);
+            error = rmse(image, reference);
+            double renderTime = progress.seconds - measuring;
+            if (reached < 0 && error <= target) reached = renderTime;
+            measuring += elapsed(begin);
+            if (!stopped && (reached >= 0 || renderTime >= seconds)) {
+                stopped = true;
+                stop.set_value();
+            }
+        };
+        job = renderer.submit(scene, camera, settings, callbacks);
+        if (!job) return;
+        stop.get_future().wait();
+        job->cancel();
+        RenderResult result = job->wait();
+        const GuidingField *field = job->guidingField();
+        std::cout << (guided ? "on" : "off") << ", " << result.samplesCompleted << ", " << result.rays / ((result.seconds - measuring) * 1e6)
+                  << ", " << error << ", ";
+        if (reached >= 0) std::cout << reached;
+        else std::cout << "-";
+        std::cout << ", " << (field ? field->bytes() / (1024.0 * 1024.0) : 0) << std::endl;
+    }
+}
+
+/* Integrator benchmark */
+// Equal time comparison of the path tracer and the bidirectional
+// integrator: both render for `seconds` and are compared to a
+// bidirectional reference rendered 8 times as long with another
+// seed (the path tracer's reference would still hold the
+// fireflies the comparison is about). Besides the RMSE it counts
+// fireflies: pixels with a channel more than 0.5 brighter than the
+// reference.
+void benchmarkIntegrators(const Scene &scene, RenderSettings settings, double seconds, int threads) {
+    Renderer renderer(threads);
+    Camera camera = scene.view.makeCamera(double(settings.width) / double(settings.height));
+    settings.spp = 1 << 16;
+    auto render = [&](const char *integrator, double budget, uint64_t seed, std::vector<Color> &radiance, RenderResult &result) {
+        settings.integrator = integrator;
+        settings.seed = seed;
+        std::shared_ptr<RenderJob> job = renderer.submit(scene, camera, settings);
+        if (!job) return false;
+        if (job->result().wait_for(std::chrono::duration<double>(budget)) == std::future_status::timeout) job->cancel();
+        result = job->wait();
+        filmRadiance(*result.film, radiance);
+        return true;
+    };
+    std::vector<Color> reference;
+    std::vector<Color> image;
+    RenderResult result;
+    if (!render("bdpt", 8 * seconds, settings.seed + 1000, reference, result)) return;
+    std::cout << "integrator, spp, Mrays/s, RMSE, fireflies (%)" << std::endl;
+    const char *integrators[] = { "path", "bdpt" };
+    for (const char *integrator : integrators) {
+        if (!render(integrator, seconds, settings.seed, image, result)) return;
+        size_t fireflies = 0;
+        for (size_t i = 0; i < image.size(); i++) {
+            Color d = image[i] - reference[i];
+            if (fmax(d.x(), fmax(d.y(), d.z())) > 0.5) fireflies++;
+        }
+        std::cout << integrator << ", " << result.samplesCompleted << ", " << result.rays / (result.seconds * 1e6) << ", "
+                  << rmse(image, reference) << ", " << 100.0 * fireflies / image.size() << std::endl;
+    }
+}
+
+/* Convergence benchmark */
+// Equal time image quality over a fixed set of scenes: every scene
+// renders with the given settings, its error against a stored
+// reference is measured at checkpoints (1/16, 1/8, 1/4, 1/2 and all
+// of `seconds`) and the curves go to <directory>/<label>.csv and
+// .json. Runs with other options and labels are compared by the
+// time they need to reach an error.
+//
+// * room, caustics and cornell are the scenes of --scene, field and
+//   lights are generated with fixed settings (1000 spheres, and
+//   10000 clustered spheres lit by 100 small lights), so references
+//   stay valid whatever the command line asks for.
+// * References are rendered once per scene, size and depth with
+//   bdpt (no fireflies from caustics to carry into every
+//   comparison) at referenceSpp and a seed of their own, and kept
+//   in the directory as PFM (<scene>_<width>x<height>_d<depth>.pfm).
+//   Delete them to render new ones.
+Scene *convergenceScene(const std::string &name) {
+    if (name == "room") return defaultRoomScene();
+    if (name == "caustics") return defaultRoomScene(1);
+    if (name == "cornell") return cornellBoxScene();
+    SphereFieldSettings field;
+    if (name == "field") return generateSphereField(field);
+    if (name == "lights") {
+        field.objectCount = 10000;
+        field.layout = SceneLayout::Clustered;
+        field.lightCount = 100;
+        return generateSphereField(field);
+    }
+    return nullptr;
+}
+
+bool benchmarkConvergence(const std::string &directory, const std::string &label, const std::vector<std::string> &sceneNames,
+                          const RenderSettings &settings, int referenceSpp, double seconds, int threads) {
+    mkdir(directory.c_str(), 0755);
+    Renderer renderer(threads);
+    std::vector<double> checkpoints;
+    for (int i = 4; i >= 0; i--) checkpoints.push_back(seconds / double(1 << i));
+    std::vector<ConvergenceCurve> curves;
+    std::cout << "scene, checkpoint (s), time (s), spp, Mrays/s, RMSE, relMSE" << std::endl;
+    for (const std::string &name : sceneNames) {
+        Scene *world = convergenceScene(name);
+        if (!world) {
+            std::cout << "ERROR: unknown convergence scene " << name << "." << std::endl;
+            return false;
+        }
+        world->build();
+        Camera camera = world->view.makeCamera(double(settings.width) / double(settings.height));
+        ConvergenceCurve curve;
+        curve.scene = name;
+        curve.reference = directory + "/" + name + "_" + std::to_string(settings.width) + "x" + std::to_string(settings.height) + "_d" +
+                          std::to_string(settings.maxDepth) + ".pfm";
+        std::vector<Color> reference;
+        if (!readPFM(curve.reference, settings.width, settings.height, reference)) {
+            RenderSettings referenceSettings = settings;
+            referenceSettings.spp = referenceSpp;
+            referenceSettings.integrator = "bdpt";
+            referenceSettings.sampler = "sobol";
+            referenceSettings.lightSampling = "bvh";
+            referenceSettings.guiding = false;
+            referenceSettings.seed = 0x5eed;
+            std::shared_ptr<RenderJob> job = renderer.submit(*world, camera, referenceSettings);
+            if (!job) return false;
+            RenderResult result = job->wait();
+            filmRadiance(*result.film, reference, false);
+            if (!writePFM(curve.reference, settings.width, settings.height, reference)) {
+                std::cout << "ERROR: could not write reference " << curve.reference << "." << std::endl;
+                return false;
+            }
+            std::cout << "Reference: " << curve.reference << ", " << referenceSpp << " spp, " << result.seconds << "s." << std::endl;
+        }
+        curve.points = measureConvergence(renderer, *world, camera, settings, reference, checkpoints);
+        // No points: the renderer rejected the settings
+        if (curve.points.empty()) {
+            delete world;
+            return false;
+        }
+        for (const ConvergencePoint &point : curve.points) {
+            std::cout << name << ", " << point.checkpoint << ", " << point.seconds << ", " << point.spp << ", " << point.mraysPerSecond << ", "
+                      << point.rmse << ", " << point.relativeMSE << std::endl;
+        }
+        curves.push_back(curve);
+        delete world;
+    }
+    std::string prefix = directory + "/" + label;
+    if (!writeConvergenceCSV(prefix + ".csv", label, curves) || !writeConvergenceJSON(prefix + ".json", label, settings, threads, curves)) {
+        std::cout << "ERROR: could not write " << prefix << ".csv/.json." << std::endl;
+        return false;
+    }
+    std::cout << "Curves: " << prefix << ".csv, " << prefix << ".json." << std::endl;
+    return true;
+}
+
+void printUsage() {
+    std::cout << "Usage: gloom [options]" << std::endl
+              << "  -o, --output <file>       output PPM path" << std::endl
+              << "  --width <n>, --height <n> image size (960x400)" << std::endl
+              << "  --spp <n>                 samples per pixel (800)" << std::endl
+              << "  --sampler <name>          independent | stratified | sobol | bluenoise (sobol)" << std::endl
+              << "  --seed <n>                sampler seed (0)" << std::endl
+              << "  --compare-samplers <n>    RMSE of every sampler against an n spp reference" << std::endl
+              << "  --exposure <stops>        exposure adjustment (0)" << std::endl
+              << "  --tonemap <name>          clamp | reinhard | aces (clamp)" << std::endl
+              << "  --no-dither               quantize without blue noise dithering" << std::endl
+              << "  --progressive <n>         also write the output every n passes" << std::endl
+              << "  --resolve-benchmark       time Film::resolve() and exit" << std::endl
+              << "  --threads <n>             worker threads (hardware threads)" << std::endl
+              << "  --half                    half precision framebuffer, up to 1024 spp (float32)" << std::endl
+              << "  --framebuffer-benchmark   framebuffer memory / bandwidth at the image size and exit" << std::endl
+              << "  --scene <name>            room | caustics (room with a small light) | sphere-room (walls as" << std::endl
+              << "                            giant spheres) | cornell (rects and boxes) | field (room)" << std::endl
+              << "  --objects <n>             sphere count of the field scene (1000)" << std::endl
+              << "  --layout <name>           uniform | clustered field layout (uniform)" << std::endl
+              << "  --mix <type=w,...>        field material weights: lambertian, glossy, metal, dielectric, light" << std::endl
+              << "  --scene-seed <n>          field generator seed (1)" << std::endl
+              << "  --field-lights <n>        light the field with n small lights instead of one large one" << std::endl
+              << "  --scene-cache <file>      render the scene in a scene cache instead of --scene" << std::endl
+              << "  --write-scene-cache <file> write the --scene scene to a scene cache and exit" << std::endl
+              << "  --paging-budget <MiB>     page the scene cache's geometry through a pool of this size instead of mapping it" << std::endl
+              << "  --paging-chunk <KiB>      largest geometry chunk read at once (64)" << std::endl
+              << "  --paging-benchmark <list> throughput and chunk loads of the scene cache for every budget (MiB)" << std::endl
+              << "  --view <x,y,z,x,y,z[,fov[,w,h]]> add a view: position, target, vertical fov and size;" << std::endl
+              << "                            several views render in one batch to <output>_<n>.ppm" << std::endl
+              << "  --stereo <separation>     add a stereo pair around the scene's view" << std::endl
+              << "  --batch-benchmark         time the views one after another against one batch and exit" << std::endl
+              << "  --texture <file.ppm>      texture every diffuse, glossy and metal material" << std::endl
+              << "  --texture-scale <s>       texture repeats per surface (1)" << std::endl
+              << "  --texture-cache <MiB>     texture cache capacity (256)" << std::endl
+              << "  --crop <x,y,w,h>          only render this rectangle of the image (from the top left, not with bdpt)" << std::endl
+              << "  --tile-order <name>       scanline | spiral | hilbert (scanline)" << std::endl
+              << "  --priority <x,y,w,h>      render this rectangle to full spp before the rest (repeatable)" << std::endl
+              << "  --time-limit <s>          cancel the render after s seconds and write what is done" << std::endl
+              << "  --lights <name>           light sampling: none | uniform | bvh (bvh)" << std::endl
+              << "  --light-benchmark <list>  equal time RMSE of every light sampling on fields with the given light counts;" << std::endl
+              << "                            --time-limit seconds each (2)" << std::endl
+              << "  --integrator <name>       path | bdpt (bidirectional, for caustics) (path)" << std::endl
+              << "  --integrator-benchmark    equal time RMSE of both integrators; --time-limit seconds each (10)" << std::endl
+              << "  --guiding                 learn incident light while rendering and guide bounces with it" << std::endl
+              << "  --guiding-memory <MiB>    bound of the guiding field (64)" << std::endl
+              << "  --guiding-benchmark <e>   time to RMSE e with and without guiding; --time-limit seconds at most (10)" << std::endl
+              << "  --convergence <dir>       error over time on fixed scenes against references kept in dir, curves to" << std::endl
+              << "                            dir/<label>.csv and .json; --time-limit seconds per scene (8)" << std::endl
+              << "  --convergence-label <name> label of the run (<integrator>_<sampler>_<lights>[_guiding])" << std::endl
+              << "  --convergence-scenes <list> room, caustics, cornell, field, lights (all)" << std::endl
+              << "  --convergence-reference-spp <n> spp of new references (1024)" << std::endl
+              << "  --strip-height <rows>     stream the image in strips of this height straight to the output;" << std::endl
+              << "                            memory does not grow with the image height" << std::endl
+              << "  --strip-window <n>        strips rendered at the same time when streaming (2)" << std::endl
+              << "  --packets <n>             trace camera rays in n x n packets (0: one by one, 1-8) (0)" << std::endl
+              << "  --packet-benchmark        camera ray Mrays/s one by one and in 4x4 / 8x8 packets; --bench-spp passes" << std::endl
+              << "  --numa                    pin the threads to the NUMA nodes, one scene copy and film band per node" << std::endl
+              << "  --numa-split <n>          pretend every NUMA node is n nodes (to test --numa on one socket)" << std::endl
+              << "  --numa-benchmark          Mrays/s on 1, 2, ... nodes with and without --numa" << std::endl
+              << "  --job-benchmark <n>       per job overhead of n small preview jobs submitted at once" << std::endl
+              << "  --scaling-benchmark <list> build time, memory and Mrays/s of fields with the given object counts" << std::endl
+              << "  --bench-threads <list>    thread counts for --scaling-benchmark (--threads)" << std::endl
+              << "  --bench-spp <n>           passes rendered per configuration (2)" << std::endl;
+}
+
+int main(int argc, char **argv) {
     /* Image parameters */
-    const int width = 960;
-    const int height = 400;
-    const int spp = 800;
+    int width = 960;
+    int height = 400;
+    int spp = 800;
     const int rayBounce = 50;
+    std::string outputPath = "/home/entinfx/dev/gloom/Output/render.ppm";
+    std::string samplerName = "sobol";
+    uint64_t seed = 0;
+    int referenceSpp = 0;
+    int progressiveInterval = 0;
+    bool resolveBenchmark = false;
+    bool framebufferBenchmark = false;
+    int threads = 0;
+    PixelFormat pixelFormat = PixelFormat::Float32;
+    std::string sceneName = "room";
+    SphereFieldSettings fieldSettings;
+    std::string sceneCachePath;
+    std::string writeSceneCachePath;
+    double pagingBudget = 0;
+    double pagingChunk = 64;
+    std::vector<long long> pagingBudgets;
+    std::vector<long long> benchObjects;
+    std::vector<long long> benchThreads;
+    int benchSpp = 2;
+    int benchJobs = 0;
+    double timeLimit = 0;
+    std::vector<std::string> viewOptions;
+    double stereoSeparation = 0;
+    std::string texturePath;
+    double textureScale = 1;
+    bool batchBenchmark = false;
+    std::string lightSamplingName = "bvh";
+    std::vector<long long> benchLights;
+    std::string integrator = "path";
+    bool integratorBenchmark = false;
+    bool guiding = false;
+    double guidingMemory = 64;
+    double guidingTarget = 0;
+    PixelRect crop;
+    std::string tileOrder = "scanline";
+    std::vector<PixelRect> priorityRegions;
+    std::string convergenceDirectory;
+    std::string convergenceLabel;
+    std::vector<std::string> convergenceScenes = { "room", "caustics", "cornell", "field", "lights" };
+    int convergenceReferenceSpp = 1024;
+    int packetSize = 0;
+    int stripHeight = 0;
+    int stripWindow = 2;
+    bool packetBenchmark = false;
+    bool numa = false;
+    int numaSplit = 1;
+    bool numaBenchmark = false;
+    FilmSettings filmSettings;
+
+    /* Command line */
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if ((arg == "-o" || arg == "--output") && hasValue) outputPath = argv[++i];
+        else if (arg == "--width" && hasValue) width = atoi(argv[++i]);
+        else if (arg == "--height" && hasValue) height = atoi(argv[++i]);
+        else if (arg == "--spp" && hasValue) spp = atoi(argv[++i]);
+        else if (arg == "--sampler" && hasValue) samplerName = argv[++i];
+        else if (arg == "--seed" && hasValue) seed = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--compare-samplers" && hasValue) referenceSpp = atoi(argv[++i]);
+        else if (arg == "--exposure" && hasValue) filmSettings.exposure = atof(argv[++i]);
+        else if (arg == "--tonemap" && hasValue) {
+            std::string name = argv[++i];
+            if (name == "clamp") filmSettings.tonemap = Tonemap::Clamp;
+            else if (name == "reinhard") filmSettings.tonemap = Tonemap::Reinhard;
+            else if (name == "aces") filmSettings.tonemap = Tonemap::ACES;
+            else {
+                std::cout << "ERROR: unknown tonemap " << name << "." << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--no-dither") filmSettings.dither = false;
+        else if (arg == "--progressive" && hasValue) progressiveInterval = atoi(argv[++i]);
+        else if (arg == "--resolve-benchmark") resolveBenchmark = true;
+        else if (arg == "--threads" && hasValue) threads = atoi(argv[++i]);
+        else if (arg == "--half") pixelFormat = PixelFormat::Half;
+        else if (arg == "--framebuffer-benchmark") framebufferBenchmark = true;
+        else if (arg == "--scene" && hasValue) sceneName = argv[++i];
+        else if (arg == "--objects" && hasValue) fieldSettings.objectCount = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--layout" && hasValue) {
+            std::string layout = argv[++i];
+            if (layout == "uniform") fieldSettings.layout = SceneLayout::Uniform;
+            else if (layout == "clustered") fieldSettings.layout = SceneLayout::Clustered;
+            else {
+                std::cout << "ERROR: unknown layout " << layout << "." << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--mix" && hasValue) {
+            if (!parseMaterialMix(argv[++i], fieldSettings.mix)) {
+                std::cout << "ERROR: bad material mix " << argv[i] << "." << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--scene-seed" && hasValue) fieldSettings.seed = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--field-lights" && hasValue) fieldSettings.lightCount = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--scene-cache" && hasValue) sceneCachePath = argv[++i];
+        else if (arg == "--write-scene-cache" && hasValue) writeSceneCachePath = argv[++i];
+        else if (arg == "--paging-budget" && hasValue) pagingBudget = atof(argv[++i]);
+        else if (arg == "--paging-chunk" && hasValue) pagingChunk = atof(argv[++i]);
+        else if (arg == "--paging-benchmark" && hasValue) pagingBudgets = parseList(argv[++i]);
+        else if (arg == "--texture" && hasValue) texturePath = argv[++i];
+        else if (arg == "--texture-scale" && hasValue) textureScale = atof(argv[++i]);
+        else if (arg == "--texture-cache" && hasValue) TextureCache::shared().setCapacity(size_t(atof(argv[++i]) * 1024 * 1024));
+        else if (arg == "--view" && hasValue) viewOptions.push_back(argv[++i]);
+        else if (arg == "--stereo" && hasValue) stereoSeparation = atof(argv[++i]);
+        else if (arg == "--batch-benchmark") batchBenchmark = true;
+        else if (arg == "--time-limit" && hasValue) timeLimit = atof(argv[++i]);
+        else if (arg == "--lights" && hasValue) lightSamplingName = argv[++i];
+        else if (arg == "--light-benchmark" && hasValue) benchLights = parseList(argv[++i]);
+        else if (arg == "--integrator" && hasValue) integrator = argv[++i];
+        else if (arg == "--integrator-benchmark") integratorBenchmark = true;
+        else if (arg == "--guiding") guiding = true;
+        else if (arg == "--guiding-memory" && hasValue) guidingMemory = atof(argv[++i]);
+        else if (arg == "--guiding-benchmark" && hasValue) guidingTarget = atof(argv[++i]);
+        else if ((arg == "--crop" || arg == "--priority") && hasValue) {
+            PixelRect rect;
+            if (!parsePixelRect(argv[++i], rect) || rect.isEmpty()) {
+                std::cout << "ERROR: bad rectangle " << argv[i] << "." << std::endl;
+                return 1;
+            }
+            if (arg == "--crop") crop = rect;
+            else priorityRegions.push_back(rect);
+        }
+        else if (arg == "--tile-order" && hasValue) tileOrder = argv[++i];
+        else if (arg == "--convergence" && hasValue) convergenceDirectory = argv[++i];
+        else if (arg == "--convergence-label" && hasValue) convergenceLabel = argv[++i];
+        else if (arg == "--convergence-scenes" && hasValue) convergenceScenes = parseNames(argv[++i]);
+        else if (arg == "--convergence-reference-spp" && hasValue) convergenceReferenceSpp = atoi(argv[++i]);
+        else if (arg == "--strip-height" && hasValue) stripHeight = atoi(argv[++i]);
+        else if (arg == "--strip-window" && hasValue) stripWindow = atoi(argv[++i]);
+        else if (arg == "--packets" && hasValue) packetSize = atoi(argv[++i]);
+        else if (arg == "--packet-benchmark") packetBenchmark = true;
+        else if (arg == "--numa") numa = true;
+        else if (arg == "--numa-split" && hasValue) numaSplit = std::max(1, atoi(argv[++i]));
+        else if (arg == "--numa-benchmark") numaBenchmark = numa = true;
+        else if (arg == "--job-benchmark" && hasValue) benchJobs = atoi(argv[++i]);
+        else if (arg == "--scaling-benchmark" && hasValue) benchObjects = parseList(argv[++i]);
+        else if (arg == "--bench-threads" && hasValue) benchThreads = parseList(argv[++i]);
+        else if (arg == "--bench-spp" && hasValue) benchSpp = atoi(argv[++i]);
+        else {
+            printUsage();
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+    }
+    if (width <= 0 || height <= 0 || spp <= 0) {
+        std::cout << "ERROR: width, height and spp must be positive." << std::endl;
+        return 1;
+    }
+    LightSampling lightSampling;
+    if (!parseLightSampling(lightSamplingName, lightSampling)) {
+        std::cout << "ERROR: unknown light sampling " << lightSamplingName << "." << std::endl;
+        return 1;
+    }
+    if (threads <= 0) threads = std::max(1, int(std::thread::hardware_concurrency()));
+    filmSettings.threads = threads;
+    std::vector<NumaNode> topology;
+    if (numa) {
+        topology = splitNumaNodes(numaTopology(), numaSplit);
+        std::cout << "NUMA: " << topology.size() << " node(s):";
+        for (const NumaNode &node : topology) std::cout << " " << node.cpus.size() << " CPU(s)";
+        std::cout << "." << std::endl;
+    }
+    if (framebufferBenchmark) {
+        benchmarkFramebuffer(width, height);
+        return 0;
+    }
+    if (resolveBenchmark) {
+        benchmarkResolve(width, height, filmSettings);
+        return 0;
+    }
+    if (!benchObjects.empty()) {
+        benchmarkScaling(fieldSettings, benchObjects, benchThreads.empty() ? std::vector<long long>(1, threads) : benchThreads,
+                         width, height, benchSpp, rayBounce);
+        return 0;
+    }
+    if (!pagingBudgets.empty()) {
+        if (sceneCachePath.empty()) {
+            std::cout << "ERROR: --paging-benchmark needs --scene-cache." << std::endl;
+            return 1;
+        }
+        RenderSettings settings;
+        settings.width = width;
+        settings.height = height;
+        settings.spp = benchSpp;
+        settings.maxDepth = rayBounce;
+        benchmarkPaging(sceneCachePath, pagingBudgets, size_t(pagingChunk * 1024), settings, threads);
+        return 0;
+    }
+    if (!benchLights.empty()) {
+        benchmarkLights(fieldSettings, benchLights, width, height, timeLimit > 0 ? timeLimit : 2, threads, rayBounce);
+        return 0;
+    }
+    Sampler *sampler = createSampler(samplerName, spp, seed);
+    if (!sampler) {
+        std::cout << "ERROR: unknown sampler " << samplerName << "." << std::endl;
+        return 1;
+    }
+    delete sampler;
+    if (!convergenceDirectory.empty()) {
+        RenderSettings settings;
+        settings.width = width;
+        settings.height = height;
+        settings.maxDepth = rayBounce;
+        settings.sampler = samplerName;
+        settings.lightSampling = lightSamplingName;
+        settings.integrator = integrator;
+        settings.guiding = guiding;
+        settings.guidingBytes = size_t(guidingMemory * 1024 * 1024);
+        settings.seed = seed;
+        settings.pixelFormat = pixelFormat;
+        std::string label = convergenceLabel;
+        if (label.empty()) label = integrator + "_" + samplerName + "_" + lightSamplingName + (guiding ? "_guiding" : "");
+        bool ok = benchmarkConvergence(convergenceDirectory, label, convergenceScenes, settings, convergenceReferenceSpp,
+                                       timeLimit > 0 ? timeLimit : 8, threads);
+        return ok ? 0 : 1;
+    }
 
     /* Scene */
-    Material *wallMaterial = new Lambertian(Color(0.15, 0.26, 0.6));
-
-    Hitable *list[11];
-    list[0] = new Sphere(Point3d(0, -1000, -1), 1000, wallMaterial); // floor
-    list[1] = new Sphere(Point3d(0, 0, -10000 - 2.25), 10000, wallMaterial); // back wall
-    list[2] = new Sphere(Point3d(-10000 - 2.5, 0, -1), 10000, wallMaterial); // left wall
-    list[3] = new Sphere(Point3d(-1.2, 0 + 0.45, -0.7), 0.45, new Glossy(Color(0.7, 0.1, 0.25))); // left Glossy
-    list[4] = new Sphere(Point3d(0, 0 + 0.5, -1), 0.5, new Glossy(Color(1, 0.2, 0.4))); // middle Glossy
-    list[5] = new Sphere(Point3d(1.2, 0 + 0.3, -0.7), 0.3, new Metal(Color(0.75, 0.75, 0.75), 0.0)); // right Metal
-    list[6] = new Sphere(Point3d(2.0, 0 + 0.3, -0.7), 0.3, new Glossy(Color(0.25, 0.45, 0.65))); // right Glossy
-    list[7] = new Sphere(Point3d(0.45, 0 + 0.3, -0.2), 0.3, new Dielectric(Color(0.96, 0.96, 0.98), 1.5)); // front right glass
-    list[8] = new Sphere(Point3d(-0.45, 0 + 0.25, -0.25), 0.25, new Glossy(Color(0.2, 1.0, 0.55))); // front left Glossy
-    list[9] = new Sphere(Point3d(30, 20, 0), 30, new DiffuseLight(Color(2.2, 2.0, 3.3))); // right light
-    list[10] = new Sphere(Point3d(-1.0, 0 + 0.35, 0.5), 0.35, new Glossy(Color(1.0, 0.2, 0.55))); // front left Glossy
-    Hitable *scene = new HitableList(list, 11);
+    // Either mapped from a scene cache, ready to trace, or generated
+    // and built. With NUMA nodes a generated scene is generated and
+    // built once per node, on that node.
+    Scene *world;
+    auto sceneBegin = std::chrono::steady_clock::now();
+    if (!sceneCachePath.empty() && pagingBudget > 0) {
+        world = loadPagedSceneCache(sceneCachePath, size_t(pagingBudget * 1024 * 1024), size_t(pagingChunk * 1024));
+        if (!world) return 1;
+        double loadTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - sceneBegin).count();
+        const PagedSphereBVH *root = dynamic_cast<const PagedSphereBVH *>(world->world());
+        const GeometryPool &pool = root->geometryPool();
+        std::cout << "Scene: " << world->objectCount() << " objects, paged " << sceneCachePath << " in " << loadTime * 1e3 << "ms, "
+                  << root->chunkCount() << " chunks, pool " << pool.getSlotCount() << " x " << pool.getSlotBytes() / 1024.0 << " KiB." << std::endl;
+    } else if (!sceneCachePath.empty()) {
+        world = loadSceneCache(sceneCachePath);
+        if (!world) return 1;
+        double loadTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - sceneBegin).count();
+        std::cout << "Scene: " << world->objectCount() << " objects, mapped " << sceneCachePath << " in " << loadTime * 1e3 << "ms." << std::endl;
+    } else {
+        auto generateScene = [&]() -> Scene * {
+            if (sceneName == "room") return defaultRoomScene();
+            if (sceneName == "caustics") return defaultRoomScene(1);
+            if (sceneName == "sphere-room") return sphereRoomScene();
+            if (sceneName == "cornell") return cornellBoxScene();
+            if (sceneName == "field") return generateSphereField(fieldSettings);
+            return nullptr;
+        };
+        // Runs on node 0's CPUs, so the scene's memory is there
+        auto onFirstNode = [&](const std::function<void()> &f) {
+            if (topology.empty()) f();
+            else runOnNode(topology[0], f);
+        };
+        onFirstNode([&]() { world = generateScene(); });
+        if (!world) {
+            std::cout << "ERROR: unknown scene " << sceneName << "." << std::endl;
+            return 1;
+        }
+        if (!writeSceneCachePath.empty()) {
+            auto writeBegin = std::chrono::steady_clock::now();
+            if (!writeSceneCache(*world, writeSceneCachePath)) return 1;
+            double writeTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - writeBegin).count();
+            std::cout << "Scene cache: " << writeSceneCachePath << ", " << world->objectCount() << " objects, build + write "
+                      << writeTime * 1e3 << "ms." << std::endl;
+            delete world;
+            return 0;
+        }
+        auto buildBegin = std::chrono::steady_clock::now();
+        double generateTime = std::chrono::duration<double>(buildBegin - sceneBegin).count();
+        onFirstNode([&]() { world->build(); });
+        double buildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildBegin).count();
+        std::cout << "Scene: " << world->objectCount() << " objects, generate " << generateTime * 1e3 << "ms, build " << buildTime * 1e3 << "ms." << std::endl;
+        if (topology.size() > 1) {
+            auto replicaBegin = std::chrono::steady_clock::now();
+            bool textured = true;
+            for (size_t node = 1; node < topology.size(); node++) {
+                runOnNode(topology[node], [&]() {
+                    Scene *copy = generateScene();
+                    copy->build();
+                    if (!texturePath.empty() && !applyTexture(*copy, texturePath, textureScale)) textured = false;
+                    world->setReplica(int(node), copy);
+                });
+            }
+            if (!textured) return 1;
+            double replicaTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - replicaBegin).count();
+            std::cout << "Scene: " << world->replicaCount() << " replica(s) on the other NUMA nodes, generate + build "
+                      << replicaTime * 1e3 << "ms, " << world->replicaCount() * world->bytes() / (1024.0 * 1024.0) << " MiB." << std::endl;
+        }
+    }
+    if (!sceneCachePath.empty() && topology.size() > 1) {
+        // Its pages are in the page cache, which all nodes share
+        std::cout << "Scene cache: not replicated, all NUMA nodes read the one copy." << std::endl;
+    }
+    if (!texturePath.empty() && !applyTexture(*world, texturePath, textureScale)) return 1;
+    const Hitable *scene = world->world();
 
     /* Camera */
-    Point3d lookFrom(0, 1.5, 3);
-    Point3d lookAt(0, 0.5, -1);
-    Point3d vUp(0, 1, 0);
-    double vFov = 40;
-    double distanceToFocus = (lookFrom - lookAt).length();
-    double aperture = 0.25;
-    Camera *camera = new Camera(lookFrom, lookAt, vUp, vFov, double (width) / double(height), aperture, distanceToFocus);
-
-    /* Set up image buffer */
-    Color **buffer = new Color*[height];
-    for (int i = 0; i < height; i++) buffer[i] = new Color[width];
-
-    // TEMP PPM WRITER
-    std::ofstream progressiveWriter("/home/entinfx/dev/gloom/Output/render.ppm", std::ifstream::trunc);
-    progressiveWriter << "P3" << std::endl << width << " " << height << std::endl << 255 << std::endl;
-
-    if (progressiveWriter) {
-        for (int currentSample = 0; currentSample < spp; currentSample++) {
-            std::cout << "SPP: " << currentSample + 1 << "/" << spp;
-
-            Point3d dofOffset = randomInUnitDisk();
-            clock_t begin = clock();
-
-            for (int line = height - 1; line >= 0; --line) {
-                for (int pixel = 0; pixel < width; ++pixel) {
-                    // Get ray for u, v
-                    double u = (double(pixel) + drand48()) / double(width);
-                    double v = (double(line) + drand48()) / double(height);
-                    Ray ray = camera->getRay(u, v, dofOffset);
-                    // Get color for ray, add to buffer
-                    buffer[line][pixel] = (currentSample > 0) ? buffer[line][pixel] + color(ray, scene, 0, rayBounce) : color(ray, scene, 0, rayBounce);
-
-                    /* Average buffer */
-                    Color color = buffer[line][pixel] / (currentSample + 1);
-
-                    /* Clipping */
-                    if (color.r() > 1) color = Color(1, color.g(), color.b());
-                    if (color.g() > 1) color = Color(color.r(), 1, color.b());
-                    if (color.b() > 1) color = Color(color.r(), color.g(), 1);
-
-                    /* Gamma correction */
-                    // Human eye color perception is non-linear, correction
-                    // must be applied: encodedColor = linearColor^(gamma), where
-                    // gamma = 1/2.2 for human eye (use gamma = 2.2 to decode back into linear).
-                    // Lower gamma means brighter image (color rises faster).
-                    color = Color(sqrt(color.r()), sqrt(color.g()), sqrt(color.b()));
-                    // Convert to 8 bit per channel
-                    int r = static_cast<int>(255.999 * color.r());
-                    int g = static_cast<int>(255.999 * color.g());
-                    int b = static_cast<int>(255.999 * color.b());
-                    // Render
-                    // _renderView.buffer[i + width * (height - j - 1)] = r << 16 | g << 8 | b; // i and j might have to be swapped, careful
-                    progressiveWriter << r << " " << g << " " << b << std::endl;
-                }
-            }
+    Camera camera = world->view.makeCamera(double(width) / double(height));
+
+    if (referenceSpp > 0) {
+        compareSamplers(scene, DirectLighting{ world->lights(), lightSampling }, camera, width, height, spp, referenceSpp, rayBounce);
+        return 0;
+    }
+    if (benchJobs > 0) {
+        benchmarkJobs(*world, benchJobs, threads, rayBounce);
+        delete world;
+        return 0;
+    }
 
-            clock_t end = clock();
-            double timePassed = double(end - begin) / CLOCKS_PER_SEC;
-            std::cout << ", Time: " << timePassed << "s." << std::endl;
+    /* Views */
+    // The scene's view unless --view or --stereo ask for others
+    std::vector<RenderView> views;
+    for (const std::string &option : viewOptions) {
+        RenderView view;
+        if (!parseView(option, world->view, width, height, view)) {
+            std::cout << "ERROR: bad view " << option << "." << std::endl;
+            return 1;
         }
+        views.push_back(view);
+    }
+    if (stereoSeparation > 0) {
+        std::vector<RenderView> pair = stereoViews(world->view, stereoSeparation, width, height);
+        views.insert(views.end(), pair.begin(), pair.end());
+    }
+    if (views.empty()) {
+        RenderView view;
+        view.camera = camera;
+        view.width = width;
+        view.height = height;
+        views.push_back(view);
+    }
+    const int viewCount = int(views.size());
 
-        progressiveWriter.close();
-    } else {
-        std::cout << "ERROR: std::ofstream failed." << std::endl;
+    /* Render */
+    // The render only accumulates radiance, tonemapping and encoding
+    // happen in Film::resolve() when an output is written.
+    RenderSettings renderSettings;
+    renderSettings.spp = spp;
+    renderSettings.maxDepth = rayBounce;
+    renderSettings.sampler = samplerName;
+    renderSettings.lightSampling = lightSamplingName;
+    renderSettings.integrator = integrator;
+    renderSettings.guiding = guiding;
+    renderSettings.guidingBytes = size_t(guidingMemory * 1024 * 1024);
+    renderSettings.seed = seed;
+    renderSettings.pixelFormat = pixelFormat;
+    renderSettings.crop = crop;
+    renderSettings.tileOrder = tileOrder;
+    renderSettings.priorityRegions = priorityRegions;
+    renderSettings.packetSize = packetSize;
+    if (batchBenchmark) {
+        benchmarkBatch(*world, views, renderSettings, threads);
+        delete world;
+        return 0;
+    }
+    if (integratorBenchmark) {
+        renderSettings.width = width;
+        renderSettings.height = height;
+        benchmarkIntegrators(*world, renderSettings, timeLimit > 0 ? timeLimit : 10, threads);
+        delete world;
+        return 0;
+    }
+    if (guidingTarget > 0) {
+        renderSettings.width = width;
+        renderSettings.height = height;
+        benchmarkGuiding(*world, renderSettings, guidingTarget, timeLimit > 0 ? timeLimit : 10, threads);
+        delete world;
+        return 0;
+    }
+    if (packetBenchmark) {
+        benchmarkPackets(*world, width, height, benchSpp);
+        delete world;
+        return 0;
+    }
+    if (numaBenchmark) {
+        renderSettings.width = width;
+        renderSettings.height = height;
+        benchmarkNuma(*world, topology, renderSettings);
+        delete world;
+        return 0;
+    }
+
+    /* Streaming */
+    // Strips to full spp, written as they finish (StripRender.hpp)
+    if (stripHeight > 0) {
+        if (viewCount > 1 || !crop.isEmpty() || !priorityRegions.empty() || progressiveInterval > 0 || timeLimit > 0) {
+            std::cout << "ERROR: streaming renders one whole view, without crop, priority regions, progressive output or time limit." << std::endl;
+            return 1;
+        }
+        renderSettings.width = width;
+        renderSettings.height = height;
+        Renderer renderer(threads, topology);
+        StripStatistics stats;
+        int reported = 0;
+        auto onStrip = [&](int done, int total, const StripStatistics &progress) {
+            // About every 10% of the strips
+            if (done * 10 / total == reported && done < total) return;
+            reported = done * 10 / total;
+            std::cout << "Strips: " << done << "/" << total << ", " << progress.seconds << "s, "
+                      << progress.rays / (progress.seconds * 1e6) << " Mrays/s, RSS " << residentMemoryBytes() / (1024.0 * 1024.0) << " MiB." << std::endl;
+        };
+        if (!renderStrips(renderer, *world, camera, renderSettings, stripHeight, stripWindow, filmSettings, outputPath, stats, onStrip)) return 1;
+        int tileRows = (height + Framebuffer::tileSize - 1) / Framebuffer::tileSize;
+        double frameMiB = double(stats.stripBytes) / (stats.stripHeight / Framebuffer::tileSize) * tileRows / (1024.0 * 1024.0);
+        std::cout << "Output: " << outputPath << ", " << width << "x" << height << " (" << width * double(height) * 1e-6 << " MP) in "
+                  << stats.strips << " strips of " << stats.stripHeight << " rows, " << stats.seconds << "s." << std::endl;
+        std::cout << "Memory: strip films " << stats.stripBytes / (1024.0 * 1024.0) << " MiB x " << std::max(1, stripWindow)
+                  << ", peak RSS " << peakResidentMemoryBytes() / (1024.0 * 1024.0) << " MiB (a whole frame film would be "
+                  << frameMiB << " MiB)." << std::endl;
+        delete world;
+        return 0;
+    }
+
+    auto writeOutput = [&](const Film &film, int view) {
+        std::string path = viewOutputPath(outputPath, view, viewCount);
+        auto resolveBegin = std::chrono::steady_clock::now();
+        if (!film.writePPM(path, filmSettings)) {
+            std::cout << "ERROR: std::ofstream failed." << std::endl;
+            return false;
+        }
+        double resolveTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - resolveBegin).count();
+        std::cout << "Output: " << path << ", resolve + write " << resolveTime * 1e3 << "ms ("
+                  << resolveTime * 1e3 / (film.getWidth() * double(film.getHeight()) * 1e-6) << "ms/MP)." << std::endl;
+        return true;
+    };
+
+    // Passes finish one after another, so the callback's state needs
+    // no locking.
+    double passEnd = 0;
+    uint64_t passRays = 0;
+    double priorityDone = -1;
+    bool writeFailed = false;
+    RenderCallbacks callbacks;
+    callbacks.onPass = [&](const RenderJob &job, const RenderProgress &progress) {
+        double timePassed = progress.seconds - passEnd;
+        double mrays = (progress.rays - passRays) / (timePassed * 1e6);
+        passEnd = progress.seconds;
+        passRays = progress.rays;
+        if (!priorityRegions.empty() && priorityDone < 0) {
+            std::cout << "SPP: " << progress.prioritySamplesCompleted << "/" << spp << " (priority regions), Time: " << timePassed << "s, "
+                      << mrays << " Mrays/s." << std::endl;
+            if (progress.prioritySamplesCompleted == spp) priorityDone = progress.seconds;
+            return;
+        }
+        std::cout << "SPP: " << progress.samplesCompleted << "/" << spp << ", Time: " << timePassed << "s, " << mrays << " Mrays/s." << std::endl;
+        // Progressive output (the last pass is written below)
+        if (progressiveInterval > 0 && progress.samplesCompleted % progressiveInterval == 0 && progress.samplesCompleted < spp) {
+            for (int view = 0; view < job.viewCount(); view++) {
+                if (!writeOutput(job.getFilm(view), view)) writeFailed = true;
+            }
+        }
+    };
+
+    Renderer renderer(threads, topology);
+    std::shared_ptr<RenderJob> job = renderer.submit(*world, views, renderSettings, callbacks);
+    if (!job) return 1;
+    size_t framebufferBytes = 0;
+    for (int view = 0; view < viewCount; view++) framebufferBytes += job->getFilm(view).buffer().bytes();
+    std::cout << "Framebuffer: " << framebufferBytes / (1024.0 * 1024.0) << " MiB";
+    if (viewCount > 1) std::cout << " for " << viewCount << " views";
+    std::cout << ", " << renderer.threadCount() << " thread(s)." << std::endl;
+    if (timeLimit > 0 && job->result().wait_for(std::chrono::duration<double>(timeLimit)) == std::future_status::timeout) job->cancel();
+    RenderResult result = job->wait();
+    if (priorityDone >= 0) {
+        std::cout << "Priority regions: " << spp << " spp after " << priorityDone << "s, the rest after " << result.seconds << "s." << std::endl;
+    }
+    if (result.cancelled) {
+        std::cout << "Cancelled after " << result.seconds << "s, " << result.samplesCompleted << "/" << spp << " complete passes." << std::endl;
+    }
+    if (const GuidingField *field = job->guidingField()) {
+        std::cout << "Guiding field: " << field->cellCount() << " cells, " << field->bytes() / (1024.0 * 1024.0) << " MiB, "
+                  << field->iterationCount() << " training iterations." << std::endl;
+    }
+    if (const PagedSphereBVH *root = dynamic_cast<const PagedSphereBVH *>(world->world())) {
+        GeometryPool::Statistics stats = root->geometryPool().statistics();
+        std::cout << "Geometry paging: " << stats.loads << " chunk loads (" << 1000.0 * stats.loads / result.rays << " per 1000 rays), "
+                  << stats.bytesRead / (1024.0 * 1024.0) << " MiB read, " << stats.deferred << " deferred chunk visits, "
+                  << stats.culled << " of them culled by a closer hit." << std::endl;
+    }
+    if (!texturePath.empty()) {
+        TextureCache::Statistics stats = TextureCache::shared().statistics();
+        uint64_t lookups = stats.hits + stats.misses;
+        std::cout << "Texture cache: " << lookups << " lookups, hit rate " << (lookups ? 100.0 * stats.hits / lookups : 0) << "%, "
+                  << stats.misses << " tiles read, " << stats.evictions << " evicted, "
+                  << stats.residentBytes / (1024.0 * 1024.0) << "/" << TextureCache::shared().getCapacity() / (1024.0 * 1024.0) << " MiB." << std::endl;
+    }
+    for (int view = 0; view < viewCount; view++) {
+        if (!writeOutput(*result.films[view], view)) writeFailed = true;
     }
+    if (writeFailed) return 1;
+    job.reset();
+    delete world;
 }